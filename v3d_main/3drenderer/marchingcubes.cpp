@@ -57,8 +57,10 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #include <stdio.h>
 #include <math.h>
 #include <assert.h>
+#include <algorithm>
 
 #include "marchingcubes.h"
+#include "../basic_c_fun/basic_parallel.h"
 
 
 static struct Triangle* pT0 = NULL; //head
@@ -438,6 +440,679 @@ void vMarchCube2(float fX, float fY, float fZ, float fScale)
 }
 
 
+//---------------------------------------------------------------------
+// Indexed Marching Cubes of label fields (method 0 only).
+// All the state lives in the structs below instead of the file statics above, so slabs run concurrently.
+// Every grid edge is owned by the slab of its lower end point; that slab creates the edge's vertex once
+// per crossing group, the cells only record edge keys, which are resolved to vertex indices at the end.
+
+extern float a2fVertexOffset[8][3];
+extern int   a2iEdgeConnection[12][2];
+extern int aiCubeEdgeFlags[256];
+extern int a2iTriangleConnectionTable[256][16];
+
+namespace {
+
+const int mcBlock = 8; // grid points per block edge, also the brick size of the min/max octree in voxels
+
+// (grid edge, group) key -> vertex index, open addressing with linear probing
+class EdgeVertexHash
+{
+public:
+	EdgeVertexHash() : count(0) { keys.assign(256, -1); values.resize(256); }
+	int find(V3DLONG key) const
+	{
+		size_t mask = keys.size()-1;
+		for (size_t i = slot(key, mask); ; i = (i+1) & mask)
+		{
+			if (keys[i]==key) return values[i];
+			if (keys[i]<0) return -1;
+		}
+	}
+	void insert(V3DLONG key, int value)
+	{
+		if (2*(count+1) > keys.size()) grow();
+		size_t mask = keys.size()-1;
+		size_t i = slot(key, mask);
+		while (keys[i]>=0 && keys[i]!=key) i = (i+1) & mask;
+		if (keys[i]<0) count++;
+		keys[i] = key;
+		values[i] = value;
+	}
+private:
+	std::vector<V3DLONG> keys; // -1 for empty slots
+	std::vector<int> values;
+	size_t count;
+
+	static size_t slot(V3DLONG key, size_t mask)
+	{
+		unsigned long long h = (unsigned long long)key;
+		h ^= h >> 33;  h *= 0xff51afd7ed558ccdULL;  h ^= h >> 33;
+		return size_t(h) & mask;
+	}
+	void grow()
+	{
+		std::vector<V3DLONG> oldkeys;  oldkeys.swap(keys);
+		std::vector<int> oldvalues;    oldvalues.swap(values);
+		keys.assign(oldkeys.size()*2, -1);
+		values.resize(oldkeys.size()*2);
+		count = 0;
+		for (size_t i=0; i<oldkeys.size(); i++)
+			if (oldkeys[i]>=0) insert(oldkeys[i], oldvalues[i]);
+	}
+};
+
+// voxel value -> group index, the ranges must not overlap
+struct LabelGroupTable
+{
+	std::vector<LabelRange> range; // sorted, disjoint
+	std::vector<int> group;        // group index of range[i]
+	std::vector<int> lut;          // for unsigned char/short voxels
+
+	bool build(const std::vector<LabelRange>& ranges, int datatype)
+	{
+		std::vector< std::pair<float,int> > order;
+		for (int i=0; i<(int)ranges.size(); i++)
+			if (ranges[i].lo <= ranges[i].hi) order.push_back(std::make_pair(ranges[i].lo, i));
+		std::sort(order.begin(), order.end());
+		range.clear();  group.clear();
+		for (int i=0; i<(int)order.size(); i++)
+		{
+			const LabelRange& r = ranges[order[i].second];
+			if (i>0 && r.lo <= range.back().hi) return false;
+			range.push_back(r);
+			group.push_back(order[i].second);
+		}
+		lut.clear();
+		if (datatype==1 || datatype==2)
+		{
+			lut.resize((datatype==1)? 256 : 65536);
+			for (int v=0; v<(int)lut.size(); v++) lut[v] = find(float(v));
+		}
+		return true;
+	}
+	int first(float v) const // first range with hi>=v
+	{
+		int a = 0, b = int(range.size());
+		while (a<b)
+		{
+			int m = (a+b)/2;
+			if (range[m].hi < v) a = m+1; else b = m;
+		}
+		return a;
+	}
+	int find(float v) const
+	{
+		int a = first(v);
+		return (a<(int)range.size() && range[a].lo<=v) ? group[a] : -1;
+	}
+	int classify(unsigned char v) const  { return lut[v]; }
+	int classify(unsigned short v) const { return lut[v]; }
+	int classify(float v) const          { return find(v); }
+
+	// all values in [lo,hi] fall into one group, or into none
+	bool uniform(float lo, float hi) const
+	{
+		int a = first(lo);
+		if (a==(int)range.size() || range[a].lo > hi) return true;
+		return (range[a].lo<=lo && hi<=range[a].hi);
+	}
+};
+
+// the groups around a grid point and their field values
+struct LatticeSample
+{
+	int n;
+	int g[8];
+	float v[8];
+	float value(int group) const
+	{
+		for (int i=0; i<n; i++)
+			if (g[i]==group) return v[i];
+		return 0;
+	}
+};
+
+inline void addGroups(const LatticeSample& s, int* cand, int& ncand)
+{
+	for (int i=0; i<s.n; i++)
+	{
+		int c = 0;
+		while (c<ncand && cand[c]!=s.g[i]) c++;
+		if (c==ncand) cand[ncand++] = s.g[i];
+	}
+}
+
+// percent filter of every group, same arithmetic as _labelSampleFunc of renderer_labelfield.cpp
+template <class T>
+struct LabelField
+{
+	const T* data;
+	int sx, sy, sz;
+	const LabelGroupTable* table;
+
+	void footprint(float fX, float fY, float fZ, int* gs, float* sf) const
+	{
+		float x, y, z;
+		x = CLAMP01(fX)*(sx-1);
+		y = CLAMP01(fY)*(sy-1);
+		z = CLAMP01(fZ)*(sz-1);
+		int x0,x1, y0,y1, z0,z1;
+		x0 = floor(x); 		x1 = ceil(x);
+		y0 = floor(y); 		y1 = ceil(y);
+		z0 = floor(z); 		z1 = ceil(z);
+		float xf, yf, zf;
+		xf = x-x0;
+		yf = y-y0;
+		zf = z-z0;
+		V3DLONG sxy = V3DLONG(sx)*sy;
+		const T* p00 = data + z0*sxy + V3DLONG(y0)*sx;
+		const T* p01 = data + z1*sxy + V3DLONG(y0)*sx;
+		const T* p10 = data + z0*sxy + V3DLONG(y1)*sx;
+		const T* p11 = data + z1*sxy + V3DLONG(y1)*sx;
+		gs[0] = table->classify(p00[x0]);	sf[0] = (1-xf)*(1-yf)*(1-zf);
+		gs[1] = table->classify(p01[x0]);	sf[1] = (1-xf)*(1-yf)*(  zf);
+		gs[2] = table->classify(p10[x0]);	sf[2] = (1-xf)*(  yf)*(1-zf);
+		gs[3] = table->classify(p11[x0]);	sf[3] = (1-xf)*(  yf)*(  zf);
+		gs[4] = table->classify(p00[x1]);	sf[4] = (  xf)*(1-yf)*(1-zf);
+		gs[5] = table->classify(p01[x1]);	sf[5] = (  xf)*(1-yf)*(  zf);
+		gs[6] = table->classify(p10[x1]);	sf[6] = (  xf)*(  yf)*(1-zf);
+		gs[7] = table->classify(p11[x1]);	sf[7] = (  xf)*(  yf)*(  zf);
+	}
+	void sampleAll(float fX, float fY, float fZ, LatticeSample& s) const
+	{
+		int gs[8];
+		float sf[8], count[8];
+		footprint(fX, fY, fZ, gs, sf);
+		s.n = 0;
+		for (int i=0; i<8; i++)
+		{
+			if (gs[i]<0) continue;
+			int j = 0;
+			while (j<s.n && s.g[j]!=gs[i]) j++;
+			if (j==s.n) { s.g[j] = gs[i]; count[j] = 0; s.n++; }
+			count[j] += sf[i];
+		}
+		for (int j=0; j<s.n; j++) s.v[j] = count[j]*255;
+	}
+	float sample(int group, float fX, float fY, float fZ) const
+	{
+		int gs[8];
+		float sf[8];
+		footprint(fX, fY, fZ, gs, sf);
+		float count = 0;
+		for (int i=0; i<8; i++)
+			if (gs[i]==group) count += sf[i];
+		return (count*255);
+	}
+	// same stencil as vGetNormal
+	void normal(int g, float fX, float fY, float fZ, float d, vector3& rfNormal) const
+	{
+		#define _S_(x,y,z)  sample(g, x,y,z)
+		rfNormal.fX =   2*(_S_(fX-d,  fY,    fZ)   - _S_(fX+d,  fY,    fZ))+
+						1*(_S_(fX-d,  fY-d,  fZ)   - _S_(fX+d,  fY-d,  fZ))+
+						1*(_S_(fX-d,  fY+d,  fZ)   - _S_(fX+d,  fY+d,  fZ))+
+						1*(_S_(fX-d,  fY,    fZ-d) - _S_(fX+d,  fY,    fZ-d))+
+						1*(_S_(fX-d,  fY,    fZ+d) - _S_(fX+d,  fY,    fZ+d));
+
+		rfNormal.fY =   2*(_S_(fX,    fY-d,  fZ)   - _S_(fX,    fY+d,  fZ))+
+						1*(_S_(fX-d,  fY-d,  fZ)   - _S_(fX-d,  fY+d,  fZ))+
+						1*(_S_(fX+d,  fY-d,  fZ)   - _S_(fX+d,  fY+d,  fZ))+
+						1*(_S_(fX,    fY-d,  fZ-d) - _S_(fX,    fY+d,  fZ-d))+
+						1*(_S_(fX,    fY-d,  fZ+d) - _S_(fX,    fY+d,  fZ+d));
+
+		rfNormal.fZ =   2*(_S_(fX,    fY,    fZ-d) - _S_(fX,    fY,    fZ+d))+
+						1*(_S_(fX-d,  fY,    fZ-d) - _S_(fX-d,  fY,    fZ+d))+
+						1*(_S_(fX+d,  fY,    fZ-d) - _S_(fX+d,  fY,    fZ+d))+
+						1*(_S_(fX,    fY-d,  fZ-d) - _S_(fX,    fY-d,  fZ+d))+
+						1*(_S_(fX,    fY+d,  fZ-d) - _S_(fX,    fY+d,  fZ+d));
+		#undef _S_
+		vNormalizeVector(rfNormal, rfNormal);
+	}
+};
+
+// min/max of the voxel values, level 0 nodes are mcBlock^3 bricks, each level up halves the node count
+struct MinMaxOctree
+{
+	std::vector<int> nx, ny, nz;
+	std::vector< std::vector<float> > vmin, vmax;
+
+	template <class T> struct BrickScan
+	{
+		MinMaxOctree* tree;
+		const T* data;
+		int sx, sy, sz;
+		void operator()(V3DLONG begin, V3DLONG end) // brick z rows
+		{
+			std::vector<float>& lo = tree->vmin[0];
+			std::vector<float>& hi = tree->vmax[0];
+			int nx0 = tree->nx[0], ny0 = tree->ny[0];
+			for (V3DLONG bz=begin; bz<end; bz++)
+			for (int by=0; by<ny0; by++)
+			for (int bx=0; bx<nx0; bx++)
+			{
+				int x1 = qMin(sx, (bx+1)*mcBlock), y1 = qMin(sy, (by+1)*mcBlock), z1 = qMin(sz, int(bz+1)*mcBlock);
+				float a = data[(bz*mcBlock*V3DLONG(sy) + by*mcBlock)*sx + bx*mcBlock];
+				float b = a;
+				for (int z=int(bz)*mcBlock; z<z1; z++)
+				for (int y=by*mcBlock; y<y1; y++)
+				{
+					const T* p = data + (z*V3DLONG(sy) + y)*sx;
+					for (int x=bx*mcBlock; x<x1; x++)
+					{
+						float v = p[x];
+						if (v<a) a = v;
+						if (v>b) b = v;
+					}
+				}
+				V3DLONG i = (bz*ny0 + by)*nx0 + bx;
+				lo[i] = a;
+				hi[i] = b;
+			}
+		}
+	};
+
+	template <class T>
+	void build(const T* data, int sx, int sy, int sz, int nthreads)
+	{
+		nx.assign(1, (sx+mcBlock-1)/mcBlock);
+		ny.assign(1, (sy+mcBlock-1)/mcBlock);
+		nz.assign(1, (sz+mcBlock-1)/mcBlock);
+		vmin.assign(1, std::vector<float>(V3DLONG(nx[0])*ny[0]*nz[0]));
+		vmax.assign(1, std::vector<float>(V3DLONG(nx[0])*ny[0]*nz[0]));
+		BrickScan<T> scan;
+		scan.tree = this;  scan.data = data;
+		scan.sx = sx;  scan.sy = sy;  scan.sz = sz;
+		v3d_parallel_for(nz[0], scan, nthreads);
+
+		for (int l=0; nx[l]>1 || ny[l]>1 || nz[l]>1; l++)
+		{
+			int cx = (nx[l]+1)/2, cy = (ny[l]+1)/2, cz = (nz[l]+1)/2;
+			nx.push_back(cx);  ny.push_back(cy);  nz.push_back(cz);
+			vmin.push_back(std::vector<float>(V3DLONG(cx)*cy*cz));
+			vmax.push_back(std::vector<float>(V3DLONG(cx)*cy*cz));
+			for (int z=0; z<cz; z++)
+			for (int y=0; y<cy; y++)
+			for (int x=0; x<cx; x++)
+			{
+				bool first = true;
+				float a = 0, b = 0;
+				for (int k=2*z; k<=2*z+1 && k<nz[l]; k++)
+				for (int j=2*y; j<=2*y+1 && j<ny[l]; j++)
+				for (int i=2*x; i<=2*x+1 && i<nx[l]; i++)
+				{
+					V3DLONG c = (V3DLONG(k)*ny[l] + j)*nx[l] + i;
+					if (first || vmin[l][c]<a) a = vmin[l][c];
+					if (first || vmax[l][c]>b) b = vmax[l][c];
+					first = false;
+				}
+				V3DLONG p = (V3DLONG(z)*cy + y)*cx + x;
+				vmin[l+1][p] = a;
+				vmax[l+1][p] = b;
+			}
+		}
+	}
+
+	// min/max over the nodes touching an inclusive voxel box, a conservative bound for the box
+	void query(int x0, int x1, int y0, int y1, int z0, int z1, float& lo, float& hi) const
+	{
+		int b[6] = {x0/mcBlock, x1/mcBlock, y0/mcBlock, y1/mcBlock, z0/mcBlock, z1/mcBlock};
+		bool found = false;
+		visit(int(nx.size())-1, 0, 0, 0, b, found, lo, hi);
+	}
+	void visit(int l, int ix, int iy, int iz, const int* b, bool& found, float& lo, float& hi) const
+	{
+		int x0 = ix<<l, x1 = ((ix+1)<<l)-1;
+		int y0 = iy<<l, y1 = ((iy+1)<<l)-1;
+		int z0 = iz<<l, z1 = ((iz+1)<<l)-1;
+		if (x1<b[0] || x0>b[1] || y1<b[2] || y0>b[3] || z1<b[4] || z0>b[5]) return;
+		if (l==0 || (b[0]<=x0 && x1<=b[1] && b[2]<=y0 && y1<=b[3] && b[4]<=z0 && z1<=b[5]))
+		{
+			V3DLONG i = (V3DLONG(iz)*ny[l] + iy)*nx[l] + ix;
+			if (!found || vmin[l][i]<lo) lo = vmin[l][i];
+			if (!found || vmax[l][i]>hi) hi = vmax[l][i];
+			found = true;
+			return;
+		}
+		for (int k=2*iz; k<=2*iz+1 && k<nz[l-1]; k++)
+		for (int j=2*iy; j<=2*iy+1 && j<ny[l-1]; j++)
+		for (int i=2*ix; i<=2*ix+1 && i<nx[l-1]; i++)
+			visit(l-1, i, j, k, b, found, lo, hi);
+	}
+};
+
+template <class T>
+struct LabelSurfaceSlabs
+{
+	const LabelField<T>* field;
+	const MinMaxOctree* octree;
+	int ngroups;
+	int numStep;
+	float step, iso;
+	std::vector<int> planeBegin;                               // slab s owns grid planes [planeBegin[s], planeBegin[s+1])
+	std::vector<EdgeVertexHash> edgeVertex;                    // [slab] (edge,group) -> vertex index in part[slab][group]
+	std::vector< std::vector<IndexedMesh> > part;              // [slab][group]
+	std::vector< std::vector< std::vector<V3DLONG> > > corner; // [slab][group] edge keys of the triangle corners
+
+	V3DLONG edgeKey(int i, int j, int k, int axis, int g) const
+	{
+		V3DLONG N = numStep+1;
+		return (((k*N + j)*N + i)*3 + axis)*ngroups + g;
+	}
+	int slabOfKey(V3DLONG key) const
+	{
+		V3DLONG N = numStep+1;
+		int k = int(key/ngroups/3/(N*N));
+		return int(std::upper_bound(planeBegin.begin(), planeBegin.end(), k) - planeBegin.begin()) - 1;
+	}
+
+	// all voxels under the grid points [i0,i1]x[j0,j1]x[k0,k1] are in one group (or none), no surface there
+	bool emptyBlock(int i0, int i1, int j0, int j1, int k0, int k1) const
+	{
+		int x0 = floor(CLAMP01(i0*step)*(field->sx-1)), x1 = ceil(CLAMP01(i1*step)*(field->sx-1));
+		int y0 = floor(CLAMP01(j0*step)*(field->sy-1)), y1 = ceil(CLAMP01(j1*step)*(field->sy-1));
+		int z0 = floor(CLAMP01(k0*step)*(field->sz-1)), z1 = ceil(CLAMP01(k1*step)*(field->sz-1));
+		float lo, hi;
+		octree->query(x0, x1, y0, y1, z0, z1, lo, hi);
+		return field->table->uniform(lo, hi);
+	}
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		for (V3DLONG s=begin; s<end; s++) march(int(s));
+	}
+
+	void march(int s)
+	{
+		// the grid edge of each cube edge: offset of its lower end point and its axis
+		int cornerOffset[8][3], edgeLower[12][3], edgeAxis[12];
+		for (int v=0; v<8; v++)
+			for (int a=0; a<3; a++) cornerOffset[v][a] = int(a2fVertexOffset[v][a]);
+		for (int e=0; e<12; e++)
+		{
+			const int* p0 = cornerOffset[ a2iEdgeConnection[e][0] ];
+			const int* p1 = cornerOffset[ a2iEdgeConnection[e][1] ];
+			for (int a=0; a<3; a++)
+			{
+				edgeLower[e][a] = qMin(p0[a], p1[a]);
+				if (p0[a]!=p1[a]) edgeAxis[e] = a;
+			}
+		}
+
+		const int N = numStep;
+		const int kb = planeBegin[s], ke = planeBegin[s+1];
+		std::vector<LatticeSample> cache((mcBlock+1)*(mcBlock+1)*(mcBlock+1));
+		std::vector<IndexedMesh>& mesh = part[s];
+		std::vector< std::vector<V3DLONG> >& keys = corner[s];
+		EdgeVertexHash& hash = edgeVertex[s];
+
+		for (int k0=kb; k0<ke; k0+=mcBlock)
+		for (int j0=0; j0<=N; j0+=mcBlock)
+		for (int i0=0; i0<=N; i0+=mcBlock)
+		{
+			int i1 = qMin(i0+mcBlock, N), j1 = qMin(j0+mcBlock, N), k1 = qMin(k0+mcBlock, N);
+			if (emptyBlock(i0, i1, j0, j1, k0, k1)) continue;
+
+			int ni = i1-i0+1, nj = j1-j0+1;
+			#define _AT_(i,j,k)  cache[((k-k0)*nj + (j-j0))*ni + (i-i0)]
+			for (int k=k0; k<=k1; k++)
+			for (int j=j0; j<=j1; j++)
+			for (int i=i0; i<=i1; i++)
+				field->sampleAll(i*step, j*step, k*step, _AT_(i,j,k));
+
+			// vertices on the edges leaving the points owned by this block
+			int pk1 = qMin(k0+mcBlock, ke), pj1 = qMin(j0+mcBlock, N+1), pi1 = qMin(i0+mcBlock, N+1);
+			for (int k=k0; k<pk1; k++)
+			for (int j=j0; j<pj1; j++)
+			for (int i=i0; i<pi1; i++)
+			{
+				const LatticeSample& p = _AT_(i,j,k);
+				for (int a=0; a<3; a++)
+				{
+					int qi = i+(a==0), qj = j+(a==1), qk = k+(a==2);
+					if (qi>N || qj>N || qk>N) continue;
+					const LatticeSample& q = _AT_(qi,qj,qk);
+					int cand[16], ncand = 0;
+					addGroups(p, cand, ncand);
+					addGroups(q, cand, ncand);
+					for (int c=0; c<ncand; c++)
+					{
+						int g = cand[c];
+						float fp = p.value(g), fq = q.value(g);
+						if ((fp<=iso) == (fq<=iso)) continue;
+
+						vector3 pos, nrm;
+						float fOffset = fGetOffset(fp, fq, iso);
+						pos.fX = i*step;  pos.fY = j*step;  pos.fZ = k*step;
+						if (a==0) pos.fX += fOffset*step;
+						if (a==1) pos.fY += fOffset*step;
+						if (a==2) pos.fZ += fOffset*step;
+						field->normal(g, pos.fX, pos.fY, pos.fZ, step, nrm);
+
+						IndexedMesh& m = mesh[g];
+						hash.insert(edgeKey(i,j,k,a,g), m.numVertices());
+						m.vertex.push_back(pos.fX);  m.vertex.push_back(pos.fY);  m.vertex.push_back(pos.fZ);
+						m.normal.push_back(nrm.fX);  m.normal.push_back(nrm.fY);  m.normal.push_back(nrm.fZ);
+					}
+				}
+			}
+
+			// triangles of the cells owned by this block, as edge keys
+			int ck1 = qMin(k0+mcBlock, qMin(ke, N)), cj1 = qMin(j0+mcBlock, N), ci1 = qMin(i0+mcBlock, N);
+			for (int k=k0; k<ck1; k++)
+			for (int j=j0; j<cj1; j++)
+			for (int i=i0; i<ci1; i++)
+			{
+				const LatticeSample* c[8];
+				int cand[64], ncand = 0;
+				for (int v=0; v<8; v++)
+				{
+					c[v] = &_AT_(i+cornerOffset[v][0], j+cornerOffset[v][1], k+cornerOffset[v][2]);
+					addGroups(*c[v], cand, ncand);
+				}
+				for (int n=0; n<ncand; n++)
+				{
+					int g = cand[n];
+					int iFlagIndex = 0;
+					for (int v=0; v<8; v++)
+						if (c[v]->value(g) <= iso) iFlagIndex |= 1<<v;
+					if (aiCubeEdgeFlags[iFlagIndex] == 0) continue;
+
+					const int* tri = a2iTriangleConnectionTable[iFlagIndex];
+					for (int t=0; t<15 && tri[t]>=0; t++)
+					{
+						int e = tri[t];
+						keys[g].push_back(edgeKey(i+edgeLower[e][0], j+edgeLower[e][1], k+edgeLower[e][2], edgeAxis[e], g));
+					}
+				}
+			}
+			#undef _AT_
+		}
+	}
+};
+
+// edge keys -> global vertex indices, after all slabs have created their vertices
+template <class T>
+struct LabelSurfaceResolve
+{
+	LabelSurfaceSlabs<T>* slabs;
+	const std::vector< std::vector<int> >* offset; // [slab][group] first vertex of part[slab][group] in the group mesh
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		for (V3DLONG s=begin; s<end; s++)
+		for (int g=0; g<slabs->ngroups; g++)
+		{
+			std::vector<V3DLONG>& keys = slabs->corner[s][g];
+			std::vector<int>& index = slabs->part[s][g].index;
+			index.reserve(keys.size());
+			for (size_t t=0; t+2<keys.size(); t+=3)
+			{
+				int v[3];
+				bool ok = true;
+				for (int c=0; c<3 && ok; c++)
+				{
+					int owner = slabs->slabOfKey(keys[t+c]);
+					int local = slabs->edgeVertex[owner].find(keys[t+c]);
+					if (local<0) ok = false;
+					else v[c] = (*offset)[owner][g] + local;
+				}
+				if (!ok) continue;
+				index.push_back(v[0]);  index.push_back(v[1]);  index.push_back(v[2]);
+			}
+			std::vector<V3DLONG>().swap(keys);
+		}
+	}
+};
+
+// concatenate the slab parts of every group
+template <class T>
+struct LabelSurfaceAssemble
+{
+	LabelSurfaceSlabs<T>* slabs;
+	std::vector<IndexedMesh>* meshes;
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		int nslabs = int(slabs->part.size());
+		for (V3DLONG g=begin; g<end; g++)
+		{
+			IndexedMesh& m = (*meshes)[g];
+			size_t nv = 0, ni = 0;
+			for (int s=0; s<nslabs; s++)
+			{
+				nv += slabs->part[s][g].vertex.size();
+				ni += slabs->part[s][g].index.size();
+			}
+			m.vertex.reserve(nv);  m.normal.reserve(nv);  m.index.reserve(ni);
+			for (int s=0; s<nslabs; s++)
+			{
+				IndexedMesh& p = slabs->part[s][g];
+				m.vertex.insert(m.vertex.end(), p.vertex.begin(), p.vertex.end());
+				m.normal.insert(m.normal.end(), p.normal.begin(), p.normal.end());
+				m.index.insert(m.index.end(), p.index.begin(), p.index.end());
+				std::vector<float>().swap(p.vertex);
+				std::vector<float>().swap(p.normal);
+				std::vector<int>().swap(p.index);
+			}
+		}
+	}
+};
+
+template <class T>
+void marchLabelGroups(const T* data, int sx, int sy, int sz, const LabelGroupTable& table, int ngroups,
+					  const MinMaxOctree& octree, int numStep, float isoValue,
+					  std::vector<IndexedMesh>& meshes, int nthreads)
+{
+	LabelField<T> field;
+	field.data = data;
+	field.sx = sx;  field.sy = sy;  field.sz = sz;
+	field.table = &table;
+
+	int nslabs = qMin(nthreads, numStep+1);
+	LabelSurfaceSlabs<T> slabs;
+	slabs.field = &field;
+	slabs.octree = &octree;
+	slabs.ngroups = ngroups;
+	slabs.numStep = numStep;
+	slabs.step = 1.0f/numStep;
+	slabs.iso = isoValue;
+	for (int s=0; s<=nslabs; s++)
+		slabs.planeBegin.push_back(int(V3DLONG(numStep+1)*s/nslabs));
+	slabs.edgeVertex.resize(nslabs);
+	slabs.part.assign(nslabs, std::vector<IndexedMesh>(ngroups));
+	slabs.corner.assign(nslabs, std::vector< std::vector<V3DLONG> >(ngroups));
+	v3d_parallel_for(nslabs, slabs, nslabs);
+
+	std::vector< std::vector<int> > offset(nslabs, std::vector<int>(ngroups, 0));
+	for (int s=1; s<nslabs; s++)
+		for (int g=0; g<ngroups; g++)
+			offset[s][g] = offset[s-1][g] + slabs.part[s-1][g].numVertices();
+	LabelSurfaceResolve<T> resolve;
+	resolve.slabs = &slabs;
+	resolve.offset = &offset;
+	v3d_parallel_for(nslabs, resolve, nslabs);
+	std::vector<EdgeVertexHash>().swap(slabs.edgeVertex);
+
+	meshes.assign(ngroups, IndexedMesh());
+	LabelSurfaceAssemble<T> assemble;
+	assemble.slabs = &slabs;
+	assemble.meshes = &meshes;
+	v3d_parallel_for(ngroups, assemble, nthreads);
+}
+
+template <class T>
+void marchLabelVolume(const T* data, int datatype, int sx, int sy, int sz, const std::vector<LabelRange>& ranges,
+					  int numStep, float isoValue, std::vector<IndexedMesh>& meshes, int nthreads)
+{
+	MinMaxOctree octree;
+	octree.build(data, sx, sy, sz, nthreads);
+
+	LabelGroupTable table;
+	if (table.build(ranges, datatype))
+	{
+		marchLabelGroups(data, sx, sy, sz, table, int(ranges.size()), octree, numStep, isoValue, meshes, nthreads);
+		return;
+	}
+
+	// overlapping ranges, one group at a time
+	meshes.assign(ranges.size(), IndexedMesh());
+	for (int i=0; i<(int)ranges.size(); i++)
+	{
+		std::vector<LabelRange> one(1, ranges[i]);
+		std::vector<IndexedMesh> result;
+		table.build(one, datatype);
+		marchLabelGroups(data, sx, sy, sz, table, 1, octree, numStep, isoValue, result, nthreads);
+		std::swap(meshes[i], result[0]);
+	}
+}
+
+} // namespace
+
+void MarchingCubesLabels(const void* data, int datatype, int sx, int sy, int sz,
+						 const std::vector<LabelRange>& ranges,
+						 int numStep, float isoValue,
+						 std::vector<IndexedMesh>& meshes,
+						 int nthreads)
+{
+	meshes.assign(ranges.size(), IndexedMesh());
+	if (!data || sx<1 || sy<1 || sz<1 || numStep<1 || ranges.empty()) return;
+	if (nthreads<=0) nthreads = v3d_parallel_thread_count();
+
+	if (datatype==1)
+		marchLabelVolume((const unsigned char*)data, datatype, sx, sy, sz, ranges, numStep, isoValue, meshes, nthreads);
+	else if (datatype==2)
+		marchLabelVolume((const unsigned short*)data, datatype, sx, sy, sz, ranges, numStep, isoValue, meshes, nthreads);
+	else if (datatype==4)
+		marchLabelVolume((const float*)data, datatype, sx, sy, sz, ranges, numStep, isoValue, meshes, nthreads);
+}
+
+struct Triangle* trianglesFromIndexedMesh(const IndexedMesh& mesh, float sx, float sy, float sz)
+{
+	struct Triangle* head = NULL;
+	struct Triangle* tail = NULL;
+	const float scale[3] = {sx, sy, sz};
+	for (int t=0; t<mesh.numTriangles(); t++)
+	{
+		struct Triangle* p = new struct Triangle;
+		p->next = NULL;
+		if (tail == NULL)	head = tail = p;
+		else				{ tail->next = p;  tail = p; }
+
+		for (int iCorner = 0; iCorner < 3; iCorner++)
+		{
+			int v = mesh.index[3*t+iCorner];
+			for (int a=0; a<3; a++)
+			{
+				p->vertex[iCorner][a] = mesh.vertex[3*v+a]*scale[a];
+				p->normal[iCorner][a] = mesh.normal[3*v+a];
+			}
+		}
+	}
+	return head;
+}
+
+
 
 //-------------------------------------------------------------------------------------
 
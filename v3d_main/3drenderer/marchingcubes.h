@@ -42,6 +42,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #ifndef _marchingcubes_h_
 #define _marchingcubes_h_
 
+#include <vector>
 
 //-----------------------------------------
 // triangle struct
@@ -97,4 +98,43 @@ struct Triangle* MarchingCubes(        //return triangle list
 				   int method=0);      //0/1 -- Marching Cubes/Tetrahedrons
 
 
+//-----------------------------------------
+// indexed mesh, every vertex is shared by all triangles around it
+
+struct IndexedMesh
+{
+	std::vector<float> vertex;  // x,y,z per vertex
+	std::vector<float> normal;  // nx,ny,nz per vertex
+	std::vector<int>   index;   // 3 vertex indices per triangle
+	int numVertices() const  { return int(vertex.size()/3); }
+	int numTriangles() const { return int(index.size()/3); }
+};
+
+// convert to a triangle list for drawing/picking/saving, vertices are scaled by (sx,sy,sz)
+struct Triangle* trianglesFromIndexedMesh(const IndexedMesh& mesh, float sx=1, float sy=1, float sz=1);
+
+// a label group, all voxels with lo<=value<=hi
+struct LabelRange
+{
+	float lo;
+	float hi;
+};
+
+// Marching Cubes over all label groups of a 1-channel volume in one pass.
+// The field of each group is the percent filter of the label field surface (trilinear weight of
+// the voxels inside the group * 255), sampled on a numStep^3 grid over normalized [0,1] coordinates.
+// Blocks whose voxels all belong to one group (or none) are skipped by a min/max octree, the z-slabs
+// run in parallel and vertices on the same grid edge are welded, so meshes[i] is the closed
+// indexed surface of ranges[i]. Overlapping ranges are extracted one by one.
+void MarchingCubesLabels(
+				   const void* data,   //x fastest, then y, z
+				   int datatype,       //1/2/4 -- unsigned char/unsigned short/float
+				   int sx, int sy, int sz,
+				   const std::vector<LabelRange>& ranges,
+				   int   numStep,      //num of sampling steps
+				   float isoValue,     //iso value of the percent filter, in 0~255
+				   std::vector<IndexedMesh>& meshes,
+				   int nthreads=0);    //0 -- one slab per core
+
+
 #endif// _marchingcubes_h_
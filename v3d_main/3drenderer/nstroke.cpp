@@ -883,6 +883,7 @@ void Renderer_gl1::solveCurveRefineLast()
 
                }
           } // end update linking for refined points
+          curImg->tracedNeuron.invalidateIndex(); // nodes moved in place
 
           // update radius of each point
           if (V3dApplication::getMainWindow()->global_setting.b_3dcurve_autowidth)
@@ -1619,21 +1620,22 @@ void Renderer_gl1::seg2GridMapping(My4DImage* curImg)
 	// Each grid is mapped to segments that run through it. set<segments run through the grid> = Renderer_gl1::wholeGrid2segIDmap(grid).
 	// -- MK, June, 2018
 
+	// The grid is rebuilt only after it was cleared by an edit made outside the highlighting mode, see tracedNeuronReloaded().
+	// -- Morton-keyed hash grid instead of map<"x_y_z", set<size_t> >
+
 	this->gridLength = 50;
-	for (vector<V_NeuronSWC>::iterator segIt = curImg->tracedNeuron.seg.begin(); segIt != curImg->tracedNeuron.seg.end(); ++segIt)
-	{
-		for (vector<V_NeuronSWC_unit>::iterator nodeIt = segIt->row.begin(); nodeIt != segIt->row.end(); ++nodeIt)
-		{
-			int xLabel = nodeIt->x / this->gridLength;
-			int yLabel = nodeIt->y / this->gridLength;
-			int zLabel = nodeIt->z / this->gridLength;
-			QString gridKeyQ = QString::number(xLabel) + "_" + QString::number(yLabel) + "_" + QString::number(zLabel);
-			string gridKey = gridKeyQ.toStdString();
-			this->wholeGrid2segIDmap[gridKey].insert(size_t(segIt - curImg->tracedNeuron.seg.begin()));
-		}
-	}
+	this->wholeGrid2segIDmap.setGridLength(this->gridLength);
+	this->wholeGrid2segIDmap.sync(curImg->tracedNeuron.seg);
+
+	//cout << this->wholeGrid2segIDmap.nCells() << endl;
+}
 
-	//cout << this->wholeGrid2segIDmap.size() << endl;
+void Renderer_gl1::tracedNeuronReloaded()
+{
+	// Edits of the highlighting mode update the grid segment by segment and set segGridKept. Any other edit may
+	// have renumbered the segments, so the grid is cleared and seg2GridMapping() rebuilds it when it is needed again.
+	if (!this->segGridKept) this->wholeGrid2segIDmap.clear();
+	this->segGridKept = false;
 }
 
 void Renderer_gl1::segEnd2SegIDmapping(My4DImage* curImg)
@@ -1968,9 +1970,8 @@ V3DLONG Renderer_gl1::findNearestNeuronNode_WinXYV2(int cx, int cy)
 	for (V3DLONG i=0;i<N;i++)
 	{
 		ix = segi.row.at(i).x, iy = segi.row.at(i).y, iz = segi.row.at(i).z;
-		GLint res = gluProject(ix, iy, iz, markerViewMatrix, projectionMatrix, viewport, &px, &py, &pz);// note: should use the saved modelview,projection and viewport matrix
-		py = viewport[3]-py; //the Y axis is reversed
-		if (res==GL_FALSE) {qDebug()<<"gluProject() fails for NeuronTree ["<<i<<"] node"; return -1;}
+		bool res = ScreenPickCache::projectPoint(ix, iy, iz, markerViewMatrix, projectionMatrix, viewport, px, py, pz);// note: should use the saved modelview,projection and viewport matrix; py is already flipped
+		if (!res) {qDebug()<<"gluProject() fails for NeuronTree ["<<i<<"] node"; return -1;}
 
 		double cur_dist = (px-cx)*(px-cx)+(py-cy)*(py-cy);
 		if (i==0) {	best_dist = cur_dist; best_ind=0; }
@@ -2314,6 +2315,7 @@ void Renderer_gl1::updateDraggedNeuronXYZ()
 
           }
      }
+     curImg->tracedNeuron.invalidateIndex(); // nodes moved in place
 
      // update radius of each point
      if (V3dApplication::getMainWindow()->global_setting.b_3dcurve_autowidth)
@@ -3294,6 +3294,9 @@ void Renderer_gl1::deleteMultiNeuronsByStrokeCommit()
     V3dR_GLWidget* w = (V3dR_GLWidget*)widget;
 
     My4DImage* curImg = 0;       if (w) {editinput = 3;curImg = v3dr_getImage4d(_idep);}
+    for (V3DLONG i=0; i<curImg->tracedNeuron.nsegs(); i++)
+        if (curImg->tracedNeuron.seg[i].to_be_deleted)
+            w->collaborationRemoveSegment(curImg->tracedNeuron.seg[i]);
     curImg->tracedNeuron.deleteMultiSeg();
     //curImg->proj_trace_history_append();          // no need to update the history
     curImg->update_3drenderer_neuron_view(w, this);
@@ -4432,6 +4435,7 @@ void Renderer_gl1::showConnectedSegs()
 			//cout << endl;
 			/* ----------------- END of [Start finding connected segments] ----------------- */
 
+			this->segGridKept = true; // highlighting changes only the node types
             curImg->update_3drenderer_neuron_view(w, this);
 			//curImg->proj_trace_history_append(); // -> Highlighting is for temporary checking purpose, should not be appended to the history.
 		}
@@ -4534,22 +4538,16 @@ set<size_t> Renderer_gl1::segEndRegionCheck(My4DImage* curImg, size_t inputSegID
 	set<size_t> otherConnectedSegs;
 	otherConnectedSegs.clear();
 
-	int xHead = (curImg->tracedNeuron.seg[inputSegID].row.end() - 1)->x / this->gridLength;
-	int yHead = (curImg->tracedNeuron.seg[inputSegID].row.end() - 1)->y / this->gridLength;
-	int zHead = (curImg->tracedNeuron.seg[inputSegID].row.end() - 1)->z / this->gridLength;
-	int xTail = curImg->tracedNeuron.seg[inputSegID].row.begin()->x / this->gridLength;
-	int yTail = curImg->tracedNeuron.seg[inputSegID].row.begin()->y / this->gridLength;
-	int zTail = curImg->tracedNeuron.seg[inputSegID].row.begin()->z / this->gridLength;
-	QString gridKeyHeadQ = QString::number(xHead) + "_" + QString::number(yHead) + "_" + QString::number(zHead);
-	string gridKeyHead = gridKeyHeadQ.toStdString();
-	QString gridKeyTailQ = QString::number(xTail) + "_" + QString::number(yTail) + "_" + QString::number(zTail);
-	string gridKeyTail = gridKeyTailQ.toStdString();
-
-	set<size_t> headRegionSegs = this->wholeGrid2segIDmap[gridKeyHead];
-	set<size_t> tailRegionSegs = this->wholeGrid2segIDmap[gridKeyTail];
+	const V_NeuronSWC_unit & headNode = *(curImg->tracedNeuron.seg[inputSegID].row.end() - 1);
+	const V_NeuronSWC_unit & tailNode = *curImg->tracedNeuron.seg[inputSegID].row.begin();
+	const SegmentGridIndex::SegList * headSegs = this->wholeGrid2segIDmap.segsAt(headNode.x, headNode.y, headNode.z);
+	const SegmentGridIndex::SegList * tailSegs = this->wholeGrid2segIDmap.segsAt(tailNode.x, tailNode.y, tailNode.z);
+	SegmentGridIndex::SegList noSegs;
+	const SegmentGridIndex::SegList & headRegionSegs = (headSegs) ? *headSegs : noSegs;
+	const SegmentGridIndex::SegList & tailRegionSegs = (tailSegs) ? *tailSegs : noSegs;
 
 	//cout << " Head region segs:";
-	for (set<size_t>::iterator headIt = headRegionSegs.begin(); headIt != headRegionSegs.end(); ++headIt)
+	for (SegmentGridIndex::SegList::const_iterator headIt = headRegionSegs.begin(); headIt != headRegionSegs.end(); ++headIt)
 	{
 		if (*headIt == inputSegID || curImg->tracedNeuron.seg[*headIt].to_be_deleted) continue;
 		//cout << *headIt << " ";
@@ -4560,7 +4558,7 @@ set<size_t> Renderer_gl1::segEndRegionCheck(My4DImage* curImg, size_t inputSegID
 		}
 	}
 	//cout << endl << " Tail region segs:";
-	for (set<size_t>::iterator tailIt = tailRegionSegs.begin(); tailIt != tailRegionSegs.end(); ++tailIt)
+	for (SegmentGridIndex::SegList::const_iterator tailIt = tailRegionSegs.begin(); tailIt != tailRegionSegs.end(); ++tailIt)
 	{
 		if (*tailIt == inputSegID || curImg->tracedNeuron.seg[*tailIt].to_be_deleted) continue;
 		//cout << *tailIt << " ";
@@ -4599,22 +4597,17 @@ void Renderer_gl1::loopDetection()
 		if (curImg->tracedNeuron.seg[*it].row.size() <= 1)
 		{
 			curImg->tracedNeuron.seg[*it].to_be_deleted = true;
+			this->wholeGrid2segIDmap.removeSegment(*it);
 			continue;
 		}
 		else if (curImg->tracedNeuron.seg[*it].to_be_deleted) continue;
 
 		for (vector<V_NeuronSWC_unit>::iterator nodeIt = curImg->tracedNeuron.seg[*it].row.begin(); nodeIt != curImg->tracedNeuron.seg[*it].row.end(); ++nodeIt)
 		{
-			int xLabel = nodeIt->x / this->gridLength;
-			int yLabel = nodeIt->y / this->gridLength;
-			int zLabel = nodeIt->z / this->gridLength;
-			QString gridKeyQ = QString::number(xLabel) + "_" + QString::number(yLabel) + "_" + QString::number(zLabel);
-			string gridKey = gridKeyQ.toStdString();
-
-			set<size_t> scannedSegs = this->wholeGrid2segIDmap[gridKey];
-			if (!scannedSegs.empty())
+			const SegmentGridIndex::SegList * scannedSegs = this->wholeGrid2segIDmap.segsAt(nodeIt->x, nodeIt->y, nodeIt->z);
+			if (scannedSegs)
 			{
-				for (set<size_t>::iterator scannedIt = scannedSegs.begin(); scannedIt != scannedSegs.end(); ++scannedIt)
+				for (SegmentGridIndex::SegList::const_iterator scannedIt = scannedSegs->begin(); scannedIt != scannedSegs->end(); ++scannedIt)
 				{
 					int connectedSegsSize = connectedSegs.size();
 					if (*scannedIt == *it || curImg->tracedNeuron.seg[*scannedIt].to_be_deleted) continue;
@@ -4782,6 +4775,7 @@ void Renderer_gl1::loopDetection()
 		cout << "non LOOPS ERROR NUMBER (set): " << this->nonLoopErrors.size() << endl << endl;
 	}
 
+	this->segGridKept = true; // only the node types changed
 	curImg->update_3drenderer_neuron_view(w, this);
 }
 
@@ -4971,6 +4965,7 @@ void Renderer_gl1::escPressed_subtree()
 		for (map<size_t, vector<V_NeuronSWC_unit> >::iterator it = this->originalSegMap.begin(); it != this->originalSegMap.end(); ++it)
 			curImg->tracedNeuron.seg[it->first].row = it->second;
 
+		this->segGridKept = true; // only the node types changed
 		curImg->update_3drenderer_neuron_view(w, this);
 
 		this->pressedShowSubTree = false;
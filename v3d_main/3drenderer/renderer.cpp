@@ -41,9 +41,11 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) Automatic reconstruction
 
 #include "renderer.h"
 #include "v3dr_glwidget.h" //for makeCurrent, drawText
+#include "../basic_c_fun/basic_parallel.h"
 #include <sstream>
 #include <string>
 #include <cmath>
+#include <cstring>
 
 Renderer::SelectMode Renderer::defaultSelectMode = Renderer::smObject;
 
@@ -1240,6 +1242,128 @@ void rgba3d_r2gray(RGBA8* rgbaBuf, V3DLONG bufSize[5])
 		}
 }
 
+// Converts whole (ot,oz) slices of data4dp_to_rgba3d. Each output voxel takes the 8-bit value of a single input voxel per
+// channel (see sampling3dUINT8_2), so the source offsets along x, y, z and their bound checks are tabulated once, and
+// 16-bit data goes through a per-channel lookup table built with the arithmetic of Image4DProxy::value8bit_at().
+class Data4dpToRGBA3dSlices
+{
+public:
+	Image4DProxy<Image4DSimple> & img4dp;
+	RGBA8 * rgbaBuf;
+	V3DLONG imageX, imageY, imageZ, imageC, imageT, dim4;
+	std::vector<V3DLONG> ix, iy, iz;      // source coordinates, as in the sequential loops
+	std::vector<char> okx, oky, okz;     // whether the dx*dy*dz box at the coordinate fits in the image
+	std::vector<v3d_uint8> lut16;        // [c*65536 + value] for 16-bit data
+
+	Data4dpToRGBA3dSlices(Image4DProxy<Image4DSimple> & img4dpParam, RGBA8 * rgbaBufParam) : img4dp(img4dpParam), rgbaBuf(rgbaBufParam) {}
+
+	void buildLUT()
+	{
+		if (img4dp.su!=2) return;
+		lut16.resize(size_t(img4dp.sc)*65536);
+		for (V3DLONG c=0; c<img4dp.sc; c++)
+			for (V3DLONG u=0; u<65536; u++)
+			{
+				double v = (double)(v3d_uint16)u;
+				if (img4dp.has_minmax())
+				{
+					double r = 255./(img4dp.vmax[c]-img4dp.vmin[c]);
+					v = (v-img4dp.vmin[c])*r;
+				}
+				lut16[c*65536+u] = (v3d_uint8)v;
+			}
+	}
+
+	void sampleRow(V3DLONG c, V3DLONG y, V3DLONG z, unsigned char * row) const
+	{
+		if (c<0 || c>=img4dp.sc) // keep the behavior of value8bit_at for out of range channels
+		{
+			for (V3DLONG ox=0; ox<imageX; ox++) row[ox] = okx[ox] ? img4dp.value8bit_at(ix[ox], y, z, c) : 0;
+			return;
+		}
+		const v3d_uint8 * p = img4dp.data_p + img4dp.stride_y*y + img4dp.stride_z*z + img4dp.stride_c*c;
+		if (img4dp.su==1)
+		{
+			for (V3DLONG ox=0; ox<imageX; ox++) row[ox] = okx[ox] ? p[ix[ox]] : 0;
+		}
+		else if (img4dp.su==2)
+		{
+			const v3d_uint16 * p16 = (const v3d_uint16 *)p;
+			const v3d_uint8 * lut = &lut16[c*65536];
+			for (V3DLONG ox=0; ox<imageX; ox++) row[ox] = okx[ox] ? lut[p16[ix[ox]]] : 0;
+		}
+		else
+		{
+			for (V3DLONG ox=0; ox<imageX; ox++) row[ox] = okx[ox] ? img4dp.value8bit_at(ix[ox], y, z, c) : 0;
+		}
+	}
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		std::vector<unsigned char> rows(4*imageX, 0);
+		unsigned char * v0 = &rows[0], * v1 = v0+imageX, * v2 = v1+imageX, * v3 = v2+imageX;
+		for (V3DLONG slice=begin; slice<end; slice++)
+		{
+			V3DLONG ot = slice/imageZ, oz = slice%imageZ;
+			V3DLONG SAM0 = ot*dim4/imageT + 0;
+			RGBA8 * out = rgbaBuf + slice*(imageY*imageX);
+			for (V3DLONG oy=0; oy<imageY; oy++, out+=imageX)
+			{
+				unsigned char * v[4] = {v0, v1, v2, v3};
+				for (V3DLONG c=0; c<imageC && c<4; c++)
+				{
+					if (okz[oz] && oky[oy]) sampleRow(SAM0+c, iy[oy], iz[oz], v[c]);
+					else memset(v[c], 0, imageX);
+				}
+
+				if (imageC==1)
+					for (V3DLONG ox=0; ox<imageX; ox++)
+					{
+						RGBA8 rgba;
+						rgba.r = v0[ox];
+						rgba.g = 0;
+						rgba.b = 0;
+						float t = (0.f + rgba.r + rgba.g + rgba.b);
+						rgba.a = (unsigned char)t;
+						out[ox] = rgba;
+					}
+				if (imageC==2)
+					for (V3DLONG ox=0; ox<imageX; ox++)
+					{
+						RGBA8 rgba;
+						rgba.r = v0[ox];
+						rgba.g = v1[ox];
+						rgba.b = 0;
+						float t = (0.f + rgba.r + rgba.g + rgba.b)/2.0;
+						rgba.a = (unsigned char)t;
+						out[ox] = rgba;
+					}
+				if (imageC==3)
+					for (V3DLONG ox=0; ox<imageX; ox++)
+					{
+						RGBA8 rgba;
+						rgba.r = v0[ox];
+						rgba.g = v1[ox];
+						rgba.b = v2[ox];
+						float t = (0.f + rgba.r + rgba.g + rgba.b)/3.0;
+						rgba.a = (unsigned char)t;
+						out[ox] = rgba;
+					}
+				if (imageC>=4)
+					for (V3DLONG ox=0; ox<imageX; ox++)
+					{
+						RGBA8 rgba;
+						rgba.r = v0[ox];
+						rgba.g = v1[ox];
+						rgba.b = v2[ox];
+						rgba.a = v3[ox];
+						out[ox] = rgba;
+					}
+			}
+		}
+	}
+};
+
 void data4dp_to_rgba3d(Image4DProxy<Image4DSimple>& img4dp, V3DLONG dim5,
 		V3DLONG start1, V3DLONG start2, V3DLONG start3, V3DLONG start4,
 		V3DLONG size1, V3DLONG size2, V3DLONG size3, V3DLONG size4,
@@ -1257,12 +1381,6 @@ void data4dp_to_rgba3d(Image4DProxy<Image4DSimple>& img4dp, V3DLONG dim5,
 
 	V3DLONG dim1=img4dp.sx; V3DLONG dim2=img4dp.sy; V3DLONG dim3=img4dp.sz;
 	V3DLONG dim4=img4dp.sc;
-	#define SAMPLE(it, ic, ix,iy,iz, dx,dy,dz) \
-				(unsigned char)sampling3dUINT8( img4dp, (it*dim4/imageT + ic), \
-												ix, iy, iz, dx, dy, dz )
-
-        #define SAMPLE2(si, ix,iy,iz, dx,dy,dz, dxyz) \
-                        (unsigned char)sampling3dUINT8_2( img4dp, si, ix, iy, iz, dx, dy, dz, dxyz)
 
 	// only convert 1<=dim4<=4 ==> RGBA
 	V3DLONG imageX, imageY, imageZ, imageC, imageT;
@@ -1287,82 +1405,35 @@ void data4dp_to_rgba3d(Image4DProxy<Image4DSimple>& img4dp, V3DLONG dim5,
         V3DLONG dxyz = dx*dy*dz;
 	MESSAGE_ASSERT(dx*dy*dz >=1); //down sampling
 
-	V3DLONG ot;
+	// the voxel sampled for (ox,oy,oz) and the bound check of sampling3dUINT8_2, one axis at a time
+	Data4dpToRGBA3dSlices slices(img4dp, rgbaBuf);
+	slices.imageX = imageX;  slices.imageY = imageY;  slices.imageZ = imageZ;
+	slices.imageC = imageC;  slices.imageT = imageT;  slices.dim4 = dim4;
+	slices.ix.resize(imageX);  slices.okx.resize(imageX);
+	slices.iy.resize(imageY);  slices.oky.resize(imageY);
+	slices.iz.resize(imageZ);  slices.okz.resize(imageZ);
 	V3DLONG ox, oy, oz;
-	V3DLONG ix, iy, iz;
+	for (ox=0; ox<imageX; ox++)
+	{
+		V3DLONG ix = start1+ CLAMP(0,dim1-1, IROUND(ox*sx));
+		slices.ix[ox] = ix;
+		slices.okx[ox] = (dxyz>0 && ix>=0 && ix+dx<=dim1);
+	}
+	for (oy=0; oy<imageY; oy++)
+	{
+		V3DLONG iy = start2+ CLAMP(0,dim2-1, IROUND(oy*sy));
+		slices.iy[oy] = iy;
+		slices.oky[oy] = (iy>=0 && iy+dy<=dim2);
+	}
+	for (oz=0; oz<imageZ; oz++)
+	{
+		V3DLONG iz = start3+ CLAMP(0,dim3-1, IROUND(oz*sz));
+		slices.iz[oz] = iz;
+		slices.okz[oz] = (iz>=0 && iz+dz<=dim3);
+	}
+	slices.buildLUT();
 
-        V3DLONG otOffset, ozOffset, oyOffset, oxOffset;
-
-        V3DLONG SAM0, SAM1, SAM2, SAM3;
-
-
-        for (ot=0; ot<imageT; ot++) {
-            SAM0 = ot*dim4/imageT + 0;
-            SAM1 = SAM0+1;
-            SAM2 = SAM0+2;
-            SAM3 = SAM0+3;
-            otOffset=ot*(imageZ*imageY*imageX);
-            for (oz = 0; oz < imageZ; oz++) {
-                ozOffset=oz*(imageY*imageX);
-                iz = start3+ CLAMP(0,dim3-1, IROUND(oz*sz));
-                for (oy = 0; oy < imageY; oy++) {
-                    oyOffset=oy*imageX;
-                    oxOffset=otOffset+ozOffset+oyOffset;
-                    iy = start2+ CLAMP(0,dim2-1, IROUND(oy*sy));
-
-                    if (imageC==1) {
-                        for (ox=0;ox<imageX;ox++) {
-                            ix = start1+ CLAMP(0,dim1-1, IROUND(ox*sx));
-                            RGBA8 rgba;
-                            rgba.r = SAMPLE2(SAM0, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.g = 0;
-                            rgba.b = 0;
-                            float t = (0.f + rgba.r + rgba.g + rgba.b);
-                            rgba.a = (unsigned char)t;
-                            rgbaBuf[oxOffset++] = rgba;
-                        }
-                    }
-
-                    if (imageC==2) {
-                        for (ox=0;ox<imageX;ox++) {
-                            ix = start1+ CLAMP(0,dim1-1, IROUND(ox*sx));
-                            RGBA8 rgba;
-                            rgba.r = SAMPLE2(SAM0, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.g = SAMPLE2(SAM1, ix,iy,iz, dx,dy,dz, dxyz);;
-                            rgba.b = 0;
-                            float t = (0.f + rgba.r + rgba.g + rgba.b)/2.0;
-                            rgba.a = (unsigned char)t;
-                            rgbaBuf[oxOffset++] = rgba;
-                        }
-                    }
-
-                    if (imageC==3) {
-                        for (ox=0;ox<imageX;ox++) {
-                            ix = start1+ CLAMP(0,dim1-1, IROUND(ox*sx));
-                            RGBA8 rgba;
-                            rgba.r = SAMPLE2(SAM0, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.g = SAMPLE2(SAM1, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.b = SAMPLE2(SAM2, ix,iy,iz, dx,dy,dz, dxyz);
-                            float t = (0.f + rgba.r + rgba.g + rgba.b)/3.0;
-                            rgba.a = (unsigned char)t;
-                            rgbaBuf[oxOffset++] = rgba;
-                        }
-                    }
-
-                    if (imageC>=4) {
-                        for (ox=0;ox<imageX;ox++) {
-                            ix = start1+ CLAMP(0,dim1-1, IROUND(ox*sx));
-                            RGBA8 rgba;
-                            rgba.r = SAMPLE2(SAM0, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.g = SAMPLE2(SAM1, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.b = SAMPLE2(SAM2, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgba.a = SAMPLE2(SAM3, ix,iy,iz, dx,dy,dz, dxyz);
-                            rgbaBuf[oxOffset++] = rgba;
-                        }
-                    }
-                }
-            }
-        }
+	v3d_parallel_for(imageT*imageZ, slices);
 }
 
 void data4dp_to_rgba3d(unsigned char* data4dp, V3DLONG dim1, V3DLONG dim2, V3DLONG dim3, V3DLONG dim4, V3DLONG dim5,
@@ -52,6 +52,8 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) Automatic reconstruction
 
 #include "renderer.h"
 #include "marchingcubes.h"
+#include "segment_grid_index.h"
+#include "screen_pick_cache.h"
 #include <time.h>
 #include <map>
 #include <set>
@@ -252,8 +254,9 @@ public:
 	QString info_NeuronNode(int node_i, NeuronTree * ptree);
 	QString info_SurfVertex(int vertex_i, Triangle * triangle, int label);
 
-	QList <NeuronTree> * getHandleNeuronTrees() {return &listNeuronTree;}
+	QList <NeuronTree> * getHandleNeuronTrees() {neuronPickCache.clear(); return &listNeuronTree;} // the caller may edit the trees
 	V3DLONG findNearestNeuronNode_WinXY(int cx, int cy, NeuronTree * ptree, double & best_dist);	//find the nearest node in a neuron in XY project of the display window.//return the index of the respective neuron node
+	std::map<const NeuronTree *, ScreenPickCache> neuronPickCache; // window projections of the nodes, per tree, cleared when a tree is edited or the camera moves
 
 #ifdef _NEURON_ASSEMBLER_
 	double radius;
@@ -507,7 +510,8 @@ public:
 
 	 // --------- loop safe guard and hilighting [subtree/connected segs] for both 3D view and terafly editing mode, MK 2018 May ---------
 	 int gridLength;
-	 map<string, set<size_t> > wholeGrid2segIDmap;
+	 SegmentGridIndex wholeGrid2segIDmap; // segments having a node in each gridLength^3 cell, kept current by the highlighting edits
+	 bool segGridKept;                    // the last edit already updated wholeGrid2segIDmap
 	 multimap<string, size_t> segEnd2segIDmap;
 
 	 set<size_t> subtreeSegs;
@@ -516,6 +520,7 @@ public:
 
 	 void segEnd2SegIDmapping(My4DImage* curImg);
 	 void seg2GridMapping(My4DImage* curImg);
+	 void tracedNeuronReloaded();         // called when the traced neuron is loaded into the view after an edit
 	 void rc_findConnectedSegs(My4DImage* curImg, size_t startSegID);
 	 set<size_t> segEndRegionCheck(My4DImage* curImg, size_t inputSegID);
 	 bool pressedShowSubTree;
@@ -746,6 +751,7 @@ private:
 
 		childHighlightMode = false;
 		showingGrid = false;
+		segGridKept = false;
 		_idep=0;
 		isSimulatedData=false;
 		data_unitbytes=0;
@@ -844,6 +850,8 @@ public:
 	QList <LabelSurf> listLabelSurf;
 	QList <Triangle*> list_listTriangle;
 	QList <GLuint> list_glistLabel;
+	QList <IndexedMesh*> list_labelMesh;		// shared-vertex surface of a label, NULL when the label has only a triangle list
+	QList <GLuint> list_labelMeshBuffer;	// vertex+normal and index buffer objects, 2 per label, 0 without VBO support
 	BoundingBox labelBB;
 
 	void createMarker_atom();  					// makeCurrent & called in loadObj
@@ -886,6 +894,8 @@ public:
 	void compileLabelfieldSurf(int update=0);  					// makeCurrent
 	virtual void drawLabelfieldSurf();
 	void cleanLabelfieldSurf();
+	void drawLabelMesh(int i);
+	Triangle* labelTriangles(int i);						// triangle list of label i, built from its mesh on first use
 	void loadWavefrontOBJ(const QString& filename);
 	void saveWavefrontOBJ(const QString& filename);
 	void loadV3DSurface(const QString& filename);
@@ -156,7 +156,7 @@ int Renderer_gl1::processHit(int namelen, int names[], int cx, int cy, bool b_me
 			(qsName = QString("label surface #%1 ... ").arg(names[2]) + listLabelSurf.at(names[2]-1).name);
 			LIST_SELECTED(listLabelSurf, names[2]-1, true);
 			int vertex_i=0;
-			Triangle * T = findNearestSurfTriangle_WinXY(cx, cy, vertex_i, (Triangle*)list_listTriangle.at(names[2]-1));
+			Triangle * T = findNearestSurfTriangle_WinXY(cx, cy, vertex_i, labelTriangles(names[2]-1));
 			qsInfo = info_SurfVertex(vertex_i, T, listLabelSurf.at(names[2]-1).label);
 		}break;
 		case stNeuronStructure: {//swc
@@ -1757,6 +1757,7 @@ int Renderer_gl1::processHit(int namelen, int names[], int cx, int cy, bool b_me
                         NeuronTree newtree = V_NeuronSWC_list__2__NeuronTree(curImg->tracedNeuron);
                         listNeuronTree = listNeuronTree_old;
                         listNeuronTree.replace(realCurEditingNeuron_inNeuronTree, newtree);
+                        neuronPickCache.clear();
 
                         NeuronTree *p_tree = (NeuronTree *)(&(listNeuronTree.at(realCurEditingNeuron_inNeuronTree)));
                         p_tree->name = listNeuronTree_old.at(realCurEditingNeuron_inNeuronTree).name;
@@ -1920,6 +1921,9 @@ int Renderer_gl1::processHit(int namelen, int names[], int cx, int cy, bool b_me
 			if (p_tree)	{double best_dist; n_id = findNearestNeuronNode_WinXY(cx, cy, p_tree, best_dist);}
 			if (n_id>=0)
 			{
+				V3DLONG seg_id = p_tree->listNeuron.at(n_id).seg_id;
+				if (seg_id>=0 && seg_id<curImg->tracedNeuron.nsegs())
+					w->collaborationRemoveSegment(curImg->tracedNeuron.seg[seg_id]);
 				curImg->proj_trace_deleteNeuronSeg(n_id, p_tree);
 				curImg->update_3drenderer_neuron_view(w, this);
 			}
@@ -2020,7 +2024,15 @@ int Renderer_gl1::processHit(int namelen, int names[], int cx, int cy, bool b_me
 					//						addMarker(loc);
 					//					}
 					//now break the seg
-					curImg->proj_trace_breakNeuronSeg(n_id, p_tree);
+					V3DLONG seg_id = cur_node.seg_id, nsegs = curImg->tracedNeuron.nsegs();
+					V_NeuronSWC broken = (seg_id>=0 && seg_id<nsegs) ? curImg->tracedNeuron.seg[seg_id] : V_NeuronSWC();
+					if (curImg->proj_trace_breakNeuronSeg(n_id, p_tree))
+					{
+						// the pieces are appended in place of the broken segment
+						w->collaborationRemoveSegment(broken);
+						for (V3DLONG i=nsegs-1; i<curImg->tracedNeuron.nsegs(); i++)
+							w->collaborationUpdateSegment(curImg->tracedNeuron.seg[i]);
+					}
 					curImg->update_3drenderer_neuron_view(w, this);
 				}
 			}
@@ -2260,7 +2272,7 @@ int Renderer_gl1::processHit(int namelen, int names[], int cx, int cy, bool b_me
 	else if (act==actDispSurfVertexInfo)
 	{
 		int vertex_i=0;
-		Triangle * T = findNearestSurfTriangle_WinXY(cx, cy, vertex_i, (Triangle*)list_listTriangle.at(names[2]-1));
+		Triangle * T = findNearestSurfTriangle_WinXY(cx, cy, vertex_i, labelTriangles(names[2]-1));
 		if (T!=NULL)
 		{
 			QString qsInfo = info_SurfVertex(vertex_i, T, listLabelSurf.at(names[2]-1).label);
@@ -2299,6 +2311,7 @@ void Renderer_gl1::endSelectMode()
             for (map<size_t, vector<V_NeuronSWC_unit> >::iterator it = this->originalSegMap.begin(); it != this->originalSegMap.end(); ++it)
 				curImg->tracedNeuron.seg[it->first].row = it->second;
 
+			this->segGridKept = true; // only the node types changed
 			curImg->update_3drenderer_neuron_view(w, this);
 			curImg->proj_trace_history_append();
 
@@ -3159,6 +3172,7 @@ void Renderer_gl1::editSurfaceObjBasicGeometry(int dc, int st, int i) // i is 1-
 			NeuronTree old_nt; old_nt.copy(listNeuronTree[ii]); //first make a backup
 			SurfaceObjGeometryDialog tmp_dialog(w, this, dc, st, ii);
 			int res = tmp_dialog.exec(); //note that the neuron's data as well as its 3D view will get real-time update when the dialog is running
+			neuronPickCache.clear();
 			if (res!=QDialog::Accepted) //restore the old tree
 			{
 				listNeuronTree.replace(ii, old_nt);
@@ -3385,32 +3399,18 @@ V3DLONG Renderer_gl1::findNearestNeuronNode_WinXY(int cx, int cy, NeuronTree * p
 	QList <NeuronSWC> *p_listneuron = &(ptree->listNeuron);
 	if (!p_listneuron) return -1;
 	//qDebug()<<"win click position:"<<cx<<" "<<cy;
-	GLdouble px, py, pz, ix, iy, iz;
-	V3DLONG best_ind=-1; best_dist=-1;
-	for (V3DLONG i=0;i<p_listneuron->size();i++)
-	{
-		ix = p_listneuron->at(i).x, iy = p_listneuron->at(i).y, iz = p_listneuron->at(i).z;
-		GLint res = gluProject(ix, iy, iz, markerViewMatrix, projectionMatrix, viewport, &px, &py, &pz);// note: should use the saved modelview,projection and viewport matrix
-		py = viewport[3]-py; //the Y axis is reversed
-		if (res==GL_FALSE) {qDebug()<<"gluProject() fails for NeuronTree ["<<i<<"] node"; return -1;}
-		//qDebug()<<i<<" "<<px<<" "<<py<<" "<<pz<<"\n";
-		double cur_dist = (px-cx)*(px-cx)+(py-cy)*(py-cy);
+
+	// the projected nodes are kept per tree and only recomputed when the tree or the saved camera matrices change
+	if (neuronPickCache.size()>32 && neuronPickCache.find(ptree)==neuronPickCache.end()) neuronPickCache.clear(); // trees come and go, e.g. temporary copies
+	ScreenPickCache & pick = neuronPickCache[ptree];
+	if (!pick.update(*ptree, markerViewMatrix, projectionMatrix, viewport)) {qDebug()<<"gluProject() fails for NeuronTree node"; return -1;} // note: should use the saved modelview,projection and viewport matrix
+
+	V3DLONG best_ind = pick.nearest(cx, cy, best_dist);
 
 #ifdef _NEURON_ASSEMBLER_
-		if (cur_dist < this->radius * this->radius) this->indices.insert(i);
+	pick.within(cx, cy, this->radius, this->indices);
 #endif
 
-		if (i==0) {	best_dist = cur_dist; best_ind=0; }
-		else 
-		{	
-			if (cur_dist<best_dist) 
-			{
-				best_dist=cur_dist; 
-				best_ind = i;
-			}
-		}
-	}
-
 	// Sensitivity test for mouse click and projected coordinates -- MK, May, 2020
 	/*GLint res = gluProject(p_listneuron->at(best_ind).x, p_listneuron->at(best_ind).y, p_listneuron->at(best_ind).z, currMviewMatrix, currPmatrix, currViewport, &px, &py, &pz);
 	cout << " --- mouse click coords from rendere_hit: " << cx << " " << cy << endl;
@@ -3512,7 +3512,7 @@ double Renderer_gl1::computeSurfaceArea(int dc, int st, int index) //index is 1-
 	if (dc==dcSurface && st==stLabelSurface)
 	{
 		//LabelSurf &S = listLabelSurf[index-1];
-		Triangle* pT = list_listTriangle[index-1];
+		Triangle* pT = labelTriangles(index-1);
 		double sum = 0;
 		for (Triangle* p = pT; p!=NULL; p = p->next)
 		{
@@ -339,6 +339,10 @@ void Renderer_gl1::constructLabelfieldSurf(int mesh_method, int mesh_density)
 		qDebug("-------------------------------------------------------");
         unsigned V3DLONG count = 0;
 		{
+			QSet<int> labelSet; // listLabelSurf.contains() per voxel is too slow for atlases with many labels
+			for (i=0; i<listLabelSurf.size(); i++)
+				labelSet.insert(listLabelSurf.at(i).label);
+
             for (V3DLONG z=0; z<lf_sz2; z++)
 			{
 				PROGRESS_TEXT( QObject::tr("Counting label: %1 labels").arg(count).toStdString());
@@ -358,8 +362,9 @@ void Renderer_gl1::constructLabelfieldSurf(int mesh_method, int mesh_density)
 					S.on = true; //090406
 					//S.color;
 
-					if (label>0  &&  ! listLabelSurf.contains(S))
+					if (label>0  &&  ! labelSet.contains(label))
 					{
+						labelSet.insert(label);
 //						//always generate a sorted list. by PHC, 090222  // 090427 RZC: replaced by qSort
 //						bool b_insert=false;
 //						for (int tmpi=0;tmpi<listLabelSurf.size();tmpi++)
@@ -409,35 +414,75 @@ void Renderer_gl1::constructLabelfieldSurf(int mesh_method, int mesh_density)
 
     V3DLONG f_num = 0;
     V3DLONG num_surf = listLabelSurf.size();
-    for (i=0; i<num_surf; i++)
+	int lf_datatype = (lf_mask==0xff)? 1 : (lf_mask==0xffff)? 2 : (lf_mask==0xffffffff)? 4 : 0;
+	if (mesh_method==0 && lf_datatype>0) // all groups in one parallel pass with shared vertices, then the same triangle lists
+	{
+		PROGRESS_TEXT( QObject::tr("Creating geometric data of %1 groups/labels").arg(num_surf).toStdString() );
+		PROGRESS_PERCENT(10);
+
+		std::vector<LabelRange> ranges(num_surf);
+		for (i=0; i<num_surf; i++)
+		{
+			ranges[i].lo = listLabelSurf.at(i).label;
+			ranges[i].hi = listLabelSurf.at(i).label2;
+		}
+		std::vector<IndexedMesh> meshes;
+		MarchingCubesLabels(lf_data_ch, lf_datatype, lf_sz0, lf_sz1, lf_sz2, ranges, mesh_density, 255/2.f, meshes);
+
+		while (list_labelMesh.size() < list_listTriangle.size()) list_labelMesh.append(0); // labels loaded from file
+		for (i=0; i<num_surf; i++)
+		{
+			IndexedMesh* pM = new IndexedMesh;
+			pM->vertex.swap(meshes[i].vertex);
+			pM->normal.swap(meshes[i].normal);
+			pM->index.swap(meshes[i].index);
+			for (size_t k=0; k<pM->vertex.size(); k+=3) // restore scale
+			{
+				pM->vertex[k]   *= lf_sz0;
+				pM->vertex[k+1] *= lf_sz1;
+				pM->vertex[k+2] *= lf_sz2;
+			}
+			V3DLONG t_num = pM->numTriangles();
+			qDebug("		#%d label(%d-%d) triangle num = %d, vertex num = %d", i, listLabelSurf.at(i).label, listLabelSurf.at(i).label2,
+				   t_num, pM->numVertices());
+
+			list_listTriangle.append(0); // made by labelTriangles() only for picking
+			list_labelMesh.append(pM);
+			f_num += t_num;
+		}
+	}
+	else
 	{
-        V3DLONG t_num = 0;
-		PROGRESS_TEXT( QObject::tr("Creating geometric group/label %1 of %2").arg(i+1).arg(num_surf).toStdString() );
-		PROGRESS_PERCENT((i+1)*90/num_surf);
+		for (i=0; i<num_surf; i++)
 		{
+			V3DLONG t_num = 0;
+			PROGRESS_TEXT( QObject::tr("Creating geometric group/label %1 of %2").arg(i+1).arg(num_surf).toStdString() );
+			PROGRESS_PERCENT((i+1)*90/num_surf);
+			{
 
-			MESSAGE_ASSERT(i>=0 && i<listLabelSurf.size());
-			// _labelSampleFunc parameters
-			mesh_iso0 = listLabelSurf.at(i).label;
-			mesh_iso1 = listLabelSurf.at(i).label2;
+				MESSAGE_ASSERT(i>=0 && i<listLabelSurf.size());
+				// _labelSampleFunc parameters
+				mesh_iso0 = listLabelSurf.at(i).label;
+				mesh_iso1 = listLabelSurf.at(i).label2;
 
-			Triangle* pT = MarchingCubes(mesh_density, 255/2.f, _labelSampleFunc, mesh_method); //method 0 is better for label data
+				Triangle* pT = MarchingCubes(mesh_density, 255/2.f, _labelSampleFunc, mesh_method); //method 0 is better for label data
 
-			// restore scale
-			for (Triangle* p = pT; p!=NULL; p = p->next)
-				for (int iCorner = 0; iCorner < 3; iCorner++)
-				{
-					p->vertex[iCorner][0] *= lf_sz0;
-					p->vertex[iCorner][1] *= lf_sz1;
-					p->vertex[iCorner][2] *= lf_sz2;
-				}
+				// restore scale
+				for (Triangle* p = pT; p!=NULL; p = p->next)
+					for (int iCorner = 0; iCorner < 3; iCorner++)
+					{
+						p->vertex[iCorner][0] *= lf_sz0;
+						p->vertex[iCorner][1] *= lf_sz1;
+						p->vertex[iCorner][2] *= lf_sz2;
+					}
 
-			t_num = numTriangles(pT);
-			qDebug("		#%d label(%d-%d) triangle num = %d", i, mesh_iso0, mesh_iso1, t_num);
+				t_num = numTriangles(pT);
+				qDebug("		#%d label(%d-%d) triangle num = %d", i, mesh_iso0, mesh_iso1, t_num);
 
-			list_listTriangle.append(pT);
+				list_listTriangle.append(pT);
+			}
+			f_num += t_num;
 		}
-		f_num += t_num;
 	}
 
     num_surf += num_surf0;
@@ -472,6 +517,8 @@ void Renderer_gl1::compileLabelfieldSurf(int update)
 	makeCurrent(); //ensure right context when multiple views animation or mouse drop, 081118
 
 	int num_surf = list_listTriangle.size();
+	while (list_labelMesh.size() < num_surf) list_labelMesh.append(0); // labels loaded from file
+
 	if (update==0) // initial color & on
 	{
 
@@ -486,6 +533,13 @@ void Renderer_gl1::compileLabelfieldSurf(int update)
 		labelBB = NULL_BoundingBox;
 		for (int i=0; i<num_surf; i++)
 		{
+			if (list_labelMesh[i])
+			{
+				const std::vector<float>& v = list_labelMesh[i]->vertex;
+				for (size_t k=0; k<v.size(); k+=3)
+					labelBB.expand(XYZ(v[k],v[k+1],v[k+2]));
+				continue;
+			}
 			struct Triangle* p;
 			struct Triangle* pnext;
 			for (p = list_listTriangle[i]; p != NULL; p = pnext)
@@ -504,23 +558,84 @@ void Renderer_gl1::compileLabelfieldSurf(int update)
 		glDeleteLists(list_glistLabel[i], 1);
 	list_glistLabel.clear();
 
+	if (list_labelMeshBuffer.size())
+		glDeleteBuffersARB(list_labelMeshBuffer.size(), &list_labelMeshBuffer[0]);
+	list_labelMeshBuffer.clear();
+
 	if (compiledLabelSurf)
 		for (int i=0; i<listLabelSurf.size(); i++)
 	{
-		GLuint g = glGenLists(1);
-		list_glistLabel.append(g);
+		GLuint buf[2] = {0, 0};
+		const IndexedMesh* pM = list_labelMesh[i];
+		if (pM && pM->numTriangles() && GLEE_ARB_vertex_buffer_object) // indexed mesh: upload vertices once, draw by glDrawElements
+		{
+			GLsizeiptrARB vsize = pM->vertex.size()*sizeof(float);
+			glGenBuffersARB(2, buf);
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB, buf[0]);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, 2*vsize, NULL, GL_STATIC_DRAW_ARB);
+			glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, vsize, &pM->vertex[0]);
+			glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, vsize, vsize, &pM->normal[0]);
+			glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, buf[1]);
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, pM->index.size()*sizeof(int), &pM->index[0], GL_STATIC_DRAW_ARB);
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+			glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+		}
+		list_labelMeshBuffer.append(buf[0]);
+		list_labelMeshBuffer.append(buf[1]);
 
-		glNewList(g, GL_COMPILE);
+		GLuint g = 0;
+		if (! pM) // a display list copies every corner of every triangle
 		{
-			// set color move to drawing, 081114
+			g = glGenLists(1);
+			glNewList(g, GL_COMPILE);
+			{
+				// set color move to drawing, 081114
 
-			RENDER_TRIANGLES(list_listTriangle[i]);
+				RENDER_TRIANGLES(list_listTriangle[i]);
+			}
+			glEndList();
 		}
-		glEndList();
+		list_glistLabel.append(g);
 	}
 
 }
 
+void Renderer_gl1::drawLabelMesh(int i)
+{
+	const IndexedMesh& M = *list_labelMesh[i];
+	if (M.numTriangles()==0) return;
+	GLuint vbuf = (2*i+1 < list_labelMeshBuffer.size())? list_labelMeshBuffer[2*i] : 0;
+	GLuint ibuf = (2*i+1 < list_labelMeshBuffer.size())? list_labelMeshBuffer[2*i+1] : 0;
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	if (vbuf && ibuf)
+	{
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbuf);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, ibuf);
+		glVertexPointer(3, GL_FLOAT, 0, 0);
+		glNormalPointer(GL_FLOAT, 0, (const GLvoid*)(M.vertex.size()*sizeof(float)));
+		glDrawElements(GL_TRIANGLES, M.index.size(), GL_UNSIGNED_INT, 0);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+	}
+	else // client arrays
+	{
+		glVertexPointer(3, GL_FLOAT, 0, &M.vertex[0]);
+		glNormalPointer(GL_FLOAT, 0, &M.normal[0]);
+		glDrawElements(GL_TRIANGLES, M.index.size(), GL_UNSIGNED_INT, &M.index[0]);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+}
+
+Triangle* Renderer_gl1::labelTriangles(int i)
+{
+	if (list_listTriangle[i]==NULL && i<list_labelMesh.size() && list_labelMesh[i])
+		list_listTriangle[i] = trianglesFromIndexedMesh(*list_labelMesh[i]); // already scaled
+	return list_listTriangle[i];
+}
+
 void Renderer_gl1::cleanLabelfieldSurf()
 {
     for (V3DLONG i=0; i<list_listTriangle.size(); i++)
@@ -535,6 +650,16 @@ void Renderer_gl1::cleanLabelfieldSurf()
 	}
 	list_glistLabel.clear();
 
+	for (V3DLONG i=0; i<list_labelMesh.size(); i++)
+	{
+		delete list_labelMesh[i];
+	}
+	list_labelMesh.clear();
+
+	if (list_labelMeshBuffer.size())
+		glDeleteBuffersARB(list_labelMeshBuffer.size(), &list_labelMeshBuffer[0]);
+	list_labelMeshBuffer.clear();
+
 	listLabelSurf.clear();
 }
 
@@ -558,7 +683,9 @@ void Renderer_gl1::drawLabelfieldSurf()
 			glColor4ubv(S.color.c);
 
 			glPushName(1+i);
-			if (compiledLabelSurf)
+			if (i<list_labelMesh.size() && list_labelMesh[i])
+				drawLabelMesh(i);
+			else if (compiledLabelSurf)
 				glCallList(list_glistLabel[i]);
 			else
 				RENDER_TRIANGLES(list_listTriangle[i]);
@@ -611,6 +738,8 @@ void Renderer_gl1::saveWavefrontOBJ(const QString& filename)
 		qf.write(buf, strlen(buf));
 
 		Triangle* pT = list_listTriangle[i];
+		bool b_tmp = (pT==NULL && i<list_labelMesh.size() && list_labelMesh[i]); // not kept after saving
+		if (b_tmp) pT = trianglesFromIndexedMesh(*list_labelMesh[i]);
 		for (Triangle* p = pT; p != NULL; p = p->next)
 		{
 			for (int iCorner = 0; iCorner < 3; iCorner++)
@@ -635,6 +764,7 @@ void Renderer_gl1::saveWavefrontOBJ(const QString& filename)
 			f_num ++;
 		}
 		qDebug("		#%d label(%d-%d) triangle num = %d", i, g_label0, g_label1, numTriangles(pT));
+		if (b_tmp) delTriangles(pT);
 	}
 	qDebug("---------------------write %d objects, %d triangles, %d vertices", list_listTriangle.size(), f_num, v_num);
 }
@@ -962,6 +1092,8 @@ void Renderer_gl1::saveV3DSurface(const QString& filename)
 		//now write the triangle data
 
 		Triangle* pT = list_listTriangle[i];
+		bool b_tmp = (pT==NULL && i<list_labelMesh.size() && list_labelMesh[i]); // not kept after saving
+		if (b_tmp) pT = trianglesFromIndexedMesh(*list_labelMesh[i]);
 		int t_num = numTriangles(pT);
 		QF_WRITE( t_num );
 
@@ -984,6 +1116,7 @@ void Renderer_gl1::saveV3DSurface(const QString& filename)
 		}
 		//qDebug("		#%d label(%d-%d) triangle num = %d", i, g_label0, g_label1, t_num);
 		f_num += t_num;
+		if (b_tmp) delTriangles(pT);
 	}
 	qDebug("---------------------write %d objects, %d faces, %d vertices", list_listTriangle.size(), f_num, v_num);
 }
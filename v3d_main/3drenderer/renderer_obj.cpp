@@ -828,6 +828,7 @@ void Renderer_gl1::cleanObj()
 		listNeuronTree[i].hashNeuron.clear();
 	}
 	listNeuronTree.clear();
+	neuronPickCache.clear();
 	glistTube=glistTubeEnd = 0;
 	// label field
 	cleanLabelfieldSurf();
@@ -1669,6 +1670,8 @@ void Renderer_gl1::updateNeuronBoundingBoxWithXYZCut(float xMin, float xMax, flo
 
 void Renderer_gl1::updateNeuronBoundingBox()
 {
+    neuronPickCache.clear(); // called after the neuron trees are loaded or edited
+
     if (cuttingZ){updateNeuronBoundingBoxWithZCut(zMin, zMax); return;}
     if (cuttingXYZ){updateNeuronBoundingBoxWithXYZCut(xMin, xMax, yMin, yMax, zMin, zMax); return;}
 
@@ -1727,10 +1730,13 @@ void Renderer_gl1::addCurveSWC(vector<XYZ> &loc_list, int chno, double creatmode
         {
             if(selectMode == smCurveTiltedBB_fm_sbbox) //LMG 26/10/2018 Creation mode 1 for BBox
                 creatmode = 1;
+            bool added;
             if(selectMode == smCurveCreate_MarkerCreate1_fm)
-                curImg->proj_trace_add_curve_segment(loc_list, chno,currentTraceType,default_radius_gd,creatmode);
+                added = curImg->proj_trace_add_curve_segment(loc_list, chno,currentTraceType,default_radius_gd,creatmode);
             else
-                curImg->proj_trace_add_curve_segment(loc_list, chno,currentTraceType, 1,creatmode);
+                added = curImg->proj_trace_add_curve_segment(loc_list, chno,currentTraceType, 1,creatmode);
+            if (added)
+                w->collaborationUpdateSegment(curImg->tracedNeuron.seg.back());
             curImg->update_3drenderer_neuron_view(w, this);
         }
     }
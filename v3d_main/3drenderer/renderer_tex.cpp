@@ -466,9 +466,16 @@ void Renderer_gl1::paint()
 
 	glPushMatrix();
 	setMarkerSpace(); // space to define marker & curve
+	GLint lastViewport[4];  GLdouble lastProjection[16], lastMarkerView[16];
+	memcpy(lastViewport, viewport, sizeof(lastViewport));
+	memcpy(lastProjection, projectionMatrix, sizeof(lastProjection));
+	memcpy(lastMarkerView, markerViewMatrix, sizeof(lastMarkerView));
 	glGetIntegerv(GL_VIEWPORT,         viewport);            // used for selectObj(smMarkerCreate)
 	glGetDoublev(GL_PROJECTION_MATRIX, projectionMatrix);    // used for selectObj(smMarkerCreate)
 	glGetDoublev(GL_MODELVIEW_MATRIX,  markerViewMatrix);    // used for selectObj(smMarkerCreate)
+	if (memcmp(lastViewport, viewport, sizeof(lastViewport)) || memcmp(lastProjection, projectionMatrix, sizeof(lastProjection))
+		|| memcmp(lastMarkerView, markerViewMatrix, sizeof(lastMarkerView)))
+		neuronPickCache.clear(); // the camera moved, the window positions of the nodes are stale
 	glPopMatrix();
 
 	bShowCSline = bShowAxes;
@@ -2517,7 +2524,7 @@ int Renderer_gl1::hitMenu(int x, int y, bool b_glwidget)
                     LIST_SELECTED(listLabelSurf, hitNames[2]-1, true);
 
                     int vertex_i=0;
-                    Triangle * T = findNearestSurfTriangle_WinXY(x, y, vertex_i, (Triangle*)list_listTriangle.at(hitNames[2]-1));
+                    Triangle * T = findNearestSurfTriangle_WinXY(x, y, vertex_i, labelTriangles(hitNames[2]-1));
                     qsInfo = info_SurfVertex(vertex_i, T, listLabelSurf.at(hitNames[2]-1).label);
             }break;
 
@@ -0,0 +1,204 @@
+/*
+ * screen_pick_cache.h
+ *
+ * Window-space projection of the nodes of a NeuronTree, kept across mouse picks. The nodes are projected
+ * once and binned into a uniform 2D grid, so finding the node nearest to a click, or the nodes within a
+ * radius of it, only visits the cells around the click instead of calling gluProject() for every node of
+ * the reconstruction on every pick. The owner calls invalidate() when the tree is edited or the camera
+ * (modelview, projection, viewport) changes; until then update() reuses the projection as it is.
+ *
+ * projectPoint() does the same arithmetic as gluProject() (including the Y flip of the window) without a
+ * GL context, so the results - nearest index and squared distance, ties going to the lowest index - are
+ * those of the brute-force loop it replaces.
+ */
+
+#ifndef __SCREEN_PICK_CACHE_H__
+#define __SCREEN_PICK_CACHE_H__
+
+#include "../basic_c_fun/basic_surf_objs.h"
+
+#include <math.h>
+#include <string.h>
+#include <set>
+#include <vector>
+
+class ScreenPickCache
+{
+public:
+	ScreenPickCache() : nNodes(-1), failed(false), gx0(0), gy0(0), gx1(0), gy1(0), cellSize(1), nx(0), ny(0) {}
+
+	// window coordinates of (x,y,z) as gluProject() computes them, with py measured from the top of the viewport;
+	// returns false where gluProject() returns GL_FALSE
+	static bool projectPoint(double x, double y, double z, const double mv[16], const double proj[16], const int vp[4],
+	                         double & px, double & py, double & pz)
+	{
+		double in[4] = {x, y, z, 1.0}, out[4];
+		for (int i=0; i<4; i++) out[i] = in[0]*mv[0*4+i] + in[1]*mv[1*4+i] + in[2]*mv[2*4+i] + in[3]*mv[3*4+i];
+		for (int i=0; i<4; i++) in[i] = out[0]*proj[0*4+i] + out[1]*proj[1*4+i] + out[2]*proj[2*4+i] + out[3]*proj[3*4+i];
+		if (in[3]==0.0) return false;
+		in[0] /= in[3];  in[1] /= in[3];  in[2] /= in[3];
+		in[0] = in[0]*0.5+0.5;  in[1] = in[1]*0.5+0.5;  in[2] = in[2]*0.5+0.5;
+		px = in[0]*vp[2]+vp[0];
+		py = in[1]*vp[3]+vp[1];
+		pz = in[2];
+		py = vp[3]-py; //the Y axis is reversed
+		return true;
+	}
+
+	// project the nodes if invalidate() was called (or the node count changed) since the last projection;
+	// false if a node cannot be projected
+	bool update(const NeuronTree & tree, const double mv[16], const double proj[16], const int vp[4])
+	{
+		const QList<NeuronSWC> & nodes = tree.listNeuron;
+		if (nNodes==nodes.size()) return !failed;
+
+		nNodes = nodes.size();
+		memcpy(viewport, vp, sizeof(viewport));
+		failed = false;
+		wx.resize(nNodes);  wy.resize(nNodes);
+		double pz;
+		for (int i=0; i<nNodes; i++)
+		{
+			const NeuronSWC & p = nodes.at(i);
+			if (!projectPoint(p.x, p.y, p.z, mv, proj, vp, wx[i], wy[i], pz)) {failed = true; break;}
+		}
+		if (failed) {wx.clear(); wy.clear(); cellStart.clear(); cellNodes.clear(); outside.clear(); nx = ny = 0;}
+		else buildGrid();
+		return !failed;
+	}
+
+	void invalidate() {nNodes = -1;}
+
+	// index of the node nearest to (cx,cy) and its squared window distance, or -1 (best_dist -1) if there are no nodes
+	V3DLONG nearest(double cx, double cy, double & best_dist) const
+	{
+		V3DLONG best_ind = -1;  best_dist = -1;
+		if (nNodes<=0 || failed) return -1;
+
+		if (nx>0)
+		{
+			int ix = clampCell(int(floor((cx-gx0)/cellSize)), nx), iy = clampCell(int(floor((cy-gy0)/cellSize)), ny);
+			int rmax = qMax(qMax(ix, nx-1-ix), qMax(iy, ny-1-iy));
+			for (int r=0; r<=rmax; r++)
+			{
+				for (int j=iy-r; j<=iy+r; j++)
+				{
+					if (j<0 || j>=ny) continue;
+					bool edgeRow = (j==iy-r || j==iy+r);
+					for (int i=ix-r; i<=ix+r; i+=(edgeRow ? 1 : 2*r))
+					{
+						if (i>=0 && i<nx) scanCell(j*nx+i, cx, cy, best_ind, best_dist);
+						if (r==0) break;
+					}
+				}
+				// every node not yet visited is farther than the border of the visited block
+				double lb = qMin(qMin(cx-(gx0+(ix-r)*cellSize), gx0+(ix+r+1)*cellSize-cx),
+				                 qMin(cy-(gy0+(iy-r)*cellSize), gy0+(iy+r+1)*cellSize-cy));
+				if (best_ind>=0 && lb>0 && best_dist<lb*lb) break;
+			}
+		}
+		if (!outside.empty())
+		{
+			double lb = distToGrid(cx, cy);
+			if (best_ind<0 || lb<=0 || best_dist>=lb*lb)
+				for (size_t k=0; k<outside.size(); k++) consider(outside[k], cx, cy, best_ind, best_dist);
+		}
+		return best_ind;
+	}
+
+	// add to result the indices of the nodes closer than radius to (cx,cy)
+	void within(double cx, double cy, double radius, std::set<int> & result) const
+	{
+		if (nNodes<=0 || failed) return;
+		double r2 = radius*radius;
+		if (nx>0)
+		{
+			int i0 = clampCell(int(floor((cx-radius-gx0)/cellSize)), nx), i1 = clampCell(int(floor((cx+radius-gx0)/cellSize)), nx);
+			int j0 = clampCell(int(floor((cy-radius-gy0)/cellSize)), ny), j1 = clampCell(int(floor((cy+radius-gy0)/cellSize)), ny);
+			for (int j=j0; j<=j1; j++)
+				for (int i=i0; i<=i1; i++)
+					for (int k=cellStart[j*nx+i]; k<cellStart[j*nx+i+1]; k++)
+					{
+						int n = cellNodes[k];
+						if (dist2(n, cx, cy) < r2) result.insert(n);
+					}
+		}
+		for (size_t k=0; k<outside.size(); k++)
+			if (dist2(outside[k], cx, cy) < r2) result.insert(outside[k]);
+	}
+
+	int size() const {return nNodes<0 ? 0 : nNodes;}
+
+private:
+	int nNodes;                      // -1 until projected and after invalidate()
+	bool failed;
+	int viewport[4];
+
+	std::vector<double> wx, wy;      // window coordinates of the nodes
+	double gx0, gy0, gx1, gy1;       // bounding box of the nodes in the grid, in window pixels
+	double cellSize;
+	int nx, ny;
+	std::vector<int> cellStart;      // nodes of cell c are cellNodes[cellStart[c] .. cellStart[c+1])
+	std::vector<int> cellNodes;      // ascending node index within a cell
+	std::vector<int> outside;        // nodes far outside the viewport or not finite, scanned only when needed
+
+	static int clampCell(int v, int n) {return v<0 ? 0 : (v>=n ? n-1 : v);}
+
+	double dist2(int n, double cx, double cy) const {return (wx[n]-cx)*(wx[n]-cx)+(wy[n]-cy)*(wy[n]-cy);}
+
+	void consider(int n, double cx, double cy, V3DLONG & best_ind, double & best_dist) const
+	{
+		double d = dist2(n, cx, cy);
+		if (best_ind<0 || d<best_dist || (d==best_dist && n<best_ind)) {best_dist = d; best_ind = n;}
+	}
+	void scanCell(int c, double cx, double cy, V3DLONG & best_ind, double & best_dist) const
+	{
+		for (int k=cellStart[c]; k<cellStart[c+1]; k++) consider(cellNodes[k], cx, cy, best_ind, best_dist);
+	}
+	double distToGrid(double cx, double cy) const // distance from a point inside the grid box to its border, <=0 outside
+	{
+		if (nx<=0) return 0;
+		return qMin(qMin(cx-gx0, gx1-cx), qMin(cy-gy0, gy1-cy));
+	}
+
+	void buildGrid()
+	{
+		cellStart.clear();  cellNodes.clear();  outside.clear();  nx = ny = 0;
+
+		// the grid covers the projected nodes, but not further than one viewport around the viewport
+		double vx0 = viewport[0]-viewport[2], vx1 = viewport[0]+2.0*viewport[2];
+		double vy0 = -viewport[3], vy1 = 2.0*viewport[3];
+		double x0 = vx1, x1 = vx0, y0 = vy1, y1 = vy0;
+		int nIn = 0;
+		for (int i=0; i<nNodes; i++)
+			if (wx[i]>=vx0 && wx[i]<=vx1 && wy[i]>=vy0 && wy[i]<=vy1)
+			{
+				x0 = qMin(x0, wx[i]);  x1 = qMax(x1, wx[i]);  y0 = qMin(y0, wy[i]);  y1 = qMax(y1, wy[i]);
+				nIn++;
+			}
+		if (nIn==0) {for (int i=0; i<nNodes; i++) outside.push_back(i); return;}
+
+		// about two nodes per cell, and no more than 1024 cells along an axis
+		double w = qMax(x1-x0, 1.0), h = qMax(y1-y0, 1.0);
+		cellSize = qMax(sqrt(2.0*w*h/nIn), qMax(w, h)/1024);
+		gx0 = x0;  gy0 = y0;  gx1 = x1;  gy1 = y1;
+		nx = int(w/cellSize)+1;  ny = int(h/cellSize)+1;
+
+		std::vector<int> cellOf(nNodes, -1);
+		cellStart.assign(size_t(nx)*ny+1, 0);
+		for (int i=0; i<nNodes; i++)
+		{
+			if (!(wx[i]>=x0 && wx[i]<=x1 && wy[i]>=y0 && wy[i]<=y1)) {outside.push_back(i); continue;}
+			int c = clampCell(int((wy[i]-gy0)/cellSize), ny)*nx + clampCell(int((wx[i]-gx0)/cellSize), nx);
+			cellOf[i] = c;
+			cellStart[c+1]++;
+		}
+		for (size_t c=1; c<cellStart.size(); c++) cellStart[c] += cellStart[c-1];
+		cellNodes.resize(cellStart.back());
+		std::vector<int> fill(cellStart.begin(), cellStart.end()-1);
+		for (int i=0; i<nNodes; i++)
+			if (cellOf[i]>=0) cellNodes[fill[cellOf[i]]++] = i;
+	}
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * segment_grid_index.h
+ *
+ * Sparse voxel grid over the segments of a traced neuron: for every cell of gridLength^3 it lists the
+ * segments having a node in that cell. Used by the stroke editing tools (subtree highlighting, loop
+ * detection) to find the segments around a segment end without walking the whole reconstruction.
+ *
+ * Cells are addressed by a 64-bit Morton key (21 bits per axis) in an open-addressing hash table, each
+ * cell keeps a small sorted vector of segment IDs. Edits keep the grid current with addSegment() and
+ * removeSegment(); after an edit that renumbers the segments call clear(), and sync() rebuilds it.
+ */
+
+#ifndef __SEGMENT_GRID_INDEX_H__
+#define __SEGMENT_GRID_INDEX_H__
+
+#include "../neuron_editing/v_neuronswc.h"
+
+#include <algorithm>
+#include <vector>
+
+class SegmentGridIndex
+{
+public:
+	typedef std::vector<unsigned int> SegList;
+
+	SegmentGridIndex(double gridLengthParam=50) : gridLength(gridLengthParam), nUsed(0), built(false) {}
+
+	double getGridLength() const {return gridLength;}
+	void setGridLength(double len) {if (len!=gridLength) {clear(); gridLength=len;}}
+
+	void clear()
+	{
+		keys.clear(); slots.clear(); cells.clear(); freeCells.clear(); nUsed = 0;
+		segCells.clear(); built = false;
+	}
+	bool isBuilt() const {return built;}
+
+	// cell index along one axis, the same truncation as int(x/gridLength)
+	int cellCoord(double v) const {return int(v/gridLength);}
+
+	static quint64 mortonKey(int ix, int iy, int iz)
+	{
+		return spread(ix) | (spread(iy)<<1) | (spread(iz)<<2);
+	}
+	quint64 keyOf(double x, double y, double z) const {return mortonKey(cellCoord(x), cellCoord(y), cellCoord(z));}
+
+	// the segments with a node in the cell of (x,y,z), ascending, or 0 if there is none
+	const SegList * segsAt(double x, double y, double z) const
+	{
+		int c = findCell(keyOf(x, y, z));
+		return (c<0 || cells[c].empty()) ? 0 : &cells[c];
+	}
+
+	void addSegment(size_t segID, const V_NeuronSWC & seg)
+	{
+		if (segID>=segCells.size()) segCells.resize(segID+1);
+		removeSegment(segID);
+		std::vector<quint64> & mine = segCells[segID];
+		for (V3DLONG i=0; i<(V3DLONG)seg.row.size(); i++)
+		{
+			quint64 key = keyOf(seg.row[i].x, seg.row[i].y, seg.row[i].z);
+			if (!mine.empty() && mine.back()==key) continue; // consecutive nodes are mostly in the same cell
+			SegList & list = cells[insertCell(key)];
+			SegList::iterator it = std::lower_bound(list.begin(), list.end(), (unsigned int)segID);
+			if (it!=list.end() && *it==segID) continue;
+			list.insert(it, (unsigned int)segID);
+			mine.push_back(key);
+		}
+	}
+
+	void removeSegment(size_t segID)
+	{
+		if (segID>=segCells.size()) return;
+		std::vector<quint64> & mine = segCells[segID];
+		for (size_t i=0; i<mine.size(); i++)
+		{
+			int c = findCell(mine[i]);
+			if (c<0) continue;
+			SegList & list = cells[c];
+			SegList::iterator it = std::lower_bound(list.begin(), list.end(), (unsigned int)segID);
+			if (it!=list.end() && *it==segID) list.erase(it);
+		}
+		std::vector<quint64>().swap(mine);
+	}
+
+	// index all of segs if the grid was cleared, otherwise it is already kept current by the edits
+	void sync(const std::vector<V_NeuronSWC> & segs)
+	{
+		if (built) return;
+		for (size_t i=0; i<segs.size(); i++)
+			addSegment(i, segs[i]);
+		built = true;
+	}
+
+	void build(const std::vector<V_NeuronSWC> & segs) {clear(); sync(segs);}
+
+	size_t nCells() const {return nUsed;}
+
+private:
+	double gridLength;
+	std::vector<quint64> keys;     // hash table of cell keys, emptyKey for free slots
+	std::vector<int> slots;        // cell index of each used slot
+	std::vector<SegList> cells;
+	std::vector<int> freeCells;
+	size_t nUsed;
+	std::vector< std::vector<quint64> > segCells; // [segID] cells the segment is listed in
+	bool built;
+
+	static quint64 emptyKey() {return ~quint64(0);}
+
+	static quint64 spread(int v) // 21 bits, biased so negative cells keep distinct keys
+	{
+		quint64 x = quint64(v + (1<<20)) & 0x1fffff;
+		x = (x | (x<<32)) & 0x1f00000000ffffULL;
+		x = (x | (x<<16)) & 0x1f0000ff0000ffULL;
+		x = (x | (x<<8))  & 0x100f00f00f00f00fULL;
+		x = (x | (x<<4))  & 0x10c30c30c30c30c3ULL;
+		x = (x | (x<<2))  & 0x1249249249249249ULL;
+		return x;
+	}
+	static size_t hashOf(quint64 key, size_t mask)
+	{
+		key ^= key >> 33;  key *= 0xff51afd7ed558ccdULL;  key ^= key >> 33;
+		return size_t(key) & mask;
+	}
+	int findCell(quint64 key) const
+	{
+		if (keys.empty()) return -1;
+		size_t mask = keys.size()-1;
+		for (size_t i=hashOf(key, mask); ; i=(i+1)&mask)
+		{
+			if (keys[i]==key) return slots[i];
+			if (keys[i]==emptyKey()) return -1;
+		}
+	}
+	int insertCell(quint64 key)
+	{
+		if (2*(nUsed+1) > keys.size()) rehash(keys.empty() ? 1024 : keys.size()*2);
+		size_t mask = keys.size()-1;
+		size_t i = hashOf(key, mask);
+		for (; keys[i]!=emptyKey(); i=(i+1)&mask)
+			if (keys[i]==key) return slots[i];
+		int c;
+		if (!freeCells.empty()) {c = freeCells.back(); freeCells.pop_back();}
+		else {c = int(cells.size()); cells.push_back(SegList());}
+		keys[i] = key;
+		slots[i] = c;
+		nUsed++;
+		return c;
+	}
+	void rehash(size_t n) // also drops the cells that became empty
+	{
+		std::vector<quint64> oldkeys(n, emptyKey());  oldkeys.swap(keys);
+		std::vector<int> oldslots(n, -1);            oldslots.swap(slots);
+		nUsed = 0;
+		size_t mask = n-1;
+		for (size_t j=0; j<oldkeys.size(); j++)
+		{
+			if (oldkeys[j]==emptyKey()) continue;
+			int c = oldslots[j];
+			if (cells[c].empty()) {freeCells.push_back(c); continue;}
+			size_t i = hashOf(oldkeys[j], mask);
+			while (keys[i]!=emptyKey()) i = (i+1)&mask;
+			keys[i] = oldkeys[j];
+			slots[i] = c;
+			nUsed++;
+		}
+	}
+};
+
+#endif
@@ -1299,10 +1299,14 @@ void V3dR_GLWidget::handleKeyPressEvent(QKeyEvent * e)  //090428 RZC: make publi
 					if (thisRenderer->originalSegMap.empty()) return;
 
 					for (set<size_t>::iterator segIDit = thisRenderer->subtreeSegs.begin(); segIDit != thisRenderer->subtreeSegs.end(); ++segIDit)
+					{
 						curImg->tracedNeuron.seg[*segIDit].to_be_deleted = true;
+						thisRenderer->wholeGrid2segIDmap.removeSegment(*segIDit);
+					}
 
 					thisRenderer->escPressed_subtree();
 
+					thisRenderer->segGridKept = true;
 					curImg->update_3drenderer_neuron_view(this, thisRenderer);
 					curImg->proj_trace_history_append();
 				}
@@ -1591,6 +1595,7 @@ void V3dR_GLWidget::handleKeyPressEvent(QKeyEvent * e)  //090428 RZC: make publi
 						curImg->tracedNeuron.seg[*segIDit].row = thisRenderer->originalSegMap[*segIDit];
 					}
 
+					thisRenderer->segGridKept = true; // only the node types changed
 					curImg->update_3drenderer_neuron_view(this, thisRenderer);
 					curImg->proj_trace_history_append();
 				}
@@ -3955,6 +3960,7 @@ void V3dR_GLWidget::subtreeHighlightModeMonitor()
 					}
 				}
 
+				thisRenderer->segGridKept = true; // only the node types changed
 				curImg->update_3drenderer_neuron_view(this, thisRenderer);
 				curImg->proj_trace_history_append();
 			}
@@ -3979,6 +3985,7 @@ void V3dR_GLWidget::subtreeHighlightModeMonitor()
 					//}
 				}
 
+				thisRenderer->segGridKept = true; // only the node types changed
 				curImg->update_3drenderer_neuron_view(this, thisRenderer);
 				curImg->proj_trace_history_append();
 			}
@@ -4385,6 +4392,23 @@ void V3dR_GLWidget::cancelSelect()
 {
 	if (renderer) renderer->endSelectMode();
 }
+
+void V3dR_GLWidget::collaborationUpdateSegment(V_NeuronSWC & seg)
+{
+#ifdef __ALLOW_VR_FUNCS__
+	if (TeraflyCommunicator && TeraflyCommunicator->binaryProtocol())
+		TeraflyCommunicator->UpdateSendPoolNTList(seg);
+#endif
+}
+
+void V3dR_GLWidget::collaborationRemoveSegment(const V_NeuronSWC & seg)
+{
+#ifdef __ALLOW_VR_FUNCS__
+	if (TeraflyCommunicator && TeraflyCommunicator->binaryProtocol())
+		TeraflyCommunicator->RemoveSendPoolNTList(seg);
+#endif
+}
+
 #ifdef __ALLOW_VR_FUNCS_
 void V3dR_GLWidget::UpdateVRcollaInfo()
 {
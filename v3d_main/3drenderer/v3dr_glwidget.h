@@ -59,12 +59,14 @@ typedef QGLWidget QOpenGLWidget_proxy;
 #ifdef __ALLOW_VR_FUNCS__
 #include "../vrrenderer/VR_MainWindow.h"
 #include "../vrrenderer/V3dR_Communicator.h"
+#include <QPointer>
 #endif
 
 #include "ui_setVoxSize.h"
 
 class V3dr_colormapDialog;
 class V3dr_surfaceDialog;
+struct V_NeuronSWC;
 
 #ifdef __ALLOW_VR_FUNCS__
 	class VR_MainWindow;
@@ -125,7 +127,7 @@ public:
 	void UpdateVRcollaInfo();
 	bool VRClientON;
 	VR_MainWindow * myvrwin;
-	V3dR_Communicator * TeraflyCommunicator;
+	QPointer<V3dR_Communicator> TeraflyCommunicator; // null until a session is joined, and again once it is deleted with its connection
 	XYZ teraflyZoomInPOS;
 	XYZ CollaborationCreatorPos;
 	XYZ collaborationMaxResolution;
@@ -134,6 +136,10 @@ public:
 
 	static bool resumeCollaborationVR;
 #endif
+	// a segment of the traced neuron added, edited or deleted by the user, for the other annotators of a
+	// collaboration session with the binary messages; nothing otherwise
+	void collaborationUpdateSegment(V_NeuronSWC & seg);
+	void collaborationRemoveSegment(const V_NeuronSWC & seg);
 //protected:
 	virtual void choiceRenderer();
 	virtual void settingRenderer(); // for setting the default renderer state when initialize
@@ -83,6 +83,7 @@ void V3dr_surfaceDialog::undo()
 		// restore the old state
 		renderer->listLabelSurf  = listLabelSurf;
 		renderer->listNeuronTree = listNeuronTree;  //renderer->compileNeuronTreeList(); // for pre-compiled
+		renderer->neuronPickCache.clear();
 		renderer->listCell       = listCell;
 		renderer->listMarker     = listMarker;
 
@@ -38,6 +38,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 
 #include "stackutil.h"
 #include "basic_4dimage.h"
+#include "basic_parallel.h"
 
 //extern "C" {
 //#include "../common_lib/src_packages/mylib_tiff/image.h"
@@ -49,6 +50,25 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 
 typedef unsigned short int USHORTINT16;
 
+// runs the page-parallel TIF/LSM readers of stackutil on a thread pool; stackutil itself is plain C++
+struct StackutilRangeFunctor
+{
+	StackutilRangeBody body;
+	void * ctx;
+	void operator()(V3DLONG begin, V3DLONG end) {body(ctx, begin, end);}
+};
+
+static void stackutil_pool_runner(V3DLONG n, StackutilRangeBody body, void * ctx)
+{
+	StackutilRangeFunctor f = {body, ctx};
+	v3d_parallel_for(n, f);
+}
+
+static struct StackutilRunnerInstaller
+{
+	StackutilRunnerInstaller() {setStackutilRangeRunner(stackutil_pool_runner);}
+} stackutilRunnerInstaller;
+
 
 void Image4DSimple::loadImage(const char* filename)
 {
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c)2006-2010  Hanchuan Peng (Janelia Farm, Howard Hughes Medical Institute).
+ * All rights reserved.
+ */
+
+
+/************
+ ********* LICENSE NOTICE ************
+ 
+ This folder contains all source codes for the V3D project, which is subject to the following conditions if you want to use it.
+ 
+ You will ***have to agree*** the following terms, *before* downloading/using/running/editing/changing any portion of codes in this package.
+ 
+ 1. This package is free for non-profit research, but needs a special license for any commercial purpose. Please contact Hanchuan Peng for details.
+ 
+ 2. You agree to appropriately cite this work in your related studies and publications.
+ 
+ Peng, H., Ruan, Z., Long, F., Simpson, J.H., and Myers, E.W. (2010) “V3D enables real-time 3D visualization and quantitative analysis of large-scale biological image data sets,” Nature Biotechnology, Vol. 28, No. 4, pp. 348-353, DOI: 10.1038/nbt.1612. ( http://penglab.janelia.org/papersall/docpdf/2010_NBT_V3D.pdf )
+ 
+ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstruction of 3D neuron structures using a graph-augmented deformable model,” Bioinformatics, Vol. 26, pp. i38-i46, 2010. ( http://penglab.janelia.org/papersall/docpdf/2010_Bioinfo_GD_ISMB2010.pdf )
+ 
+ 3. This software is provided by the copyright holders (Hanchuan Peng), Howard Hughes Medical Institute, Janelia Farm Research Campus, and contributors "as is" and any express or implied warranties, including, but not limited to, any implied warranties of merchantability, non-infringement, or fitness for a particular purpose are disclaimed. In no event shall the copyright owner, Howard Hughes Medical Institute, Janelia Farm Research Campus, or contributors be liable for any direct, indirect, incidental, special, exemplary, or consequential damages (including, but not limited to, procurement of substitute goods or services; loss of use, data, or profits; reasonable royalties; or business interruption) however caused and on any theory of liability, whether in contract, strict liability, or tort (including negligence or otherwise) arising in any way out of the use of this software, even if advised of the possibility of such damage.
+ 
+ 4. Neither the name of the Howard Hughes Medical Institute, Janelia Farm Research Campus, nor Hanchuan Peng, may be used to endorse or promote products derived from this software without specific prior written permission.
+ 
+ *************/
+
+
+/*
+ * basic_intensity_stats.h
+ *
+ * Per-channel intensity statistics computed in one parallel pass over the voxels: min, max and a histogram,
+ * plus the saturation percentiles and the lookup-table mapping used by the contrast operations of My4DImage.
+ * 8/16-bit data are histogrammed over their whole range (one bin per value); float data over [lower, upper],
+ * mapped onto the bins the same way as a linear rescaling of [lower, upper] to [0, nbins-1] followed by truncation.
+ */
+
+#ifndef __BASIC_INTENSITY_STATS_H__
+#define __BASIC_INTENSITY_STATS_H__
+
+#include "basic_parallel.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <map>
+#include <vector>
+
+struct V3dIntensityStats
+{
+	double vmin, vmax;
+	std::vector<V3DLONG> hist;  //empty if not computed
+	double histLower, histUpper; //float data: the range mapped onto the bins
+	V3dIntensityStats() : vmin(0), vmax(0), histLower(0), histUpper(0) {}
+};
+
+//the linear mapping of My4DImage::scaleintensity(): clamp to [lower, upper], then to [target_min, target_max]
+class V3dLinearScale
+{
+public:
+	V3dLinearScale(double lower, double upper, double target_min, double target_max)
+	{
+		double t;
+		if (lower>upper) {t=lower; lower=upper; upper=t;}
+		if (target_min>target_max) {t=target_min; target_min=target_max; target_max=t;}
+		lo = lower; hi = upper; tmin = target_min;
+		rate = (upper==lower) ? 1 : (target_max-target_min)/(upper-lower);
+	}
+	double operator()(double t) const
+	{
+		if (t>hi) t=hi;
+		else if (t<lo) t=lo;
+		return (t - lo)*rate + tmin;
+	}
+private:
+	double lo, hi, rate, tmin;
+};
+
+template <class T> inline V3DLONG v3d_intensity_bin(T v, const V3dLinearScale &, V3DLONG nbins)
+{
+	V3DLONG b = V3DLONG(v);
+	return (b<nbins) ? b : nbins-1;
+}
+
+inline V3DLONG v3d_intensity_bin(float v, const V3dLinearScale & scale, V3DLONG nbins)
+{
+	float t = (float)scale(v);
+	if (!(t>=0)) return 0; //also NaN
+	V3DLONG b = V3DLONG(t);
+	return (b<nbins) ? b : nbins-1;
+}
+
+template <class T> class V3dIntensityStatsBody
+{
+public:
+	V3dIntensityStatsBody(const T *d, V3DLONG nb, const V3dLinearScale & s) : data(d), nbins(nb), scale(s) {}
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		//same comparisons as minMaxInVector(), the blocks are merged in order afterwards
+		T minv = data[begin], maxv = data[begin];
+		std::vector<V3DLONG> h(nbins, 0);
+		for (V3DLONG i=begin; i<end; i++)
+		{
+			T v = data[i];
+			if (v>maxv) maxv = v;
+			else if (v<minv) minv = v;
+			if (nbins) h[v3d_intensity_bin(v, scale, nbins)]++;
+		}
+
+		QMutexLocker locker(&mutex);
+		Block & b = blocks[begin];
+		b.minv = minv; b.maxv = maxv;
+		b.hist.swap(h);
+	}
+
+	void result(V3dIntensityStats & s)
+	{
+		s.hist.assign(nbins, 0);
+		typename std::map<V3DLONG, Block>::iterator it;
+		for (it = blocks.begin(); it != blocks.end(); ++it)
+		{
+			if (it == blocks.begin()) {s.vmin = it->second.minv; s.vmax = it->second.maxv;}
+			else
+			{
+				if (it->second.maxv>s.vmax) s.vmax = it->second.maxv;
+				if (it->second.minv<s.vmin) s.vmin = it->second.minv;
+			}
+			for (V3DLONG k=0; k<nbins; k++)
+				s.hist[k] += it->second.hist[k];
+		}
+	}
+
+private:
+	struct Block {T minv, maxv; std::vector<V3DLONG> hist;};
+	const T *data;
+	V3DLONG nbins;
+	V3dLinearScale scale;
+	QMutex mutex;
+	std::map<V3DLONG, Block> blocks;
+};
+
+//min and max of data[0..n-1] and, if nbins>0, their histogram (float data: over [lower, upper])
+template <class T> bool v3d_intensity_stats(const T *data, V3DLONG n, V3dIntensityStats & s, V3DLONG nbins=0, double lower=0, double upper=0)
+{
+	if (!data || n<=0 || nbins<0)
+		return false;
+
+	V3dLinearScale scale(lower, upper, 0, (nbins>0) ? nbins-1 : 0);
+	V3dIntensityStatsBody<T> body(data, nbins, scale);
+	v3d_parallel_for(n, body, 0, 1<<20);
+	body.result(s);
+	s.histLower = lower; s.histUpper = upper;
+	return true;
+}
+
+//thresholds where the cumulative histogram crosses apercent and 1-apercent (0 if it does not)
+inline void v3d_intensity_saturation_bounds(const std::vector<V3DLONG> & hist, double apercent, double & lowerth, double & upperth)
+{
+	lowerth = upperth = 0;
+	V3DLONG n = hist.size(), i;
+	if (n<=0) return;
+
+	std::vector<double> cdf(n);
+	cdf[0] = hist[0];
+	for (i=1;i<n;i++) cdf[i] = cdf[i-1] + hist[i];
+	double total = cdf[n-1];
+	for (i=0;i<n;i++) cdf[i] /= total;
+
+	for (i=0;i<n-1;i++)
+	{
+		if (cdf[i]<apercent && cdf[i+1]>apercent)
+			lowerth = i;
+		if (cdf[i]<1-apercent && cdf[i+1]>1-apercent)
+			upperth = i;
+	}
+}
+
+template <class T1, class T2> class V3dLookupBody
+{
+public:
+	V3dLookupBody(const T1 *i, T2 *o, const T2 *l) : in(i), out(o), lut(l) {}
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		for (V3DLONG i=begin; i<end; i++)
+			out[i] = lut[in[i]];
+	}
+private:
+	const T1 *in;
+	T2 *out;
+	const T2 *lut;
+};
+
+//out[i] = lut[in[i]] for i in [0, n), in parallel; in and out may be the same buffer
+template <class T1, class T2> void v3d_apply_lookup(const T1 *in, T2 *out, V3DLONG n, const T2 *lut)
+{
+	V3dLookupBody<T1, T2> body(in, out, lut);
+	v3d_parallel_for(n, body, 0, 1<<20);
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c)2006-2010  Hanchuan Peng (Janelia Farm, Howard Hughes Medical Institute).
+ * All rights reserved.
+ */
+
+
+/************
+ ********* LICENSE NOTICE ************
+ 
+ This folder contains all source codes for the V3D project, which is subject to the following conditions if you want to use it.
+ 
+ You will ***have to agree*** the following terms, *before* downloading/using/running/editing/changing any portion of codes in this package.
+ 
+ 1. This package is free for non-profit research, but needs a special license for any commercial purpose. Please contact Hanchuan Peng for details.
+ 
+ 2. You agree to appropriately cite this work in your related studies and publications.
+ 
+ Peng, H., Ruan, Z., Long, F., Simpson, J.H., and Myers, E.W. (2010) “V3D enables real-time 3D visualization and quantitative analysis of large-scale biological image data sets,” Nature Biotechnology, Vol. 28, No. 4, pp. 348-353, DOI: 10.1038/nbt.1612. ( http://penglab.janelia.org/papersall/docpdf/2010_NBT_V3D.pdf )
+ 
+ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstruction of 3D neuron structures using a graph-augmented deformable model,” Bioinformatics, Vol. 26, pp. i38-i46, 2010. ( http://penglab.janelia.org/papersall/docpdf/2010_Bioinfo_GD_ISMB2010.pdf )
+ 
+ 3. This software is provided by the copyright holders (Hanchuan Peng), Howard Hughes Medical Institute, Janelia Farm Research Campus, and contributors "as is" and any express or implied warranties, including, but not limited to, any implied warranties of merchantability, non-infringement, or fitness for a particular purpose are disclaimed. In no event shall the copyright owner, Howard Hughes Medical Institute, Janelia Farm Research Campus, or contributors be liable for any direct, indirect, incidental, special, exemplary, or consequential damages (including, but not limited to, procurement of substitute goods or services; loss of use, data, or profits; reasonable royalties; or business interruption) however caused and on any theory of liability, whether in contract, strict liability, or tort (including negligence or otherwise) arising in any way out of the use of this software, even if advised of the possibility of such damage.
+ 
+ 4. Neither the name of the Howard Hughes Medical Institute, Janelia Farm Research Campus, nor Hanchuan Peng, may be used to endorse or promote products derived from this software without specific prior written permission.
+ 
+ *************/
+
+
+/*
+ * basic_parallel.h
+ *
+ * A minimal parallel-for over contiguous index blocks, for the plain C++ code in basic_c_fun
+ * and the other template headers (file readers, volimg_proc, ...). The blocks run on a
+ * private QThreadPool, so nested or concurrent callers never wait on each other's tasks.
+ *
+ * The body is a functor with "void operator()(V3DLONG begin, V3DLONG end)"; it is called
+ * concurrently for disjoint [begin, end) ranges that together cover [0, n).
+ */
+
+#ifndef __BASIC_PARALLEL_H__
+#define __BASIC_PARALLEL_H__
+
+#include "v3d_basicdatatype.h"
+
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+inline int v3d_parallel_thread_count()
+{
+	int n = QThread::idealThreadCount();
+	return (n<1) ? 1 : n;
+}
+
+template <class F>
+class V3dParallelBlock : public QRunnable
+{
+public:
+	V3dParallelBlock(F & bodyParam, V3DLONG beginParam, V3DLONG endParam) : body(bodyParam), begin(beginParam), end(endParam) {}
+	void run() {body(begin, end);}
+private:
+	F & body;
+	V3DLONG begin, end;
+};
+
+// nthreads<=0 means one block per available core; grain is the smallest block worth a thread
+template <class F>
+void v3d_parallel_for(V3DLONG n, F & body, int nthreads=0, V3DLONG grain=1)
+{
+	if (n<=0) return;
+	if (nthreads<=0) nthreads = v3d_parallel_thread_count();
+	if (grain<1) grain = 1;
+	V3DLONG nblocks = (n + grain - 1) / grain;
+	if (nblocks > nthreads) nblocks = nthreads;
+	if (nblocks <= 1)
+	{
+		body(0, n);
+		return;
+	}
+	V3DLONG blocksize = (n + nblocks - 1) / nblocks;
+
+	QThreadPool pool;
+	pool.setMaxThreadCount(int(nblocks));
+	for (V3DLONG b=0; b<n; b+=blocksize)
+		pool.start(new V3dParallelBlock<F>(body, b, (b+blocksize<n) ? b+blocksize : n));
+	pool.waitForDone();
+}
+
+#endif
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c)2006-2010  Hanchuan Peng (Janelia Farm, Howard Hughes Medical Institute).
+ * All rights reserved.
+ */
+
+
+/************
+ ********* LICENSE NOTICE ************
+ 
+ This folder contains all source codes for the V3D project, which is subject to the following conditions if you want to use it.
+ 
+ You will ***have to agree*** the following terms, *before* downloading/using/running/editing/changing any portion of codes in this package.
+ 
+ 1. This package is free for non-profit research, but needs a special license for any commercial purpose. Please contact Hanchuan Peng for details.
+ 
+ 2. You agree to appropriately cite this work in your related studies and publications.
+ 
+ Peng, H., Ruan, Z., Long, F., Simpson, J.H., and Myers, E.W. (2010) “V3D enables real-time 3D visualization and quantitative analysis of large-scale biological image data sets,” Nature Biotechnology, Vol. 28, No. 4, pp. 348-353, DOI: 10.1038/nbt.1612. ( http://penglab.janelia.org/papersall/docpdf/2010_NBT_V3D.pdf )
+ 
+ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstruction of 3D neuron structures using a graph-augmented deformable model,” Bioinformatics, Vol. 26, pp. i38-i46, 2010. ( http://penglab.janelia.org/papersall/docpdf/2010_Bioinfo_GD_ISMB2010.pdf )
+ 
+ 3. This software is provided by the copyright holders (Hanchuan Peng), Howard Hughes Medical Institute, Janelia Farm Research Campus, and contributors "as is" and any express or implied warranties, including, but not limited to, any implied warranties of merchantability, non-infringement, or fitness for a particular purpose are disclaimed. In no event shall the copyright owner, Howard Hughes Medical Institute, Janelia Farm Research Campus, or contributors be liable for any direct, indirect, incidental, special, exemplary, or consequential damages (including, but not limited to, procurement of substitute goods or services; loss of use, data, or profits; reasonable royalties; or business interruption) however caused and on any theory of liability, whether in contract, strict liability, or tort (including negligence or otherwise) arising in any way out of the use of this software, even if advised of the possibility of such damage.
+ 
+ 4. Neither the name of the Howard Hughes Medical Institute, Janelia Farm Research Campus, nor Hanchuan Peng, may be used to endorse or promote products derived from this software without specific prior written permission.
+ 
+ *************/
+
+
+
+/*
+ * basic_resample.h
+ *
+ * Separable resampling of 4D (x,y,z,channel) volumes. Each axis gets a table of weights computed once
+ * (nearest, linear, cubic or area averaging); every output z plane is then built from x/y-resampled input
+ * planes, which each thread keeps in a small ring while it walks its own range of output planes, so no
+ * full-size intermediate volume is allocated. The inner loops run over contiguous float rows and planes
+ * with the weight hoisted out, which the compiler vectorizes.
+ */
+
+#ifndef __BASIC_RESAMPLE_H__
+#define __BASIC_RESAMPLE_H__
+
+#include "basic_parallel.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <limits>
+#include <vector>
+
+enum V3dResampleMethod {V3D_RESAMPLE_NEAREST=0, V3D_RESAMPLE_LINEAR=1, V3D_RESAMPLE_CUBIC=2, V3D_RESAMPLE_AREA=3};
+
+//output i is at the input coordinate i*step (clamped to [0, nin-1]); V3D_RESAMPLE_AREA instead averages the inputs
+//[floor(i*step), floor((i+1)*step-1)] as downsample3dimg_1dpt() does, and falls back to linear for step<=1.
+//Borders are replicated, nearest rounds halves down, cubic is Catmull-Rom.
+class V3dResampleAxis
+{
+public:
+	V3dResampleAxis() : nin(0), nout(0), taps(0), identity(false) {}
+
+	bool set(V3DLONG ninParam, V3DLONG noutParam, double step, int method)
+	{
+		nin = ninParam; nout = noutParam; taps = 0; identity = false;
+		first.clear(); weights.clear();
+		if (nin<1 || nout<1 || !(step>0) || method<V3D_RESAMPLE_NEAREST || method>V3D_RESAMPLE_AREA)
+			return false;
+		if (method==V3D_RESAMPLE_AREA && step<=1)
+			method = V3D_RESAMPLE_LINEAR;
+
+		first.assign(nout, 0);
+		std::vector<int> count(nout, 0);
+		double w[4];
+		for (V3DLONG i=0; i<nout; i++)
+		{
+			count[i] = kernel(i, step, method, first[i], w);
+			if (count[i]>taps) taps = count[i];
+		}
+
+		weights.assign(nout*taps, 0.0f);
+		identity = (nin==nout);
+		for (V3DLONG i=0; i<nout; i++)
+		{
+			if (method!=V3D_RESAMPLE_AREA)
+				kernel(i, step, method, first[i], w);
+			if (count[i]!=1 || first[i]!=i || (method!=V3D_RESAMPLE_AREA && w[0]!=1))
+				identity = false;
+
+			//keep the zero padding inside [0, nin) so that the inner loops need no bound checks
+			V3DLONG shift = first[i] + taps - nin;
+			if (shift<0) shift = 0;
+			first[i] -= shift;
+			for (int t=0; t<count[i]; t++)
+				weights[i*taps+shift+t] = (method==V3D_RESAMPLE_AREA) ? float(1.0/count[i]) : float(w[t]);
+		}
+		return true;
+	}
+
+	V3DLONG nin, nout;
+	int taps;                     //weights per output, zero padded
+	bool identity;                //out[i] = in[i]
+	std::vector<V3DLONG> first;   //first input of each output
+	std::vector<float> weights;   //nout*taps
+
+private:
+	//the inputs first..first+count-1 of output i; w[] is only filled for the point kernels
+	int kernel(V3DLONG i, double step, int method, V3DLONG & lo, double w[4]) const
+	{
+		if (method==V3D_RESAMPLE_AREA)
+		{
+			lo = V3DLONG(floor(i*step));
+			V3DLONG hi = V3DLONG(floor((i+1)*step-1));
+			if (hi>nin-1) hi = nin-1;
+			if (lo>hi) lo = hi;
+			return int(hi-lo+1);
+		}
+
+		double x = i*step;
+		if (x>nin-1) x = nin-1;
+		V3DLONG k0 = V3DLONG(floor(x));
+		double f = x - k0;
+		w[0] = w[1] = w[2] = w[3] = 0;
+		if (method==V3D_RESAMPLE_NEAREST || f==0)
+		{
+			lo = (f>0.5+1e-9) ? k0+1 : k0; //coordinates computed as i*step land on either side of the halves
+			w[0] = 1;
+			return 1;
+		}
+		if (method==V3D_RESAMPLE_LINEAR)
+		{
+			lo = k0;
+			w[0] = 1-f; w[1] = f;
+			return 2;
+		}
+
+		double c[4];
+		c[0] = ((-0.5*f + 1.0)*f - 0.5)*f;
+		c[1] = (1.5*f - 2.5)*f*f + 1.0;
+		c[2] = ((-1.5*f + 2.0)*f + 0.5)*f;
+		c[3] = (0.5*f - 0.5)*f*f;
+		lo = (k0-1<0) ? 0 : k0-1;
+		V3DLONG hi = (k0+2>nin-1) ? nin-1 : k0+2;
+		for (int t=0; t<4; t++)
+		{
+			V3DLONG k = k0-1+t;
+			if (k<0) k = 0; else if (k>nin-1) k = nin-1;
+			w[k-lo] += c[t];
+		}
+		return int(hi-lo+1);
+	}
+};
+
+//rounds and saturates for the integer types
+template <class T> inline T v3d_resample_value(float v)
+{
+	if (!std::numeric_limits<T>::is_integer)
+		return T(v);
+	if (v <= float(std::numeric_limits<T>::min())) return std::numeric_limits<T>::min();
+	if (v >= float(std::numeric_limits<T>::max())) return std::numeric_limits<T>::max();
+	if (std::numeric_limits<T>::min()==0)
+		return T(v + 0.5f);
+	return T(floor(v + 0.5f));
+}
+
+template <class T> class V3dResampleBody
+{
+public:
+	V3dResampleBody(const T *i, T *o, const V3dResampleAxis & x, const V3dResampleAxis & y, const V3dResampleAxis & z)
+		: in(i), out(o), ax(x), ay(y), az(z) {}
+
+	//[begin, end) indexes the output planes of all channels, c*az.nout + k
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		V3DLONG plane = ax.nout*ay.nout, inplane = ax.nin*ay.nin;
+		bool xyIdentity = ax.identity && ay.identity; //z only: blend the input planes directly
+		V3DLONG nx = (ax.nout>ax.nin) ? ax.nout : ax.nin, ny = (ay.nout>ay.nin) ? ay.nout : ay.nin;
+		std::vector<float> rows(xyIdentity ? 0 : nx*ny), ring(xyIdentity ? 0 : plane*az.taps), acc(plane);
+		std::vector<V3DLONG> ringZ(az.taps, -1);
+		V3DLONG ringC = -1;
+
+		for (V3DLONG p=begin; p<end; p++)
+		{
+			V3DLONG c = p / az.nout, k = p % az.nout;
+			const float *w = &az.weights[k*az.taps];
+			T *dst = out + p*plane;
+			if (c!=ringC)
+			{
+				ringZ.assign(az.taps, -1);
+				ringC = c;
+			}
+
+			int ntaps = 0;
+			for (int t=0; t<az.taps; t++)
+			{
+				if (w[t]==0) continue;
+				V3DLONG z = az.first[k] + t;
+				if (xyIdentity)
+				{
+					const T *src = in + (c*az.nin + z)*inplane;
+					if (w[t]==1)
+					{
+						for (V3DLONG i=0; i<plane; i++) dst[i] = src[i];
+						ntaps = -1;
+						break;
+					}
+					accumulate(src, w[t], ntaps++, &acc[0], plane);
+					continue;
+				}
+
+				float *src = &ring[(z % az.taps)*plane];
+				if (ringZ[z % az.taps]!=z)
+				{
+					resampleXY(in + (c*az.nin + z)*inplane, &rows[0], src);
+					ringZ[z % az.taps] = z;
+				}
+				accumulate((const float *)src, w[t], ntaps++, &acc[0], plane);
+			}
+
+			const float *a = &acc[0];
+			if (ntaps==0)
+				for (V3DLONG i=0; i<plane; i++) dst[i] = T(0);
+			else if (ntaps>0)
+				for (V3DLONG i=0; i<plane; i++) dst[i] = v3d_resample_value<T>(a[i]);
+		}
+	}
+
+private:
+	template <class S> static void accumulate(const S *src, float wt, int n, float *a, V3DLONG len)
+	{
+		if (n==0)
+			for (V3DLONG i=0; i<len; i++) a[i] = wt*float(src[i]);
+		else
+			for (V3DLONG i=0; i<len; i++) a[i] += wt*float(src[i]);
+	}
+
+	//x and y passes of one input plane into dst (ax.nout x ay.nout); the pass that can shrink the plane runs first,
+	//through rows (at most max(ax.nout, ax.nin) x max(ay.nin, ay.nout))
+	void resampleXY(const T *src, float *rows, float *dst)
+	{
+		if (ay.identity)
+		{
+			for (V3DLONG j=0; j<ay.nin; j++)
+				resampleX(src + j*ax.nin, dst + j*ax.nout);
+		}
+		else if (ax.identity || ay.nout<=ay.nin)
+		{
+			for (V3DLONG j=0; j<ay.nout; j++)
+				resampleY(src, ax.nin, j, ax.identity ? dst + j*ax.nout : rows + j*ax.nin);
+			if (!ax.identity)
+				for (V3DLONG j=0; j<ay.nout; j++)
+					resampleX(rows + j*ax.nin, dst + j*ax.nout);
+		}
+		else
+		{
+			for (V3DLONG j=0; j<ay.nin; j++)
+				resampleX(src + j*ax.nin, rows + j*ax.nout);
+			for (V3DLONG j=0; j<ay.nout; j++)
+				resampleY((const float *)rows, ax.nout, j, dst + j*ax.nout);
+		}
+	}
+
+	template <class S> void resampleX(const S *s, float *r)
+	{
+		V3DLONG ox = ax.nout;
+		if (ax.identity)
+		{
+			for (V3DLONG i=0; i<ox; i++) r[i] = float(s[i]);
+			return;
+		}
+		int taps = ax.taps;
+		const float *w = &ax.weights[0];
+		const V3DLONG *f = &ax.first[0];
+		for (V3DLONG i=0; i<ox; i++, w+=taps)
+		{
+			const S *si = s + f[i];
+			float v = 0;
+			for (int t=0; t<taps; t++)
+				v += w[t]*float(si[t]);
+			r[i] = v;
+		}
+	}
+
+	//output row j of the y pass over rows of length nx
+	template <class S> void resampleY(const S *s, V3DLONG nx, V3DLONG j, float *d)
+	{
+		const float *w = &ay.weights[j*ay.taps];
+		bool started = false;
+		for (int t=0; t<ay.taps; t++)
+		{
+			if (w[t]==0) continue;
+			const S *r = s + (ay.first[j]+t)*nx;
+			float wt = w[t];
+			if (!started)
+				for (V3DLONG i=0; i<nx; i++) d[i] = wt*float(r[i]);
+			else
+				for (V3DLONG i=0; i<nx; i++) d[i] += wt*float(r[i]);
+			started = true;
+		}
+		if (!started)
+			for (V3DLONG i=0; i<nx; i++) d[i] = 0;
+	}
+
+	const T *in;
+	T *out;
+	const V3dResampleAxis & ax, & ay, & az;
+};
+
+//resamples the sc channels of in (ax.nin*ay.nin*az.nin per channel, x fastest) into out (ax.nout*ay.nout*az.nout per channel)
+template <class T> bool v3d_resample3d(const T *in, T *out, V3DLONG sc, const V3dResampleAxis & ax, const V3dResampleAxis & ay, const V3dResampleAxis & az, int nthreads=0)
+{
+	if (!in || !out || sc<1 || ax.taps<1 || ay.taps<1 || az.taps<1)
+		return false;
+	V3dResampleBody<T> body(in, out, ax, ay, az);
+	v3d_parallel_for(sc*az.nout, body, nthreads, 4*az.taps);
+	return true;
+}
+
+//replaces img (sz[0..3]) by its resampling, and sz[0..2] by the output sizes of the axes; img is left as is on failure
+template <class T> bool v3d_resample3d(T * & img, V3DLONG * sz, const V3dResampleAxis & ax, const V3dResampleAxis & ay, const V3dResampleAxis & az)
+{
+	if (!img || !sz || ax.nin!=sz[0] || ay.nin!=sz[1] || az.nin!=sz[2] || sz[3]<1)
+		return false;
+
+	T *outimg = 0;
+	try
+	{
+		outimg = new T [ax.nout*ay.nout*az.nout*sz[3]];
+	}
+	catch (...)
+	{
+		fprintf(stderr, "Fail to allocate memory. [%s][%d].\n", __FILE__, __LINE__);
+		return false;
+	}
+	if (!v3d_resample3d((const T *)img, outimg, sz[3], ax, ay, az))
+	{
+		delete []outimg;
+		return false;
+	}
+
+	delete []img;
+	img = outimg;
+	sz[0] = ax.nout;
+	sz[1] = ay.nout;
+	sz[2] = az.nout;
+	return true;
+}
+
+#endif
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c)2006-2010  Hanchuan Peng (Janelia Farm, Howard Hughes Medical Institute).
+ * All rights reserved.
+ */
+
+
+/************
+ ********* LICENSE NOTICE ************
+ 
+ This folder contains all source codes for the V3D project, which is subject to the following conditions if you want to use it.
+ 
+ You will ***have to agree*** the following terms, *before* downloading/using/running/editing/changing any portion of codes in this package.
+ 
+ 1. This package is free for non-profit research, but needs a special license for any commercial purpose. Please contact Hanchuan Peng for details.
+ 
+ 2. You agree to appropriately cite this work in your related studies and publications.
+ 
+ Peng, H., Ruan, Z., Long, F., Simpson, J.H., and Myers, E.W. (2010) “V3D enables real-time 3D visualization and quantitative analysis of large-scale biological image data sets,” Nature Biotechnology, Vol. 28, No. 4, pp. 348-353, DOI: 10.1038/nbt.1612. ( http://penglab.janelia.org/papersall/docpdf/2010_NBT_V3D.pdf )
+ 
+ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstruction of 3D neuron structures using a graph-augmented deformable model,” Bioinformatics, Vol. 26, pp. i38-i46, 2010. ( http://penglab.janelia.org/papersall/docpdf/2010_Bioinfo_GD_ISMB2010.pdf )
+ 
+ 3. This software is provided by the copyright holders (Hanchuan Peng), Howard Hughes Medical Institute, Janelia Farm Research Campus, and contributors "as is" and any express or implied warranties, including, but not limited to, any implied warranties of merchantability, non-infringement, or fitness for a particular purpose are disclaimed. In no event shall the copyright owner, Howard Hughes Medical Institute, Janelia Farm Research Campus, or contributors be liable for any direct, indirect, incidental, special, exemplary, or consequential damages (including, but not limited to, procurement of substitute goods or services; loss of use, data, or profits; reasonable royalties; or business interruption) however caused and on any theory of liability, whether in contract, strict liability, or tort (including negligence or otherwise) arising in any way out of the use of this software, even if advised of the possibility of such damage.
+ 
+ 4. Neither the name of the Howard Hughes Medical Institute, Janelia Farm Research Campus, nor Hanchuan Peng, may be used to endorse or promote products derived from this software without specific prior written permission.
+ 
+ *************/
+
+
+
+/*
+ * basic_volexpr.h
+ *
+ * Element-wise expressions over volumes, evaluated in one parallel pass without temporaries.
+ * A volume is either a T*** row-pointer array (new3dpointer) or a contiguous buffer; expressions are
+ * built with the usual operators and the v3d_vol_* functions, e.g.
+ *
+ *     v3d_vol_assign(v3d_vol(res, d0, d1, d2), (v3d_vol(a, d0, d1, d2) - v3d_vol(b, d0, d1, d2)) * 0.5);
+ *     double ss = v3d_vol_sum(v3d_vol_square(v3d_vol(a, n) - mean));
+ *
+ * Every element is computed in double and cast back to the element type on assignment, as the
+ * vol3d_* functions do. The volume is cut into contiguous pieces of rows (at most V3D_VOLEXPR_CHUNK
+ * elements each) that are spread over the threads; reductions keep one partial result per piece and
+ * merge them in order, so the result does not depend on the number of threads.
+ */
+
+#ifndef __BASIC_VOLEXPR_H__
+#define __BASIC_VOLEXPR_H__
+
+#include "basic_parallel.h"
+
+#include <math.h>
+#include <vector>
+
+#define V3D_VOLEXPR_CHUNK 16384
+
+//the part [i0,i1) x [j0,j1) x [k0,k1) of a volume that is evaluated
+struct V3dVolBox
+{
+	V3DLONG i0, i1, j0, j1, k0, k1;
+	V3dVolBox(V3DLONG d0, V3DLONG d1, V3DLONG d2) : i0(0), i1(d0), j0(0), j1(d1), k0(0), k1(d2) {}
+	V3dVolBox(V3DLONG b0, V3DLONG e0, V3DLONG b1, V3DLONG e1, V3DLONG b2, V3DLONG e2) : i0(b0), i1(e0), j0(b1), j1(e1), k0(b2), k1(e2) {}
+	bool empty() const {return i1<=i0 || j1<=j0 || k1<=k0;}
+};
+
+//leaf: element (i,j,k) is p3d[k][j][i], or p[(k*d1+j)*d0+i] for a contiguous buffer
+template <class T> class V3dVolLeaf
+{
+public:
+	V3dVolLeaf(T *** p3d, V3DLONG d0Param, V3DLONG d1Param, V3DLONG d2Param) : rows(p3d), data(0), d0(d0Param), d1(d1Param), d2(d2Param) {}
+	V3dVolLeaf(T * p, V3DLONG d0Param, V3DLONG d1Param, V3DLONG d2Param) : rows(0), data(p), d0(d0Param), d1(d1Param), d2(d2Param) {}
+
+	T * row(V3DLONG j, V3DLONG k) const {return rows ? rows[k][j] : data + (k*d1+j)*d0;}
+	bool valid() const {return (rows || data) && d0>0 && d1>0 && d2>0;}
+
+	struct Row
+	{
+		const T *p;
+		double operator[](V3DLONG i) const {return double(p[i]);}
+	};
+	Row bind(V3DLONG j, V3DLONG k) const {Row r; r.p = row(j, k); return r;}
+
+	T *** rows;
+	T * data;
+	V3DLONG d0, d1, d2;
+};
+
+class V3dVolConst
+{
+public:
+	explicit V3dVolConst(double v) : c(v) {}
+	struct Row
+	{
+		double c;
+		double operator[](V3DLONG) const {return c;}
+	};
+	Row bind(V3DLONG, V3DLONG) const {Row r; r.c = c; return r;}
+	double c;
+};
+
+template <class A, class Op> class V3dVolUnary
+{
+public:
+	V3dVolUnary(const A & aParam, const Op & opParam) : a(aParam), op(opParam) {}
+	struct Row
+	{
+		typename A::Row a;
+		Op op;
+		double operator[](V3DLONG i) const {return op(a[i]);}
+	};
+	Row bind(V3DLONG j, V3DLONG k) const {Row r = {a.bind(j, k), op}; return r;}
+	A a;
+	Op op;
+};
+
+template <class A, class B, class Op> class V3dVolBinary
+{
+public:
+	V3dVolBinary(const A & aParam, const B & bParam) : a(aParam), b(bParam) {}
+	struct Row
+	{
+		typename A::Row a;
+		typename B::Row b;
+		double operator[](V3DLONG i) const {return Op::apply(a[i], b[i]);}
+	};
+	Row bind(V3DLONG j, V3DLONG k) const {Row r = {a.bind(j, k), b.bind(j, k)}; return r;}
+	A a;
+	B b;
+};
+
+template <class C, class A, class B> class V3dVolWhere
+{
+public:
+	V3dVolWhere(const C & cParam, const A & aParam, const B & bParam) : c(cParam), a(aParam), b(bParam) {}
+	struct Row
+	{
+		typename C::Row c;
+		typename A::Row a;
+		typename B::Row b;
+		double operator[](V3DLONG i) const {return c[i] ? a[i] : b[i];}
+	};
+	Row bind(V3DLONG j, V3DLONG k) const {Row r = {c.bind(j, k), a.bind(j, k), b.bind(j, k)}; return r;}
+	C c;
+	A a;
+	B b;
+};
+
+//two expressions evaluated side by side, for the reducers that need both (see V3dVolSum2)
+template <class A, class B> class V3dVolPair
+{
+public:
+	V3dVolPair(const A & aParam, const B & bParam) : a(aParam), b(bParam) {}
+	struct Row
+	{
+		typename A::Row a;
+		typename B::Row b;
+	};
+	Row bind(V3DLONG j, V3DLONG k) const {Row r = {a.bind(j, k), b.bind(j, k)}; return r;}
+	A a;
+	B b;
+};
+
+//the handle the operators work on
+template <class E> class V3dVolExpr
+{
+public:
+	explicit V3dVolExpr(const E & eParam) : e(eParam) {}
+	typedef typename E::Row Row;
+	Row bind(V3DLONG j, V3DLONG k) const {return e.bind(j, k);}
+	E e;
+};
+
+template <class T> inline V3dVolExpr< V3dVolLeaf<T> > v3d_vol(T *** p, V3DLONG d0, V3DLONG d1, V3DLONG d2)
+{
+	return V3dVolExpr< V3dVolLeaf<T> >(V3dVolLeaf<T>(p, d0, d1, d2));
+}
+
+template <class T> inline V3dVolExpr< V3dVolLeaf<T> > v3d_vol(T * p, V3DLONG d0, V3DLONG d1=1, V3DLONG d2=1)
+{
+	return V3dVolExpr< V3dVolLeaf<T> >(V3dVolLeaf<T>(p, d0, d1, d2));
+}
+
+inline V3dVolExpr<V3dVolConst> v3d_vol_const(double v)
+{
+	return V3dVolExpr<V3dVolConst>(V3dVolConst(v));
+}
+
+//element-wise operations
+
+struct V3dVolOpPlus {static double apply(double a, double b) {return a + b;}};
+struct V3dVolOpMinus {static double apply(double a, double b) {return a - b;}};
+struct V3dVolOpTimes {static double apply(double a, double b) {return a * b;}};
+struct V3dVolOpDivide {static double apply(double a, double b) {return a / b;}};
+struct V3dVolOpLess {static double apply(double a, double b) {return a < b;}};
+struct V3dVolOpGreater {static double apply(double a, double b) {return a > b;}};
+struct V3dVolOpEqual {static double apply(double a, double b) {return a == b;}};
+struct V3dVolOpNotEqual {static double apply(double a, double b) {return a != b;}};
+struct V3dVolOpOr {static double apply(double a, double b) {return a || b;}};
+
+struct V3dVolOpNegative {double operator()(double a) const {return -a;}};
+struct V3dVolOpInverse {double operator()(double a) const {return 1.0/a;}};
+struct V3dVolOpSquare {double operator()(double a) const {return a*a;}};
+struct V3dVolOpSqrt {double operator()(double a) const {return sqrt(a);}};
+struct V3dVolOpExp {double operator()(double a) const {return exp(a);}};
+struct V3dVolOpLog {double operator()(double a) const {return log(a);}};
+struct V3dVolOpFabs {double operator()(double a) const {return fabs(a);}};
+
+#define V3D_VOLEXPR_BINARY(opname, OpType) \
+template <class A, class B> inline V3dVolExpr< V3dVolBinary<A, B, OpType> > opname(const V3dVolExpr<A> & a, const V3dVolExpr<B> & b) \
+{ return V3dVolExpr< V3dVolBinary<A, B, OpType> >(V3dVolBinary<A, B, OpType>(a.e, b.e)); } \
+template <class A> inline V3dVolExpr< V3dVolBinary<A, V3dVolConst, OpType> > opname(const V3dVolExpr<A> & a, double b) \
+{ return V3dVolExpr< V3dVolBinary<A, V3dVolConst, OpType> >(V3dVolBinary<A, V3dVolConst, OpType>(a.e, V3dVolConst(b))); } \
+template <class B> inline V3dVolExpr< V3dVolBinary<V3dVolConst, B, OpType> > opname(double a, const V3dVolExpr<B> & b) \
+{ return V3dVolExpr< V3dVolBinary<V3dVolConst, B, OpType> >(V3dVolBinary<V3dVolConst, B, OpType>(V3dVolConst(a), b.e)); }
+
+V3D_VOLEXPR_BINARY(operator+, V3dVolOpPlus)
+V3D_VOLEXPR_BINARY(operator-, V3dVolOpMinus)
+V3D_VOLEXPR_BINARY(operator*, V3dVolOpTimes)
+V3D_VOLEXPR_BINARY(operator/, V3dVolOpDivide)
+V3D_VOLEXPR_BINARY(operator<, V3dVolOpLess)
+V3D_VOLEXPR_BINARY(operator>, V3dVolOpGreater)
+V3D_VOLEXPR_BINARY(operator==, V3dVolOpEqual)
+V3D_VOLEXPR_BINARY(operator!=, V3dVolOpNotEqual)
+V3D_VOLEXPR_BINARY(operator||, V3dVolOpOr)
+
+#undef V3D_VOLEXPR_BINARY
+
+#define V3D_VOLEXPR_UNARY(fname, OpType) \
+template <class A> inline V3dVolExpr< V3dVolUnary<A, OpType> > fname(const V3dVolExpr<A> & a) \
+{ return V3dVolExpr< V3dVolUnary<A, OpType> >(V3dVolUnary<A, OpType>(a.e, OpType())); }
+
+V3D_VOLEXPR_UNARY(operator-, V3dVolOpNegative)
+V3D_VOLEXPR_UNARY(v3d_vol_inverse, V3dVolOpInverse)
+V3D_VOLEXPR_UNARY(v3d_vol_square, V3dVolOpSquare)
+V3D_VOLEXPR_UNARY(v3d_vol_sqrt, V3dVolOpSqrt)
+V3D_VOLEXPR_UNARY(v3d_vol_exp, V3dVolOpExp)
+V3D_VOLEXPR_UNARY(v3d_vol_log, V3dVolOpLog)
+V3D_VOLEXPR_UNARY(v3d_vol_fabs, V3dVolOpFabs)
+
+#undef V3D_VOLEXPR_UNARY
+
+//c ? a : b, element-wise
+template <class C, class A, class B> inline V3dVolExpr< V3dVolWhere<C, A, B> > v3d_vol_where(const V3dVolExpr<C> & c, const V3dVolExpr<A> & a, const V3dVolExpr<B> & b)
+{
+	return V3dVolExpr< V3dVolWhere<C, A, B> >(V3dVolWhere<C, A, B>(c.e, a.e, b.e));
+}
+
+template <class C, class A> inline V3dVolExpr< V3dVolWhere<C, A, V3dVolConst> > v3d_vol_where(const V3dVolExpr<C> & c, const V3dVolExpr<A> & a, double b)
+{
+	return V3dVolExpr< V3dVolWhere<C, A, V3dVolConst> >(V3dVolWhere<C, A, V3dVolConst>(c.e, a.e, V3dVolConst(b)));
+}
+
+template <class A, class B> inline V3dVolExpr< V3dVolPair<A, B> > v3d_vol_pair(const V3dVolExpr<A> & a, const V3dVolExpr<B> & b)
+{
+	return V3dVolExpr< V3dVolPair<A, B> >(V3dVolPair<A, B>(a.e, b.e));
+}
+
+//the evaluation: pieces of at most V3D_VOLEXPR_CHUNK elements of a row, numbered row by row
+
+class V3dVolPieces
+{
+public:
+	explicit V3dVolPieces(const V3dVolBox & b) : box(b)
+	{
+		V3DLONG len = box.i1 - box.i0;
+		nj = box.j1 - box.j0;
+		chunk = (len<V3D_VOLEXPR_CHUNK) ? len : V3D_VOLEXPR_CHUNK;
+		perRow = (chunk>0) ? (len + chunk - 1)/chunk : 0;
+		count = box.empty() ? 0 : perRow * nj * (box.k1 - box.k0);
+	}
+	void get(V3DLONG u, V3DLONG & j, V3DLONG & k, V3DLONG & ib, V3DLONG & ie) const
+	{
+		V3DLONG r = u / perRow, c = u % perRow;
+		j = box.j0 + r % nj;
+		k = box.k0 + r / nj;
+		ib = box.i0 + c*chunk;
+		ie = (ib + chunk < box.i1) ? ib + chunk : box.i1;
+	}
+	V3DLONG grain() const {V3DLONG g = (V3D_VOLEXPR_CHUNK*4)/chunk; return (g<1) ? 1 : g;}
+
+	V3dVolBox box;
+	V3DLONG nj, chunk, perRow, count;
+};
+
+template <class T, class E> class V3dVolAssignBody
+{
+public:
+	V3dVolAssignBody(const V3dVolLeaf<T> & r, const E & eParam, const V3dVolPieces & p) : res(r), e(eParam), pieces(p) {}
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		V3DLONG j, k, ib, ie;
+		for (V3DLONG u=begin; u<end; u++)
+		{
+			pieces.get(u, j, k, ib, ie);
+			T *d = res.row(j, k);
+			typename E::Row row = e.bind(j, k);
+			for (V3DLONG i=ib; i<ie; i++)
+				d[i] = (T)(row[i]);
+		}
+	}
+private:
+	const V3dVolLeaf<T> & res;
+	const E & e;
+	const V3dVolPieces & pieces;
+};
+
+//res = e over the box (the whole of res by default); res may also appear in e
+template <class T, class E> bool v3d_vol_assign(const V3dVolExpr< V3dVolLeaf<T> > & res, const V3dVolExpr<E> & e, const V3dVolBox & box)
+{
+	if (!res.e.valid())
+		return false;
+	V3dVolPieces pieces(box);
+	V3dVolAssignBody<T, V3dVolExpr<E> > body(res.e, e, pieces);
+	v3d_parallel_for(pieces.count, body, 0, pieces.grain());
+	return true;
+}
+
+template <class T, class E> bool v3d_vol_assign(const V3dVolExpr< V3dVolLeaf<T> > & res, const V3dVolExpr<E> & e)
+{
+	return v3d_vol_assign(res, e, V3dVolBox(res.e.d0, res.e.d1, res.e.d2));
+}
+
+//reductions: a reducer R has a State, accumulate(State &, row, ib, ie) for the elements [ib, ie) of a row,
+//and merge(State &, const State &) to append the state of the next piece
+
+template <class R, class E> class V3dVolReduceBody
+{
+public:
+	V3dVolReduceBody(const R & rParam, const E & eParam, const V3dVolPieces & p, std::vector<typename R::State> & s)
+		: reducer(rParam), e(eParam), pieces(p), states(s) {}
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		V3DLONG j, k, ib, ie;
+		for (V3DLONG u=begin; u<end; u++)
+		{
+			pieces.get(u, j, k, ib, ie);
+			reducer.accumulate(states[u], e.bind(j, k), ib, ie);
+		}
+	}
+private:
+	const R & reducer;
+	const E & e;
+	const V3dVolPieces & pieces;
+	std::vector<typename R::State> & states;
+};
+
+template <class R, class E> typename R::State v3d_vol_reduce(const R & reducer, const V3dVolExpr<E> & e, const V3dVolBox & box)
+{
+	V3dVolPieces pieces(box);
+	std::vector<typename R::State> states(pieces.count);
+	V3dVolReduceBody<R, V3dVolExpr<E> > body(reducer, e, pieces, states);
+	v3d_parallel_for(pieces.count, body, 0, pieces.grain());
+
+	typename R::State s;
+	for (V3DLONG u=0; u<pieces.count; u++)
+		reducer.merge(s, states[u]);
+	return s;
+}
+
+//the sum, accumulated from 0 in element order within each piece
+struct V3dVolSum
+{
+	struct State
+	{
+		double v;
+		State() : v(0) {}
+	};
+	template <class Row> void accumulate(State & s, const Row & row, V3DLONG ib, V3DLONG ie) const
+	{
+		double v = 0;
+		for (V3DLONG i=ib; i<ie; i++)
+			v += row[i];
+		s.v = v;
+	}
+	void merge(State & a, const State & b) const {a.v += b.v;}
+};
+
+//the sums of both expressions of a v3d_vol_pair() in one pass
+struct V3dVolSum2
+{
+	struct State
+	{
+		double a, b;
+		State() : a(0), b(0) {}
+	};
+	template <class Row> void accumulate(State & s, const Row & row, V3DLONG ib, V3DLONG ie) const
+	{
+		double va = 0, vb = 0;
+		for (V3DLONG i=ib; i<ie; i++)
+		{
+			va += row.a[i];
+			vb += row.b[i];
+		}
+		s.a = va; s.b = vb;
+	}
+	void merge(State & x, const State & y) const {x.a += y.a; x.b += y.b;}
+};
+
+//min and max with the comparisons of vol3d_min()/vol3d_max(), starting from the first element
+struct V3dVolMinMax
+{
+	struct State
+	{
+		double vmin, vmax;
+		bool has;
+		State() : vmin(0), vmax(0), has(false) {}
+	};
+	template <class Row> void accumulate(State & s, const Row & row, V3DLONG ib, V3DLONG ie) const
+	{
+		double vm = row[ib], vM = vm;
+		for (V3DLONG i=ib+1; i<ie; i++)
+		{
+			double v = row[i];
+			vm = (v < vm) ? v : vm;
+			vM = (v > vM) ? v : vM;
+		}
+		s.vmin = vm; s.vmax = vM; s.has = true;
+	}
+	void merge(State & a, const State & b) const
+	{
+		if (!b.has) return;
+		if (!a.has) {a = b; return;}
+		a.vmin = (b.vmin < a.vmin) ? b.vmin : a.vmin;
+		a.vmax = (b.vmax > a.vmax) ? b.vmax : a.vmax;
+	}
+};
+
+template <class E> inline double v3d_vol_sum(const V3dVolExpr<E> & e, const V3dVolBox & box)
+{
+	return v3d_vol_reduce(V3dVolSum(), e, box).v;
+}
+
+//min and max of e over box in one pass; false if the box is empty
+template <class E> inline bool v3d_vol_minmax(const V3dVolExpr<E> & e, const V3dVolBox & box, double & vmin, double & vmax)
+{
+	V3dVolMinMax::State s = v3d_vol_reduce(V3dVolMinMax(), e, box);
+	vmin = s.vmin; vmax = s.vmax;
+	return s.has;
+}
+
+//the number of elements of box where e is nonzero
+template <class E> inline V3DLONG v3d_vol_nnz(const V3dVolExpr<E> & e, const V3dVolBox & box)
+{
+	return V3DLONG(v3d_vol_sum(e != 0.0, box));
+}
+
+#endif
@@ -42,6 +42,9 @@ extern "C" {
 #include "../common_lib/src_packages/mylib_tiff/image.h"
 };
 
+//in stackutil.cpp; stackutil.h is not included here, as libtiff and mylib both typedef uint16/uint32
+int loadTif2StackPageParallel(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, int & nbits, int nthreads=0);
+
 void freeMylibArray(Array * indata)
 {
     if (indata)
@@ -67,6 +70,10 @@ int loadTif2StackMylib(char * filename, unsigned char * & img, V3DLONG * & sz, i
 	if (!filename) 
 		return 1;
 	
+	//plain 8/16-bit grayscale stacks are decoded page-parallel by libtiff; mylib handles everything else
+	if (loadTif2StackPageParallel(filename, img, sz, datatype, nbits)==0)
+		return 0;
+	
 	//read data
 	V3DLONG n; //n for the number of layers
 	
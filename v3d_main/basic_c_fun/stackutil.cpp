@@ -77,6 +77,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
  *           Anyway, I have now used a 2G buffer to read >2G data. I have not changed the saveStack2Raw functions. It seems they work in the Matlab mex functions. Thus I assumed
  *           they don't need to change. Need tests anyway.
  * 20120410: fix a bug when strcasecmp_l() taking a NULL parameter so that it crashes
+ * 20261019: index the pages of multipage TIF/LSM files first, then decode the pages in parallel, each thread with its own TIFF handle
  */
 
 #define _FILE_OFFSET_BITS  64  //20140919
@@ -115,6 +116,8 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #include "stackutil.h"
 #include "basic_memory.cpp" //change basic_memory.h to basic_memory.cpp, 080302
 
+#include <vector>
+
 /*
 extern "C" {
 */
@@ -2026,6 +2029,192 @@ void swap4bytes(void *targetp)
 }
 
 
+//20261019: page-parallel decoding of multipage TIF/LSM files
+
+//serial unless the application installs a runner, so that this file needs no thread library
+static StackutilRangeRunner stackutil_range_runner = 0;
+
+void setStackutilRangeRunner(StackutilRangeRunner runner)
+{
+	stackutil_range_runner = runner;
+}
+
+//nthreads==1 keeps the ranges on the calling thread, e.g. when it is itself one of many loader threads
+static void run_stackutil_ranges(V3DLONG n, StackutilRangeBody body, void * ctx, int nthreads=0)
+{
+	if (n<=0) return;
+	if (stackutil_range_runner && nthreads!=1)
+		stackutil_range_runner(n, body, ctx);
+	else
+		body(ctx, 0, n);
+}
+
+// Decode one 8/16-bit single-sample TIFF page (stripped or tiled) into a contiguous width*height buffer
+int read_tif_page_gray(TIFF *tif, unsigned char * page, V3DLONG width, V3DLONG height, int datatype)
+{
+	V3DLONG rowbytes = width*datatype;
+	if (TIFFIsTiled(tif))
+	{
+		uint32 tile_width=0, tile_height=0;
+		TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tile_width);
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &tile_height);
+		if (tile_width==0 || tile_height==0) return 1;
+
+		unsigned char *buf = (unsigned char *)_TIFFmalloc(TIFFTileSize(tif));
+		if (!buf) return 1;
+		for (V3DLONG y=0; y<height; y+=tile_height)
+		{
+			V3DLONG n = (y+tile_height>height) ? height-y : tile_height;
+			for (V3DLONG x=0; x<width; x+=tile_width)
+			{
+				if (TIFFReadTile(tif, buf, uint32(x), uint32(y), 0, 0)<0) {_TIFFfree(buf); return 1;}
+				V3DLONG m = (x+tile_width>width) ? width-x : tile_width;
+				for (V3DLONG j=0; j<n; j++)
+					memcpy(page + (y+j)*rowbytes + x*datatype, buf + j*V3DLONG(tile_width)*datatype, m*datatype);
+			}
+		}
+		_TIFFfree(buf);
+	}
+	else
+	{
+		uint32 rowsperstrip=0;
+		TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsperstrip);
+		if (rowsperstrip==0 || V3DLONG(rowsperstrip)>height) rowsperstrip = uint32(height);
+		tstrip_t s, ns = TIFFNumberOfStrips(tif);
+		for (s=0; s<ns; s++)
+		{
+			V3DLONG y = V3DLONG(s)*rowsperstrip;
+			if (y>=height) break;
+			V3DLONG n = (y+V3DLONG(rowsperstrip)>height) ? height-y : rowsperstrip;
+			if (TIFFReadEncodedStrip(tif, s, page + y*rowbytes, n*rowbytes)<0)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+// Decodes a range of pages (given by their directory offsets) straight into their place in img.
+// Every worker opens its own TIFF handle, since a handle can only be positioned at one directory;
+// plain TIFFOpen(), as the caller has opened the file already and Open_Tiff() touches mg_image_lib state.
+struct TiffPageRangeDecoder
+{
+	char * filename;
+	const std::vector<toff_t> * diroffsets; // 0 marks a page to leave empty
+	unsigned char * img;
+	V3DLONG width, height, pixel_per_slice, pixel_per_channel;
+	int datatype;
+	bool b_lsm;
+	volatile int b_error;
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		TIFF *tif = TIFFOpen(filename, "r");
+		if (!tif) {b_error=1; return;}
+		for (V3DLONG d=begin; d<end; d++)
+		{
+			if ((*diroffsets)[d]==0) continue;
+			if (!TIFFSetSubDirectory(tif, (*diroffsets)[d])) {b_error=1; break;}
+			unsigned char *page = img + d*pixel_per_slice*datatype;
+			if (b_lsm)
+				read_lsm_slice(tif, page, pixel_per_slice, pixel_per_channel, datatype);
+			else if (read_tif_page_gray(tif, page, width, height, datatype))
+				b_error=1;
+		}
+		TIFFClose(tif);
+	}
+
+	static void run(void * ctx, V3DLONG begin, V3DLONG end) {(*(TiffPageRangeDecoder *)ctx)(begin, end);}
+};
+
+// Returns 0 on success; non-zero if the file is not a plain 8/16-bit grayscale stack or cannot be read,
+// in which case the caller should fall back to a general reader.
+int loadTif2StackPageParallel(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, int & nbits, int nthreads)
+{
+	//cheap checks first, and a single TIFFOpen (not Open_Tiff, which retries with sleeps): a file
+	//that fails here goes on to the caller's own reader at no extra cost
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) return 1;
+	unsigned char magic[4] = {0, 0, 0, 0};
+	size_t nmagic = fread(magic, 1, 4, fp);
+	fclose(fp);
+	if (nmagic!=4 || !((magic[0]=='I' && magic[1]=='I' && (magic[2]==42 || magic[2]==43) && magic[3]==0) ||
+	                   (magic[0]=='M' && magic[1]=='M' && magic[2]==0 && (magic[3]==42 || magic[3]==43))))
+		return 1; //not a TIFF (42) or BigTIFF (43)
+	TIFF *tif = TIFFOpen(filename, "r");
+	if (!tif) return 1;
+
+	//first pass: index the page directories and check they all share one simple layout
+	uint32 width=0, height=0;
+	uint16 bits=0, spp=1, photo=PHOTOMETRIC_MINISBLACK, sampleformat=SAMPLEFORMAT_UINT;
+	std::vector<toff_t> diroffsets;
+	do
+	{
+		uint32 cur_width=0, cur_height=0;
+		uint16 cur_bits=0, cur_spp=1, cur_photo=PHOTOMETRIC_MINISBLACK, cur_format=SAMPLEFORMAT_UINT;
+		TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &cur_width);
+		TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &cur_height);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &cur_bits);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &cur_spp);
+		TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &cur_photo);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &cur_format);
+		if (diroffsets.empty())
+		{
+			width = cur_width; height = cur_height; bits = cur_bits; spp = cur_spp; photo = cur_photo; sampleformat = cur_format;
+		}
+		else if (cur_width!=width || cur_height!=height || cur_bits!=bits || cur_spp!=spp || cur_photo!=photo || cur_format!=sampleformat)
+		{
+			TIFFClose(tif);
+			return 1;
+		}
+		diroffsets.push_back(TIFFCurrentDirOffset(tif));
+	} while (TIFFReadDirectory(tif));
+	TIFFClose(tif);
+
+	if (width==0 || height==0 || spp!=1 || (bits!=8 && bits!=16) || photo!=PHOTOMETRIC_MINISBLACK || sampleformat!=SAMPLEFORMAT_UINT)
+		return 1;
+
+	V3DLONG depth = diroffsets.size();
+	int cur_datatype = bits/8;
+	unsigned char *cur_img = 0;
+	try
+	{
+		cur_img = new unsigned char [V3DLONG(width)*V3DLONG(height)*depth*cur_datatype];
+	}
+	catch (...)
+	{
+		fprintf(stderr, "Fail to allocate memory in loadTif2StackPageParallel().\n");
+		return 1;
+	}
+
+	TiffPageRangeDecoder decoder;
+	decoder.filename = filename;
+	decoder.diroffsets = &diroffsets;
+	decoder.img = cur_img;
+	decoder.width = width;
+	decoder.height = height;
+	decoder.pixel_per_slice = V3DLONG(width)*V3DLONG(height);
+	decoder.pixel_per_channel = decoder.pixel_per_slice*depth;
+	decoder.datatype = cur_datatype;
+	decoder.b_lsm = false;
+	decoder.b_error = 0;
+	run_stackutil_ranges(depth, TiffPageRangeDecoder::run, &decoder, nthreads);
+
+	if (decoder.b_error)
+	{
+		delete []cur_img;
+		return 1;
+	}
+
+	if (img) {delete []img; img=0;}
+	if (sz) {delete []sz; sz=0;}
+	img = cur_img;
+	sz = new V3DLONG [4];
+	sz[0] = width; sz[1] = height; sz[2] = depth; sz[3] = 1;
+	datatype = cur_datatype;
+	nbits = bits;
+	return 0;
+}
+
 int loadTif2Stack(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, int chan_id_to_load) //overload for convenience to read only 1 channel
 {
 	if (chan_id_to_load<0) {fprintf(stderr, "Chan_id_to_load < 0. Do nothing\n"); int b_error=1; return b_error;}
@@ -2071,6 +2260,11 @@ int loadTif2Stack(char * filename, unsigned char * & img, V3DLONG * & sz, int &
 	if (!tmp) {fprintf(stderr, "The file [%s] does not exist.\n", filename); b_error=1; return b_error;}
 	else {fclose(tmp);}
 
+	//plain 8/16-bit grayscale stacks are decoded page-parallel; everything else goes through Gene's reader
+	int nbits=0;
+	if (loadTif2StackPageParallel(filename, img, sz, datatype, nbits)==0)
+		return b_error;
+
 	//the following are the interface codes
 
 	Stack *tmpstack = Read_Stack(filename);
@@ -2512,22 +2706,40 @@ int loadLsm2Stack(char * filename, unsigned char * & img, V3DLONG * & sz, int &
 		return 1; //070805, by Hanchuan Peng
 	}
 
-	depth = 1;
-	while (TIFFReadDirectory(tif))
-		depth += 1;
-	TIFFClose(tif);
-
-	printf("Total # of directories is %d, half of them are thumbnails So real data have %d slices.\n", depth, depth/2);
-	depth = depth / 2;		/* half the dirs are thumbnails */
-
-	tif = Open_Tiff(filename,"r");
-    if (!tif) return 1;
 	TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
 	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
 	TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &colorchannels);
 	TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bits);
 	printf("# bits=%d\n", int(bits));
 
+	//first pass: index the data directories (every other one; the in between are thumbnails)
+	std::vector<toff_t> diroffsets;
+	short cur_colorchannels, cur_bits;
+	int cur_width, cur_height;
+	V3DLONG ndirs = 0;
+	do
+	{
+		if (ndirs%2==0)
+		{
+			TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &cur_width);
+			TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &cur_height);
+			TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &cur_colorchannels);
+			TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &cur_bits);
+			if (cur_width != width || cur_height != height || cur_colorchannels!=colorchannels || cur_bits!=bits)
+			{
+				fprintf(stderr, "The %ld Individual image slice has a different size/colorchannel/bits from the first slice!", V3DLONG(diroffsets.size()));
+				diroffsets.push_back(0); //in this case, do nothing to read the data and leave it empty
+			}
+			else
+				diroffsets.push_back(TIFFCurrentDirOffset(tif));
+		}
+		ndirs++;
+	} while (TIFFReadDirectory(tif));
+	TIFFClose(tif);
+
+	printf("Total # of directories is %ld, half of them are thumbnails So real data have %ld slices.\n", ndirs, ndirs/2);
+	depth = ndirs / 2;		/* half the dirs are thumbnails */
+
 	if (bits<=8 && bits>0) datatype=1;
 	else if (bits<=16 && bits>0) datatype=2;
 	else
@@ -2569,39 +2781,21 @@ int loadLsm2Stack(char * filename, unsigned char * & img, V3DLONG * & sz, int &
 		}
 	}
 
-	// read every other directory (real data, the in between are thumbnails
-	V3DLONG d;
-	short cur_colorchannels, cur_bits;
-	int cur_width, cur_height;
-	for (d=0;d<depth;d++)
-	{
-		TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &cur_width);
-		TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &cur_height);
-		TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &cur_colorchannels);
-		TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &cur_bits);
-		
-		//printf("d=%ld, current width=%d, height=%d, cur_colorchannels=%d, cur_bits=%d\n", d, cur_width, cur_height, cur_colorchannels, cur_bits); fflush(stdout); //080301
-
-		if (cur_width != width || cur_height != height || cur_colorchannels!=colorchannels || cur_bits!=bits)
-		{
-			fprintf(stderr, "The %ld Individual image slice has a different size/colorchannel/bits from the first slice!", d);
-			//in this case, do nothing to read the data and leave it empty
-		}
-		else
-		{
-			read_lsm_slice(tif, img+V3DLONG(d)*V3DLONG(pixel_per_slice)*V3DLONG(datatype), pixel_per_slice, pixel_per_channel, datatype);
-		}
-
-		if (d==depth-1)
-			break; //no need to do read directory anymore once the last one is read
-		else
-		{
-			if (!TIFFReadDirectory(tif)) break;	  /* skip the one we just read, it's a thumbnail  */
-			if (!TIFFReadDirectory(tif)) break;	  /* get the next slice  */
-		}
-	}
-
-	TIFFClose(tif);
+	// decode the data pages in parallel, each straight to its z offset
+	TiffPageRangeDecoder decoder;
+	decoder.filename = filename;
+	decoder.diroffsets = &diroffsets;
+	decoder.img = img;
+	decoder.width = width;
+	decoder.height = height;
+	decoder.pixel_per_slice = pixel_per_slice;
+	decoder.pixel_per_channel = pixel_per_channel;
+	decoder.datatype = datatype;
+	decoder.b_lsm = true;
+	decoder.b_error = 0;
+	run_stackutil_ranges(depth, TiffPageRangeDecoder::run, &decoder);
+	if (decoder.b_error)
+		fprintf(stderr, "Some slices of the LSM file could not be read in loadLsm2Stack().\n");
 
 	//return (stack);
 	return berror;
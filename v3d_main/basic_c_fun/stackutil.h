@@ -49,6 +49,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
  * 100519: add v3d_basicdatatype.h
  * 100817: add mylib interface, PHC
  * 150507: add nrrd support, PHC
+ * 20261019: add page-parallel TIF stack reading
  */
 
 #ifndef __STACKUTIL__
@@ -95,6 +96,13 @@ char checkMachineEndian();
 //use libtiff to read tiff files. MUST < 2G
 int loadTif2Stack(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype);
 int loadTif2Stack(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, int chan_id_to_load); //overload for convenience to read only 1 channel
+int loadTif2StackPageParallel(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, int & nbits, int nthreads=0); //8/16-bit grayscale stacks only; non-zero return means use another reader; nthreads==1 decodes on the calling thread
+
+//the page-parallel TIF/LSM readers hand their page ranges to a runner: body(ctx, begin, end) for
+//disjoint ranges covering [0, n). Without one they run serially; basic_4dimage.cpp installs a thread pool.
+typedef void (*StackutilRangeBody)(void * ctx, V3DLONG begin, V3DLONG end);
+typedef void (*StackutilRangeRunner)(V3DLONG n, StackutilRangeBody body, void * ctx);
+void setStackutilRangeRunner(StackutilRangeRunner runner);
 int saveStack2Tif(const char * filename, const unsigned char * img, const V3DLONG * sz, int datatype);
 
 //the following two functions are the major routines to load LSM file using libtiff, the file should have a size < 2G
@@ -121,6 +129,7 @@ int read_tif_slice(TIFF *tif, unsigned char * pointer_first_page, V3DLONG width,
 
 int read_tif_slice_strip(TIFF *in, unsigned char * pointer_first_page, V3DLONG pagepixelnumber, V3DLONG channelpixelnumber, int datatype);
 int read_tif_slice_tile(TIFF *in, unsigned char * pointer_first_page, V3DLONG pagepixelnumber, V3DLONG channelpixelnumber, int datatype);
+int read_tif_page_gray(TIFF *tif, unsigned char * page, V3DLONG width, V3DLONG height, int datatype);
 
 int loadRawSlice(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, V3DLONG sliceno, bool b_thumbnail);
 int loadRawSlice_2byte(char * filename, unsigned char * & img, V3DLONG * & sz, int & datatype, V3DLONG sliceno, bool b_thumbnail);
@@ -40,6 +40,8 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #define __BASIC_VOLUME_IMG_PROCESSING__
 
 #include "volimg_proc_declare.h"
+#include "basic_resample.h"
+#include "basic_volexpr.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -59,24 +61,14 @@ template <class T> void swapValue(T & a, T & b)
 }
 
 
+//the vol3d_* functions evaluate through basic_volexpr.h: one parallel pass each, computed in double as before
+
 template <class T> bool vol3d_assign(T *** res, T v, V3DLONG d0, V3DLONG d1, V3DLONG d2)
 {
 	if (!res || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = v;
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_const(double(v)));
 }
 
 template <class T> bool vol3d_assign(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -84,19 +76,7 @@ template <class T> bool vol3d_assign(T *** res, T *** sa, V3DLONG d0, V3DLONG d1
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = sa[k][j][i];
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2));
 }
 
 template <class T> bool vol3d_negative(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -104,19 +84,7 @@ template <class T> bool vol3d_negative(T *** res, T *** sa, V3DLONG d0, V3DLONG
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(-double(sa[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), -v3d_vol(sa, d0, d1, d2));
 }
 
 template <class T> bool vol3d_inverse(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -124,19 +92,7 @@ template <class T> bool vol3d_inverse(T *** res, T *** sa, V3DLONG d0, V3DLONG d
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(1.0/double(sa[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_inverse(v3d_vol(sa, d0, d1, d2)));
 }
 
 template <class T> bool vol3d_square(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -144,21 +100,7 @@ template <class T> bool vol3d_square(T *** res, T *** sa, V3DLONG d0, V3DLONG d1
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	double tmp;
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				tmp = double(sa[k][j][i]);
-				res[k][j][i] = (T)(tmp*tmp);
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_square(v3d_vol(sa, d0, d1, d2)));
 }
 
 template <class T> bool vol3d_root(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -166,19 +108,7 @@ template <class T> bool vol3d_root(T *** res, T *** sa, V3DLONG d0, V3DLONG d1,
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)sqrt(double(sa[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_sqrt(v3d_vol(sa, d0, d1, d2)));
 }
 
 template <class T> bool vol3d_exp(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -186,19 +116,7 @@ template <class T> bool vol3d_exp(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)exp(double(sa[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_exp(v3d_vol(sa, d0, d1, d2)));
 }
 
 template <class T> bool vol3d_log(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -206,19 +124,7 @@ template <class T> bool vol3d_log(T *** res, T *** sa, V3DLONG d0, V3DLONG d1, V
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)log(double(sa[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_log(v3d_vol(sa, d0, d1, d2)));
 }
 
 
@@ -227,20 +133,9 @@ template <class T> bool vol3d_min(T & res, T *** sa, V3DLONG d0, V3DLONG d1, V3D
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	double v;
-	V3DLONG i,j,k;
-	v = (double)sa[0][0][0];
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				v = (double(sa[k][j][i]) < v) ? double(sa[k][j][i]) : v;
-			}
-		}
-	}
-	res = (T)v;
+	double vm, vM;
+	v3d_vol_minmax(v3d_vol(sa, d0, d1, d2), V3dVolBox(d0, d1, d2), vm, vM);
+	res = (T)vm;
 
 	return true;
 }
@@ -250,20 +145,9 @@ template <class T> bool vol3d_max(T & res, T *** sa, V3DLONG d0, V3DLONG d1, V3D
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	double v;
-	V3DLONG i,j,k;
-	v = (double)sa[0][0][0];
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				v = (double(sa[k][j][i]) > v) ? double(sa[k][j][i]) : v;
-			}
-		}
-	}
-	res = (T)v;
+	double vm, vM;
+	v3d_vol_minmax(v3d_vol(sa, d0, d1, d2), V3dVolBox(d0, d1, d2), vm, vM);
+	res = (T)vM;
 
 	return true;
 }
@@ -275,51 +159,14 @@ template <class T> bool vol3d_scale_01(T *** res, T *** sa, V3DLONG d0, V3DLONG
 		return false;
 
 	double vm, vM;
-	V3DLONG i,j,k;
-	vm = (double)sa[0][0][0];
-	vM = (double)sa[0][0][0];
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				vm = (double(sa[k][j][i]) < vm) ? double(sa[k][j][i]) : vm;
-				vM = (double(sa[k][j][i]) > vM) ? double(sa[k][j][i]) : vM;
-			}
-		}
-	}
+	v3d_vol_minmax(v3d_vol(sa, d0, d1, d2), V3dVolBox(d0, d1, d2), vm, vM);
 
 	double L = vM-vm;
 
 	if (L==0.0)
-	{
-		for (k=0;k<d2;k++)
-		{
-			for (j=0;j<d1;j++)
-			{
-				for (i=0;i<d0;i++)
-				{
-					res[k][j][i] = (T)0;
-				}
-			}
-		}
-	}
+		return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol_const(0));
 	else
-	{
-		for (k=0;k<d2;k++)
-		{
-			for (j=0;j<d1;j++)
-			{
-				for (i=0;i<d0;i++)
-				{
-					res[k][j][i] = (T)((double(res[k][j][i])-vm)/L);
-				}
-			}
-		}
-	}
-
-	return true;
+		return v3d_vol_assign(v3d_vol(res, d0, d1, d2), (v3d_vol(res, d0, d1, d2) - vm) / L);
 }
 
 template <class T> bool vol3d_sum(T & res, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -327,20 +174,7 @@ template <class T> bool vol3d_sum(T & res, T *** sa, V3DLONG d0, V3DLONG d1, V3D
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	double v;
-	V3DLONG i,j,k;
-	v = (double)0;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				v += double(sa[k][j][i]);
-			}
-		}
-	}
-	res = (T)v;
+	res = (T)v3d_vol_sum(v3d_vol(sa, d0, d1, d2), V3dVolBox(d0, d1, d2));
 
 	return true;
 }
@@ -351,19 +185,7 @@ template <class T> bool vol3d_mean(T & res, T *** sa, V3DLONG d0, V3DLONG d1, V3
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	double v;
-	V3DLONG i,j,k;
-	v = (double)0;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				v += double(sa[k][j][i]);
-			}
-		}
-	}
+	double v = v3d_vol_sum(v3d_vol(sa, d0, d1, d2), V3dVolBox(d0, d1, d2));
 	res = (T)(v/(double(d0)*d1*d2));
 
 	return true;
@@ -374,39 +196,11 @@ template <class T> bool vol3d_threshold(T *** res, V3DLONG d0, V3DLONG d1, V3DLO
 	if (!res || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
+	V3dVolExpr< V3dVolLeaf<T> > v = v3d_vol(res, d0, d1, d2);
 	if (b_set_to_binary==false)
-	{
-		for (k=0;k<d2;k++)
-		{
-			for (j=0;j<d1;j++)
-			{
-				for (i=0;i<d0;i++)
-				{
-					if (res[k][j][i]<thres)
-					  res[k][j][i] = (T)0;
-				}
-			}
-		}
-	}
+		return v3d_vol_assign(v, v3d_vol_where(v < double(thres), v3d_vol_const(0), v));
 	else
-	{
-		for (k=0;k<d2;k++)
-		{
-			for (j=0;j<d1;j++)
-			{
-				for (i=0;i<d0;i++)
-				{
-					if (res[k][j][i]<thres)
-					  res[k][j][i] = (T)0;
-					else
-					  res[k][j][i] = (T)1;
-				}
-			}
-		}
-	}
-
-	return true;
+		return v3d_vol_assign(v, v3d_vol_where(v < double(thres), v3d_vol_const(0), v3d_vol_const(1)));
 }
 
 template <class T> bool vol3d_nnz(V3DLONG &nnz, T *** sa, V3DLONG d0, V3DLONG d1, V3DLONG d2, V3DLONG d0b, V3DLONG d0e, V3DLONG d1b, V3DLONG d1e, V3DLONG d2b, V3DLONG d2e)
@@ -419,18 +213,7 @@ template <class T> bool vol3d_nnz(V3DLONG &nnz, T *** sa, V3DLONG d0, V3DLONG d1
 	    d2b<0 || d2b>=d2 || d2e<0 || d2e>=d2 || d2b>d2e)
 		return false;
 
-	V3DLONG i,j,k;
-	nnz=0;
-	for (k=d2b;k<=d2e;k++)
-	{
-		for (j=d1b;j<=d1e;j++)
-		{
-			for (i=d0b;i<=d0e;i++)
-			{
-				if (sa[k][j][i]) nnz++;
-			}
-		}
-	}
+	nnz = v3d_vol_nnz(v3d_vol(sa, d0, d1, d2), V3dVolBox(d0b, d0e+1, d1b, d1e+1, d2b, d2e+1));
 
 	return true;
 }
@@ -441,19 +224,7 @@ template <class T> bool vol3d_plus(T *** res, T *** sa, T *** sb, V3DLONG d0, V3
 	if (!res || !sa || !sb || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(double(sa[k][j][i]) + double(sb[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2) + v3d_vol(sb, d0, d1, d2));
 }
 
 template <class T> bool vol3d_plus_constant(T *** res, T *** sa, double c, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -461,19 +232,7 @@ template <class T> bool vol3d_plus_constant(T *** res, T *** sa, double c, V3DLO
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(double(sa[k][j][i]) + c);
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2) + c);
 }
 
 template <class T> bool vol3d_minus(T *** res, T *** sa, T *** sb, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -481,19 +240,7 @@ template <class T> bool vol3d_minus(T *** res, T *** sa, T *** sb, V3DLONG d0, V
 	if (!res || !sa || !sb || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(double(sa[k][j][i]) - double(sb[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2) - v3d_vol(sb, d0, d1, d2));
 }
 
 template <class T> bool vol3d_time(T *** res, T *** sa, T *** sb, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -501,19 +248,7 @@ template <class T> bool vol3d_time(T *** res, T *** sa, T *** sb, V3DLONG d0, V3
 	if (!res || !sa || !sb || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(double(sa[k][j][i]) * double(sb[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2) * v3d_vol(sb, d0, d1, d2));
 }
 
 template <class T> bool vol3d_time_constant(T *** res, T *** sa, double c, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -521,19 +256,7 @@ template <class T> bool vol3d_time_constant(T *** res, T *** sa, double c, V3DLO
 	if (!res || !sa || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(double(sa[k][j][i]) * c);
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2) * c);
 }
 
 template <class T> bool vol3d_divide(T *** res, T *** sa, T *** sb, V3DLONG d0, V3DLONG d1, V3DLONG d2)
@@ -541,19 +264,7 @@ template <class T> bool vol3d_divide(T *** res, T *** sa, T *** sb, V3DLONG d0,
 	if (!res || !sa || !sb || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				res[k][j][i] = (T)(double(sa[k][j][i])/double(sb[k][j][i]));
-			}
-		}
-	}
-
-	return true;
+	return v3d_vol_assign(v3d_vol(res, d0, d1, d2), v3d_vol(sa, d0, d1, d2) / v3d_vol(sb, d0, d1, d2));
 }
 
 
@@ -562,21 +273,7 @@ template <class T> bool vol3d_square_root_diff(double & res, T *** sa, T *** sb,
 	if (!sa || !sb || d0<=0 || d1<=0 || d2<=0)
 		return false;
 
-	V3DLONG i,j,k;
-	double tmp;
-	res = 0.0;
-	for (k=0;k<d2;k++)
-	{
-		for (j=0;j<d1;j++)
-		{
-			for (i=0;i<d0;i++)
-			{
-				tmp = (double(sa[k][j][i]) - double(sb[k][j][i]));
-				res += tmp*tmp;
-			}
-		}
-	}
-	res = sqrt(res);
+	res = sqrt(v3d_vol_sum(v3d_vol_square(v3d_vol(sa, d0, d1, d2) - v3d_vol(sb, d0, d1, d2)), V3dVolBox(d0, d1, d2)));
 
 	return true;
 }
@@ -586,9 +283,6 @@ template <class T1, class T2> bool mean_and_std(T1 *data, V3DLONG n, T2 & ave, T
     if (!data || n<=0)
 	  return false;
 
-	int j;
-	double ep=0.0,s,p;
-
 	if (n <= 1)
 	{
 	  //printf("len must be at least 2 in mean_and_std\n");
@@ -597,42 +291,29 @@ template <class T1, class T2> bool mean_and_std(T1 *data, V3DLONG n, T2 & ave, T
 	  return true; //do nothing
 	}
 
-	s=0.0;
-	for (j=0;j<n;j++) s += data[j];
+	V3dVolExpr< V3dVolLeaf<T1> > v = v3d_vol(data, n);
+	V3dVolBox box(n, 1, 1);
+
+	double s = v3d_vol_sum(v, box);
 	double ave_double=(T2)(s/n); //use ave_double for the best accuracy
 
-	double var=0.0;
-	for (j=0;j<n;j++) {
-		s=data[j]-(ave_double);
-		var += (p=s*s);
-	}
-	var=(var-ep*ep/n)/(n-1);
+	double var = v3d_vol_sum(v3d_vol_square(v - ave_double), box);
+	var=var/(n-1);
 	sdev=(T2)(sqrt(var));
 	ave=(T2)ave_double; //use ave_double for the best accuracy
 
 	return true;
 }
 
-template <class T> bool mean_and_std(T *data, V3DLONG n, T & ave, T & sdev, T maskval)
+//the masked versions below: sums of the values kept by mask (1 where used) and of the mask itself in one pass, then the variance
+template <class T, class M> bool mean_and_std_masked(T *data, V3DLONG n, T & ave, T & sdev, const V3dVolExpr<M> & mask)
 {
-    if (!data || n<=0)
-	  return false;
-
-	int j;
-	double ep=0.0,s,p;
-
-	if (n <= 1)
-	{
-	  //printf("len must be at least 2 in mean_and_std\n");
-	  ave = data[0];
-	  sdev = (T)0;
-	  return true; //do nothing
-	}
+	V3dVolExpr< V3dVolLeaf<T> > v = v3d_vol(data, n);
+	V3dVolBox box(n, 1, 1);
 
-	V3DLONG n_use;
-
-	s=0.0;
-	for (j=0, n_use=0;j<n;j++) {if (data[j]!=maskval) {s += data[j]; n_use++;}}
+	V3dVolSum2::State sn = v3d_vol_reduce(V3dVolSum2(), v3d_vol_pair(mask, v3d_vol_where(mask, v, 0.0)), box);
+	V3DLONG n_use = V3DLONG(sn.a);
+	double s = sn.b;
 	if (n_use<=0)
 	{
 	  ave = data[0];
@@ -648,30 +329,19 @@ template <class T> bool mean_and_std(T *data, V3DLONG n, T & ave, T & sdev, T ma
 
 	double ave_double=(T)(s/n_use); //use ave_double for the best accuracy
 
-	double var=0.0;
-	for (j=0;j<n;j++)
-	{
-	    if (data[j]!=maskval)
-		{
-			s=data[j]-(ave_double);
-			var += (p=s*s);
-		}
-	}
-	var=(var-ep*ep/n_use)/(n_use-1);
+	double var = v3d_vol_sum(v3d_vol_where(mask, v3d_vol_square(v - ave_double), 0.0), box);
+	var=var/(n_use-1);
 	sdev=(T)(sqrt(var));
 	ave=(T)ave_double; //use ave_double for the best accuracy
 
 	return true;
 }
 
-template <class T> bool mean_and_std(T *data, V3DLONG n, T & ave, T & sdev, T maskval_lowerbound, T maskval_upperbound)
+template <class T> bool mean_and_std(T *data, V3DLONG n, T & ave, T & sdev, T maskval)
 {
     if (!data || n<=0)
 	  return false;
 
-	int j;
-	double ep=0.0,s,p;
-
 	if (n <= 1)
 	{
 	  //printf("len must be at least 2 in mean_and_std\n");
@@ -680,41 +350,26 @@ template <class T> bool mean_and_std(T *data, V3DLONG n, T & ave, T & sdev, T ma
 	  return true; //do nothing
 	}
 
-	V3DLONG n_use;
+	return mean_and_std_masked(data, n, ave, sdev, v3d_vol(data, n) != double(maskval));
+}
 
-	if (maskval_lowerbound>maskval_upperbound) {T tmp=maskval_lowerbound; maskval_lowerbound=maskval_upperbound; maskval_upperbound=tmp;} //070528: assure the range is valid
+template <class T> bool mean_and_std(T *data, V3DLONG n, T & ave, T & sdev, T maskval_lowerbound, T maskval_upperbound)
+{
+    if (!data || n<=0)
+	  return false;
 
-	s=0.0;
-	for (j=0, n_use=0;j<n;j++) {if (data[j]<maskval_lowerbound || data[j]>maskval_upperbound) {s += data[j]; n_use++;}}
-	if (n_use<=0)
+	if (n <= 1)
 	{
+	  //printf("len must be at least 2 in mean_and_std\n");
 	  ave = data[0];
 	  sdev = (T)0;
-	  return true; //do nothing if everything is equal maskval
-	}
-	if (n_use==1)
-	{
-	  ave=s;
-	  sdev = T(0);
-	  return true; //do nothing if there is only one 1 value
+	  return true; //do nothing
 	}
 
-	double ave_double=(T)(s/n_use); //use ave_double for the best accuracy
-
-	double var=0.0;
-	for (j=0;j<n;j++)
-	{
-	    if (data[j]<maskval_lowerbound || data[j]>maskval_upperbound)
-		{
-			s=data[j]-(ave_double);
-			var += (p=s*s);
-		}
-	}
-	var=(var-ep*ep/n_use)/(n_use-1);
-	sdev=(T)(sqrt(var));
-	ave=(T)ave_double; //use ave_double for the best accuracy
+	if (maskval_lowerbound>maskval_upperbound) {T tmp=maskval_lowerbound; maskval_lowerbound=maskval_upperbound; maskval_upperbound=tmp;} //070528: assure the range is valid
 
-	return true;
+	V3dVolExpr< V3dVolLeaf<T> > v = v3d_vol(data, n);
+	return mean_and_std_masked(data, n, ave, sdev, (v < double(maskval_lowerbound)) || (v > double(maskval_upperbound)));
 }
 
 template <class T> void moment(T *data, V3DLONG n, double & ave, double & adev, double & sdev, double & var, double & skew, double & curt)
@@ -952,79 +607,13 @@ template <class T> bool downsample3dimg_1dpt(T * & img, V3DLONG * sz, double dfa
 		return false;
 	}
 
-	T * outimg = new T [cur_sz0 * cur_sz1 * cur_sz2 * cur_sz3];
-	if (!outimg)
-	{
-		fprintf(stderr, "Fail to allocate memory. [%s][%d].\n", __FILE__, __LINE__);
-		return false;
-	}
-
-	T **** out_tmp4d = 0;
-	T **** in_tmp4d = 0;
-
-	new4dpointer(out_tmp4d, cur_sz0, cur_sz1, cur_sz2, cur_sz3, outimg);
-	new4dpointer(in_tmp4d, sz[0], sz[1], sz[2], sz[3], img);
-
-    for (V3DLONG c=0;c<cur_sz3;c++)
-	{
-		for (V3DLONG k=0;k<cur_sz2;k++)
-		{
-			//V3DLONG k2low=V3DLONG(floor(k*dfactor)), k2high=V3DLONG(floor((k+1)*dfactor-1));
-			V3DLONG k2low=k, k2high=k; //do not downsampling z, 070927
-			if (k2high>sz[2]-1) k2high = sz[2]-1;
-			V3DLONG kw = k2high - k2low + 1;
-
-			for (V3DLONG j=0;j<cur_sz1;j++)
-			{
-				//V3DLONG j2low=V3DLONG(floor(j*dfactor)), j2high=V3DLONG(floor((j+1)*dfactor-1));
-				V3DLONG j2low=V3DLONG(floor(j*dfactor)); V3DLONG j2high=V3DLONG(floor((j+1)*dfactor-1));
-				if (j2high>sz[1]-1) j2high = sz[1]-1;
-				V3DLONG jw = j2high - j2low + 1;
-
-				for (V3DLONG i=0;i<cur_sz0;i++)
-				{
-					//V3DLONG i2low=V3DLONG(floor(i*dfactor)), i2high=V3DLONG(floor((i+1)*dfactor-1));
-					V3DLONG i2low=V3DLONG(floor(i*dfactor)); V3DLONG i2high=V3DLONG(floor((i+1)*dfactor-1));
-					if (i2high>sz[0]-1) i2high = sz[0]-1;
-					V3DLONG iw = i2high - i2low + 1;
-
-					double cubevolume = double(kw) * jw * iw;
-					//cout<<cubevolume <<" ";
-
-					double s=0.0;
-					for (V3DLONG k1=k2low;k1<=k2high;k1++)
-					{
-						for (V3DLONG j1=j2low;j1<=j2high;j1++)
-						{
-							for (V3DLONG i1=i2low;i1<=i2high;i1++)
-							{
-								s += in_tmp4d[c][k1][j1][i1];
-							}
-						}
-					}
-
-					out_tmp4d[c][k][j][i] = (T)(s/cubevolume);
-				}
-			}
-		}
-	}
-
-	//delete temprary 4d pointers
+	//average the dfactor x dfactor boxes of each xy plane, z is not downsampled (070927)
+	V3dResampleAxis ax, ay, az;
+	ax.set(sz[0], cur_sz0, dfactor, V3D_RESAMPLE_AREA);
+	ay.set(sz[1], cur_sz1, dfactor, V3D_RESAMPLE_AREA);
+	az.set(sz[2], cur_sz2, 1, V3D_RESAMPLE_NEAREST);
 
-	delete4dpointer(out_tmp4d, cur_sz0, cur_sz1, cur_sz2, cur_sz3);
-	delete4dpointer(in_tmp4d, sz[0], sz[1], sz[2], sz[3]);
-
-	//copy to output data
-
-	delete []img;
-	img = outimg;
-
-	sz[0] = cur_sz0;
-	sz[1] = cur_sz1;
-	sz[2] = cur_sz2;
-	sz[3] = cur_sz3;
-
-	return true;
+	return v3d_resample3d(img, sz, ax, ay, az);
 }
 
 
@@ -1034,167 +623,46 @@ template <class T> bool reslice_Z(T * & invol1d, V3DLONG * sz, double xy_rez, do
 {
   //check if parameters are correct
 
-  V3DLONG i,j,k,c;
-
-  //get image
-
   if (!invol1d || sz[0]*sz[1]*sz[2]*sz[3]<=0 || xy_rez<=0 || z_rez<=0)
   {
     fprintf(stderr,"You have provided illgeal parameters to reslice_Z().\n");
 	return false;
   }
 
-  if (interp_method!=0 && interp_method!=1) //0 for nearest neighbor interp and 1 for linear
+  if (interp_method!=V3D_RESAMPLE_NEAREST && interp_method!=V3D_RESAMPLE_LINEAR && interp_method!=V3D_RESAMPLE_CUBIC) //0 for nearest neighbor interp, 1 for linear and 2 for cubic
   {
     fprintf(stderr,"You have provided illgeal interp_method parameters to reslice_Z() [you pass a code %d].\n", interp_method);
 	return false;
   }
 
+  //output slice i is at z = i*z_rez_new/z_rez of the input, clamped to the last slice (100831, by PHC)
 
-  //==================== set up the input and output volume matrix =====================
-
-  V3DLONG xlen_out = sz[0];
-  V3DLONG ylen_out = sz[1];
   V3DLONG zlen_out = V3DLONG((double(sz[2]) * z_rez)/xy_rez + 0.5); //if use ceil() then rish having no value at the border //remove sz[2]-1 on 100831, by PHC
   double z_rez_new = xy_rez;
-  V3DLONG clen_out = sz[3];
-
-  T * outvol1d = 0;
-  T **** outvol4d=0, ****invol4d=0;
-
-  try
+  if (zlen_out<=0)
   {
-  outvol1d =  new T [xlen_out*ylen_out*zlen_out*clen_out];
-  if (!outvol1d)
-  {
-    fprintf(stderr,"Fail to allocate memory for the output volume 1d in reslice_Z().\n");
+    fprintf(stderr,"The resliced volume would have no slice in reslice_Z().\n");
 	return false;
   }
 
-  new4dpointer(invol4d, sz[0], sz[1], sz[2], sz[3], invol1d);
-  new4dpointer(outvol4d, xlen_out, ylen_out, zlen_out, clen_out, outvol1d);
-  if (!invol4d || !outvol4d)
-  {
-    if (invol4d) {delete4dpointer(invol4d, sz[0], sz[1], sz[2], sz[3]); invol4d=0;}
-	if (outvol4d) {delete4dpointer(outvol4d, xlen_out, ylen_out, zlen_out, clen_out); outvol4d=0;}
-    fprintf(stderr,"Fail to allocate memory for the input/output volumes 4d in reslice_Z().\n");
-	return false;
-  }
-  }
-  catch(...)
-  {
-  fprintf(stderr, "Unable to allocate mmeory in reslice_Z().\n");
-  return false;
-  }
+  V3dResampleAxis ax, ay, az;
+  ax.set(sz[0], sz[0], 1, V3D_RESAMPLE_NEAREST);
+  ay.set(sz[1], sz[1], 1, V3D_RESAMPLE_NEAREST);
+  az.set(sz[2], zlen_out, z_rez_new/z_rez, interp_method);
 
   printf("#original slice=%ld original rez=%6.5f -> #output slices=%ld new rez=%6.5f\n", sz[2], z_rez, zlen_out, z_rez_new);
-  //return;
-
-  //============ generate linear interpolation ===================
 
-  if (interp_method==1) //linear interp
+  if (!v3d_resample3d(invol1d, sz, ax, ay, az))
   {
-	  for (c=0; c<clen_out; c++)
-	  {
-		  for (i=0; i<zlen_out; i++)
-		  {
-			  double curpz = double(i)*z_rez_new/z_rez;
-			  if (curpz>=sz[2]-1) curpz=sz[2]-1; //100831, by PHC
-			  
-			  V3DLONG cpz0 = (V3DLONG)(floor(curpz)), cpz1 = (V3DLONG)(ceil(curpz));
-
-			  if (cpz0==cpz1)
-			  {
-				  for (j=0;j<ylen_out; j++)
-				  {
-					for (k=0; k<xlen_out; k++)
-					{
-						outvol4d[c][i][j][k] = invol4d[c][cpz0][j][k];
-					}
-				  }
-			  }
-			  else
-			  {
-				  double w0z = (cpz1-curpz);
-				  double w1z = (curpz-cpz0);
-
-				  for (j=0;j<ylen_out; j++)
-				  {
-					for (k=0; k<xlen_out; k++)
-					{
-						outvol4d[c][i][j][k] = (T)(w0z * double(invol4d[c][cpz0][j][k]) + w1z * double(invol4d[c][cpz1][j][k]));
-					}
-				  }
-			  }
-
-		  }
-	  }
-  }
-  else //nearest neighbor interp
-  {
-	  for (c=0; c<clen_out; c++)
-	  {
-		  for (i=0; i<zlen_out; i++)
-		  {
-			  double curpz = double(i)*z_rez_new/z_rez;
-			  if (curpz>=sz[2]-1) curpz=sz[2]-1; //100831, by PHC
-
-			  V3DLONG cpz0 = (V3DLONG)(floor(curpz)), cpz1 = (V3DLONG)(ceil(curpz));
-
-			  if (cpz0==cpz1)
-			  {
-				  for (j=0;j<ylen_out; j++)
-				  {
-					for (k=0; k<xlen_out; k++)
-					{
-						outvol4d[c][i][j][k] = invol4d[c][cpz0][j][k];
-					}
-				  }
-			  }
-			  else
-			  {
-				  double w0z = (cpz1-curpz);
-				  double w1z = (curpz-cpz0);
-
-				  if (w0z>=w1z) //note >= condition so that to handle the case of x2 zoom-in
-				  {
-					  for (j=0;j<ylen_out; j++)
-					  {
-						for (k=0; k<xlen_out; k++)
-						{
-							outvol4d[c][i][j][k] = invol4d[c][cpz0][j][k];
-						}
-					  }
-				  }
-				  else
-				  {
-					  for (j=0;j<ylen_out; j++)
-					  {
-						for (k=0; k<xlen_out; k++)
-						{
-							outvol4d[c][i][j][k] = invol4d[c][cpz1][j][k];
-						}
-					  }
-				  }
-			  }
-		  }
-	  }
+    fprintf(stderr, "Unable to allocate mmeory in reslice_Z().\n");
+	return false;
   }
 
-  // ====free memory=============
-  if (invol4d) {delete4dpointer(invol4d, sz[0], sz[1], sz[2], sz[3]); invol4d=0;}
-  if (outvol4d) {delete4dpointer(outvol4d, xlen_out, ylen_out, zlen_out, clen_out); outvol4d=0;}
-
-  //update the output pointer and size of Z
-  delete []invol1d;
-  invol1d = outvol1d;
-
-  sz[2] = zlen_out;
-
   return true;
 }
 
 //re-sampling data volume with different scaling factors of different axes
+//interp_method is a V3dResampleMethod; with linear interpolation the DOWN-sampled axes average their input boxes, as before
 template <class T> bool resample3dimg_interp(T * & img, V3DLONG * sz, double dfactor_x, double dfactor_y, double dfactor_z, int interp_method)
 {
 	if (!img || !sz)
@@ -1203,9 +671,9 @@ template <class T> bool resample3dimg_interp(T * & img, V3DLONG * sz, double dfa
 		return false;
 	}
 
-	if (dfactor_x<1 || dfactor_y<1 || dfactor_z<1)
+	if (!(dfactor_x>0) || !(dfactor_y>0) || !(dfactor_z>0))
 	{
-		fprintf(stderr, "The resampling factor must be >1 in resample3dimg_linear_interp(), because now only DOWN-sampling is supported [%s][%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "The resampling factors must be >0 in resample3dimg_interp() [%s][%d].\n", __FILE__, __LINE__);
 		return false;
 	}
 
@@ -1215,9 +683,9 @@ template <class T> bool resample3dimg_interp(T * & img, V3DLONG * sz, double dfa
 		return false;
 	}
 
-	if (interp_method!=1) //0 for nearest neighbor interp and 1 for linear
+	if (interp_method<V3D_RESAMPLE_NEAREST || interp_method>V3D_RESAMPLE_AREA) //0 nearest neighbor, 1 linear, 2 cubic, 3 area averaging
 	{
-		fprintf(stderr,"Invalid interpolation code. Now only linear interpolation is supported in  resample3dimg_linear_interp() [you pass a code %d].\n", interp_method);
+		fprintf(stderr,"Invalid interpolation code in resample3dimg_interp() [you pass a code %d].\n", interp_method);
 		return false;
 	}
 
@@ -1232,76 +700,14 @@ template <class T> bool resample3dimg_interp(T * & img, V3DLONG * sz, double dfa
 		return false;
 	}
 
-	T * outimg = new T [cur_sz0 * cur_sz1 * cur_sz2 * cur_sz3];
-	if (!outimg)
-	{
-		fprintf(stderr, "Fail to allocate memory. [%s][%d].\n", __FILE__, __LINE__);
-		return false;
-	}
-
-	T **** out_tmp4d = 0;
-	T **** in_tmp4d = 0;
-
-	new4dpointer(out_tmp4d, cur_sz0, cur_sz1, cur_sz2, cur_sz3, outimg);
-	new4dpointer(in_tmp4d, sz[0], sz[1], sz[2], sz[3], img);
-
-    for (V3DLONG c=0;c<cur_sz3;c++)
-	{
-		for (V3DLONG k=0;k<cur_sz2;k++)
-		{
-			V3DLONG k2low=(V3DLONG)(floor(k*dfactor_z)), k2high=(V3DLONG)(floor((k+1)*dfactor_z-1));
-			if (k2high>sz[2]-1) k2high = sz[2]-1;
-			V3DLONG kw = k2high - k2low + 1;
-
-			for (V3DLONG j=0;j<cur_sz1;j++)
-			{
-				V3DLONG j2low=(V3DLONG)(floor(j*dfactor_y)), j2high=(V3DLONG)(floor((j+1)*dfactor_y-1));
-				if (j2high>sz[1]-1) j2high = sz[1]-1;
-				V3DLONG jw = j2high - j2low + 1;
-
-				for (V3DLONG i=0;i<cur_sz0;i++)
-				{
-					V3DLONG i2low=(V3DLONG)(floor(i*dfactor_x)), i2high=(V3DLONG)(floor((i+1)*dfactor_x-1));
-					if (i2high>sz[0]-1) i2high = sz[0]-1;
-					V3DLONG iw = i2high - i2low + 1;
-
-					double cubevolume = double(kw) * jw * iw;
-					//cout<<cubevolume <<" ";
-
-					double s=0.0;
-					for (V3DLONG k1=k2low;k1<=k2high;k1++)
-					{
-						for (V3DLONG j1=j2low;j1<=j2high;j1++)
-						{
-							for (V3DLONG i1=i2low;i1<=i2high;i1++)
-							{
-								s += in_tmp4d[c][k1][j1][i1];
-							}
-						}
-					}
-
-					out_tmp4d[c][k][j][i] = (T)(s/cubevolume);
-				}
-			}
-		}
-	}
-
-	//delete temprary 4d pointers
-
-	delete4dpointer(out_tmp4d, cur_sz0, cur_sz1, cur_sz2, cur_sz3);
-	delete4dpointer(in_tmp4d, sz[0], sz[1], sz[2], sz[3]);
+	int method = (interp_method==V3D_RESAMPLE_LINEAR) ? V3D_RESAMPLE_AREA : interp_method; //area falls back to linear where step<=1
 
-	//copy to output data
+	V3dResampleAxis ax, ay, az;
+	ax.set(sz[0], cur_sz0, dfactor_x, method);
+	ay.set(sz[1], cur_sz1, dfactor_y, method);
+	az.set(sz[2], cur_sz2, dfactor_z, method);
 
-	delete []img;
-	img = outimg;
-
-	sz[0] = cur_sz0;
-	sz[1] = cur_sz1;
-	sz[2] = cur_sz2;
-	sz[3] = cur_sz3;
-
-	return true;
+	return v3d_resample3d(img, sz, ax, ay, az);
 }
 
 template <class T> double calCorrelation(T * img1, T * img2, V3DLONG imglen)
@@ -6,6 +6,7 @@
 #include "CellCounter3D.h"
 #include "../v3d/v3d_core.h"
 
+#include "../neuron_annotator/analysis/DilationErosion.h"
 #include "../neuron_annotator/analysis/SleepThread.h" //added by PHC, 20130521, to avoid a linking error on Windows
 /*  //commented by PHC, 20130521, to avoid a linking error on Windows
 class SleepThread : QThread {
@@ -551,30 +552,10 @@ void CellCounter3D::markImage() {
 
 void CellCounter3D::dialateOrErode(int type, unsigned char*** s, unsigned char*** t, int elementSize, int neighborsForThreshold) {
     qDebug() << "CellCounter3D::dialateOrErode() start";
-    currentSource=s;
-    currentTarget=t;
-    QList< QFuture<void> > deList;
-    for (int z=0;z<zDim;z++) {
-        QFuture<void> qf = QtConcurrent::run(this, &CellCounter3D::dialateOrErodeZslice, type, z, elementSize, neighborsForThreshold);
-        deList.append(qf);
-    }
-    while(1) {
-        SleepThread st;
-        st.msleep(5000);
-        int doneCount=0;
-        for (int i=0;i<deList.size();i++) {
-            QFuture<void> qf=deList.at(i);
-            if (qf.isFinished()) {
-                doneCount++;
-            }
-        }
-        int stillActive=deList.size()-doneCount;
-        if (stillActive==0) {
-            break;
-        } else {
-            qDebug() << "Waiting on " << stillActive << " z-slices";
-        }
-    }
+    // same neighbor counting and thresholds, DIALATE and ERODE match DilationErosion::TYPE_DILATE and TYPE_ERODE
+    DilationErosion de;
+    de.dilateOrErode(type==DIALATE ? DilationErosion::TYPE_DILATE : DilationErosion::TYPE_ERODE,
+                     xDim, yDim, zDim, s, t, elementSize, neighborsForThreshold);
 }
 
 long CellCounter3D::countNonZero(unsigned char*** d) {
@@ -592,85 +573,6 @@ long CellCounter3D::countNonZero(unsigned char*** d) {
 }
 
 
-void CellCounter3D::dialateOrErodeZslice(int type, int z, int elementSize, int neighborsForThreshold) {
-    unsigned char*** s=currentSource;
-    unsigned char*** t=currentTarget;
-    long dialateCount=0;
-    long erosionCount=0;
-    for (int y=0;y<yDim;y++) {
-        for (int x=0;x<xDim;x++) {
-
-            int currentValue=s[z][y][x];
-
-            if (type==ERODE) {
-                if (currentValue==0) {
-                    // nothing to do
-                    t[z][y][x]=0;
-                    continue;
-                }
-            } else if (type==DIALATE) {
-                if (currentValue>0) {
-                    t[z][y][x]=currentValue;
-                    continue;
-                }
-            }
-
-            int neighborCount=0;
-            for (int ez=z-elementSize;ez<z+elementSize;ez++) {
-                int sz=ez;
-                if (sz<0) {
-                    sz=0;
-                } else if (ez>=zDim) {
-                    sz=zDim-1;
-                }
-                for (int ey=y-elementSize;ey<y+elementSize;ey++) {
-                    int sy=ey;
-                    if (ey<0) {
-                        sy=0;
-                    } else if (ey>=yDim) {
-                        sy=yDim-1;
-                    }
-                    for (int ex=x-elementSize;ex<x+elementSize;ex++) {
-                        int sx=ex;
-                        if (ex<0) {
-                            sx=0;
-                        } else if (ex>=xDim) {
-                            sx=xDim-1;
-                        }
-                        // DEBUG
-                        unsigned char neighborValue=s[sz][sy][sx];
-                        if (neighborValue>0) {
-                            neighborCount++;
-                        }
-                    }
-                }
-            }
-
-            if (type==DIALATE) {
-                if (neighborCount>=neighborsForThreshold) {
-                    dialateCount++;
-                    t[z][y][x] = 255;
-                } else {
-                    t[z][y][x] = 0;
-                }
-            } else if (type==ERODE) {
-                if (neighborCount<=neighborsForThreshold) {
-                    erosionCount++;
-                    t[z][y][x] = 0;
-                } else {
-                    t[z][y][x] = s[z][y][x];
-                }
-            }
-
-        }
-    }
-    if (type==DIALATE) {
-        qDebug() << "Dialated " << dialateCount << " voxels";
-    } else if (type==ERODE) {
-        qDebug() << "Eroded " << erosionCount << " voxels";
-    }
-}
-
 void CellCounter3D::copyToImage(unsigned char*** d, unsigned char**** data) {
     for (int z=0;z<zDim;z++) {
         for (int y=0;y<yDim;y++) {
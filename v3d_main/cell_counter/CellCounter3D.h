@@ -190,7 +190,6 @@ public:
 protected:
 
     void dialateOrErode(int type, unsigned char*** s, unsigned char*** t, int elementSize, int neighborsForThreshold);
-    void dialateOrErodeZslice(int type, int z, int elementSize, int neighborsForThreshold);
     void copyToImage(int sourceChannel, unsigned char**** d, unsigned char**** data, bool nonZeroOnly, bool markAllChannels);
     void copyToImage(unsigned char*** d, unsigned char**** data);
     void addCrossMark(unsigned char**** d, int z, int y, int x, int size);
@@ -251,9 +250,6 @@ protected:
     int yDim;
     int zDim;
 
-    // Shared for dialateOrErode threads
-    unsigned char*** currentSource;
-    unsigned char*** currentTarget;
     int lastTargetIndex;
 
     // Shared for center-surround threads
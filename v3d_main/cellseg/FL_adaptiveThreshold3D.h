@@ -42,105 +42,295 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #include "FL_upSample3D.h"
 #include "FL_downSample3D.h"
 #include "FL_defType.h"
+#include "../basic_c_fun/basic_parallel.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
 
 #define CONTRAST 15
 //#define COEF 1.5  
 //#define COEF 1  
 #define COEF 0.8  
-				 
-template <class T1, class T2> bool adaptiveThre3d(T1 ***indata3d, T2 *** outdata3d, V3DLONG *sz, V3DLONG * kernelsz, V3DLONG * kernelstp)
+
+// The background level at a point is found from the statistics of the (2*kernelsz+1)^3 window around it
+// (clipped to the image): mean+COEF*std if the window has enough contrast, 255 otherwise.
+// The window statistics (min, max, sum and sum of squares) are separable, so they are computed
+// one axis at a time with running windows: the cost per voxel does not depend on the kernel size.
+
+struct AdaptiveThreWinStats
 {
-	
-	V3DLONG i,j,k;
-	V3DLONG m,n,p;
-		
-	unsigned V3DLONG len, cnt, cnt0;
-	V3DLONG rr[3];
-	
-	for (i=0;i<3;i++)
+	float minval, maxval;
+	double sum, sum2;
+};
+
+inline void adaptiveThre_empty(AdaptiveThreWinStats & a)
+{
+	a.minval = std::numeric_limits<float>::infinity();
+	a.maxval = -std::numeric_limits<float>::infinity();
+	a.sum = 0; a.sum2 = 0;
+}
+
+inline void adaptiveThre_merge(AdaptiveThreWinStats & a, const AdaptiveThreWinStats & b)
+{
+	if (b.minval<a.minval) a.minval = b.minval;
+	if (b.maxval>a.maxval) a.maxval = b.maxval;
+	a.sum += b.sum; a.sum2 += b.sum2;
+}
+
+// statistics of the windows [pos-r, pos+r] (clipped to [0,n)) of a line, van Herk/Gil-Werman:
+// the line is padded with r empty elements at both ends and cut into blocks of w=2r+1, a window is then
+// the tail of the block where it starts (h) merged with the head of the next block (g),
+// or exactly one block (h alone, so that the sums do not count it twice)
+// g and h are buffers of n+2r elements
+
+inline void adaptiveThre_window1d(const AdaptiveThreWinStats *line, V3DLONG n, V3DLONG r,
+								  const V3DLONG *pos, V3DLONG npos, AdaptiveThreWinStats *out,
+								  AdaptiveThreWinStats *g, AdaptiveThreWinStats *h)
+{
+	V3DLONG len = n+2*r, w = 2*r+1, q;
+
+	for (q=0; q<len; q++)
 	{
-	    rr[i] = (2*kernelsz[i]+1);
+		if (q<r || q>=n+r) adaptiveThre_empty(g[q]); else g[q] = line[q-r];
+		h[q] = g[q];
+		if (q%w) adaptiveThre_merge(g[q], g[q-1]);
 	}
-	len = rr[0]*rr[1]*rr[2];
-	
-	float *vec1d = new float[len];	
-	float meanval, stdval,minval,maxval;
-	V3DLONG cntk, cntj, cnti;
-	V3DLONG m1, m2, n1, n2, p1, p2;
-	
-	V3DLONG szsmall[3];
-	for (V3DLONG i=0; i<3; i++)
+	for (q=len-2; q>=0; q--)
 	{
-		szsmall[i] = floor(sz[i]/kernelstp[i])+1;
+		if ((q+1)%w) adaptiveThre_merge(h[q], h[q+1]);
 	}
-	 
-	T2 *bgddatasmall1d = new T2 [szsmall[0]*szsmall[1]*szsmall[2]];
-	T2 ***bgddatasmall3d = 0;
-	new3dpointer(bgddatasmall3d, szsmall[0], szsmall[1], szsmall[2], bgddatasmall1d);
 
-	// finding background level on sampled grids
-	
-	cntk=0;
-	
-	for (k = 0; k<sz[2]; k+=kernelstp[2])
+	for (V3DLONG m=0; m<npos; m++)
 	{
-		m1 = k-kernelsz[2]; m2 = k+kernelsz[2];
-		cntj=0;
+		V3DLONG s = pos[m]; // window [pos-r, pos+r] is [s, s+2r] in the padded line
+		out[m] = h[s];
+		if (s%w) adaptiveThre_merge(out[m], g[s+2*r]);
+	}
+}
 
-		for (j = 0; j<sz[1]; j+=kernelstp[1])
-		{
+// number of voxels of the window around p along an axis of length n
+inline V3DLONG adaptiveThre_window_count(V3DLONG p, V3DLONG r, V3DLONG n)
+{
+	V3DLONG p1 = (p-r<0) ? 0 : p-r, p2 = (p+r>n-1) ? n-1 : p+r;
+	return p2-p1+1;
+}
 
-			n1 = j-kernelsz[1]; n2 = j+kernelsz[1];
-		    cnti=0;
-			
-			for (i = 0; i<sz[0]; i+=kernelstp[0])
-			{
+// background level of a window, computed as mean_and_std() and min_and_max() do on the window voxels
+// (mean rounded to float, then the variance around that mean), so that the grid values are unchanged
+template <class T2> T2 adaptiveThre_level(const AdaptiveThreWinStats & a, V3DLONG cnt)
+{
+	float meanval, stdval;
+	if (cnt<=1)
+	{
+		meanval = a.minval;
+		stdval = 0;
+	}
+	else
+	{
+		meanval = (float)(a.sum/cnt);
+		long double dev = (long double)a.sum2 - 2*(long double)meanval*a.sum + (long double)cnt*meanval*meanval;
+		double var = (dev>0) ? (double)(dev/(cnt-1)) : 0.0;
+		stdval = (float)(sqrt(var));
+	}
+	return ((a.maxval-a.minval)>CONTRAST)?(T2)(meanval+COEF*stdval):255;
+}
+
+// first pass over a range of z planes: windows along x for every row, then along y at the sampled x,
+// the results (nx*ny per plane) go to plane (z-z0) of stats
+template <class T1> class AdaptiveThreXYPass
+{
+public:
+	AdaptiveThreXYPass(T1 ***d, const V3DLONG *s, const V3DLONG *r, const V3DLONG *px, V3DLONG nxParam, const V3DLONG *py, V3DLONG nyParam,
+					   V3DLONG z0Param, AdaptiveThreWinStats *st)
+	: data(d), sz(s), rr(r), posx(px), nx(nxParam), posy(py), ny(nyParam), z0(z0Param), stats(st) {}
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		V3DLONG maxlen = (sz[0]>sz[1]) ? sz[0] : sz[1];
+		V3DLONG maxr = (rr[0]>rr[1]) ? rr[0] : rr[1];
+		std::vector<AdaptiveThreWinStats> line(maxlen), g(maxlen+2*maxr), h(maxlen+2*maxr), col(ny);
+		std::vector<AdaptiveThreWinStats> rows(sz[1]*nx);
+		V3DLONG i, j, m;
 
-				p1 = i-kernelsz[0]; p2 = i+kernelsz[0];
-				cnt = 0; 
-			
-				for (m = m1; m <= m2; m++)
+		for (V3DLONG k = begin; k < end; k++)
+		{
+			V3DLONG z = z0+k;
+			for (j=0; j<sz[1]; j++)
+			{
+				T1 *p = data[z][j];
+				for (i=0; i<sz[0]; i++)
 				{
-					for (n = n1; n <= n2; n++)
-					{				
-						for (p = p1 ; p <= p2; p++)
-						{   
-							if (m>=0 & m<sz[2] & n>=0 & n<sz[1] & p>=0 & p<sz[0])
-							{
-							    vec1d[cnt] = (float)indata3d[m][n][p];
-								cnt++;
-							}
-						}
-					}
+					float v = (float)p[i];
+					line[i].minval = line[i].maxval = v;
+					line[i].sum = v; line[i].sum2 = (double)v*v;
 				}
-				
-				mean_and_std(vec1d, (float)cnt, meanval, stdval);		
-				min_and_max(vec1d, (float)cnt, minval, maxval);	
+				adaptiveThre_window1d(&line[0], sz[0], rr[0], posx, nx, &rows[j*nx], &g[0], &h[0]);
+			}
 
-				 bgddatasmall3d[cntk][cntj][cnti] = ((maxval-minval)>CONTRAST)?(T2)(meanval+COEF*stdval):255;
-				 	
-				cnti++;
+			AdaptiveThreWinStats *plane = stats + k*nx*ny;
+			for (m=0; m<nx; m++)
+			{
+				for (j=0; j<sz[1]; j++)
+					line[j] = rows[j*nx+m];
+				adaptiveThre_window1d(&line[0], sz[1], rr[1], posy, ny, &col[0], &g[0], &h[0]);
+				for (j=0; j<ny; j++)
+					plane[j*nx+m] = col[j];
 			}
-			cntj++;
 		}
-		cntk++;
 	}
-		
-	//interpolate
 
-	double dfactor[3];	
-	V3DLONG sznew[3];
+private:
+	T1 ***data;
+	const V3DLONG *sz, *rr;
+	const V3DLONG *posx; V3DLONG nx;
+	const V3DLONG *posy; V3DLONG ny;
+	V3DLONG z0;
+	AdaptiveThreWinStats *stats;
+};
+
+// second pass over the nx*ny sampled columns: windows along z at the sampled z in [z0, z0+nz),
+// then the background levels of the grid planes [k0, k1) of bgd
+template <class T2> class AdaptiveThreZPass
+{
+public:
+	AdaptiveThreZPass(const AdaptiveThreWinStats *st, V3DLONG nzParam, V3DLONG z0Param, V3DLONG r, const V3DLONG *pz, V3DLONG k0Param, V3DLONG k1Param,
+					  V3DLONG nxParam, V3DLONG nyParam, const V3DLONG *cx, const V3DLONG *cy, const V3DLONG *cz, T2 *b)
+	: stats(st), nz(nzParam), z0(z0Param), rz(r), posz(pz), k0(k0Param), k1(k1Param), nx(nxParam), ny(nyParam), cntx(cx), cnty(cy), cntz(cz), bgd(b) {}
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		V3DLONG nk = k1-k0, k;
+		std::vector<AdaptiveThreWinStats> line(nz), g(nz+2*rz), h(nz+2*rz), res(nk);
+		std::vector<V3DLONG> pos(nk);
+		for (k=0; k<nk; k++)
+			pos[k] = posz[k0+k]-z0;
+
+		for (V3DLONG c = begin; c < end; c++)
+		{
+			for (k=0; k<nz; k++)
+				line[k] = stats[k*nx*ny+c];
+			adaptiveThre_window1d(&line[0], nz, rz, &pos[0], nk, &res[0], &g[0], &h[0]);
+
+			V3DLONG cnt = cntx[c%nx]*cnty[c/nx];
+			for (k=0; k<nk; k++)
+				bgd[(k0+k)*nx*ny+c] = adaptiveThre_level<T2>(res[k], cnt*cntz[k0+k]);
+		}
+	}
+
+private:
+	const AdaptiveThreWinStats *stats;
+	V3DLONG nz, z0, rz;
+	const V3DLONG *posz;
+	V3DLONG k0, k1, nx, ny;
+	const V3DLONG *cntx, *cnty, *cntz;
+	T2 *bgd;
+};
+
+// background levels at the grid points pos[0][i], pos[1][j], pos[2][k] (n[0]*n[1]*n[2] points, x fastest) into bgd1d
+// the z planes are done in slabs, each slab runs its planes and then its columns in parallel
+
+template <class T1, class T2> void adaptiveThre3d_background(T1 ***indata3d, V3DLONG *sz, V3DLONG *kernelsz, V3DLONG **pos, V3DLONG *n, T2 *bgd1d)
+{
+	V3DLONG a, m;
+
+	std::vector<V3DLONG> cnt[3];
+	for (a=0; a<3; a++)
+	{
+		cnt[a].resize(n[a]);
+		for (m=0; m<n[a]; m++)
+			cnt[a][m] = adaptiveThre_window_count(pos[a][m], kernelsz[a], sz[a]);
+	}
+
+	// slabs of grid planes spanning at least 4 windows (or 64 planes) of the input, to bound the memory of the x/y statistics
+	V3DLONG r2 = kernelsz[2];
+	V3DLONG maxspan = (4*(2*r2+1) > 64) ? 4*(2*r2+1) : 64;
+	std::vector<AdaptiveThreWinStats> stats;
+
+	for (V3DLONG k0 = 0, k1; k0 < n[2]; k0 = k1)
+	{
+		V3DLONG z0 = (pos[2][k0]-r2<0) ? 0 : pos[2][k0]-r2;
+		for (k1 = k0+1; k1 < n[2] && pos[2][k1]+r2-z0+1 <= maxspan; k1++);
+		V3DLONG z1 = (pos[2][k1-1]+r2>sz[2]-1) ? sz[2]-1 : pos[2][k1-1]+r2;
+		V3DLONG nz = z1-z0+1;
+
+		stats.resize(nz*n[0]*n[1]);
 
+		AdaptiveThreXYPass<T1> xypass(indata3d, sz, kernelsz, pos[0], n[0], pos[1], n[1], z0, &stats[0]);
+		v3d_parallel_for(nz, xypass, 0, 1);
+
+		AdaptiveThreZPass<T2> zpass(&stats[0], nz, z0, r2, pos[2], k0, k1, n[0], n[1], &cnt[0][0], &cnt[1][0], &cnt[2][0], bgd1d);
+		v3d_parallel_for(n[0]*n[1], zpass, 0, 1024);
+	}
+}
+
+// 3D adaptive thresholding: voxels brighter than the background level of their neighborhood are set to 255,
+// the others and a margin of kernelsz at the borders to 0
+// kernelstp is the step of the grid where the background is computed, it is then interpolated in between;
+// with all steps <= 1 (dense mode) the background is computed at every voxel, without interpolation
+
+template <class T1, class T2> bool adaptiveThre3d(T1 ***indata3d, T2 *** outdata3d, V3DLONG *sz, V3DLONG * kernelsz, V3DLONG * kernelstp)
+{
+	
+	V3DLONG i,j,k;
+
+	bool dense = (kernelstp[0]<=1 && kernelstp[1]<=1 && kernelstp[2]<=1);
+
+	V3DLONG szsmall[3];
+	std::vector<V3DLONG> grid[3];
+	V3DLONG *pos[3];
 	for (i=0; i<3; i++)
 	{
-		dfactor[i] = (double)sz[i]/(double)szsmall[i];
-		sznew[i] = V3DLONG(ceil(dfactor[i]*szsmall[i]));
+		V3DLONG stp = (dense || kernelstp[i]<1) ? 1 : kernelstp[i];
+		szsmall[i] = dense ? sz[i] : V3DLONG(floor(sz[i]/stp))+1;
+
+		// grid points; when the step divides the size, the last one is beyond the image and takes the last voxel
+		grid[i].resize(szsmall[i]);
+		for (j=0; j<szsmall[i]; j++)
+			grid[i][j] = (j*stp<sz[i]) ? j*stp : sz[i]-1;
+		pos[i] = &grid[i][0];
 	}
-	  
-	T2 *bdgdata1d = new T2 [sznew[0]*sznew[1]*sznew[2]];
+
+	V3DLONG k1, j1, i1;
+	T2 *bdgdata1d = 0;
 	T2 ***bdgdata3d = 0;
-	new3dpointer(bdgdata3d, sznew[0], sznew[1], sznew[2], bdgdata1d);
-	upsample3dvol(bdgdata3d, bgddatasmall3d, szsmall[0], szsmall[1], szsmall[2], dfactor);
+	V3DLONG sznew[3];
+
+	if (dense)
+	{
+		bdgdata1d = new T2 [sz[0]*sz[1]*sz[2]];
+		adaptiveThre3d_background(indata3d, sz, kernelsz, pos, szsmall, bdgdata1d);
+
+		for (i=0; i<3; i++) sznew[i] = sz[i];
+		new3dpointer(bdgdata3d, sznew[0], sznew[1], sznew[2], bdgdata1d);
+	}
+	else
+	{
+		// finding background level on sampled grids
+
+		T2 *bgddatasmall1d = new T2 [szsmall[0]*szsmall[1]*szsmall[2]];
+		T2 ***bgddatasmall3d = 0;
+		new3dpointer(bgddatasmall3d, szsmall[0], szsmall[1], szsmall[2], bgddatasmall1d);
+
+		adaptiveThre3d_background(indata3d, sz, kernelsz, pos, szsmall, bgddatasmall1d);
+
+		//interpolate
+
+		double dfactor[3];
+
+		for (i=0; i<3; i++)
+		{
+			dfactor[i] = (double)sz[i]/(double)szsmall[i];
+			sznew[i] = V3DLONG(ceil(dfactor[i]*szsmall[i]));
+		}
+
+		bdgdata1d = new T2 [sznew[0]*sznew[1]*sznew[2]];
+		new3dpointer(bdgdata3d, sznew[0], sznew[1], sznew[2], bdgdata1d);
+		upsample3dvol(bdgdata3d, bgddatasmall3d, szsmall[0], szsmall[1], szsmall[2], dfactor);
+
+		if (bgddatasmall3d) {delete3dpointer(bgddatasmall3d, szsmall[0], szsmall[1], szsmall[2]);}
+		if (bgddatasmall1d) {delete []bgddatasmall1d; bgddatasmall1d=0;}
+	}
 	
 	//pad margin to make outimg the same size of inimg
 	for (k=0; k<sz[2]; k++)
@@ -154,20 +344,9 @@ template <class T1, class T2> bool adaptiveThre3d(T1 ***indata3d, T2 *** outdata
 		}
 	}
 
-	V3DLONG k1 = sz[2]<sznew[2]?sz[2]:sznew[2];
-	V3DLONG j1 = sz[1]<sznew[1]?sz[1]:sznew[1];
-	V3DLONG i1 = sz[0]<sznew[0]?sz[0]:sznew[0];
-
-//	for (k=0; k<k1; k++)
-//	{
-//		for (j=0;j<j1; j++)
-//		{
-//			for (i=0;i<i1;i++)
-//			{
-//				outdata3d[k][j][i] = (T2)((indata3d[k][j][i]>bdgdata3d[k][j][i])?255:0);
-//			}
-//		}
-//	}
+	k1 = sz[2]<sznew[2]?sz[2]:sznew[2];
+	j1 = sz[1]<sznew[1]?sz[1]:sznew[1];
+	i1 = sz[0]<sznew[0]?sz[0]:sznew[0];
 
 	for (k=kernelsz[2]; k<k1-kernelsz[2]; k++)
 	{
@@ -181,13 +360,8 @@ template <class T1, class T2> bool adaptiveThre3d(T1 ***indata3d, T2 *** outdata
 	}
 
 	//free memory
-//	if (bdgdata3d) {delete bdgdata3d; bdgdata3d=0;}
 	if (bdgdata3d) {delete3dpointer(bdgdata3d, sznew[0], sznew[1], sznew[2]);}
-	if (bdgdata1d) {delete bdgdata1d; bdgdata1d=0;}
-//	if (bgddatasmall3d) {delete bgddatasmall3d; bgddatasmall3d=0;}
-	if (bgddatasmall3d) {delete3dpointer(bgddatasmall3d, szsmall[0], szsmall[1], szsmall[2]);}
-	if (bgddatasmall1d) {delete bgddatasmall1d; bgddatasmall1d=0;}
-    if (vec1d) {delete []vec1d; vec1d=0;}
+	if (bdgdata1d) {delete []bdgdata1d; bdgdata1d=0;}
 	
 	return true;
 }
@@ -39,254 +39,164 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #define __FL_BWDIST__
 
 #include <algorithm>
+#include <limits>
+#include <vector>
 //#include <math>
 
+#include "../basic_c_fun/basic_parallel.h"
+
 #define INF 1E20
 
 template <class T> inline T square(const T &x) { return x*x; };
 
-// dt of 1d function using squared distance 
-// user is in charge of allocating memory for label outside
-
-//int data type might do
+// dt of 1d function using squared distance, without allocation
+// d receives the squared distances, label (if not 0) the index of the nearest sample of each sample
+// w is the squared sample spacing; v and z are scratch buffers of n and n+1 elements
 
-float *dt1d(float *f, V3DLONG * label, const V3DLONG n)
+inline void dt1d(const float *f, float *d, V3DLONG * label, const V3DLONG n, const float w, V3DLONG *v, float *z)
 {
-	float *d = new float[n];
-	int *v = new int[n];
-	float *z = new float[n+1];
-    
-	int k = 0;
+	// the envelope bounds must stay outside any intersection, INF is not enough once w < 1
+	const float inf = std::numeric_limits<float>::infinity();
+	V3DLONG k = 0;
 	v[0] = 0;
-	z[0] = -INF;
-	z[1] = +INF;
-	for (int q = 1; q <= n-1; q++) 
+	z[0] = -inf;
+	z[1] = +inf;
+	for (V3DLONG q = 1; q <= n-1; q++) 
 	{
-		float s  = ((f[q]+square(q))-(f[v[k]]+square(v[k])))/(2*q-2*v[k]);
+		float s  = ((f[q]+w*float(q*q))-(f[v[k]]+w*float(v[k]*v[k])))/(w*float(2*q-2*v[k]));
 		while (s <= z[k]) 
 		{
 			k--;
-			s  = ((f[q]+square(q))-(f[v[k]]+square(v[k])))/(2*q-2*v[k]);
+			s  = ((f[q]+w*float(q*q))-(f[v[k]]+w*float(v[k]*v[k])))/(w*float(2*q-2*v[k]));
 		}
 		k++;
 		v[k] = q;
 		z[k] = s;
-		z[k+1] = +INF;
+		z[k+1] = +inf;
 	}
 	
 	k = 0;
 	
-	for (int q = 0; q <= n-1; q++) {
+	for (V3DLONG q = 0; q <= n-1; q++) {
 		while (z[k+1] < q)
 			k++;
-		d[q] = float(square(q-v[k])) + f[v[k]];
-		
-		label[q] = v[k];
+		d[q] = w*float((q-v[k])*(q-v[k])) + f[v[k]];
 		
+		if (label) label[q] = v[k];
 	}
-	
-	if (v) {delete [] v; v=0;}
-	if (z) {delete [] z; z=0;}
-	return d;
 }
 
-// dt of general 2d function using squared euclidean distance 
+// dt of 1d function using squared distance 
 // user is in charge of allocating memory for label outside
 
-void dt2d(float *data, V3DLONG * label, const V3DLONG *sz) 
+//int data type might do
+
+inline float *dt1d(float *f, V3DLONG * label, const V3DLONG n)
 {
-	V3DLONG len = std::max(sz[0],sz[1]);
-	float *f = new float[len];
-	V3DLONG tmp_j;
-	V3DLONG i,j,k;
-	V3DLONG *lab1 = new V3DLONG [sz[0]*sz[1]];
-	V3DLONG *lab2 = new V3DLONG [sz[0]*sz[1]];
-	
-	// transform along columns
-	for (i = 0; i < sz[0]; i++) 
-	{
-		for (j = 0; j < sz[1]; j++) 
-		{
-			f[j] = *(data + j*sz[0] + i); 
-		}
-		
-		float *d = dt1d(f, lab1 + i*sz[1], sz[1]);
-		
-		for (j = 0; j < sz[1]; j++) 
-		{
-			*(data + j*sz[0] + i) = d[j];
-		}
-		if (d) {delete [] d; d = 0;}
-	}
-	
-	// transform along rows
-	for (j = 0; j < sz[1]; j++) 
-	{
-		tmp_j = j*sz[0];
-		
-		for (i = 0; i < sz[0]; i++) 
-		{
-			f[i] = *(data + tmp_j + i); 
-		}
-		
-		float *d = dt1d(f, lab2 + j*sz[0], sz[0]);
-		
-		for (i = 0; i < sz[0]; i++) 
-		{
-			V3DLONG tmp = tmp_j + i;
-			*(data + tmp) = d[i];
-			V3DLONG ii,jj;
-			
-			ii = *(lab2 + j*sz[0] + i);
-			jj = *(lab1 + ii*sz[1] +j);
-			
-			*(label + tmp) = jj*sz[0] + ii;
-		}
-		
-		if (d) {delete [] d; d = 0;}
-	}
+	float *d = new float[n];
+	V3DLONG *v = new V3DLONG[n];
+	float *z = new float[n+1];
 	
-	if (f) {delete []f; f = 0;}
-	if (lab1) {delete []lab1; lab1 = 0;}
-	if (lab2) {delete []lab2; lab2 = 0;}
+	dt1d(f, d, label, n, 1.0f, v, z);
 	
-	return;
+	if (v) {delete [] v; v=0;}
+	if (z) {delete [] z; z=0;}
+	return d;
 }
 
-// dt of general 3d function using squared euclidean distance
-// user is in charge of allocating memory for label outside
+// one pass of the separable transform: dt1d along every line of the given axis of a 3d volume
+// the lines are split among threads, each block of lines reuses its own line buffers
+// label (if not 0) holds the linear index of the nearest feature found so far and is updated in place:
+// the first pass starts it from the voxel itself, the next ones follow it from the nearest voxel along the line
 
-void dt3d(float *data, V3DLONG * label, const V3DLONG *sz) 
+class DT3dPass
 {
-	
-	V3DLONG i,j,k;
-	
-	V3DLONG sz10 = sz[1]*sz[0];
-	V3DLONG sz20 = sz[2]*sz[0];
-	V3DLONG sz12 = sz[1]*sz[2];
-	V3DLONG count;
-	V3DLONG tmp_k, tmp_j;
-	
-	V3DLONG len = std::max(std::max(sz[0], sz[1]),sz[2]);
-	V3DLONG len2 = sz[0]*sz[1]*sz[2];
-	
-	float *f = new float [len];
-	V3DLONG *lab1 = new V3DLONG [len2];
-	V3DLONG *lab2 = new V3DLONG [len2];
-	V3DLONG *lab3 = new V3DLONG [len2];
-	
-	
-	// transform along the i dimension
-	for (k = 0; k<sz[2]; k++)
-	{
-		tmp_k =  k*sz10;
-		
-		for (j = 0; j < sz[1]; j++) 
-		{
-			tmp_j = j*sz[0];
-			
-			for (i = 0; i < sz[0]; i++) 
-			{
-				f[i] = *(data + tmp_k + tmp_j + i); 
-			}
-			
-			float *d = dt1d(f, lab1+tmp_k+tmp_j, sz[0]);  
-			
-			for (i = 0; i < sz[0]; i++) 
-			{					
-				*(data + tmp_k + tmp_j + i) = d[i];
-			}
-			
-			if (d) {delete [] d; d = 0;}
-		}	
-	}
-	
-	// transform along the j dimension
-	
-	for (k = 0; k < sz[2]; k++)
+public:
+	DT3dPass(float *d, V3DLONG *lab, const V3DLONG *s, int a, float w, bool first)
+	: data(d), label(lab), sz(s), axis(a), weight(w), firstPass(first) {}
+
+	V3DLONG lineCount() const {return (sz[axis]>0) ? sz[0]*sz[1]*sz[2]/sz[axis] : 0;}
+
+	void operator()(V3DLONG begin, V3DLONG end)
 	{
-		tmp_k =  k*sz10;
-		
-		for (i = 0; i < sz[0]; i++) 
+		V3DLONG n = sz[axis];
+		V3DLONG stride = (axis==0) ? 1 : (axis==1) ? sz[0] : sz[0]*sz[1];
+		std::vector<float> f(n), d(n), z(n+1);
+		std::vector<V3DLONG> v(n), arg(n), lab(label ? n : 0);
+
+		for (V3DLONG line = begin; line < end; line++)
 		{
-			
-			for (j = 0; j < sz[1]; j++) 
-			{
-				
-				f[j] = *(data + tmp_k + j*sz[0] + i); 
-			}
-			
-			float *d = dt1d(f, lab2+k*sz10+i*sz[1], sz[1]);
-			
-			for (j = 0; j < sz[1]; j++) 
-			{			
-				*(data + tmp_k + j*sz[0] + i) = d[j];			
-			}
-			
-			if (d) {delete [] d; d = 0;}
-		}	
-	}
-	
-	
-	// transform along the k dimension
-	
-	for (j = 0; j<sz[1]; j++)
-	{		
-		tmp_j = j*sz[0];
-		
-		for (i = 0; i < sz[0]; i++) 
-		{			
-			for (k = 0; k < sz[2]; k++) 
-			{
-				f[k] = *(data + k*sz10 + tmp_j + i); 
-			}
-			
-			float *d = dt1d(f, lab3+j*sz20+i*sz[2], sz[2]);
-			
-			for (k = 0; k < sz[2]; k++) 
-			{
-				*(data + k*sz10 + tmp_j + i) = d[k]; 
-			}
-			
-			if (d) {delete [] d; d = 0;}
-		}	
-	}
-	
-	// assign pixel index
-	V3DLONG ii,jj,kk;
-	
-	for (i = 0; i<sz[0]; i++)
-	{		
-		for (j = 0; j < sz[1]; j++) 
-		{			
-			for (k = 0; k < sz[2]; k++) 
+			// first voxel of the line: lines of axis 1 run over i fastest, then k
+			V3DLONG base = (axis==0) ? line*sz[0] : (axis==1) ? (line/sz[0])*sz[0]*sz[1] + line%sz[0] : line;
+
+			V3DLONG q, p;
+			for (q = 0, p = base; q < n; q++, p += stride)
+				f[q] = data[p];
+
+			dt1d(&f[0], &d[0], label ? &arg[0] : 0, n, weight, &v[0], &z[0]);
+
+			if (label && !firstPass)
+				for (q = 0, p = base; q < n; q++, p += stride)
+					lab[q] = label[p];
+
+			for (q = 0, p = base; q < n; q++, p += stride)
 			{
-				kk = *(lab3+j*sz20+i*sz[2]+k);
-				jj = *(lab2+kk*sz10+i*sz[1]+j);
-				ii = *(lab1+kk*sz10+jj*sz[0]+i);
-				
-				*(label + k*sz10+j*sz[0]+i) = kk*sz10 + jj*sz[0] + ii;
+				data[p] = d[q];
+				if (label)
+					label[p] = firstPass ? base + arg[q]*stride : lab[arg[q]];
 			}
-		}	
+		}
 	}
+
+private:
+	float *data;
+	V3DLONG *label;
+	const V3DLONG *sz;
+	int axis;
+	float weight;
+	bool firstPass;
+};
+
+inline void dt3d_pass(float *data, V3DLONG *label, const V3DLONG *sz, int axis, float spacing, bool first)
+{
+	DT3dPass pass(data, label, sz, axis, spacing*spacing, first);
+	v3d_parallel_for(pass.lineCount(), pass, 0, 64);
+}
+
+// dt of general 2d function using squared euclidean distance 
+// user is in charge of allocating memory for label outside, label can be 0 if not needed
+// spacing (if not 0) gives the pixel size along x and y, the distances are then squared physical distances
+
+inline void dt2d(float *data, V3DLONG * label, const V3DLONG *sz, const float *spacing = 0) 
+{
+	V3DLONG sz3[3] = {sz[0], sz[1], 1};
 	
-	
-	if (f) {delete [] f; f = 0;}
-	if (lab1) {delete [] lab1; lab1 = 0;}
-	if (lab2) {delete [] lab2; lab2 = 0;}
-	if (lab3) {delete [] lab3; lab3 = 0;}
-	
-	return;
+	// transform along columns, then along rows
+	dt3d_pass(data, label, sz3, 1, spacing ? spacing[1] : 1.0f, true);
+	dt3d_pass(data, label, sz3, 0, spacing ? spacing[0] : 1.0f, false);
 }
 
+// dt of general 3d function using squared euclidean distance
+// user is in charge of allocating memory for label outside, label can be 0 if not needed
+// spacing (if not 0) gives the voxel size along x, y and z, the distances are then squared physical distances
+// (e.g. {1, 1, 3} for a confocal stack sampled 3 times more coarsely in z)
+
+inline void dt3d(float *data, V3DLONG * label, const V3DLONG *sz, const float *spacing = 0) 
+{
+	// transform along the i, j and k dimensions
+	dt3d_pass(data, label, sz, 0, spacing ? spacing[0] : 1.0f, true);
+	dt3d_pass(data, label, sz, 1, spacing ? spacing[1] : 1.0f, false);
+	dt3d_pass(data, label, sz, 2, spacing ? spacing[2] : 1.0f, false);
+}
 
 // distance transform of binary 2d using squared distance 
 // user is in charge of allocating memory for label outside
 // tag indicate whether to compute the distance transform for zero or non-zero values
-// label returns the linear index of the nearest non-zero (when tag = 0) or zero (when tag = 1)  pixel
+// label returns the linear index of the nearest non-zero (when tag = 0) or zero (when tag = 1)  pixel, it can be 0 if not needed
+// spacing (if not 0) gives the pixel/voxel size along each dimension, see dt2d and dt3d
 
 //note input and output share the same array, thus input arrary will be changed after calling dt2d_binary
-void dt2d_binary(float *data, V3DLONG * label, const V3DLONG *sz, unsigned char tag) 
+void dt2d_binary(float *data, V3DLONG * label, const V3DLONG *sz, unsigned char tag, const float *spacing = 0) 
 {
 	
 	V3DLONG len = sz[0]*sz[1];
@@ -306,12 +216,12 @@ void dt2d_binary(float *data, V3DLONG * label, const V3DLONG *sz, unsigned char
 			data[i] = 0;
 	}
 	
-	dt2d(data, label, sz);	
+	dt2d(data, label, sz, spacing);	
 }
 
 
 //note input and output use separate array, thus input arrary will not be changed after calling dt2d_binary
-void dt2d_binary(float *indata, float *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag) 
+void dt2d_binary(float *indata, float *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag, const float *spacing = 0) 
 {
 	
 	V3DLONG len = sz[0]*sz[1];
@@ -331,17 +241,18 @@ void dt2d_binary(float *indata, float *outdata, V3DLONG * label, const V3DLONG *
 			outdata[i] = 0;
 	}
 	
-	dt2d(outdata, label, sz);	
+	dt2d(outdata, label, sz, spacing);	
 }
 
 
 // distance transform of binary 3d using squred distance
 // user is in charge of allocating memory for label outside
 // tag indicate whether to compute the distance transform for zero or non-zero values
-// label returns the linear index of the nearest non-zero (when tag = 0) or zero (when tag = 1)  pixel
+// label returns the linear index of the nearest non-zero (when tag = 0) or zero (when tag = 1)  pixel, it can be 0 if not needed
+// spacing (if not 0) gives the pixel/voxel size along each dimension, see dt2d and dt3d
 
 // note input and output share the same array, thus input arrary will be changed after calling dt3d_binary
-void dt3d_binary(float *data, V3DLONG * label, const V3DLONG *sz, unsigned char tag) 
+void dt3d_binary(float *data, V3DLONG * label, const V3DLONG *sz, unsigned char tag, const float *spacing = 0) 
 {
 	
 	V3DLONG len = sz[0]*sz[1]*sz[2];
@@ -361,11 +272,11 @@ void dt3d_binary(float *data, V3DLONG * label, const V3DLONG *sz, unsigned char
 			data[i] = 0;
 	}
 	
-	dt3d(data, label, sz);
+	dt3d(data, label, sz, spacing);
 }
 
 // note input and output use separate array, thus input arrary will not be changed after calling dt3d_binary
-void dt3d_binary(float *indata, float *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag) 
+void dt3d_binary(float *indata, float *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag, const float *spacing = 0) 
 {
 	
 	V3DLONG len = sz[0]*sz[1]*sz[2];
@@ -387,13 +298,13 @@ void dt3d_binary(float *indata, float *outdata, V3DLONG * label, const V3DLONG *
 			outdata[i] = 0;
 	}
 	
-	dt3d(outdata, label, sz);
+	dt3d(outdata, label, sz, spacing);
 	
 }
 
 
 
-template <class T1, class T2> void dt2d_binary(T1 *indata, T2 *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag) 
+template <class T1, class T2> void dt2d_binary(T1 *indata, T2 *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag, const float *spacing = 0) 
 {
 	V3DLONG len = sz[0]*sz[1];
 	V3DLONG i;
@@ -416,7 +327,7 @@ template <class T1, class T2> void dt2d_binary(T1 *indata, T2 *outdata, V3DLONG
 			tmpdata[i] = 0;
 	}
 	
-	dt2d(tmpdata, label, sz);
+	dt2d(tmpdata, label, sz, spacing);
 	
 	for (i=0; i<len; i++)
 		outdata[i] = (T2)tmpdata[i];
@@ -425,7 +336,7 @@ template <class T1, class T2> void dt2d_binary(T1 *indata, T2 *outdata, V3DLONG
 	
 }
 
-template <class T1, class T2> void dt3d_binary(T1 *indata, T2 *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag) 
+template <class T1, class T2> void dt3d_binary(T1 *indata, T2 *outdata, V3DLONG * label, const V3DLONG *sz, unsigned char tag, const float *spacing = 0) 
 {
 	V3DLONG len = sz[0]*sz[1]*sz[2];
 	V3DLONG i;
@@ -449,7 +360,7 @@ template <class T1, class T2> void dt3d_binary(T1 *indata, T2 *outdata, V3DLONG
 			tmpdata[i] = 0;
 	}
 	
-	dt3d(tmpdata, label, sz);
+	dt3d(tmpdata, label, sz, spacing);
 	
 	for (i=0; i<len; i++)
 		outdata[i] = (T2)tmpdata[i];
@@ -42,12 +42,13 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 
 // inimg: input image
 // distimg: distance transform of the input image
-// indeximg: index of the region for each pixel, to which the distance is shortest
+// indeximg: index of the region for each pixel, to which the distance is shortest (can be 0 if not needed)
 // tag: 1 if computing the distance transform of non-zero values, 0 if compute the distance transform of zero values
+// spacing: voxel size along x, y and z, 0 for isotropic unit voxels (the distances are squared, in the units of spacing)
 
-template <class T> bool distTrans3d(Vol3DSimple <T> *inimg, Vol3DSimple <float> *distimg, Vol3DSimple <V3DLONG> *indeximg, unsigned char tag)
+template <class T> bool distTrans3d(Vol3DSimple <T> *inimg, Vol3DSimple <float> *distimg, Vol3DSimple <V3DLONG> *indeximg, unsigned char tag, const float *spacing = 0)
 {	
-	if (!inimg || !inimg->valid() || !distimg || !distimg->valid() || !indeximg || !indeximg->valid())
+	if (!inimg || !inimg->valid() || !distimg || !distimg->valid() || (indeximg && !indeximg->valid()))
 	{	printf("invalid image in distance transform \n");
 		return false;
 	}
@@ -61,7 +62,7 @@ template <class T> bool distTrans3d(Vol3DSimple <T> *inimg, Vol3DSimple <float>
 
 	T *p = inimg->getData1dHandle();
 	float *data1d = distimg->getData1dHandle();	
-	V3DLONG *pix_index = indeximg->getData1dHandle();
+	V3DLONG *pix_index = indeximg ? indeximg->getData1dHandle() : 0;
 	
 	V3DLONG k;
 		
@@ -70,14 +71,14 @@ template <class T> bool distTrans3d(Vol3DSimple <T> *inimg, Vol3DSimple <float>
 		data1d[k] = (float) p[k];	
 	}
 	
-	dt3d_binary(data1d, pix_index, sz, tag); // compute the distance transform for foreground (non-zero) pixels	if tag = 1
+	dt3d_binary(data1d, pix_index, sz, tag, spacing); // compute the distance transform for foreground (non-zero) pixels	if tag = 1
 	
 	return true;
 }
 
-template <class T1, class T2> bool distTrans3d(Vol3DSimple <T1> *inimg, Vol3DSimple <T2> *distimg, Vol3DSimple <V3DLONG> *indeximg, unsigned char tag)
+template <class T1, class T2> bool distTrans3d(Vol3DSimple <T1> *inimg, Vol3DSimple <T2> *distimg, Vol3DSimple <V3DLONG> *indeximg, unsigned char tag, const float *spacing = 0)
 {	
-	if (!inimg || !inimg->valid() || !distimg || !distimg->valid() || !indeximg || !indeximg->valid())
+	if (!inimg || !inimg->valid() || !distimg || !distimg->valid() || (indeximg && !indeximg->valid()))
 	{	printf("invalid image in distance transform \n");
 		return false;
 	}
@@ -89,9 +90,9 @@ template <class T1, class T2> bool distTrans3d(Vol3DSimple <T1> *inimg, Vol3DSim
 	
 	T1 *indata1d = inimg->getData1dHandle();
 	T2 *outdata1d = distimg->getData1dHandle();	
-	V3DLONG *pix_index = indeximg->getData1dHandle();
+	V3DLONG *pix_index = indeximg ? indeximg->getData1dHandle() : 0;
 	
-	dt3d_binary(indata1d, outdata1d, pix_index, sz, tag); // compute the distance transform for foreground (non-zero) pixels	if tag = 1
+	dt3d_binary(indata1d, outdata1d, pix_index, sz, tag, spacing); // compute the distance transform for foreground (non-zero) pixels	if tag = 1
 	
 	return true;
 }
@@ -1,8 +1,15 @@
 #include <teem/nrrd.h>
+#include <zlib.h>
 
 #include "../basic_c_fun/basic_4dimage.h"
 #include "../basic_c_fun/basic_surf_objs.h"
+#include "../basic_c_fun/basic_parallel.h"
 #include <limits>
+#include <vector>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QStringList>
 #include "v3d_nrrd.h"
 
 //isnan and isfinite is a part of the C and C++ standards, support for these has been removed
@@ -12,6 +19,733 @@
 #define isnan(x) ((x)!=(x)) 
 #endif
 
+// Native reader and writer for the common NRRD layouts (x,y[,z][,c] with raw or gzip encoding),
+// so that large volumes go straight between the file and the Image4DSimple buffer: raw data is
+// copied from a mapping of the file, gzip data is inflated into the buffer as it streams in,
+// and gzip output is deflated block by block on all cores. Sub-regions only touch the rows
+// they need. Layouts that need axis permutation, other encodings and multi-file data still go
+// through teem below.
+
+enum NrrdNativeStatus {NRRD_NATIVE_OK, NRRD_NATIVE_UNSUPPORTED, NRRD_NATIVE_ERROR};
+
+static const V3DLONG NRRD_DEFLATE_BLOCK_BYTES = 1<<20;
+static const V3DLONG NRRD_INFLATE_CHUNK_BYTES = 1<<20;
+
+struct NrrdNativeHeader
+{
+    QString dataFile;       // file holding the data, the header file itself when attached
+    qint64 dataOffset;      // where the data (before line and byte skips) starts in dataFile
+    int lineSkip;
+    V3DLONG byteSkip;       // -1 = raw data ends at the end of the file
+    bool gzip;
+    bool swapBytes;
+    int datatype;           // 1, 2 or 4 bytes per voxel
+    V3DLONG sz[4];          // x, y, z, c as laid out in the file
+    double spacing[3];
+    double direction[3][3]; // space direction of x, y and z; all zero when not given
+    double origin[3];
+};
+
+static bool nrrd_host_is_little_endian()
+{
+    unsigned short v = 1;
+    return *((unsigned char *)&v) == 1;
+}
+
+static void nrrd_swap_bytes(unsigned char * p, V3DLONG nvoxels, int unitSize)
+{
+    if (unitSize==2)
+    {
+        for (V3DLONG i=0; i<nvoxels; i++, p+=2)
+        {
+            unsigned char t=p[0]; p[0]=p[1]; p[1]=t;
+        }
+    }
+    else if (unitSize==4)
+    {
+        for (V3DLONG i=0; i<nvoxels; i++, p+=4)
+        {
+            unsigned char t=p[0]; p[0]=p[3]; p[3]=t;
+            t=p[1]; p[1]=p[2]; p[2]=t;
+        }
+    }
+}
+
+// parses "(a,b,c)" into v, returns the number of components, 0 for "none"
+static int nrrd_parse_vector(const QString & token, double v[3])
+{
+    QString t = token.trimmed();
+    if (!t.startsWith("(") || !t.endsWith(")"))
+        return 0;
+    QStringList parts = t.mid(1, t.length()-2).split(",");
+    int n = 0;
+    for (int i=0; i<parts.size() && n<3; i++)
+    {
+        bool ok = false;
+        double d = parts[i].trimmed().toDouble(&ok);
+        v[n++] = ok ? d : 0;
+    }
+    return (parts.size()>3) ? -1 : n;
+}
+
+// the teem kinds that are neither domain nor unknown
+static bool nrrd_is_range_kind(const QString & kind)
+{
+    return !(kind.isEmpty() || kind=="???" || kind=="none" || kind=="domain" || kind=="space" || kind=="time");
+}
+
+// Reads the header of imgSrcFile and works out where its voxels are. Returns
+// NRRD_NATIVE_UNSUPPORTED for anything the native path does not handle exactly like teem.
+static NrrdNativeStatus nrrd_native_read_header(const char imgSrcFile[], NrrdNativeHeader & h)
+{
+    QFile f(imgSrcFile);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        v3d_msg(QString("nrrd [%1] cannot be opened").arg(imgSrcFile), 0);
+        return NRRD_NATIVE_ERROR;
+    }
+    QByteArray magic = f.readLine(64);
+    if (!magic.startsWith("NRRD000"))
+        return NRRD_NATIVE_UNSUPPORTED;
+
+    int dim = 0, spaceDim = 0;
+    QString type, encoding = "raw", endian;
+    QStringList sizes, kinds, directions, spacings, origin;
+    h.dataFile.clear();
+    h.lineSkip = 0;
+    h.byteSkip = 0;
+    bool bBlankLine = false;
+    while (!f.atEnd())
+    {
+        QString line = QString::fromLatin1(f.readLine(1<<16)).trimmed();
+        if (line.isEmpty())
+        {
+            bBlankLine = true;
+            break;
+        }
+        if (line.startsWith("#") || line.contains(":="))
+            continue;
+        int colon = line.indexOf(':');
+        if (colon<0)
+            return NRRD_NATIVE_UNSUPPORTED;
+        QString key = line.left(colon).trimmed();
+        QString value = line.mid(colon+1).trimmed();
+        QStringList words = value.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+
+        if (key=="type") type = value;
+        else if (key=="dimension") dim = value.toInt();
+        else if (key=="sizes") sizes = words;
+        else if (key=="encoding") encoding = value;
+        else if (key=="endian") endian = value;
+        else if (key=="kinds") kinds = words;
+        else if (key=="spacings") spacings = words;
+        else if (key=="space directions") directions = words;
+        else if (key=="space origin") origin = QStringList(value);
+        else if (key=="space dimension") spaceDim = value.toInt();
+        else if (key=="space")
+        {
+            if (value.contains("time") || value.endsWith("T"))
+                return NRRD_NATIVE_UNSUPPORTED; // space-time, left to teem
+            spaceDim = 3;
+        }
+        else if (key=="line skip" || key=="lineskip") h.lineSkip = value.toInt();
+        else if (key=="byte skip" || key=="byteskip") h.byteSkip = value.toLongLong();
+        else if (key=="data file" || key=="datafile")
+        {
+            if (words.size()!=1 || value=="LIST" || value.contains('%'))
+                return NRRD_NATIVE_UNSUPPORTED; // data spread over several files
+            h.dataFile = value;
+        }
+    }
+
+    if (h.dataFile.isEmpty())
+    {
+        if (!bBlankLine)
+        {
+            v3d_msg(QString("nrrd [%1] has no data after its header").arg(imgSrcFile), 0);
+            return NRRD_NATIVE_ERROR;
+        }
+        h.dataFile = QString(imgSrcFile);
+        h.dataOffset = f.pos();
+    }
+    else
+    {
+        if (QDir::isRelativePath(h.dataFile))
+            h.dataFile = QFileInfo(QString(imgSrcFile)).dir().filePath(h.dataFile);
+        h.dataOffset = 0;
+    }
+
+    if (type=="uchar" || type=="unsigned char" || type=="uint8" || type=="uint8_t"
+        || type=="signed char" || type=="int8" || type=="int8_t")
+        h.datatype = 1;
+    else if (type=="ushort" || type=="unsigned short" || type=="unsigned short int" || type=="uint16" || type=="uint16_t"
+             || type=="short" || type=="short int" || type=="signed short" || type=="signed short int" || type=="int16" || type=="int16_t")
+        h.datatype = 2;
+    else if (type=="float")
+        h.datatype = 4;
+    else
+        return NRRD_NATIVE_UNSUPPORTED;
+
+    if (encoding=="gzip" || encoding=="gz")
+        h.gzip = true;
+    else if (encoding=="raw")
+        h.gzip = false;
+    else
+        return NRRD_NATIVE_UNSUPPORTED;
+    if (h.gzip && h.byteSkip<0)
+        return NRRD_NATIVE_UNSUPPORTED;
+    h.swapBytes = (h.datatype>1) && !endian.isEmpty() && ((endian=="little") != nrrd_host_is_little_endian());
+
+    if (dim<2 || dim>4 || sizes.size()!=dim || spaceDim>3
+        || (!kinds.isEmpty() && kinds.size()!=dim) || (!directions.isEmpty() && directions.size()!=dim))
+        return NRRD_NATIVE_UNSUPPORTED;
+
+    // sort the axes into space and colour the way read_nrrd_with_pxinfo_teem() does, and keep
+    // only the layouts whose space axes come first and colour (if any) last
+    int nSpace = 0, nRange = 0, nOpen = 0;
+    int axisRole[4]; // 0 space, 1 colour, 2 undecided
+    double axisDir[4][3];
+    for (int i=0; i<dim; i++)
+    {
+        QString kind = kinds.isEmpty() ? QString() : kinds[i];
+        int n = directions.isEmpty() ? 0 : nrrd_parse_vector(directions[i], axisDir[i]);
+        if (n<0 || kind=="time")
+            return NRRD_NATIVE_UNSUPPORTED;
+        for (int j=n; j<3; j++)
+            axisDir[i][j] = 0;
+        if (n>0 || kind=="space") {axisRole[i] = 0; nSpace++;}
+        else if (nrrd_is_range_kind(kind)) {axisRole[i] = 1; nRange++;}
+        else {axisRole[i] = 2; nOpen++;}
+    }
+    if (nRange>1)
+        return NRRD_NATIVE_UNSUPPORTED;
+    for (int i=0, assigned=0; i<dim; i++)
+    {
+        if (axisRole[i]!=2)
+            continue;
+        if (nSpace==0 && assigned<nOpen && assigned<3 && nOpen>=2)
+        {
+            axisRole[i] = 0; // no explicit space axes: the first open axes are space
+            assigned++;
+        }
+        else if (nRange==0)
+        {
+            axisRole[i] = 1; // a single leftover axis is colour
+            nRange++;
+        }
+        else
+            return NRRD_NATIVE_UNSUPPORTED; // would be time
+    }
+    nSpace = 0;
+    for (int i=0; i<dim; i++)
+        if (axisRole[i]==0) nSpace++;
+    if (nSpace<2 || nSpace>3 || nSpace+nRange!=dim)
+        return NRRD_NATIVE_UNSUPPORTED;
+    for (int i=0; i<nSpace; i++)
+        if (axisRole[i]!=0)
+            return NRRD_NATIVE_UNSUPPORTED; // colour before space needs a permutation
+
+    h.sz[0] = h.sz[1] = h.sz[2] = h.sz[3] = 1;
+    for (int i=0; i<dim; i++)
+    {
+        V3DLONG s = sizes[i].toLongLong();
+        if (s<1)
+            return NRRD_NATIVE_UNSUPPORTED;
+        h.sz[(axisRole[i]==1) ? 3 : i] = s;
+    }
+
+    // spacing from the space directions, else from "spacings", else 1.0, as nrrdSpacingCalculate()
+    for (int i=0; i<3; i++)
+    {
+        h.spacing[i] = 1.0;
+        for (int j=0; j<3; j++)
+            h.direction[i][j] = 0;
+        if (i>=nSpace)
+            continue;
+        double norm2 = 0;
+        for (int j=0; j<3; j++)
+        {
+            h.direction[i][j] = axisDir[i][j];
+            norm2 += axisDir[i][j]*axisDir[i][j];
+        }
+        bool ok = false;
+        double s = (i<spacings.size()) ? spacings[i].toDouble(&ok) : 0;
+        if (norm2>0)
+            h.spacing[i] = sqrt(norm2);
+        else if (ok && !isnan(s))
+            h.spacing[i] = s;
+        else
+            printf("WARNING: no pixel spacings in Nrrd for spatial axis %d; setting to 1.0\n", i);
+    }
+
+    h.origin[0] = h.origin[1] = h.origin[2] = 0;
+    if (!origin.isEmpty())
+    {
+        double o[3] = {0, 0, 0};
+        int n = nrrd_parse_vector(origin[0], o);
+        for (int j=0; j<n && j<3; j++)
+            h.origin[j] = isnan(o[j]) ? 0.0 : o[j];
+    }
+    return NRRD_NATIVE_OK;
+}
+
+// Copies the rows of a region out of raw voxels in memory (the file mapping), for v3d_parallel_for().
+// Row r of the region is (y,z,c) = (y0 + r%ny, z0 + (r/ny)%nz, c0 + r/(ny*nz)).
+struct NrrdRegionRows
+{
+    const unsigned char * src;  // voxel 0 of the file
+    unsigned char * dst;        // voxel 0 of the region
+    V3DLONG fileSz[4], start[4], regionSz[4];
+    int unitSize;
+    bool swapBytes;
+
+    void operator()(V3DLONG begin, V3DLONG end)
+    {
+        V3DLONG rowBytes = regionSz[0]*unitSize;
+        for (V3DLONG r=begin; r<end; r++)
+        {
+            V3DLONG y = start[1] + r % regionSz[1];
+            V3DLONG z = start[2] + (r / regionSz[1]) % regionSz[2];
+            V3DLONG c = start[3] + r / (regionSz[1]*regionSz[2]);
+            V3DLONG fileVoxel = ((c*fileSz[2] + z)*fileSz[1] + y)*fileSz[0] + start[0];
+            memcpy(dst + r*rowBytes, src + fileVoxel*unitSize, rowBytes);
+            if (swapBytes)
+                nrrd_swap_bytes(dst + r*rowBytes, regionSz[0], unitSize);
+        }
+    }
+};
+
+// Swaps a whole buffer in parallel, for v3d_parallel_for()
+struct NrrdSwapBlocks
+{
+    unsigned char * data;
+    int unitSize;
+    void operator()(V3DLONG begin, V3DLONG end) {nrrd_swap_bytes(data + begin*unitSize, end-begin, unitSize);}
+};
+
+// skips lineSkip lines of f
+static bool nrrd_skip_lines(QFile & f, int lineSkip)
+{
+    for (int i=0; i<lineSkip; i++)
+    {
+        char c = 0;
+        do {
+            if (!f.getChar(&c))
+                return false;
+        } while (c!='\n');
+    }
+    return true;
+}
+
+static bool nrrd_read_raw(QFile & f, const NrrdNativeHeader & h, NrrdRegionRows & rows)
+{
+    V3DLONG fileBytes = h.sz[0]*h.sz[1]*h.sz[2]*h.sz[3]*h.datatype;
+    qint64 offset = f.pos() + h.byteSkip;
+    if (h.byteSkip<0)
+        offset = f.size() - fileBytes;
+    if (offset<0 || offset + fileBytes > f.size())
+    {
+        v3d_msg(QString("nrrd data file [%1] is shorter than its header says").arg(f.fileName()), 0);
+        return false;
+    }
+
+    // map only the span of the region, so that the rest of the file is never paged in
+    V3DLONG nrows = rows.regionSz[1]*rows.regionSz[2]*rows.regionSz[3];
+    V3DLONG firstVoxel = ((rows.start[3]*h.sz[2] + rows.start[2])*h.sz[1] + rows.start[1])*h.sz[0];
+    V3DLONG lastVoxel = (((rows.start[3]+rows.regionSz[3]-1)*h.sz[2] + rows.start[2]+rows.regionSz[2]-1)*h.sz[1]
+                         + rows.start[1]+rows.regionSz[1])*h.sz[0];
+    uchar * mapped = f.map(offset + firstVoxel*h.datatype, (lastVoxel-firstVoxel)*h.datatype);
+    if (mapped)
+    {
+        rows.src = mapped - firstVoxel*h.datatype;
+        V3DLONG grain = 1 + NRRD_INFLATE_CHUNK_BYTES/(rows.regionSz[0]*h.datatype);
+        v3d_parallel_for(nrows, rows, 0, grain);
+        f.unmap(mapped);
+        return true;
+    }
+
+    // no address space for the mapping (32-bit builds): read row by row instead
+    V3DLONG rowBytes = rows.regionSz[0]*h.datatype;
+    for (V3DLONG r=0; r<nrows; r++)
+    {
+        V3DLONG y = rows.start[1] + r % rows.regionSz[1];
+        V3DLONG z = rows.start[2] + (r / rows.regionSz[1]) % rows.regionSz[2];
+        V3DLONG c = rows.start[3] + r / (rows.regionSz[1]*rows.regionSz[2]);
+        V3DLONG fileVoxel = ((c*h.sz[2] + z)*h.sz[1] + y)*h.sz[0] + rows.start[0];
+        if (!f.seek(offset + fileVoxel*h.datatype) || f.read((char *)rows.dst + r*rowBytes, rowBytes)!=rowBytes)
+        {
+            v3d_msg(QString("nrrd data file [%1] cannot be read").arg(f.fileName()), 0);
+            return false;
+        }
+        if (h.swapBytes)
+            nrrd_swap_bytes(rows.dst + r*rowBytes, rows.regionSz[0], h.datatype);
+    }
+    return true;
+}
+
+// Inflates the gzip data of f as it streams in. A whole volume is inflated straight into the
+// buffer; for a sub-region each chunk is inflated into a small buffer and the parts of the
+// region rows in it are copied out. Reading stops after the last row of the region.
+static bool nrrd_read_gzip(QFile & f, const NrrdNativeHeader & h, NrrdRegionRows & rows)
+{
+    const int unitSize = h.datatype;
+    const V3DLONG fileRowBytes = h.sz[0]*unitSize;
+    const V3DLONG rowBytes = rows.regionSz[0]*unitSize;
+    const V3DLONG nrows = rows.regionSz[1]*rows.regionSz[2]*rows.regionSz[3];
+    const bool bWhole = (rows.regionSz[0]==h.sz[0] && rows.regionSz[1]==h.sz[1] && rows.regionSz[2]==h.sz[2] && rows.regionSz[3]==h.sz[3]);
+    const V3DLONG endByte = h.byteSkip + ((((rows.start[3]+rows.regionSz[3]-1)*h.sz[2] + rows.start[2]+rows.regionSz[2]-1)*h.sz[1]
+                                          + rows.start[1]+rows.regionSz[1])*h.sz[0])*unitSize;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 15+32) != Z_OK) // gzip or zlib header
+        return false;
+
+    std::vector<char> in(NRRD_INFLATE_CHUNK_BYTES);
+    std::vector<unsigned char> chunk;
+    if (!bWhole || h.byteSkip>0)
+        chunk.resize(NRRD_INFLATE_CHUNK_BYTES);
+
+    V3DLONG produced = 0; // decompressed bytes so far
+    bool bOk = true, bEnd = false;
+    while (bOk && produced<endByte && !bEnd)
+    {
+        if (strm.avail_in==0 && !f.atEnd())
+        {
+            qint64 n = f.read(&in[0], in.size());
+            if (n<0)
+                break;
+            strm.next_in = (Bytef *)&in[0];
+            strm.avail_in = (uInt)n;
+        }
+
+        unsigned char * out;
+        V3DLONG outBytes;
+        if (chunk.empty())
+        {
+            out = rows.dst + produced;
+            outBytes = endByte - produced;
+            if (outBytes > ((uInt)-1)/2) outBytes = ((uInt)-1)/2;
+        }
+        else
+        {
+            out = &chunk[0];
+            outBytes = chunk.size();
+            if (outBytes > endByte - produced) outBytes = endByte - produced;
+        }
+        strm.next_out = out;
+        strm.avail_out = (uInt)outBytes;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret==Z_STREAM_END)
+        {
+            // concatenated gzip members form one stream
+            if (strm.avail_in>0 || !f.atEnd())
+                inflateReset(&strm);
+            else
+                bEnd = true;
+        }
+        else if (ret!=Z_OK && ret!=Z_BUF_ERROR)
+            bOk = false;
+        V3DLONG got = outBytes - strm.avail_out;
+        if (got==0 && ret==Z_BUF_ERROR)
+            break; // out of input
+
+        // copy the pieces of the region rows that fall in [produced, produced+got)
+        if (!chunk.empty() && got>0)
+        {
+            V3DLONG fileFirst = produced - h.byteSkip, fileEnd = fileFirst + got;
+            V3DLONG firstRow = (fileFirst>0) ? fileFirst/fileRowBytes : 0;
+            for (V3DLONG fr=firstRow; fr*fileRowBytes<fileEnd; fr++)
+            {
+                V3DLONG y = fr % h.sz[1], z = (fr / h.sz[1]) % h.sz[2], c = fr / (h.sz[1]*h.sz[2]);
+                if (y<rows.start[1] || y>=rows.start[1]+rows.regionSz[1] || z<rows.start[2] || z>=rows.start[2]+rows.regionSz[2]
+                    || c<rows.start[3] || c>=rows.start[3]+rows.regionSz[3])
+                    continue;
+                V3DLONG r = ((c-rows.start[3])*rows.regionSz[2] + z-rows.start[2])*rows.regionSz[1] + y-rows.start[1];
+                V3DLONG a = fr*fileRowBytes + rows.start[0]*unitSize, b = a + rowBytes;
+                V3DLONG lo = (a>fileFirst) ? a : fileFirst, hi = (b<fileEnd) ? b : fileEnd;
+                if (lo<hi)
+                    memcpy(rows.dst + r*rowBytes + (lo-a), &chunk[0] + (lo-fileFirst), hi-lo);
+            }
+        }
+        produced += got;
+    }
+    inflateEnd(&strm);
+    if (!bOk || produced<endByte)
+    {
+        v3d_msg(QString("nrrd data file [%1] is corrupted or shorter than its header says").arg(f.fileName()), 0);
+        return false;
+    }
+
+    if (h.swapBytes)
+    {
+        NrrdSwapBlocks swapper = {rows.dst, unitSize};
+        v3d_parallel_for(nrows*rows.regionSz[0], swapper, 0, NRRD_INFLATE_CHUNK_BYTES);
+    }
+    return true;
+}
+
+// Moves spaceorigin from voxel 0 to voxel start: along the space direction of each axis, or by its
+// spacing along its own world axis when the file gives no direction. Shared by the native and teem
+// readers so that both put a region at the same place.
+static void nrrd_region_origin(const V3DLONG start[4], const double direction[3][3], const float pixelsz[4], float spaceorigin[3])
+{
+    for (int i=0; i<3; i++)
+    {
+        double o = spaceorigin[i];
+        for (int j=0; j<3; j++)
+        {
+            bool bNoDirection = (direction[j][0]==0 && direction[j][1]==0 && direction[j][2]==0);
+            o += start[j] * (bNoDirection ? ((i==j) ? pixelsz[j] : 0) : direction[j][i]);
+        }
+        spaceorigin[i] = (float) o;
+    }
+}
+
+// Reads voxels [start, start+regionSz) of a natively supported nrrd into a new buffer.
+static NrrdNativeStatus nrrd_native_read(const char imgSrcFile[], const V3DLONG start[4], const V3DLONG regionSz[4],
+                                         unsigned char *& data1d, V3DLONG * &sz, int & datatype,
+                                         float pixelsz[4], float spaceorigin[3])
+{
+    NrrdNativeHeader h;
+    NrrdNativeStatus status = nrrd_native_read_header(imgSrcFile, h);
+    if (status!=NRRD_NATIVE_OK)
+        return status;
+
+    NrrdRegionRows rows;
+    for (int i=0; i<4; i++)
+    {
+        rows.fileSz[i] = h.sz[i];
+        rows.start[i] = start ? start[i] : 0;
+        rows.regionSz[i] = regionSz ? regionSz[i] : h.sz[i]-rows.start[i];
+        if (rows.start[i]<0 || rows.regionSz[i]<1 || rows.start[i]+rows.regionSz[i]>h.sz[i])
+        {
+            v3d_msg(QString("nrrd [%1]: the requested region is outside the image").arg(imgSrcFile), 0);
+            return NRRD_NATIVE_ERROR;
+        }
+    }
+    rows.unitSize = h.datatype;
+    rows.swapBytes = h.swapBytes;
+
+    QFile f(h.dataFile);
+    if (!f.open(QIODevice::ReadOnly) || !f.seek(h.dataOffset) || !nrrd_skip_lines(f, h.lineSkip))
+    {
+        v3d_msg(QString("nrrd data file [%1] cannot be read").arg(h.dataFile), 0);
+        return NRRD_NATIVE_ERROR;
+    }
+
+    V3DLONG totalBytes = rows.regionSz[0]*rows.regionSz[1]*rows.regionSz[2]*rows.regionSz[3]*h.datatype;
+    try
+    {
+        rows.dst = new unsigned char [totalBytes];
+    }
+    catch (...)
+    {
+        v3d_msg("Fail to allocate memory in read_nrrd.", 0);
+        return NRRD_NATIVE_ERROR;
+    }
+
+    if (!(h.gzip ? nrrd_read_gzip(f, h, rows) : nrrd_read_raw(f, h, rows)))
+    {
+        delete []rows.dst;
+        return NRRD_NATIVE_ERROR;
+    }
+
+    data1d = rows.dst;
+    datatype = h.datatype;
+    sz = new V3DLONG[4];
+    for (int i=0; i<4; i++)
+        sz[i] = rows.regionSz[i];
+    for (int i=0; i<3; i++)
+    {
+        pixelsz[i] = (float) h.spacing[i];
+        spaceorigin[i] = (float) h.origin[i];
+    }
+    nrrd_region_origin(rows.start, h.direction, pixelsz, spaceorigin);
+    return NRRD_NATIVE_OK;
+}
+
+// Deflates one round of fixed-size blocks of the voxel data, for v3d_parallel_for().
+// Every block is primed with the 32 KB of data before it and ends on a byte boundary
+// (Z_SYNC_FLUSH, Z_FINISH for the last), so the blocks concatenate into one standard
+// deflate stream, and their CRCs combine into the gzip trailer.
+struct NrrdDeflateBlocks
+{
+    const unsigned char * data;
+    V3DLONG totalBytes;
+    V3DLONG firstBlock;
+    int level;
+    std::vector< std::vector<unsigned char> > out;
+    std::vector<uLong> crc;
+    std::vector<int> ok;
+
+    void operator()(V3DLONG begin, V3DLONG end)
+    {
+        for (V3DLONG b=begin; b<end; b++)
+            ok[b] = deflateBlock(firstBlock+b, out[b], crc[b]);
+    }
+
+    int deflateBlock(V3DLONG block, std::vector<unsigned char> & buf, uLong & blockCrc)
+    {
+        V3DLONG from = block*NRRD_DEFLATE_BLOCK_BYTES;
+        V3DLONG n = (totalBytes-from < NRRD_DEFLATE_BLOCK_BYTES) ? totalBytes-from : NRRD_DEFLATE_BLOCK_BYTES;
+        bool bLast = (from+n == totalBytes);
+        blockCrc = crc32(crc32(0L, Z_NULL, 0), data+from, (uInt)n);
+
+        z_stream strm;
+        memset(&strm, 0, sizeof(strm));
+        if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return 0;
+        if (from>0)
+        {
+            V3DLONG dict = (from < 32768) ? from : 32768;
+            deflateSetDictionary(&strm, data+from-dict, (uInt)dict);
+        }
+        buf.resize(deflateBound(&strm, (uLong)n) + 16);
+        strm.next_in = (Bytef *)(data+from);
+        strm.avail_in = (uInt)n;
+        V3DLONG done = 0;
+        int ret;
+        for (;;)
+        {
+            strm.next_out = &buf[0] + done;
+            strm.avail_out = (uInt)(buf.size() - done);
+            ret = deflate(&strm, bLast ? Z_FINISH : Z_SYNC_FLUSH);
+            done = buf.size() - strm.avail_out;
+            if (ret!=Z_OK || strm.avail_out>0)
+                break;
+            buf.resize(buf.size()*2); // the flush needs more room than deflateBound() promised
+        }
+        buf.resize(done);
+        deflateEnd(&strm);
+        if (bLast)
+            return ret==Z_STREAM_END;
+        return (ret==Z_OK || ret==Z_BUF_ERROR) && strm.avail_in==0;
+    }
+};
+
+static bool nrrd_write_gzip(FILE * fid, const unsigned char * data, V3DLONG totalBytes, int level)
+{
+    static const unsigned char gzipHeader[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    if (fwrite(gzipHeader, 1, 10, fid)!=10)
+        return false;
+
+    V3DLONG nblocks = (totalBytes + NRRD_DEFLATE_BLOCK_BYTES - 1) / NRRD_DEFLATE_BLOCK_BYTES;
+    if (nblocks<1)
+        nblocks = 1;
+    // a few blocks per core at a time keeps the compressed output in memory small
+    V3DLONG roundBlocks = 4 * v3d_parallel_thread_count();
+    uLong crc = crc32(0L, Z_NULL, 0);
+    NrrdDeflateBlocks blocks;
+    blocks.data = data;
+    blocks.totalBytes = totalBytes;
+    blocks.level = level;
+    for (V3DLONG first=0; first<nblocks; first+=roundBlocks)
+    {
+        V3DLONG n = (nblocks-first < roundBlocks) ? nblocks-first : roundBlocks;
+        blocks.firstBlock = first;
+        blocks.out.assign(n, std::vector<unsigned char>());
+        blocks.crc.assign(n, 0);
+        blocks.ok.assign(n, 0);
+        v3d_parallel_for(n, blocks);
+        for (V3DLONG b=0; b<n; b++)
+        {
+            if (!blocks.ok[b])
+                return false;
+            if (!blocks.out[b].empty() && fwrite(&blocks.out[b][0], 1, blocks.out[b].size(), fid)!=blocks.out[b].size())
+                return false;
+            V3DLONG from = (first+b)*NRRD_DEFLATE_BLOCK_BYTES;
+            V3DLONG len = (totalBytes-from < NRRD_DEFLATE_BLOCK_BYTES) ? totalBytes-from : NRRD_DEFLATE_BLOCK_BYTES;
+            crc = crc32_combine(crc, blocks.crc[b], (z_off_t)len);
+        }
+    }
+
+    unsigned char trailer[8];
+    for (int i=0; i<4; i++)
+    {
+        trailer[i] = (unsigned char)(crc >> (8*i));
+        trailer[4+i] = (unsigned char)(((unsigned long long)totalBytes) >> (8*i));
+    }
+    return fwrite(trailer, 1, 8, fid)==8;
+}
+
+// Writes the header teem would write for write_nrrd_with_pxinfo(), then the gzipped voxels.
+// A .nhdr file gets a detached header and its data goes to the .raw.gz file next to it.
+static bool nrrd_native_write(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype,
+                              float pixelsz[4], float spaceorigin[3])
+{
+    const char * type = 0;
+    switch ( datatype )
+    {
+        case V3D_UINT8: type = "unsigned char"; break;
+        case V3D_UINT16: type = "unsigned short"; break;
+        case V3D_FLOAT32: type = "float"; break;
+        default:
+            v3d_msg("Error: unsupported type");
+            return false;
+    }
+    const int ndim = sz[3]>1 ? 4 : 3;
+
+    QString dataFile = QString(imgSrcFile);
+    bool bDetached = dataFile.endsWith(".nhdr", Qt::CaseInsensitive);
+    if (bDetached)
+        dataFile = dataFile.left(dataFile.length()-5) + ".raw.gz";
+
+    QString header = "NRRD0004\n"
+                     "# Complete NRRD file format specification at:\n"
+                     "# http://teem.sourceforge.net/nrrd/format.html\n";
+    header += QString("type: %1\n").arg(type);
+    header += QString("dimension: %1\n").arg(ndim);
+    header += "space dimension: 3\n";
+    header += QString("sizes: %1 %2 %3").arg(sz[0]).arg(sz[1]).arg(sz[2]);
+    header += (ndim==4) ? QString(" %1\n").arg(sz[3]) : QString("\n");
+    header += "space directions:";
+    for (int i=0; i<3; i++)
+        header += QString(" (%1,%2,%3)").arg((i==0) ? (double)pixelsz[0] : 0.0, 0, 'g', 17)
+                                         .arg((i==1) ? (double)pixelsz[1] : 0.0, 0, 'g', 17)
+                                         .arg((i==2) ? (double)pixelsz[2] : 0.0, 0, 'g', 17);
+    header += (ndim==4) ? " none\n" : "\n";
+    header += (ndim==4) ? "kinds: space space space list\n" : "kinds: space space space\n";
+    header += (ndim==4) ? "labels: \"x\" \"y\" \"z\" \"c\"\n" : "labels: \"x\" \"y\" \"z\"\n";
+    if (datatype!=V3D_UINT8)
+        header += nrrd_host_is_little_endian() ? "endian: little\n" : "endian: big\n";
+    header += "encoding: gzip\n";
+    header += QString("space origin: (%1,%2,%3)\n").arg((double)spaceorigin[0], 0, 'g', 17)
+                                                   .arg((double)spaceorigin[1], 0, 'g', 17)
+                                                   .arg((double)spaceorigin[2], 0, 'g', 17);
+    if (bDetached)
+        header += QString("data file: %1\n").arg(QFileInfo(dataFile).fileName());
+    else
+        header += "\n";
+
+    QByteArray headerBytes = header.toLatin1();
+    FILE * fid = fopen(imgSrcFile, "wb");
+    if (!fid || fwrite(headerBytes.constData(), 1, headerBytes.size(), fid)!=(size_t)headerBytes.size())
+    {
+        if (fid) fclose(fid);
+        v3d_msg(QString("ERROR: write_nrrd cannot write [%1]\n").arg(imgSrcFile));
+        return false;
+    }
+    if (bDetached)
+    {
+        fclose(fid);
+        fid = fopen(dataFile.toLocal8Bit().constData(), "wb");
+        if (!fid)
+        {
+            v3d_msg(QString("ERROR: write_nrrd cannot write [%1]\n").arg(dataFile));
+            return false;
+        }
+    }
+
+    V3DLONG totalBytes = sz[0]*sz[1]*sz[2]*sz[3]*datatype;
+    bool bOk = nrrd_write_gzip(fid, data1d, totalBytes, 9);
+    if (fclose(fid)!=0)
+        bOk = false;
+    if (!bOk)
+        v3d_msg(QString("ERROR: write_nrrd cannot write [%1]\n").arg(dataFile));
+    return bOk;
+}
+
 
 bool read_nrrd(const char imgSrcFile[], unsigned char *& data1d, V3DLONG * &sz, int & datatype)
 {
@@ -23,17 +757,14 @@ bool read_nrrd(const char imgSrcFile[], unsigned char *& data1d, V3DLONG * &sz,
 bool read_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char *& data1d, V3DLONG * &sz, int & datatype,
                            float pixelsz[4], float spaceorigin[3])
 {
-    if (data1d)
-    {
-        delete []data1d;
-        data1d=0;
-    }
-    if (sz)
-    {
-        delete []sz;
-        sz=0;
-    }
+    return read_nrrd_region(imgSrcFile, 0, 0, data1d, sz, datatype, pixelsz, spaceorigin);
+}
 
+// the general reader, for the layouts the native one leaves to teem; spacedirection gets the space
+// directions of the x, y and z axes as they are returned, zero where the file gives none
+static bool read_nrrd_with_pxinfo_teem(const char imgSrcFile[], unsigned char *& data1d, V3DLONG * &sz, int & datatype,
+                                       float pixelsz[4], float spaceorigin[3], double spacedirection[3][3])
+{
     Nrrd *nrrd = nrrdNew();
     if ( nrrdLoad( nrrd, imgSrcFile, NULL ) )
     {
@@ -234,11 +965,13 @@ bool read_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char *& data1d, V3D
         }
         
         // Fetch axis spacing
+        // (the unit direction goes to a scratch vector, so that the axes keep their space directions)
         double spacing[3] = { 1.0, 1.0, 1.0 };
+        double unitDirection[NRRD_SPACE_DIM_MAX];
         for ( unsigned int i = 0; i < spaceAxisNum; ++i )
         {
             unsigned int ax=spaceAxisIdx[i];
-            switch ( nrrdSpacingCalculate( nrrd, ax, spacing+i, nrrd->axis[ax].spaceDirection ) )
+            switch ( nrrdSpacingCalculate( nrrd, ax, spacing+i, unitDirection ) )
             {
                 case nrrdSpacingStatusScalarNoSpace:
                 case nrrdSpacingStatusDirection:
@@ -290,6 +1023,14 @@ bool read_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char *& data1d, V3D
         sz[2] = ((nrrd->dim > 2) ? nrrd->axis[2].size : 1);
         sz[3] = ((nrrd->dim > 3) ? nrrd->axis[3].size : 1);
 
+        // the colour axis is last by now, so axes 0-2 are x, y and z; an inserted z axis has no direction
+        for (unsigned int i=0; i<3; i++)
+            for (unsigned int j=0; j<3; j++)
+            {
+                double d = (i<nrrd->dim && j<nrrd->spaceDim) ? nrrd->axis[i].spaceDirection[j] : 0;
+                spacedirection[i][j] = isnan(d) ? 0 : d;
+            }
+
         nrrdNix(nrrd); //free nrrd data structure w/o the actual data it points to. Added based on Greg's suggestion.
 
         return true;
@@ -297,99 +1038,86 @@ bool read_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char *& data1d, V3D
 
 }
 
-bool write_nrrd(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype)
-{
-    float pixelsz[4];
-    pixelsz[0] = pixelsz[1] = pixelsz[2] = pixelsz[3] = 1;
-    float spaceorigin[3];
-    spaceorigin[0] = spaceorigin[1] = spaceorigin[2] = 0;
-
-    return write_nrrd_with_pxinfo(imgSrcFile, data1d, sz, datatype, pixelsz, spaceorigin);
-}
-
-bool write_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype,
-                            float pixelsz[4], float spaceorigin[3])
+bool read_nrrd_region(const char imgSrcFile[], const V3DLONG start[4], const V3DLONG regionSz[4],
+                      unsigned char *& data1d, V3DLONG * &sz, int & datatype,
+                      float pixelsz[4], float spaceorigin[3])
 {
-    int nrrdType = nrrdTypeUnknown;
-    switch ( datatype )
+    if (data1d)
     {
-        case V3D_UINT8: nrrdType = nrrdTypeUChar; break;
-        case V3D_UINT16: nrrdType = nrrdTypeUShort; break;
-        case V3D_FLOAT32: nrrdType = nrrdTypeFloat; break;
-        default: 
-            v3d_msg("Error: unsupported type");
-            return false;
-            break;
+        delete []data1d;
+        data1d=0;
     }
-    
-    void* data = (void*) data1d;
-    
-    Nrrd *nrrd = nrrdNew();
-    // write gzipped if available, raw otherwise
-    NrrdIoState *nios = nrrdIoStateNew();
-    if (nrrdEncodingGzip->available() )
+    if (sz)
     {
-        nrrdIoStateEncodingSet( nios, nrrdEncodingGzip );
-        nrrdIoStateSet( nios, nrrdIoStateZlibLevel, 9 );
+        delete []sz;
+        sz=0;
     }
 
-    try
+    NrrdNativeStatus status = nrrd_native_read(imgSrcFile, start, regionSz, data1d, sz, datatype, pixelsz, spaceorigin);
+    if (status==NRRD_NATIVE_OK)
+        return true;
+    if (status==NRRD_NATIVE_ERROR)
     {
-        // nb no way to check for 5d data at present
-        size_t nsize[NRRD_DIM_MAX] = {static_cast<size_t>(sz[0]), static_cast<size_t>(sz[1]),
-                                      static_cast<size_t>(sz[2]), static_cast<size_t>(sz[3])};
-        const unsigned int ndim = sz[3]>1 ? 4 : 3;
-
-        // wrap incoming data into nrrd struct
-        if ( nrrdWrap_nva( nrrd, data, nrrdType, ndim, nsize))
-        {
-            throw( biffGetDone(NRRD) );
-        }
+        v3d_msg(QString("nrrd [%1] reading direct fail").arg(imgSrcFile));
+        return false;
+    }
 
-        // For now always set space dimensions to 3
-        nrrdSpaceDimensionSet( nrrd, 3 );
-        double origin[NRRD_DIM_MAX] = { spaceorigin[0], spaceorigin[1], spaceorigin[2]};
-        if ( nrrdSpaceOriginSet( nrrd, origin ) )
-        {
-            throw( biffGetDone(NRRD) );
-        }
-        
-        // Vaa3d Image4DSimple assumes xyzct ordering
-        int kind[NRRD_DIM_MAX] = { nrrdKindSpace, nrrdKindSpace, nrrdKindSpace, nrrdKindList, nrrdKindTime};
-        nrrdAxisInfoSet_nva(nrrd, nrrdAxisInfoKind, kind);
-        nrrdAxisInfoSet_va(nrrd, nrrdAxisInfoLabel, "x", "y", "z", "c", "t");
-        
-        // Set up space directions to record voxel spacings.
-        double spaceDir[NRRD_DIM_MAX][NRRD_SPACE_DIM_MAX];
-        for ( int i = 0; i < ndim; ++i )
-        {
-            for ( int j = 0; j < 4; ++j )
-            {
-                if (i>2 || j>2) spaceDir[i][j] = AIR_NAN;
-                else if (i == j) spaceDir[i][j] = (double) pixelsz[i];
-                else spaceDir[i][j] = 0.0; // Can't assume that memory is zeroed
-            }
-        }
-        nrrdAxisInfoSet_nva(nrrd, nrrdAxisInfoSpaceDirection, spaceDir);
+    double spacedirection[3][3];
+    if (!read_nrrd_with_pxinfo_teem(imgSrcFile, data1d, sz, datatype, pixelsz, spaceorigin, spacedirection))
+        return false;
+    if (!start && !regionSz)
+        return true;
 
-        if ( nrrdSave( imgSrcFile, nrrd, nios ) )
+    // teem has loaded the whole image, crop it
+    NrrdRegionRows rows;
+    for (int i=0; i<4; i++)
+    {
+        rows.fileSz[i] = sz[i];
+        rows.start[i] = start ? start[i] : 0;
+        rows.regionSz[i] = regionSz ? regionSz[i] : sz[i]-rows.start[i];
+        if (rows.start[i]<0 || rows.regionSz[i]<1 || rows.start[i]+rows.regionSz[i]>sz[i])
         {
-            throw( biffGetDone(NRRD) );
+            v3d_msg(QString("nrrd [%1]: the requested region is outside the image").arg(imgSrcFile), 0);
+            free(data1d); data1d=0; // allocated by teem
+            delete []sz; sz=0;
+            return false;
         }
-
     }
-    catch ( char* err )
+    rows.src = data1d;
+    rows.unitSize = datatype;
+    rows.swapBytes = false;
+    try
     {
-        v3d_msg(QString("ERROR: write_nrrd returned error '[%1]'\n").arg(err));
-        free( err );
+        rows.dst = new unsigned char [rows.regionSz[0]*rows.regionSz[1]*rows.regionSz[2]*rows.regionSz[3]*datatype];
+    }
+    catch (...)
+    {
+        v3d_msg("Fail to allocate memory in read_nrrd_region.", 0);
+        free(data1d); data1d=0;
+        delete []sz; sz=0;
         return false;
     }
-    
-    nrrdIoStateNix( nios );
-    // Free nrrd struct but not data that it points to
-    nrrdNix(nrrd);
+    v3d_parallel_for(rows.regionSz[1]*rows.regionSz[2]*rows.regionSz[3], rows);
+    free(data1d);
+    data1d = rows.dst;
+    for (int i=0; i<4; i++)
+        sz[i] = rows.regionSz[i];
+    nrrd_region_origin(rows.start, spacedirection, pixelsz, spaceorigin);
     return true;
 }
 
+bool write_nrrd(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype)
+{
+    float pixelsz[4];
+    pixelsz[0] = pixelsz[1] = pixelsz[2] = pixelsz[3] = 1;
+    float spaceorigin[3];
+    spaceorigin[0] = spaceorigin[1] = spaceorigin[2] = 0;
 
+    return write_nrrd_with_pxinfo(imgSrcFile, data1d, sz, datatype, pixelsz, spaceorigin);
+}
 
+bool write_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype,
+                            float pixelsz[4], float spaceorigin[3])
+{
+    return nrrd_native_write(imgSrcFile, data1d, sz, datatype, pixelsz, spaceorigin);
+}
@@ -7,6 +7,10 @@
 class Image4DSimple;
 bool read_nrrd(const char imgSrcFile[], unsigned char *& data1d, V3DLONG * &sz, int & datatype);
 bool read_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char *& data1d, V3DLONG * &sz, int & datatype, float pixelsz[4], float spaceorigin[3]);
+// reads only voxels [start, start+regionSz) of x, y, z and c; spaceorigin is that of the region.
+// start==0 means from 0, regionSz==0 means up to the end of each dimension
+bool read_nrrd_region(const char imgSrcFile[], const V3DLONG start[4], const V3DLONG regionSz[4],
+                      unsigned char *& data1d, V3DLONG * &sz, int & datatype, float pixelsz[4], float spaceorigin[3]);
 
 bool write_nrrd(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype);
 bool write_nrrd_with_pxinfo(const char imgSrcFile[], unsigned char * data1d, V3DLONG sz[4], int datatype, float pixelsz[4], float spaceorigin[3]);
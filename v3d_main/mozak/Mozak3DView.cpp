@@ -1934,7 +1934,7 @@ void Mozak3DView::loadNewResolutionData(	int _resIndex,
 	if(this->waitingFor5D)
 		this->setWaitingFor5D(false);
 
-    QList <V_NeuronSWC_list> prevHist = view3DWidget->getiDrawExternalParameter()->image4d->tracedNeuron_historylist;
+    V_NeuronSWC_history prevHist = view3DWidget->getiDrawExternalParameter()->image4d->tracedNeuron_historylist;
 
     V3D_env->setImage(window, _img); // this clears the rawDataPointer for _img
 
@@ -1942,7 +1942,7 @@ void Mozak3DView::loadNewResolutionData(	int _resIndex,
 	XFormWidget *w = V3dApplication::getMainWindow()->validateImageWindow(window);
 	view3DWidget->getiDrawExternalParameter()->image4d = w->getImageData();
 
-    QList <V_NeuronSWC_list> newHist = view3DWidget->getiDrawExternalParameter()->image4d->tracedNeuron_historylist;
+    V_NeuronSWC_history newHist = view3DWidget->getiDrawExternalParameter()->image4d->tracedNeuron_historylist;
 
 	// Make sure to call updateImageData AFTER getiDrawExternalParameter's image4d is
 	// set above as this is the data being updated.
@@ -54,6 +54,13 @@
 #define HDF5_SUFFIX   "h5"
 
 #include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "zlib.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 #define MAXSTP   10
@@ -64,6 +71,19 @@
 
 #define MAX_NAME 1024
 
+#define CHUNK_CACHE_BYTES  (64*1024*1024) // chunk cache of each dataset opened for reading
+#define CHUNK_BATCH        512            // chunks moved to/from the file between two parallel (de)compression steps
+
+/* With HDF5 1.10.3 or later stored chunks are read and written as they are (H5Dread_chunk, H5Dwrite_chunk) and
+ * inflated/deflated here by zlib on all cores, outside the library that serializes every call. Datasets with
+ * other filters or a non native type, and older libraries, go through H5Dread/H5Dwrite.
+ */
+#ifdef H5_VERSION_GE
+#if H5_VERSION_GE(1,10,3)
+#define DIRECT_CHUNK_IO
+#endif
+#endif
+
 typedef double vxl_size_t[3];
 typedef hsize_t dims_t[3];
 typedef int subdvsns_t[3];
@@ -73,6 +93,225 @@ typedef int subdvsns_t[3];
  * current implementation assumes that all time points from 0 to i-1 have been created before creating timepoint i
  */
 
+/****************************************************************************
+* Chunk layer
+****************************************************************************/
+
+struct chunk_layout_t {
+	hsize_t dims[3];   // dataset dimensions (DVH)
+	hsize_t chunk[3];  // chunk dimensions (DVH)
+	int     nbytes;    // bytes per voxel
+	bool    deflate;   // deflate is the only filter
+	int     level;     // deflate compression level
+	bool    direct;    // chunks can be moved as stored
+};
+
+static void get_chunk_layout ( hid_t dataset_id, hid_t mem_type_id, chunk_layout_t &layout ) {
+	hid_t space_id = H5Dget_space(dataset_id);
+	H5Sget_simple_extent_dims(space_id, layout.dims, NULL);
+	H5Sclose(space_id);
+
+	hid_t type_id = H5Dget_type(dataset_id);
+	layout.nbytes = (int) H5Tget_size(type_id);
+	bool native = H5Tequal(type_id,mem_type_id) > 0;
+	H5Tclose(type_id);
+
+	layout.deflate = false;
+	layout.level   = 3;
+	layout.direct  = false;
+	hid_t plist_id = H5Dget_create_plist(dataset_id);
+	if ( H5Pget_layout(plist_id) == H5D_CHUNKED && H5Pget_chunk(plist_id,3,layout.chunk) == 3 ) {
+		int n_filters = H5Pget_nfilters(plist_id);
+		if ( n_filters == 1 ) {
+			unsigned int flags;
+			unsigned int level = 0;
+			size_t n_values = 1;
+			layout.deflate = H5Pget_filter2(plist_id,0,&flags,&n_values,&level,0,NULL,NULL) == H5Z_FILTER_DEFLATE;
+			if ( n_values == 1 )
+				layout.level = (int) level;
+		}
+#ifdef DIRECT_CHUNK_IO
+		layout.direct = native && (n_filters == 0 || layout.deflate);
+#endif
+	}
+	else
+		for ( int i=0; i<3; i++ )
+			layout.chunk[i] = layout.dims[i] ? layout.dims[i] : 1;
+	H5Pclose(plist_id);
+}
+
+/* lists the offsets of the chunks intersecting the box [start,start+count) */
+static void list_chunks ( const chunk_layout_t &layout, const hsize_t *start, const hsize_t *count, std::vector<hsize_t> &offsets ) {
+	offsets.clear();
+	hsize_t lo[3], hi[3];
+	for ( int i=0; i<3; i++ ) {
+		lo[i] = (start[i] / layout.chunk[i]) * layout.chunk[i];
+		hi[i] = start[i] + count[i];
+	}
+	for ( hsize_t d=lo[0]; d<hi[0]; d+=layout.chunk[0] )
+		for ( hsize_t v=lo[1]; v<hi[1]; v+=layout.chunk[1] )
+			for ( hsize_t h=lo[2]; h<hi[2]; h+=layout.chunk[2] ) {
+				offsets.push_back(d);
+				offsets.push_back(v);
+				offsets.push_back(h);
+			}
+}
+
+/* copies the intersection of the chunk at offset with the box [start,start+count) between the chunk and the box buffer */
+static void copy_chunk ( const chunk_layout_t &layout, const hsize_t *offset, const hsize_t *start, const hsize_t *count,
+						 iim::uint8 *chunk, iim::uint8 *box, bool to_box ) {
+	hsize_t lo[3], hi[3];
+	for ( int i=0; i<3; i++ ) {
+		lo[i] = std::max(offset[i],start[i]);
+		hi[i] = std::min(offset[i]+layout.chunk[i],start[i]+count[i]);
+		if ( lo[i] >= hi[i] )
+			return;
+	}
+	size_t row = (size_t) (hi[2] - lo[2]) * layout.nbytes;
+	for ( hsize_t d=lo[0]; d<hi[0]; d++ )
+		for ( hsize_t v=lo[1]; v<hi[1]; v++ ) {
+			iim::uint8 *c = chunk + ((((d-offset[0])*layout.chunk[1] + v-offset[1])*layout.chunk[2] + lo[2]-offset[2]) * layout.nbytes);
+			iim::uint8 *b = box + ((((d-start[0])*count[1] + v-start[1])*count[2] + lo[2]-start[2]) * layout.nbytes);
+			if ( to_box )
+				memcpy(b,c,row);
+			else
+				memcpy(c,b,row);
+		}
+}
+
+#ifdef DIRECT_CHUNK_IO
+
+static int chunk_threads ( ) {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+/* reads the box [start,start+count) of the dataset into buf (DVH order, voxels as stored) */
+static void read_chunks ( hid_t dataset_id, const chunk_layout_t &layout, const hsize_t *start, const hsize_t *count, iim::uint8 *buf ) {
+	std::vector<hsize_t> offsets;
+	list_chunks(layout,start,count,offsets);
+	int n_chunks = (int) (offsets.size() / 3);
+	size_t chunk_bytes = (size_t) (layout.chunk[0] * layout.chunk[1] * layout.chunk[2] * layout.nbytes);
+	std::vector< std::vector<iim::uint8> > stored(std::min(n_chunks,CHUNK_BATCH));
+	std::vector<uint32_t> filter_mask(stored.size());
+
+	for ( int first=0; first<n_chunks; first+=CHUNK_BATCH ) {
+		int n = std::min(CHUNK_BATCH,n_chunks-first);
+
+		// the library is not reentrant: chunks are fetched on this thread
+		for ( int i=0; i<n; i++ ) {
+			hsize_t *offset = &offsets[3*(first+i)];
+			hsize_t stored_bytes = 0;
+			herr_t status;
+			H5E_BEGIN_TRY { // chunks never written are not allocated
+				status = H5Dget_chunk_storage_size(dataset_id,offset,&stored_bytes);
+			} H5E_END_TRY;
+			stored[i].resize(status < 0 ? 0 : (size_t) stored_bytes);
+			filter_mask[i] = 0;
+			if ( !stored[i].empty() && H5Dread_chunk(dataset_id,H5P_DEFAULT,offset,&filter_mask[i],&stored[i][0]) < 0 )
+				throw iim::IOException(iim::strprintf("cannot read chunk at (%d,%d,%d)",(int)offset[0],(int)offset[1],(int)offset[2]).c_str(),__iim__current__function__);
+		}
+
+		int n_bad = 0;
+		#pragma omp parallel
+		{
+			std::vector<iim::uint8> chunk(chunk_bytes);
+			#pragma omp for schedule(dynamic)
+			for ( int i=0; i<n; i++ ) {
+				bool good = true;
+				if ( stored[i].empty() ) // fill value
+					memset(&chunk[0],0,chunk_bytes);
+				else if ( layout.deflate && !(filter_mask[i] & 1) ) {
+					uLongf len = (uLongf) chunk_bytes;
+					good = uncompress(&chunk[0],&len,&stored[i][0],(uLong) stored[i].size()) == Z_OK && len == chunk_bytes;
+				}
+				else if ( (good = stored[i].size() == chunk_bytes) )
+					memcpy(&chunk[0],&stored[i][0],chunk_bytes);
+				if ( good )
+					copy_chunk(layout,&offsets[3*(first+i)],start,count,&chunk[0],buf,true);
+				else {
+					#pragma omp atomic
+					n_bad++;
+				}
+			}
+		}
+		if ( n_bad )
+			throw iim::IOException(iim::strprintf("%d corrupted chunks",n_bad).c_str(),__iim__current__function__);
+	}
+}
+
+/* writes n_slices whole planes starting at slice z0 (a multiple of the chunk depth) from buf;
+ * chunks crossing the end of the slices are padded with zeros */
+static void write_chunks ( hid_t dataset_id, const chunk_layout_t &layout, hsize_t z0, hsize_t n_slices, iim::uint8 *buf ) {
+	hsize_t start[3] = {z0, 0, 0};
+	hsize_t count[3] = {n_slices, layout.dims[1], layout.dims[2]};
+	std::vector<hsize_t> offsets;
+	list_chunks(layout,start,count,offsets);
+	int n_chunks = (int) (offsets.size() / 3);
+	size_t chunk_bytes = (size_t) (layout.chunk[0] * layout.chunk[1] * layout.chunk[2] * layout.nbytes);
+	std::vector< std::vector<iim::uint8> > stored(std::min(n_chunks,CHUNK_BATCH));
+	std::vector<uint32_t> filter_mask(stored.size());
+
+	for ( int first=0; first<n_chunks; first+=CHUNK_BATCH ) {
+		int n = std::min(CHUNK_BATCH,n_chunks-first);
+
+		#pragma omp parallel
+		{
+			std::vector<iim::uint8> chunk(chunk_bytes);
+			#pragma omp for schedule(dynamic)
+			for ( int i=0; i<n; i++ ) {
+				memset(&chunk[0],0,chunk_bytes);
+				copy_chunk(layout,&offsets[3*(first+i)],start,count,&chunk[0],buf,false);
+				filter_mask[i] = 0;
+				if ( layout.deflate ) {
+					uLongf len = compressBound((uLong) chunk_bytes);
+					stored[i].resize(len);
+					if ( compress2(&stored[i][0],&len,&chunk[0],(uLong) chunk_bytes,layout.level) == Z_OK && len < chunk_bytes ) {
+						stored[i].resize(len);
+						continue;
+					}
+					filter_mask[i] = 1; // incompressible: stored skipping the filter
+				}
+				stored[i].assign(chunk.begin(),chunk.end());
+			}
+		}
+
+		for ( int i=0; i<n; i++ ) {
+			hsize_t *offset = &offsets[3*(first+i)];
+			if ( H5Dwrite_chunk(dataset_id,H5P_DEFAULT,filter_mask[i],offset,stored[i].size(),&stored[i][0]) < 0 )
+				throw iim::IOException(iim::strprintf("cannot write chunk at (%d,%d,%d)",(int)offset[0],(int)offset[1],(int)offset[2]).c_str(),__iim__current__function__);
+		}
+	}
+}
+
+#endif // DIRECT_CHUNK_IO
+
+/* writes n_slices whole planes starting at slice z0 from buf (voxels of type mem_type_id) */
+static void write_slices ( hid_t dataset_id, hid_t mem_type_id, const chunk_layout_t &layout, hsize_t z0, hsize_t n_slices, iim::uint8 *buf ) {
+	if ( n_slices == 0 )
+		return;
+#ifdef DIRECT_CHUNK_IO
+	if ( layout.direct && z0 % layout.chunk[0] == 0 ) {
+		write_chunks(dataset_id,layout,z0,n_slices,buf);
+		return;
+	}
+#endif
+	hsize_t start[3] = {z0, 0, 0};
+	hsize_t count[3] = {n_slices, layout.dims[1], layout.dims[2]};
+	hid_t bufspace_id = H5Screate_simple(3,count,NULL);
+	hid_t filespace_id = H5Dget_space(dataset_id);
+	H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, start, NULL, count, NULL);
+	herr_t status = H5Dwrite(dataset_id, mem_type_id, bufspace_id, filespace_id, H5P_DEFAULT, buf);
+	H5Sclose(filespace_id);
+	H5Sclose(bufspace_id);
+	if ( status < 0 )
+		throw iim::IOException(iim::strprintf("cannot write slices %d to %d",(int)z0,(int)(z0+n_slices-1)).c_str(),__iim__current__function__);
+}
+
+
 /****************************************************************************
 * BDV-HDF5 file descriptor
 ****************************************************************************/
@@ -91,10 +330,24 @@ class BDV_HDF5_fdescr_t {
 	int         vxl_nbytes;      // number of bytes of each channel 
 	hid_t       vxl_type;        // HDF5 type of voxel values
 	hsize_t  ***n_slices;        // number of slices of each time point at each setup at each resolutions (all setups should have the same number of slices)
+
+	/* Appended slices are staged until they fill a layer of chunks, so that every chunk is compressed and written
+	 * once, whatever the number of slices of each call (generateTilesBDV_HDF5 appends 2^(n_res-1-r) slices at
+	 * resolution r). Keys are (tp*MAXSTP + s)*MAXRES + r. */
+	struct staged_layer_t {
+		hsize_t z0;                    // first slice of the layer
+		hsize_t n;                     // slices staged
+		std::vector<iim::uint8> data;  // whole planes
+		staged_layer_t ( ) : z0(0), n(0) { }
+	};
+	std::map<int,staged_layer_t> staged;
 	
 	// private methods
 	void scan_root ( );
 
+	hid_t openDataset ( int tp, int s, int r );
+	/* opens the cells dataset of setup s at resolution r of time point tp */
+
 public:
 	BDV_HDF5_fdescr_t ( );
 	/* default constructor: returns and empty descriptor */
@@ -133,6 +386,9 @@ public:
 
 	int writeHyperslab ( int tp, int s, int r, iim::uint8 *buf, hsize_t *dims_buf, hsize_t *hl_buf, hsize_t *hl_file = 0 ); 
 	/* write hyperslab hl_buf stored in buffer buf to hyperslab hl_file at time point tp and resolution r */
+
+	void flush ( );
+	/* write the slices still staged */
 };
 
 
@@ -143,6 +399,7 @@ struct BDV_volume_descr_t {
 	hid_t  vxl_type;
 	int    vxl_nbytes;
 	hid_t *datasets_id; //
+	chunk_layout_t *layouts; // chunk layout of each dataset
 };
 
 
@@ -657,111 +914,140 @@ void BDV_HDF5_fdescr_t::scan_root ( ) {
 }
 
 
-int BDV_HDF5_fdescr_t::writeHyperslab ( int tp, int s, int r, iim::uint8 *buf, hsize_t *dims_buf, hsize_t *hl_buf, hsize_t *hl_file ) {
-
+hid_t BDV_HDF5_fdescr_t::openDataset ( int tp, int s, int r ) {
 	hsize_t len;
 	char gname[MAX_NAME];
 
-	hid_t data_group_id;
-	hid_t data_subgroup_id;
-	hid_t dataset_id;
-	hid_t datatype_id;
-	hid_t dataspace_id;
-	hid_t bufspace_id;
-
-	H5T_class_t class_id;
-	hsize_t size; // data size (#bytes)
-	int rank;   // dataset #dimensions
-	
-	hsize_t dims_file[3]; // dataset dimensions
-	hsize_t start_file[3];    // dataset dimensions
-	hsize_t count_file[3];    // dataset dimensions
-
-	hsize_t start_buf[3];    // dataset dimensions
-	hsize_t count_buf[3];    // dataset dimensions
-
-	herr_t status;
-
-    /*
-     * Define the memory dataspace.
-     */
-    bufspace_id = H5Screate_simple(3,dims_buf,NULL);   
-
-    /* 
-     * Define memory hyperslab. 
-     */
-    start_buf[0] = hl_buf[0];
-    start_buf[1] = hl_buf[1];
-    start_buf[2] = hl_buf[2];
-    count_buf[0]  = hl_buf[6];
-    count_buf[1]  = hl_buf[7];
-    count_buf[2]  = hl_buf[8];
-    status = H5Sselect_hyperslab(bufspace_id, H5S_SELECT_SET, start_buf, NULL, 
-				 count_buf, NULL);
-
 	// get name of setup to be written
 	len = H5Iget_name(setup_groups_id[s], gname, (size_t)MAX_NAME );
-	data_group_id = H5Gopen(tp_groups_id[tp],gname+1,H5P_DEFAULT);
+	hid_t data_group_id = H5Gopen(tp_groups_id[tp],gname+1,H5P_DEFAULT);
 
 	// get group (resolution) of dataset
 	std::stringstream res;
 	res << r;
-	data_subgroup_id = H5Gopen(data_group_id, res.str().c_str(), H5P_DEFAULT);
+	hid_t data_subgroup_id = H5Gopen(data_group_id, res.str().c_str(), H5P_DEFAULT);
 
 	// get dataset
-	dataset_id = H5Dopen(data_subgroup_id,"cells",H5P_DEFAULT);
+	hid_t dataset_id = H5Dopen(data_subgroup_id,"cells",H5P_DEFAULT);
 
-    /*
-     * Get datatype and dataspace handles and then query
-     * dataset class, order, size, rank and dimensions.
-     */
-    datatype_id  = H5Dget_type(dataset_id);     /* datatype handle */ 
-    class_id     = H5Tget_class(datatype_id);
-    //if (_class == H5T_INTEGER) printf("Data set has INTEGER type \n");
-    //order     = H5Tget_order(datatype);
-    //if (order == H5T_ORDER_LE) printf("Little endian order \n");
-
-	// number of bytes of the data type
-    size  = H5Tget_size(datatype_id);
-
-    dataspace_id = H5Dget_space(dataset_id);    /* dataspace handle */
-    rank      = H5Sget_simple_extent_ndims(dataspace_id);
-    status  = H5Sget_simple_extent_dims(dataspace_id, dims_file, NULL);
-    
-    /* 
-     * Define hyperslab in the dataset. 
-     */
-    if ( hl_file ) // data have not to be appended
+	H5Gclose(data_subgroup_id);
+	H5Gclose(data_group_id);
+
+	return dataset_id;
+}
+
+
+int BDV_HDF5_fdescr_t::writeHyperslab ( int tp, int s, int r, iim::uint8 *buf, hsize_t *dims_buf, hsize_t *hl_buf, hsize_t *hl_file ) {
+
+	if ( hl_file ) // data have not to be appended
 		throw iim::IOException(iim::strprintf("File hiperslab provided: only append operation is supported").c_str(),__iim__current__function__);
-    else { // append slice
-    	start_file[0] = n_slices[tp][s][r];
-    	start_file[1] = 0;
-    	start_file[2] = 0;
-		count_file[0]  = count_buf[0];
-		count_file[1]  = count_buf[1];
-		count_file[2]  = count_buf[2];
-		status = H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, start_file, NULL, 
-				 count_file, NULL);
 
-		/*
-		 * Write the data to the hyperslab.
-		 */
-		status = H5Dwrite(dataset_id, vxl_type, bufspace_id, dataspace_id, H5P_DEFAULT, buf);
+	hid_t dataset_id = openDataset(tp,s,r);
+	chunk_layout_t layout;
+	get_chunk_layout(dataset_id,vxl_type,layout);
+
+	hsize_t start_buf[3] = {hl_buf[0], hl_buf[1], hl_buf[2]};
+	hsize_t count_buf[3] = {hl_buf[6], hl_buf[7], hl_buf[8]};
+
+	// append slices, those beyond the dataset extent are dropped
+	hsize_t z = n_slices[tp][s][r];
+	hsize_t n = (z < layout.dims[0]) ? std::min(count_buf[0],layout.dims[0] - z) : 0;
+	n_slices[tp][s][r] += count_buf[0];
+
+	int key = (tp*MAXSTP + s)*MAXRES + r;
+	staged_layer_t &layer = staged[key];
+	size_t plane = (size_t) (layout.dims[1] * layout.dims[2] * vxl_nbytes);
+
+	try {
+		if ( count_buf[1] != layout.dims[1] || count_buf[2] != layout.dims[2] || start_buf[1] || start_buf[2] ) { // not whole planes: no staging
+			write_slices(dataset_id,vxl_type,layout,layer.z0,layer.n,layer.data.empty() ? 0 : &layer.data[0]);
+			staged.erase(key);
+
+			hid_t bufspace_id = H5Screate_simple(3,dims_buf,NULL);
+			hid_t dataspace_id = H5Dget_space(dataset_id);
+			hsize_t start_file[3] = {z, 0, 0};
+			hsize_t count_file[3] = {n, count_buf[1], count_buf[2]};
+			count_buf[0] = n;
+			H5Sselect_hyperslab(bufspace_id, H5S_SELECT_SET, start_buf, NULL, count_buf, NULL);
+			H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, start_file, NULL, count_file, NULL);
+			herr_t status = n ? H5Dwrite(dataset_id, vxl_type, bufspace_id, dataspace_id, H5P_DEFAULT, buf) : 0;
+			H5Sclose(bufspace_id);
+			H5Sclose(dataspace_id);
+			if ( status < 0 )
+				throw iim::IOException(iim::strprintf("cannot write slices %d to %d",(int)z,(int)(z+n-1)).c_str(),__iim__current__function__);
+		}
+		else {
+			iim::uint8 *src = buf + (size_t) (start_buf[0] * plane);
+			hsize_t depth = layout.chunk[0];
+
+			// complete the staged layer
+			if ( layer.n ) {
+				hsize_t m = std::min(n,depth - layer.n);
+				memcpy(&layer.data[(size_t) (layer.n * plane)],src,(size_t) (m * plane));
+				layer.n += m;
+				z   += m;
+				n   -= m;
+				src += m * plane;
+				if ( layer.n == depth || z == layout.dims[0] ) {
+					write_slices(dataset_id,vxl_type,layout,layer.z0,layer.n,&layer.data[0]);
+					layer.n = 0;
+				}
+			}
+
+			// whole layers, and the last one of the dataset, straight from the buffer
+			hsize_t m = (z + n == layout.dims[0]) ? n : (n / depth) * depth;
+			if ( m ) {
+				write_slices(dataset_id,vxl_type,layout,z,m,src);
+				z   += m;
+				n   -= m;
+				src += m * plane;
+			}
 
-		n_slices[tp][s][r] += count_buf[0];
+			// stage the beginning of the next layer
+			if ( n ) {
+				layer.data.resize((size_t) (depth * plane));
+				memcpy(&layer.data[0],src,(size_t) (n * plane));
+				layer.z0 = z;
+				layer.n  = n;
+			}
+			else if ( layer.n == 0 )
+				staged.erase(key);
+		}
+	}
+	catch ( iim::IOException & ) {
+		H5Dclose(dataset_id);
+		throw;
 	}
 
-	H5Tclose(datatype_id);
-	H5Sclose(bufspace_id);
-	H5Sclose(dataspace_id);
 	H5Dclose(dataset_id);
-	H5Gclose(data_subgroup_id);
-	H5Gclose(data_group_id);
 
 	return 0;
 }
 
 
+void BDV_HDF5_fdescr_t::flush ( ) {
+	for ( std::map<int,staged_layer_t>::iterator it=staged.begin(); it!=staged.end(); it++ ) {
+		if ( it->second.n == 0 )
+			continue;
+		int r  = it->first % MAXRES;
+		int s  = (it->first / MAXRES) % MAXSTP;
+		int tp = it->first / (MAXRES*MAXSTP);
+		hid_t dataset_id = openDataset(tp,s,r);
+		chunk_layout_t layout;
+		get_chunk_layout(dataset_id,vxl_type,layout);
+		try {
+			write_slices(dataset_id,vxl_type,layout,it->second.z0,it->second.n,&it->second.data[0]);
+		}
+		catch ( iim::IOException & ) {
+			H5Dclose(dataset_id);
+			throw;
+		}
+		H5Dclose(dataset_id);
+	}
+	staged.clear();
+}
+
+
 hid_t *BDV_HDF5_fdescr_t::getDATASETS_ID ( int tp, int r ) {
 	int len;
 	char gname[MAX_NAME];
@@ -770,6 +1056,10 @@ hid_t *BDV_HDF5_fdescr_t::getDATASETS_ID ( int tp, int r ) {
 
 	hid_t *dsets_id = new hid_t[n_setups];
 
+	// subvolumes read one after the other usually overlap: keep their chunks decompressed
+	hid_t dapl_id = H5Pcreate(H5P_DATASET_ACCESS);
+	H5Pset_chunk_cache(dapl_id, 12421, CHUNK_CACHE_BYTES, 0.75);
+
 	for ( int s=0; s<n_setups; s++ ) {
 		/* Open the setup dataset group of time point tp */
 		len = H5Iget_name(setup_groups_id[s], gname, (size_t)MAX_NAME );
@@ -778,12 +1068,14 @@ hid_t *BDV_HDF5_fdescr_t::getDATASETS_ID ( int tp, int r ) {
 		std::stringstream res;
 		res << r;
 		tp_subsubgroup_id = H5Gopen2(tp_subgroup_id, res.str().c_str(), H5P_DEFAULT);
-		dsets_id[s] = H5Dopen2(tp_subsubgroup_id,"cells",H5P_DEFAULT);
+		dsets_id[s] = H5Dopen2(tp_subsubgroup_id,"cells",dapl_id);
 
 		H5Gclose(tp_subsubgroup_id);
 		H5Gclose(tp_subgroup_id);
 	}
 
+	H5Pclose(dapl_id);
+
 	return dsets_id;
 }
 
@@ -823,6 +1115,7 @@ int BDV_HDF5n_resolutions ( void *descr ) {
 
 void BDV_HDF5close ( void *descr ) {
 #ifdef ENABLE_BDV_HDF5
+	((BDV_HDF5_fdescr_t *) descr)->flush();
 	delete (BDV_HDF5_fdescr_t *) descr;
 #else
 	throw iim::IOException(iim::strprintf(
@@ -921,6 +1214,9 @@ void BDV_HDF5getVolumeInfo ( void *descr, int tp, int res, void *&volume_descr,
 	int_volume_descr->vxl_nbytes = int_descr->getVXL_NBYTES();
 
 	int_volume_descr->datasets_id = int_descr->getDATASETS_ID(tp,res);
+	int_volume_descr->layouts = new chunk_layout_t[int_volume_descr->n_setups];
+	for ( int s=0; s<int_volume_descr->n_setups; s++ )
+		get_chunk_layout(int_volume_descr->datasets_id[s],int_volume_descr->vxl_type,int_volume_descr->layouts[s]);
 
 	volume_descr = int_volume_descr;
 #else
@@ -964,12 +1260,47 @@ void BDV_HDF5getSubVolume ( void *descr, int V0, int V1, int H0, int H1, int D0,
     status = H5Sselect_hyperslab(bufspace_id, H5S_SELECT_SET, start_buf, NULL, 
 				 dims_buf, NULL);
 
+	// chunks are decompressed in parallel when the library lets them be read as stored;
+	// on a single thread H5Dread is as fast and keeps the decompressed chunks in the dataset cache
+	chunk_layout_t &layout = int_volume_descr->layouts[setup];
+#ifdef DIRECT_CHUNK_IO
+	bool direct = chunk_threads() > 1 && layout.direct && layout.nbytes == int_volume_descr->vxl_nbytes && D0 >= 0 && V0 >= 0 && H0 >= 0 && D0 < D1 && V0 < V1 && H0 < H1 &&
+				  (hsize_t) D1 <= layout.dims[0] && (hsize_t) V1 <= layout.dims[1] && (hsize_t) H1 <= layout.dims[2];
+#endif
+
 	if ( int_volume_descr->vxl_nbytes == 1 ) {
+#ifdef DIRECT_CHUNK_IO
+		if ( direct ) {
+			try {
+				read_chunks(int_volume_descr->datasets_id[setup],layout,start_file,dims_buf,buf);
+			}
+			catch ( iim::IOException & ) {
+				H5Sclose(bufspace_id);
+				H5Sclose(filespace_id);
+				throw;
+			}
+		}
+		else
+#endif
 		status = H5Dread(int_volume_descr->datasets_id[setup],int_volume_descr->vxl_type,bufspace_id,filespace_id,H5P_DEFAULT,buf);
 	}
 	else if ( int_volume_descr->vxl_nbytes == 2 ) {
 		iim::sint64 sbv_ch_dim = dims_buf[0] * dims_buf[1] * dims_buf[2];
 		iim::uint8 *tempbuf = new iim::uint8[2 * sbv_ch_dim];
+#ifdef DIRECT_CHUNK_IO
+		if ( direct ) {
+			try {
+				read_chunks(int_volume_descr->datasets_id[setup],layout,start_file,dims_buf,tempbuf);
+			}
+			catch ( iim::IOException & ) {
+				delete[] tempbuf;
+				H5Sclose(bufspace_id);
+				H5Sclose(filespace_id);
+				throw;
+			}
+		}
+		else
+#endif
 		status = H5Dread(int_volume_descr->datasets_id[setup],int_volume_descr->vxl_type,bufspace_id,filespace_id,H5P_DEFAULT,tempbuf);
 
 		// convert to 8 bit and copy to buf
@@ -992,6 +1323,8 @@ void BDV_HDF5closeVolume ( void *descr ) {
 	BDV_volume_descr_t *int_volume_descr = (BDV_volume_descr_t *) descr;
 	if ( int_volume_descr->datasets_id )
 		delete int_volume_descr->datasets_id;
+	if ( int_volume_descr->layouts )
+		delete[] int_volume_descr->layouts;
 	delete (BDV_volume_descr_t *) descr;
 #else
 	throw iim::IOException(iim::strprintf(
@@ -0,0 +1,167 @@
+// bdv_hdf5_benchmark.cpp - write and read throughput of BigDataViewer HDF5 files through HDF5Mngr.
+//
+// Generates a synthetic 8-bit volume and converts it the way VolumeConverter::generateTilesBDV_HDF5() does
+// (slabs of 2^(resolutions-1) slices, every resolution written from the same slab), then reads it back
+// with BDV_HDF5getSubVolume(): whole slices, and random subvolumes of the size terafly requests.
+// Every voxel read at the highest resolution is checked against the generated data.
+//
+// build (from this directory, HDF5 >= 1.10.3 enables the parallel chunk path, add -fopenmp to use it):
+//     h5c++ -O2 -fopenmp -I.. -I../../iomanager bdv_hdf5_benchmark.cpp ../HDF5Mngr.cpp ../RawFmtMngr.cpp ../IM_config.cpp
+//
+// usage: bdv_hdf5_benchmark [file=bdv_benchmark.h5] [dimV=1024] [dimH=1024] [dimD=256] [resolutions=4] [chunk=16]
+
+#include "HDF5Mngr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <vector>
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+// smooth structures plus noise, never 0 so that unwritten regions show up
+static iim::uint8 voxel(iim::sint64 d, iim::sint64 v, iim::sint64 h)
+{
+	unsigned int x = (unsigned int)(d*73856093 ^ v*19349663 ^ h*83492791);
+	return (iim::uint8)(1 + ((v/7 + h/5 + d/3) % 128) + (x % 64));
+}
+
+// 2x2x2 mean, as VirtualVolume::halveSample_UINT8() with HALVE_BY_MEAN
+static void halve(std::vector<iim::uint8> & buf, iim::sint64 & dd, iim::sint64 & dv, iim::sint64 & dh)
+{
+	iim::sint64 nd = dd/2, nv = dv/2, nh = dh/2;
+	for(iim::sint64 d=0; d<nd; d++)
+		for(iim::sint64 v=0; v<nv; v++)
+			for(iim::sint64 h=0; h<nh; h++)
+			{
+				int sum = 0;
+				for(int k=0; k<8; k++)
+					sum += buf[((2*d+(k>>2))*dv + 2*v+((k>>1)&1))*dh + 2*h+(k&1)];
+				buf[(d*nv + v)*nh + h] = (iim::uint8)(sum/8);
+			}
+	dd = nd;  dv = nv;  dh = nh;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *fname = argc>1 ? argv[1] : "bdv_benchmark.h5";
+	iim::sint64 dimV = argc>2 ? atoi(argv[2]) : 1024;
+	iim::sint64 dimH = argc>3 ? atoi(argv[3]) : 1024;
+	iim::sint64 dimD = argc>4 ? atoi(argv[4]) : 256;
+	int n_res = argc>5 ? atoi(argv[5]) : 4;
+	int chunk = argc>6 ? atoi(argv[6]) : 16;
+	if ( dimV<1 || dimH<1 || dimD<1 || n_res<1 || n_res>8 || chunk<1 ) {
+		fprintf(stderr,"usage: %s [file] [dimV] [dimH] [dimD] [resolutions] [chunk]\n",argv[0]);
+		return 1;
+	}
+	remove(fname);
+
+	try {
+		// write
+		double t0 = now();
+		void *descr;
+		BDV_HDF5init(fname,descr,1);
+		bool res[8] = {false};
+		for ( int r=0; r<n_res; r++ )
+			res[r] = true;
+		BDV_HDF5addSetups(descr,dimV,dimH,dimD,1.0f,1.0f,1.0f,res,n_res,1,chunk,chunk,chunk);
+		BDV_HDF5addTimepoint(descr);
+
+		iim::sint64 slab = (iim::sint64)1 << (n_res-1);
+		std::vector<iim::uint8> buf;
+		for ( iim::sint64 z=0; z<dimD; z+=slab ) {
+			iim::sint64 dd = std::min(slab,dimD-z), dv = dimV, dh = dimH;
+			buf.resize(dd*dv*dh);
+			for ( iim::sint64 d=0; d<dd; d++ )
+				for ( iim::sint64 v=0; v<dv; v++ )
+					for ( iim::sint64 h=0; h<dh; h++ )
+						buf[(d*dv + v)*dh + h] = voxel(z+d,v,h);
+			for ( int r=0; r<n_res; r++ ) {
+				if ( r )
+					halve(buf,dd,dv,dh);
+				if ( dd <= 0 )
+					break;
+				iim::sint64 dims[3] = {dd, dimV >> r, dimH >> r};
+				iim::sint64 hl[12] = {0,0,0, 1,1,1, dd,dims[1],dims[2], 1,1,1};
+				BDV_HDF5writeHyperslab(descr,&buf[0],dims,hl,r,0);
+			}
+		}
+		BDV_HDF5close(descr);
+		double t_write = now()-t0;
+		printf("write: %lld x %lld x %lld, %d resolutions, chunk %d: %.2f s, %.1f MB/s\n",
+			(long long)dimV,(long long)dimH,(long long)dimD,n_res,chunk,t_write,dimV*dimH*dimD/t_write/1e6);
+
+		// read
+		BDV_HDF5init(fname,descr,1);
+		void *vol;
+		float vxl1, vxl2, vxl3, orgV, orgH, orgD;
+		iim::uint32 DV, DH, DD;
+		int DC, bytes, DT, t_0, t_1;
+		BDV_HDF5getVolumeInfo(descr,0,0,vol,vxl1,vxl2,vxl3,orgV,orgH,orgD,DV,DH,DD,DC,bytes,DT,t_0,t_1);
+		if ( DV!=dimV || DH!=dimH || DD!=dimD ) {
+			fprintf(stderr,"wrong dimensions read back: %u x %u x %u\n",DV,DH,DD);
+			return 1;
+		}
+
+		long long bad = 0;
+		t0 = now();
+		iim::sint64 slice_block = std::min<iim::sint64>(dimD,64);
+		buf.resize(slice_block*dimV*dimH);
+		for ( iim::sint64 z=0; z<dimD; z+=slice_block ) {
+			iim::sint64 dd = std::min(slice_block,dimD-z);
+			BDV_HDF5getSubVolume(vol,0,(int)dimV,0,(int)dimH,(int)z,(int)(z+dd),0,&buf[0]);
+			for ( iim::sint64 d=0; d<dd; d++ )
+				for ( iim::sint64 v=0; v<dimV; v++ )
+					for ( iim::sint64 h=0; h<dimH; h++ )
+						bad += buf[(d*dimV + v)*dimH + h] != voxel(z+d,v,h);
+		}
+		double t_full = now()-t0;
+		printf("read whole volume in blocks of %lld slices: %.2f s, %.1f MB/s\n",(long long)slice_block,t_full,dimV*dimH*dimD/t_full/1e6);
+
+		srand(1);
+		int n_sub = 50;
+		iim::sint64 sv = std::min<iim::sint64>(dimV,256), sh = std::min<iim::sint64>(dimH,256), sd = std::min<iim::sint64>(dimD,128);
+		buf.resize(sv*sh*sd);
+		t0 = now();
+		for ( int i=0; i<n_sub; i++ ) {
+			int V0 = rand()%(dimV-sv+1), H0 = rand()%(dimH-sh+1), D0 = rand()%(dimD-sd+1);
+			BDV_HDF5getSubVolume(vol,V0,(int)(V0+sv),H0,(int)(H0+sh),D0,(int)(D0+sd),0,&buf[0]);
+			for ( iim::sint64 d=0; d<sd; d++ )
+				for ( iim::sint64 v=0; v<sv; v++ )
+					for ( iim::sint64 h=0; h<sh; h++ )
+						bad += buf[(d*sv + v)*sh + h] != voxel(D0+d,V0+v,H0+h);
+		}
+		double t_sub = now()-t0;
+		printf("read %d random %lld x %lld x %lld subvolumes: %.2f s, %.1f MB/s\n",n_sub,(long long)sv,(long long)sh,(long long)sd,t_sub,n_sub*sv*sh*sd/t_sub/1e6);
+
+		// lower resolutions: dimensions only, the content depends on the downsampling
+		for ( int r=1; r<n_res; r++ ) {
+			void *vol_r;
+			BDV_HDF5getVolumeInfo(descr,0,r,vol_r,vxl1,vxl2,vxl3,orgV,orgH,orgD,DV,DH,DD,DC,bytes,DT,t_0,t_1);
+			std::vector<iim::uint8> low((size_t)DV*DH*DD);
+			BDV_HDF5getSubVolume(vol_r,0,DV,0,DH,0,DD,0,&low[0]);
+			long long empty = 0;
+			for ( size_t i=0; i<low.size(); i++ )
+				empty += low[i]==0;
+			printf("resolution %d: %u x %u x %u, %lld empty voxels\n",r,DV,DH,DD,empty);
+			bad += empty;
+			BDV_HDF5closeVolume(vol_r);
+		}
+
+		BDV_HDF5closeVolume(vol);
+		BDV_HDF5close(descr);
+		printf("%lld wrong voxels\n",bad);
+		return bad ? 1 : 0;
+	}
+	catch ( iim::IOException & e ) {
+		fprintf(stderr,"error: %s\n",e.what());
+		return 1;
+	}
+}
@@ -30,11 +30,18 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 
 #include "v3d_multithreadimageIO.h"
 #include "../basic_c_fun/v3d_message.h"
+#include "../basic_c_fun/stackutil.h"
 
 #include "../plugin_loader/v3d_plugin_loader.h"
 
 #include "../v3d/mainwindow.h"
 
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QFileInfo>
+
 
 bool v3d_multithreadimageIO(XFormWidget *curw, const v3d_multithreadimageio_paras & p)
 {
@@ -106,4 +113,219 @@ bool v3d_multithreadimageIO(XFormWidget *curw, const v3d_multithreadimageio_para
 }
 
 
+static bool isTiffSeriesFile(const QString & filename)
+{
+	QString suffix = QFileInfo(filename).suffix().toLower();
+	return suffix=="tif" || suffix=="tiff";
+}
+
+// Only these formats are read on the pool threads, by the plain readers of stackutil. Anything else,
+// and any file those readers reject, goes through readSingleImageFile() on the calling thread, as its
+// Bioformats fallback shares one temporary file and may open dialogs. LSM files stay on the calling
+// thread too, where their pages are decoded in parallel.
+static bool hasNativeSeriesReader(const QString & filename)
+{
+	QString suffix = QFileInfo(filename).suffix().toLower();
+	return isTiffSeriesFile(filename) || suffix=="mrc" || suffix=="raw5"
+		|| suffix=="raw" || suffix=="v3draw" || suffix=="v3dpbd";
+}
+
+// shared state of one parallel series import
+struct ImageSeriesImportJob
+{
+	const QStringList *filelist;
+	TimePackType timepacktype;
+	My4DImage *img;
+	V3DLONG nsz0, nsz1, nthick, ncolors;
+	ImagePixelType datatype;
+
+	QMutex lock;
+	QString errmsg; //first error only
+	volatile bool bFailed;
+	QList<V3DLONG> deferred; //files left to readSingleImageFile()
+
+	void fail(const QString & msg)
+	{
+		QMutexLocker locker(&lock);
+		if (!bFailed) errmsg = msg;
+		bFailed = true;
+	}
+
+	void defer(V3DLONG i)
+	{
+		QMutexLocker locker(&lock);
+		deferred.append(i);
+	}
 
+	//check file i against the first section and copy it into place
+	void accept(V3DLONG i, const unsigned char *data1d, const V3DLONG *sz, ImagePixelType curtype)
+	{
+		QString filename = filelist->at(i);
+		if (sz[3]!=ncolors)
+		{
+			fail(QString("The file [%1] has invalid or different colors [=%2] from first section [=%3]. Exit importing.")
+				 .arg(filename).arg(sz[3]).arg(ncolors));
+		}
+		else if (curtype!=datatype)
+		{
+			fail(QString("The file [%1] has a different data type from first section. Exit importing.").arg(filename));
+		}
+		else if (sz[0]!=nsz0 || sz[1]!=nsz1 || sz[2]!=nthick)
+		{
+			fail(QString("The file [%1] has a different [width, height, thick]=[%2, %3, %4] from the first section [%5, %6, %7]. Exit importing.")
+				 .arg(filename).arg(sz[0]).arg(sz[1]).arg(sz[2]).arg(nsz0).arg(nsz1).arg(nthick));
+		}
+		else
+		{
+			place(i, data1d);
+		}
+	}
+
+	//copy the planes of file i into their place in the packed stack
+	void place(V3DLONG i, const unsigned char *data1d)
+	{
+		V3DLONG ntime = filelist->size();
+		V3DLONG block_size = nthick*nsz0*nsz1*img->getUnitBytes();
+		for (V3DLONG cur_ch=0; cur_ch<ncolors; cur_ch++)
+		{
+			unsigned char *target = (timepacktype==TIME_PACK_Z) ?
+				img->getRawData() + (cur_ch*ntime + i)*block_size :
+				img->getRawData() + (cur_ch + i*ncolors)*block_size;
+			memcpy(target, data1d + cur_ch*block_size, block_size);
+		}
+	}
+};
+
+class ImageSeriesFileLoader : public QRunnable
+{
+public:
+	ImageSeriesFileLoader(ImageSeriesImportJob *jobParam, V3DLONG indexParam) : job(jobParam), index(indexParam) {}
+
+	void run()
+	{
+		if (job->bFailed) return;
+
+		QByteArray filename = job->filelist->at(index).toUtf8();
+		unsigned char *data1d=0;
+		V3DLONG *sz=0;
+		int dt=0;
+		bool bLoaded;
+		if (isTiffSeriesFile(job->filelist->at(index)))
+		{
+			//only the page decoder, on this thread: loadTif2Stack() would fall back to Read_Stack(),
+			//whose mg_image_lib free lists are not thread safe
+			int nbits=0;
+			bLoaded = (loadTif2StackPageParallel(filename.data(), data1d, sz, dt, nbits, 1)==0);
+		}
+		else
+		{
+			bLoaded = loadImage(filename.data(), data1d, sz, dt);
+		}
+		if (!bLoaded || !data1d || !sz)
+		{
+			job->defer(index); //let the serial reader try the other readers
+		}
+		else
+		{
+			ImagePixelType datatype = (dt==1) ? V3D_UINT8 : (dt==2) ? V3D_UINT16 : (dt==4) ? V3D_FLOAT32 : V3D_UNKNOWN;
+			job->accept(index, data1d, sz, datatype);
+		}
+
+		if (data1d) {delete []data1d; data1d=0;}
+		if (sz) {delete []sz; sz=0;}
+	}
+
+private:
+	ImageSeriesImportJob *job;
+	V3DLONG index;
+};
+
+bool v3d_importImageSeries_multithreaded(const QStringList & filelist, TimePackType timepacktype, My4DImage *img,
+                                         QString & errmsg, v3d_imageseries_import_stats *stats, int nthreads)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	V3DLONG ntime = filelist.size();
+	if (ntime<1 || !img)
+	{
+		errmsg = "The import list is empty. do nothing.";
+		return false;
+	}
+
+	//the first file determines the size and type of the whole stack
+	unsigned char *data1d=0;
+	V3DLONG *sz=0;
+	ImagePixelType datatype=V3D_UNKNOWN;
+	if (!readSingleImageFile(filelist.at(0).toUtf8().data(), data1d, sz, datatype) || !data1d || !sz || sz[3]<=0)
+	{
+		errmsg = QString("Error occurs in reading the file [%1]. Exit importing.").arg(filelist.at(0));
+		if (data1d) {delete []data1d; data1d=0;}
+		if (sz) {delete []sz; sz=0;}
+		return false;
+	}
+
+	ImageSeriesImportJob job;
+	job.filelist = &filelist;
+	job.timepacktype = timepacktype;
+	job.img = img;
+	job.nsz0 = sz[0]; job.nsz1 = sz[1]; job.nthick = sz[2]; job.ncolors = sz[3];
+	job.datatype = datatype;
+	job.bFailed = false;
+
+	V3DLONG pack_z = (timepacktype==TIME_PACK_Z) ? job.nthick*ntime : job.nthick;
+	V3DLONG pack_color = (timepacktype==TIME_PACK_Z) ? job.ncolors : job.ncolors*ntime;
+	if (!img->createImage(job.nsz0, job.nsz1, pack_z, pack_color, datatype))
+	{
+		errmsg = "Fail to allocate memory for the image stack. Exit importing.";
+		delete []data1d; delete []sz;
+		return false;
+	}
+	img->setTDim(ntime);
+	img->setTimePackType(timepacktype);
+
+	job.place(0, data1d);
+	delete []data1d; data1d=0;
+	delete []sz; sz=0;
+
+	//more threads than cores, so that slow (e.g. network) reads overlap with decoding;
+	//the pool bound also bounds the number of decoded files held in memory at once
+	if (nthreads<=0) nthreads = qMax(2, 2*QThread::idealThreadCount());
+	QThreadPool pool;
+	pool.setMaxThreadCount(nthreads);
+	for (V3DLONG i=1; i<ntime; i++)
+	{
+		if (hasNativeSeriesReader(filelist.at(i)))
+			pool.start(new ImageSeriesFileLoader(&job, i));
+		else
+			job.defer(i);
+	}
+	pool.waitForDone();
+
+	//the rest, in order, on this thread
+	qSort(job.deferred);
+	for (int k=0; k<job.deferred.size() && !job.bFailed; k++)
+	{
+		V3DLONG i = job.deferred.at(k);
+		if (!readSingleImageFile(filelist.at(i).toUtf8().data(), data1d, sz, datatype) || !data1d || !sz)
+			job.fail(QString("Error occurs in reading the file [%1]. Exit importing.").arg(filelist.at(i)));
+		else
+			job.accept(i, data1d, sz, datatype);
+		if (data1d) {delete []data1d; data1d=0;}
+		if (sz) {delete []sz; sz=0;}
+	}
+
+	if (job.bFailed)
+	{
+		errmsg = job.errmsg;
+		return false;
+	}
+
+	if (stats)
+	{
+		stats->nfiles = ntime;
+		stats->nbytes = img->getTotalBytes();
+		stats->seconds = timer.elapsed()/1000.0;
+	}
+	return true;
+}
@@ -33,9 +33,26 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 
 #include "../basic_c_fun/customary_structs/v3d_multithreadimageio_para.h"
 
+#include <QStringList>
+
 class XFormWidget;
+class My4DImage;
 bool v3d_multithreadimageIO(XFormWidget *curw, const v3d_multithreadimageio_paras & p);
 
+// Built-in parallel import of an image file series (one 2D/3D file per time point).
+// The target stack is allocated from the first file, then the remaining files are decoded
+// on a bounded thread pool and each one is copied straight to its z (or channel) offset.
+struct v3d_imageseries_import_stats
+{
+	V3DLONG nfiles;
+	V3DLONG nbytes;
+	double seconds;
+	double mbPerSecond() const {return (seconds>0) ? double(nbytes)/(1024.0*1024.0)/seconds : 0;}
+};
+
+bool v3d_importImageSeries_multithreaded(const QStringList & filelist, TimePackType timepacktype, My4DImage *img,
+                                         QString & errmsg, v3d_imageseries_import_stats *stats=0, int nthreads=0);
+
 #endif
 
 
@@ -1,15 +1,32 @@
-#if defined(USE_Qt5)
-    //#include <QtConcurrent>
-#endif 
 
-#include "DilationErosion.h"
-#include "SleepThread.h"
+#include <QtCore>
 
-#include "../terafly/src/presentation/theader.h"  //2015May PHC
+#include "DilationErosion.h"
+#include "../../basic_c_fun/basic_parallel.h"
 
 const int DilationErosion::TYPE_DILATE=0;
 const int DilationErosion::TYPE_ERODE=1;
 
+static inline int clampIndex(int i, int n) {
+    return (i<0) ? 0 : ((i>=n) ? n-1 : i);
+}
+
+// v3d_parallel_for body: one block of consecutive z-slices per call
+class DilationErosion::ZSlab
+{
+public:
+    ZSlab(DilationErosion* de, int type, int elementSize, int neighborsForThreshold)
+        : de(de), type(type), elementSize(elementSize), neighborsForThreshold(neighborsForThreshold) {}
+    void operator()(V3DLONG begin, V3DLONG end) {
+        de->dilateOrErodeZslab(type, (int)begin, (int)end, elementSize, neighborsForThreshold);
+    }
+private:
+    DilationErosion* de;
+    int type;
+    int elementSize;
+    int neighborsForThreshold;
+};
+
 DilationErosion::DilationErosion()
 {
   currentSource=0L;
@@ -19,112 +36,144 @@ DilationErosion::DilationErosion()
 
 void DilationErosion::dilateOrErode(int type, int xDim, int yDim, int zDim,
 				    unsigned char*** s, unsigned char*** t, int elementSize, int neighborsForThreshold) {
-    qDebug() << "CellCounter3D::dilateOrErode() start";
+    qDebug() << "DilationErosion::dilateOrErode() start";
     currentSource=s;
     currentTarget=t;
     this->xDim=xDim;
     this->yDim=yDim;
     this->zDim=zDim;
-    QList< QFuture<void> > deList;
+    if (elementSize<0) {
+        elementSize=0;
+    }
+    changedCounts.assign(zDim>0 ? zDim : 0, 0L);
+
+    // each block recounts the 2*elementSize planes before its first slice, so keep blocks deeper than that
+    ZSlab slab(this, type, elementSize, neighborsForThreshold);
+    v3d_parallel_for(zDim, slab, 0, 4*elementSize+1);
+
+    long changed=0;
     for (int z=0;z<zDim;z++) {
-        QFuture<void> qf = QtConcurrent::run(this, &DilationErosion::dilateOrErodeZslice, type, z, elementSize, neighborsForThreshold);
-        deList.append(qf);
+        changed+=changedCounts[z];
     }
-    while(1) {
-        SleepThread st;
-        st.msleep(5000);
-        int doneCount=0;
-        for (int i=0;i<deList.size();i++) {
-            QFuture<void> qf=deList.at(i);
-            if (qf.isFinished()) {
-                doneCount++;
-            }
+    if (type==TYPE_DILATE) {
+        qDebug() << "Dilated " << changed << " voxels";
+    } else if (type==TYPE_ERODE) {
+        qDebug() << "Eroded " << changed << " voxels";
+    }
+}
+
+// counts[y*xDim+x] = number of non-zero voxels of plane z in [x-e,x+e)x[y-e,y+e), rowCounts is scratch of the same size
+void DilationErosion::countPlaneNeighbors(int z, int elementSize, int* rowCounts, int* counts) {
+    unsigned char** s=currentSource[z];
+    int e=elementSize;
+
+    for (int y=0;y<yDim;y++) {
+        const unsigned char* line=s[y];
+        int* r=rowCounts+(V3DLONG)y*xDim;
+        int sum=0;
+        for (int ex=-e;ex<e;ex++) {
+            sum+=(line[clampIndex(ex,xDim)]>0);
+        }
+        for (int x=0;x<xDim;x++) {
+            r[x]=sum;
+            sum+=(line[clampIndex(x+e,xDim)]>0)-(line[clampIndex(x-e,xDim)]>0);
+        }
+    }
+
+    int* c=counts;
+    for (int x=0;x<xDim;x++) {
+        c[x]=0;
+    }
+    for (int ey=-e;ey<e;ey++) {
+        const int* r=rowCounts+(V3DLONG)clampIndex(ey,yDim)*xDim;
+        for (int x=0;x<xDim;x++) {
+            c[x]+=r[x];
         }
-        int stillActive=deList.size()-doneCount;
-        if (stillActive==0) {
-            break;
-        } else {
-            qDebug() << "Waiting on " << stillActive << " z-slices";
+    }
+    for (int y=1;y<yDim;y++) {
+        int* next=counts+(V3DLONG)y*xDim;
+        const int* added=rowCounts+(V3DLONG)clampIndex(y-1+e,yDim)*xDim;
+        const int* removed=rowCounts+(V3DLONG)clampIndex(y-1-e,yDim)*xDim;
+        for (int x=0;x<xDim;x++) {
+            next[x]=c[x]+added[x]-removed[x];
         }
+        c=next;
     }
 }
 
-void DilationErosion::dilateOrErodeZslice(int type, int z, int elementSize, int neighborsForThreshold) {
+void DilationErosion::dilateOrErodeZslab(int type, int z0, int z1, int elementSize, int neighborsForThreshold) {
     unsigned char*** s=currentSource;
     unsigned char*** t=currentTarget;
-    long dilateCount=0;
-    long erosionCount=0;
-    for (int y=0;y<yDim;y++) {
-        for (int x=0;x<xDim;x++) {
+    int e=elementSize;
+    int w=2*e;
+    V3DLONG planeSize=(V3DLONG)xDim*yDim;
 
-            int currentValue=s[z][y][x];
+    // plane counts of the 2e planes of the current window, the plane of slice ez is at ez mod 2e
+    std::vector<int> rowCounts(planeSize);
+    std::vector<int> window((w>0 ? w : 1)*planeSize);
+    std::vector<int> neighbors(planeSize, 0);
 
-            if (type==TYPE_ERODE) {
-                if (currentValue==0) {
-                    // nothing to do
-                    t[z][y][x]=0;
-                    continue;
-                }
-            } else if (type==TYPE_DILATE) {
-                if (currentValue>0) {
-                    t[z][y][x]=currentValue;
-                    continue;
-                }
-            }
+    for (int ez=z0-e;ez<z0+e;ez++) {
+        int* p=&window[((ez%w)+w)%w*planeSize];
+        countPlaneNeighbors(clampIndex(ez,zDim), e, &rowCounts[0], p);
+        for (V3DLONG i=0;i<planeSize;i++) {
+            neighbors[i]+=p[i];
+        }
+    }
 
-            int neighborCount=0;
-            for (int ez=z-elementSize;ez<z+elementSize;ez++) {
-                int sz=ez;
-                if (sz<0) {
-                    sz=0;
-                } else if (ez>=zDim) {
-                    sz=zDim-1;
-                }
-                for (int ey=y-elementSize;ey<y+elementSize;ey++) {
-                    int sy=ey;
-                    if (ey<0) {
-                        sy=0;
-                    } else if (ey>=yDim) {
-                        sy=yDim-1;
+    for (int z=z0;z<z1;z++) {
+        long changed=0;
+        for (int y=0;y<yDim;y++) {
+            const int* count=&neighbors[(V3DLONG)y*xDim];
+            for (int x=0;x<xDim;x++) {
+
+                int currentValue=s[z][y][x];
+
+                if (type==TYPE_ERODE) {
+                    if (currentValue==0) {
+                        // nothing to do
+                        t[z][y][x]=0;
+                        continue;
                     }
-                    for (int ex=x-elementSize;ex<x+elementSize;ex++) {
-                        int sx=ex;
-                        if (ex<0) {
-                            sx=0;
-                        } else if (ex>=xDim) {
-                            sx=xDim-1;
-                        }
-                        // DEBUG
-                        unsigned char neighborValue=s[sz][sy][sx];
-                        if (neighborValue>0) {
-                            neighborCount++;
-                        }
+                } else if (type==TYPE_DILATE) {
+                    if (currentValue>0) {
+                        t[z][y][x]=currentValue;
+                        continue;
                     }
                 }
-            }
 
-            if (type==TYPE_DILATE) {
-                if (neighborCount>=neighborsForThreshold) {
-                    dilateCount++;
-                    t[z][y][x] = 255;
-                } else {
-                    t[z][y][x] = 0;
-                }
-            } else if (type==TYPE_ERODE) {
-                if (neighborCount<=neighborsForThreshold) {
-                    erosionCount++;
-                    t[z][y][x] = 0;
-                } else {
-                    t[z][y][x] = s[z][y][x];
+                int neighborCount=count[x];
+
+                if (type==TYPE_DILATE) {
+                    if (neighborCount>=neighborsForThreshold) {
+                        changed++;
+                        t[z][y][x] = 255;
+                    } else {
+                        t[z][y][x] = 0;
+                    }
+                } else if (type==TYPE_ERODE) {
+                    if (neighborCount<=neighborsForThreshold) {
+                        changed++;
+                        t[z][y][x] = 0;
+                    } else {
+                        t[z][y][x] = s[z][y][x];
+                    }
                 }
+
             }
+        }
+        changedCounts[z]=changed;
 
+        // slide the window from [z-e,z+e) to [z+1-e,z+1+e): plane z+e replaces plane z-e
+        if (z+1<z1 && w>0) {
+            int* p=&window[(((z-e)%w)+w)%w*planeSize];
+            for (V3DLONG i=0;i<planeSize;i++) {
+                neighbors[i]-=p[i];
+            }
+            countPlaneNeighbors(clampIndex(z+e,zDim), e, &rowCounts[0], p);
+            for (V3DLONG i=0;i<planeSize;i++) {
+                neighbors[i]+=p[i];
+            }
         }
     }
-    if (type==TYPE_DILATE) {
-        qDebug() << "Dilated " << dilateCount << " voxels";
-    } else if (type==TYPE_ERODE) {
-        qDebug() << "Eroded " << erosionCount << " voxels";
-    }
 }
-
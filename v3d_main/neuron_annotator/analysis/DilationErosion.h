@@ -2,7 +2,6 @@
 #define DILATIONEROSION_H
 
 #include <vector>
-#include "../v3d/v3d_core.h"
 
 #if defined (_MSC_VER)
 #include "../basic_c_fun/vcdiff.h"
@@ -10,6 +9,12 @@
 #endif
 
 
+// Dilation and erosion of a binary (zero / non-zero) volume by neighbor counting:
+// a voxel is decided by the number of non-zero voxels of the cube [x-e,x+e)x[y-e,y+e)x[z-e,z+e)
+// around it (e = elementSize, coordinates clamped to the volume, so border voxels count several times).
+// The counts are running box sums, first along x and y in each plane, then along z over blocks
+// of z-slices, so the cost per voxel does not depend on the element size.
+
 class DilationErosion
 {
  public:
@@ -20,13 +25,18 @@ class DilationErosion
   static const int TYPE_ERODE;
 
  public:
+  // dilate: zero voxels with at least neighborsForThreshold non-zero neighbors become 255
+  // erode: non-zero voxels with at most neighborsForThreshold non-zero neighbors become 0
   void dilateOrErode(int type, int xDim, int yDim, int zDim, unsigned char*** s, unsigned char*** t, int elementSize, int neighborsForThreshold);
 
  private:
-  void dilateOrErodeZslice(int type, int z, int elementSize, int neighborsForThreshold);
+  class ZSlab;
+  void dilateOrErodeZslab(int type, int z0, int z1, int elementSize, int neighborsForThreshold);
+  void countPlaneNeighbors(int z, int elementSize, int* rowCounts, int* counts);
 
   unsigned char*** currentSource;
   unsigned char*** currentTarget;
+  std::vector<long> changedCounts; // voxels dilated or eroded, per z-slice
 
   int xDim;
   int yDim;
@@ -35,4 +45,3 @@ class DilationErosion
 };
 
 #endif // DILATIONEROSION_H
-
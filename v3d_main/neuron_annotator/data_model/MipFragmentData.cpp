@@ -1,5 +1,145 @@
 #include "MipFragmentData.h"
 
+#if defined(USE_Qt5)
+    #include <QtConcurrent/QtConcurrent>
+#endif
+
+#include <QFuture>
+#include <algorithm>
+
+namespace {
+
+// Number of z-slices projected between refreshes of the volume read lock.
+const int mipSlabDepth = 8;
+
+// Raw buffers shared by all workers of one fragment MIP projection.
+struct MipProjectionVolume
+{
+    V3DLONG sx, sy, sz, sc;
+    int mipLayers; // fragments plus background
+    int layerCount; // fragments plus background plus optional reference
+    int refIndex;
+    const v3d_uint8* signal;
+    const v3d_uint8* mask; // NULL if there is no neuron mask
+    int maskUnitBytes;
+    const v3d_uint8* reference; // NULL if there is no reference image
+    int referenceUnitBytes;
+    v3d_uint8* mip;
+    v3d_uint16* zBuffer;
+    v3d_uint16* intensity;
+};
+
+struct MipProjectionBlock;
+typedef void (*MipProjectionKernel)(const MipProjectionVolume&, MipProjectionBlock&);
+
+// One band of y-rows over one z-slab, with private fragment min/max caches.
+struct MipProjectionBlock
+{
+    const MipProjectionVolume* volume;
+    MipProjectionKernel kernel;
+    int yBegin, yEnd;
+    int zBegin, zEnd;
+    std::vector<int> minimumIntensities;
+    std::vector<int> maximumIntensities;
+
+    void run() {kernel(*volume, *this);}
+};
+
+// Converts one row of 8-, 16- or 32-bit samples, so the inner loops need not switch on type.
+template<class D>
+void readRow(const v3d_uint8* data, int unitBytes, V3DLONG offset, V3DLONG count, D* row)
+{
+    switch (unitBytes)
+    {
+        case 4: {
+            const v3d_float32* src = (const v3d_float32*)data + offset;
+            for (V3DLONG i = 0; i < count; ++i) row[i] = (D)src[i];
+            break;
+        }
+        case 2: {
+            const v3d_uint16* src = (const v3d_uint16*)data + offset;
+            for (V3DLONG i = 0; i < count; ++i) row[i] = (D)src[i];
+            break;
+        }
+        case 1:
+        default: {
+            const v3d_uint8* src = data + offset;
+            for (V3DLONG i = 0; i < count; ++i) row[i] = (D)src[i];
+            break;
+        }
+    }
+}
+
+// Same arithmetic as the former Image4DProxy-based loop, but on typed contiguous rows.
+template<class T>
+void projectFragmentRows(const MipProjectionVolume& v, MipProjectionBlock& block)
+{
+    const V3DLONG sliceSize = v.sx * v.sy;
+    const V3DLONG channelStride = sliceSize * v.sz;
+    const V3DLONG mipChannelStride = sliceSize * v.mipLayers;
+    const T* signal = (const T*)v.signal;
+    T* mip = (T*)v.mip;
+    int* minI = &block.minimumIntensities[0];
+    int* maxI = &block.maximumIntensities[0];
+    std::vector<int> maskRow(v.sx, 0);
+    std::vector<float> referenceRow(v.sx, 0.0f);
+
+    for (int z = block.zBegin; z < block.zEnd; ++z)
+    {
+        for (int y = block.yBegin; y < block.yEnd; ++y)
+        {
+            const V3DLONG rowOffset = z * sliceSize + y * v.sx;
+            const V3DLONG pixelRow = y * v.sx;
+            if (v.reference) {
+                // Reference/nc82
+                readRow(v.reference, v.referenceUnitBytes, rowOffset, v.sx, &referenceRow[0]);
+                v3d_uint16* refIntensity = v.intensity + v.refIndex * sliceSize + pixelRow;
+                v3d_uint16* refZ = v.zBuffer + v.refIndex * sliceSize + pixelRow;
+                for (V3DLONG x = 0; x < v.sx; ++x)
+                {
+                    float referenceIntensity = referenceRow[x];
+                    if (referenceIntensity > refIntensity[x]) {
+                        refIntensity[x] = (v3d_uint16)referenceIntensity;
+                        refZ[x] = (v3d_uint16)z;
+                    }
+                    if (referenceIntensity > maxI[v.refIndex])
+                        maxI[v.refIndex] = referenceIntensity;
+                    if (referenceIntensity < minI[v.refIndex])
+                        minI[v.refIndex] = referenceIntensity;
+                }
+            }
+            if (v.mask)
+                readRow(v.mask, v.maskUnitBytes, rowOffset, v.sx, &maskRow[0]);
+
+            // Neurons and Background
+            const T* signalRow = signal + rowOffset;
+            for (V3DLONG x = 0; x < v.sx; ++x)
+            {
+                const int maskIndex = maskRow[x];
+                const V3DLONG pixel = maskIndex * sliceSize + pixelRow + x;
+                float previousIntensity = v.intensity[pixel];
+                float intensity = 0;
+                for (V3DLONG c = 0; c < v.sc; ++c) {
+                    float channel_intensity = signalRow[x + c * channelStride];
+                    intensity += channel_intensity;
+                    if (channel_intensity > maxI[maskIndex])
+                        maxI[maskIndex] = channel_intensity;
+                    if (channel_intensity < minI[maskIndex])
+                        minI[maskIndex] = channel_intensity;
+                }
+                if (intensity > previousIntensity) {
+                    v.intensity[pixel] = (v3d_uint16)intensity;
+                    v.zBuffer[pixel] = (v3d_uint16)z;
+                    for (V3DLONG c = 0; c < v.sc; ++c)
+                        mip[pixel + c * mipChannelStride] = signalRow[x + c * channelStride];
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
 /* explicit */
 MipFragmentData::MipFragmentData(const NaVolumeData& volumeDataParam)
     : volumeData(volumeDataParam)
@@ -99,59 +239,76 @@ void MipFragmentData::updateFromVolumeData()
         Image4DProxy<My4DImage> intensityProxy(fragmentIntensities);
 
         // Populate mip images
-        int imageX = originalProxy.sx;
-        int imageY = originalProxy.sy;
-        int imageZ = originalProxy.sz;
-        int imageC = originalProxy.sc;
         // Reference/nc82 channel appears after all of the neuron/fragments
-		// qDebug() << "refIndex =" << refIndex;
-		// qDebug() << "fragmentMaximumIntensities.size() =" << fragmentMaximumIntensities.size();
-		// qDebug() << "fragmentMinimumIntensities.size() =" << fragmentMinimumIntensities.size();
-        for (int z = 0; z < imageZ; z++)
+        MipProjectionVolume volume;
+        volume.sx = originalProxy.sx;
+        volume.sy = originalProxy.sy;
+        volume.sz = originalProxy.sz;
+        volume.sc = originalProxy.sc;
+        volume.mipLayers = volumeReader.getNumberOfNeurons() + 1;
+        volume.layerCount = layerCount;
+        volume.refIndex = refIndex;
+        volume.signal = originalProxy.data_p;
+        volume.mask = NULL;
+        volume.maskUnitBytes = 1;
+        if (volumeReader.hasNeuronMask()) {
+            volume.mask = maskProxy.data_p;
+            volume.maskUnitBytes = maskProxy.su;
+        }
+        volume.reference = NULL;
+        volume.referenceUnitBytes = 1;
+        if (volumeReader.hasReferenceImage()) {
+            volume.reference = referenceProxy.data_p;
+            volume.referenceUnitBytes = referenceProxy.su;
+        }
+        volume.mip = mipProxy.data_p;
+        volume.zBuffer = (v3d_uint16*)zProxy.data_p;
+        volume.intensity = (v3d_uint16*)intensityProxy.data_p;
+
+        MipProjectionKernel kernel = NULL;
+        switch (originalProxy.su)
         {
-            for (int y = 0; y < imageY; y++)
-            {
-                for (int x = 0; x < imageX; x++)
-                {
-                    if (volumeReader.hasReferenceImage()) {
-                        // Reference/nc82
-                        float referenceIntensity = referenceProxy.value_at(x,y,z,0);
-                        float previousReferenceIntensity = intensityProxy.value_at(x, y, refIndex, 0);
-                        if (referenceIntensity > previousReferenceIntensity) {
-                            intensityProxy.put_at(x, y, refIndex, 0, referenceIntensity);
-                            zProxy.put_at(x, y, refIndex, 0, z);
-                        }
-                        // update max/min cache
-                        if (referenceIntensity > fragmentMaximumIntensities[refIndex])
-                            fragmentMaximumIntensities[refIndex] = referenceIntensity;
-                        if (referenceIntensity < fragmentMinimumIntensities[refIndex])
-                            fragmentMinimumIntensities[refIndex] = referenceIntensity;
-                    }
+            case 4: kernel = &projectFragmentRows<v3d_float32>; break;
+            case 2: kernel = &projectFragmentRows<v3d_uint16>; break;
+            case 1:
+            default: kernel = &projectFragmentRows<v3d_uint8>; break;
+        }
 
-                    // Neurons and Background
-                    int maskIndex = 0;
-                    if (volumeReader.hasNeuronMask())
-                        maskIndex = maskProxy.value_at(x,y,z,0);
-                    float previousIntensity = intensityProxy.value_at(x, y, maskIndex, 0);
-                    float intensity = 0;
-                    for (int c = 0; c < imageC; c++) {
-                        float channel_intensity = originalProxy.value_at(x, y, z, c);
-                        // accumulate total intensity
-                        intensity += channel_intensity;
-                        // remember max/min channel intensity
-                        if (channel_intensity > fragmentMaximumIntensities[maskIndex])
-                            fragmentMaximumIntensities[maskIndex] = channel_intensity;
-                        if (channel_intensity < fragmentMinimumIntensities[maskIndex])
-                            fragmentMinimumIntensities[maskIndex] = channel_intensity;
-                    }
-                    if (intensity > previousIntensity) {
-                        intensityProxy.put_at(x, y, maskIndex, 0, intensity);
-                        zProxy.put_at(x, y, maskIndex, 0, z);
-                        for (int c = 0; c < imageC; c++)
-                            mipProxy.put_at(x, y, maskIndex, c, originalProxy.value_at(x, y, z, c));
-                    }
-                }
-                if (! volumeReader.refreshLock()) return; // Try to reacquire lock every 25 ms
+        // Each worker owns a band of y-rows, so the per-pixel projections never collide;
+        // only the per-fragment min/max need merging, from each worker's private copy.
+        int threadCount = std::max(1, QThread::idealThreadCount());
+        int rowsPerBlock = std::max(1, (int)((volume.sy + threadCount - 1) / threadCount));
+        std::vector<MipProjectionBlock> blocks;
+        for (int y = 0; y < volume.sy; y += rowsPerBlock)
+        {
+            MipProjectionBlock block;
+            block.volume = &volume;
+            block.kernel = kernel;
+            block.yBegin = y;
+            block.yEnd = std::min((int)volume.sy, y + rowsPerBlock);
+            block.minimumIntensities.assign(layerCount, 0);
+            block.maximumIntensities.assign(layerCount, 0);
+            blocks.push_back(block);
+        }
+
+        // Stream the volume in z-slabs, so we can honor the read lock between slabs.
+        for (int z = 0; z < volume.sz; z += mipSlabDepth)
+        {
+            QList< QFuture<void> > workers;
+            for (size_t b = 0; b < blocks.size(); ++b) {
+                blocks[b].zBegin = z;
+                blocks[b].zEnd = std::min((int)volume.sz, z + mipSlabDepth);
+                workers << QtConcurrent::run(&blocks[b], &MipProjectionBlock::run);
+            }
+            for (int w = 0; w < workers.size(); ++w)
+                workers[w].waitForFinished();
+            if (! volumeReader.refreshLock()) return; // Try to reacquire lock every 25 ms
+        }
+
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            for (int i = 0; i < layerCount; ++i) {
+                fragmentMaximumIntensities[i] = std::max(fragmentMaximumIntensities[i], blocks[b].maximumIntensities[i]);
+                fragmentMinimumIntensities[i] = std::min(fragmentMinimumIntensities[i], blocks[b].minimumIntensities[i]);
             }
         }
     } // release locks before emit
@@ -53,6 +53,7 @@ NaVolumeDataLoadableStack::NaVolumeDataLoadableStack( My4DImage* stackpParam, QU
     , progressValue( 0 )
     , progressMin( 0 )
     , progressMax( 100 )
+    , loadMilliseconds( 0 )
     , bIsCanceled( false )
 {
     connect( &imageLoader, SIGNAL( progressValueChanged( int, int ) ),
@@ -65,6 +66,9 @@ NaVolumeDataLoadableStack::NaVolumeDataLoadableStack( My4DImage* stackpParam, QU
 
 bool NaVolumeDataLoadableStack::load()
 {
+    QTime stopwatch;
+    stopwatch.start();
+    loadMilliseconds = 0;
     setRelativeProgress( 0.02f ); // getting here *is* finite progress
     // qDebug() << "NaVolumeData::LoadableStack::load() fileUrl=" << fileUrl;
     QUrl fullFileUrl = determineFullFileUrl();
@@ -73,6 +77,7 @@ bool NaVolumeDataLoadableStack::load()
     imageLoader.setProgressIndex( stackIndex );
     // qDebug() << fullFileUrl << __FILE__ << __LINE__;
     if (! imageLoader.loadImage(stackp, fullFileUrl)) {
+        loadMilliseconds = stopwatch.elapsed();
         emit failed();
         qDebug() << "Error loading image" << fullFileUrl;
         return false;
@@ -89,10 +94,19 @@ bool NaVolumeDataLoadableStack::load()
     if ( ! stackp->p_vmin )
         stackp->updateminmaxvalues();
     setRelativeProgress( 1.0 );
+    loadMilliseconds = stopwatch.elapsed();
     emit finished();
     return true;
 }
 
+// Tiff loading is not reentrant, so tiff stacks are loaded one after another,
+// concurrently with the other stacks.
+static void loadStacksInSequence( QList<NaVolumeDataLoadableStack*> stacks )
+{
+    for ( int s = 0; s < stacks.size(); ++s )
+        stacks[s]->load();
+}
+
 void NaVolumeDataLoadableStack::setRelativeProgress( float relativeProgress )
 {
     int newProgressValue = ( int ) ( progressMin + relativeProgress * ( progressMax - progressMin ) + 0.5 );
@@ -424,6 +438,7 @@ void NaVolumeData::loadVolumeDataFromFiles()
     // bDoUpdateSignalTexture = true; // because it needs update now
 
     // qDebug() << "NaVolumeData::loadVolumeDataFromFiles()" << stopwatch.elapsed() / 1000.0 << "seconds" << __FILE__ << __LINE__;
+    emit benchmarkTimerPrintRequested( stackLoadTimings );
     emit progressCompleted();
     // fooDebug() << "emitting NaVolumeData::channelsLoaded" << __FILE__ << __LINE__;
     emit channelsLoaded( originalImageProxy.sc );
@@ -1002,38 +1017,25 @@ bool NaVolumeData::Writer::loadStacks()
 
     // There are some bugs with multithreaded image loading, so make it an option.
     bool bUseMultithreadedLoader = true;
-    // Tiff loading is not reentrant, so don't multithread tiff loading.
-    int tiff_count = 0;
-    if ( !originalStack.getFileUrl().isEmpty() && originalStack.determineFullFileUrl().path().endsWith( ".tif" ) )
-        ++tiff_count;
-    if ( !maskStack.getFileUrl().isEmpty() && maskStack.determineFullFileUrl().path().endsWith( ".tif" ) )
-        ++tiff_count;
-    if ( !referenceStack.getFileUrl().isEmpty() && referenceStack.determineFullFileUrl().path().endsWith( ".tif" ) )
-        ++tiff_count;
-    if ( tiff_count > 1 )
-    {
-        bUseMultithreadedLoader = false;
-        // qDebug() << "Using single thread loader because there are nonreentrant tiff files to load.";
-    }
     if ( bUseMultithreadedLoader )
     {
         // Load each file in a separate thread.  This assumes that loading code is reentrant...
+        // ...except for tiff files, which share a single thread.
         QList< QFuture<void> > loaderList;
-
-        QFuture<void> originalLoader = QtConcurrent::run( &originalStack, &LoadableStack::load );
-        loaderList.append( originalLoader );
-
-        QFuture<void> maskLoader = QtConcurrent::run( &maskStack, &LoadableStack::load );
-        loaderList.append( maskLoader );
-
-        QFuture<void> referenceLoader = QtConcurrent::run( &referenceStack, &LoadableStack::load );
-        loaderList.append( referenceLoader );
-
+        QList< LoadableStack* > tiffStacks;
+        LoadableStack* stacks[3] = { &originalStack, &maskStack, &referenceStack };
+        for ( int s = 0; s < 3; ++s )
+        {
+            if ( !stacks[s]->getFileUrl().isEmpty() && stacks[s]->determineFullFileUrl().path().endsWith( ".tif" ) )
+                tiffStacks.append( stacks[s] );
+            else
+                loaderList.append( QtConcurrent::run( stacks[s], &LoadableStack::load ) );
+        }
+        if ( ! tiffStacks.isEmpty() )
+            loaderList.append( QtConcurrent::run( loadStacksInSequence, tiffStacks ) );
 
         while ( 1 )
         {
-            SleepThread st;
-            st.msleep( 1000 );
             if ( ! m_data->representsActualData() )
             {
                 // quick abort during teardown
@@ -1060,6 +1062,9 @@ bool NaVolumeData::Writer::loadStacks()
                 // qDebug() << "Waiting on " << stillActive << " loaders";
             }
             QCoreApplication::processEvents(); // let progress signals through
+            // Short naps, so that the last stack to finish is not followed by a long idle wait
+            SleepThread st;
+            st.msleep( 20 );
         }
         if ( ! m_data->representsActualData() ) return false;
     }
@@ -1097,6 +1102,11 @@ bool NaVolumeData::Writer::loadStacks()
     m_data->originalImageStack = ensureThreeChannel( m_data->originalImageStack );
 
     // qDebug() << "NaVolumeData::Writer::loadStacks() done loading all stacks in " << stopwatch.elapsed() / 1000.0 << " seconds";
+    m_data->stackLoadTimings = QString( "Loaded stacks in %1 seconds (signal %2, label %3, reference %4)" )
+            .arg( stopwatch.elapsed() / 1000.0 )
+            .arg( originalStack.getLoadMilliseconds() / 1000.0 )
+            .arg( maskStack.getLoadMilliseconds() / 1000.0 )
+            .arg( referenceStack.getLoadMilliseconds() / 1000.0 );
 
     if ( m_data->originalImageStack->getXDim() > 0 && ! m_data->originalImageStack->p_vmin )
         m_data->originalImageStack->updateminmaxvalues();
@@ -22,6 +22,7 @@ public:
     QUrl determineFullFileUrl() const;
     const QUrl& getFileUrl() const {return fileUrl;}
     bool isCanceled() const {return bIsCanceled;}
+    int getLoadMilliseconds() const {return loadMilliseconds;} // duration of the last load()
 
 signals:
     void progressValueChanged(int progressValue, int stackIndex);
@@ -49,6 +50,7 @@ protected:
     int progressMin;
     int progressMax;
     ImageLoader imageLoader;
+    int loadMilliseconds;
 
     volatile bool bIsCanceled;
 };
@@ -119,6 +121,7 @@ private:
     Image4DProxy<My4DImage> neuronMaskProxy;
     Image4DProxy<My4DImage> referenceImageProxy;
     std::vector<int> stackLoadProgressValues;
+    QString stackLoadTimings; // for benchmarkTimerPrintRequested()
     const jfrc::VolumeTexture* volumeTexture;
     int currentProgress;
     // Staged image loader
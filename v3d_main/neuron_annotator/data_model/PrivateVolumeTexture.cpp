@@ -1,4 +1,5 @@
 #include "PrivateVolumeTexture.h"
+#include "VolumeSampler.h"
 #include "DataColorModel.h"
 #include "../utility/ImageLoader.h"
 #include "../utility/FooDebug.h"
@@ -9,242 +10,6 @@
 
 namespace jfrc {
 
-// LabelSampler class for efficiently sampling a label field.
-// This is meant to be fast, so all inline.
-// with precomputed data offsets
-template<typename T, class InputValueType, class OutputValueType>
-// template<class InputValueType, class OutputValueType>
-struct BaseSampler
-{
-    typedef size_t IndexType;
-    static const int nDims = 3;
-
-    BaseSampler(const Image4DProxy<My4DImage>& input, Base3DTexture<OutputValueType>& output)
-    {
-        // cache volume dimensions
-        dims_in.assign(4, 0);
-        dims_in[0] = input.sx;
-        dims_in[1] = input.sy;
-        dims_in[2] = input.sz;
-        dims_in[3] = input.sc;
-
-        dims_out.assign(nDims, 0);
-        dims_out[0] = output.getWidth();
-        dims_out[1] = output.getHeight();
-        dims_out[2] = output.getDepth();
-        Dimension used_size_out = output.getUsedSize();
-        Dimension padded_size_out = output.getPaddedSize();
-
-        // lesser offsets will be set during recursion
-        data_in = (const InputValueType*)input.data_p; // offset[2] = start of data block
-        data_out = (OutputValueType*)output.getData();
-
-        // precompute mapping between coordinates - nearest match
-        coords_in_from_out.assign(nDims, std::vector<IndexType>());
-        coords_out_from_in.assign(nDims, std::vector<IndexType>());
-        for (int d = 0; d < nDims; ++d) {
-            double ratio = 1.0;
-            if (dims_in[d] > 0) {
-                // Use "used" size for mapping, not padded size
-                ratio = double(used_size_out[d])/double(dims_in[d]);
-                // ratio = double(padded_size_out[d])/double(dims_in[d]);
-            }
-            if (dims_in[d] > 0) {
-                coords_out_from_in[d].assign(dims_in[d], 0);
-                for (int x1 = 0; x1 < dims_in[d]; ++x1) {
-                    int x2 = int((x1 + 0.5) * ratio);
-                    assert(x2 >= 0);
-                    assert(x2 < dims_out[d]);
-                    coords_out_from_in[d][x1] = x2;
-                }
-            }
-            if (dims_out[d] > 0) {
-                coords_in_from_out[d].assign(dims_out[d], 0);
-                for (int x2 = 0; x2 < dims_out[d]; ++x2) {
-                    int x1 = 0;
-                    if (ratio > 0)
-                        x1 = int((x2 + 0.5) / ratio);
-                    assert(x1 >= 0);
-                    if (x1 < dims_in[d])
-                        coords_in_from_out[d][x2] = x1;
-                    else
-                        coords_in_from_out[d][x2] = dims_in[d] - 1;
-                }
-            }
-        }
-    }
-
-    inline void sample_over_input()
-    {
-        const IndexType sx = dims_in[0];
-        const IndexType sy = dims_in[1];
-        const IndexType sz = dims_in[2];
-        const IndexType sc = dims_in[3];
-        const size_t vol_in_stride = sx * sy * sz;
-        const size_t slice_in_stride = sx * sy;
-        const size_t row_in_stride = sx;
-        const size_t slice_out_stride = dims_out[0] * dims_out[1];
-        const size_t row_out_stride = dims_out[0];
-
-        for (IndexType c = 0; c < sc; ++c) { // color channel
-            const InputValueType* color_in = data_in + c * vol_in_stride;
-            // precompute funny bgra mapping 0xAARRGGBB
-            IndexType c2 = 2 - c;
-            for (IndexType z = 0; z < sz; ++z) { // input z depth dimension
-                const IndexType z_out = coords_out_from_in[2][z];
-                const InputValueType* slice_in = color_in + z * slice_in_stride;
-                OutputValueType* slice_out = data_out + z_out * slice_out_stride;
-                for (IndexType y = 0; y < sy; ++y) { // input y height dimension
-                    const IndexType y_out = coords_out_from_in[1][y];
-                    const InputValueType* row_in = slice_in + y * row_in_stride;
-                    OutputValueType* row_out = slice_out + y_out * row_out_stride;
-                    for (IndexType x = 0; x < sx; ++x) // input x width dimension
-                    {
-                        const InputValueType in_val = row_in[x];
-                        // for speed, short circuit when input is zero
-                        if (0 == in_val)
-                            continue;
-                        const IndexType x_out = coords_out_from_in[0][x];
-                        static_cast<T*>(this)->sample(in_val, row_out[x_out], c2);
-                    }
-                }
-            }
-        }
-    }
-
-    inline void sample_over_output()
-    {
-        const IndexType sx = dims_out[0];
-        const IndexType sy = dims_out[1];
-        const IndexType sz = dims_out[2];
-        const IndexType sc = dims_in[3];
-        const size_t slice_out_stride = sx * sy;
-        const size_t row_out_stride = sx;
-        const size_t vol_in_stride = dims_in[0] * dims_in[1] * dims_in[2];
-        const size_t slice_in_stride = dims_in[0] * dims_in[1];
-        const size_t row_in_stride = dims_in[0];
-        for (IndexType c = 0; c < sc; ++c) {
-            IndexType c2 = 2 - c;
-            // qDebug() << "Color channel" << c << c2;
-            const InputValueType* color_in = data_in + c * vol_in_stride;
-            for (IndexType z = 0; z < sz; ++z) {
-                const IndexType z_in = coords_in_from_out[2][z];
-                OutputValueType* slice_out = data_out + z * slice_out_stride;
-                const InputValueType* slice_in = color_in + z_in * slice_in_stride;
-                for (IndexType y = 0; y < sy; ++y) {
-                    const IndexType y_in = coords_in_from_out[1][y];
-                    OutputValueType* row_out = slice_out + y * row_out_stride;
-                    const InputValueType* row_in = slice_in + y_in * row_in_stride;
-                    for (IndexType x = 0; x < sx; ++x)
-                    {
-                        const IndexType x_in = coords_in_from_out[0][x];
-                        const InputValueType& in_val = row_in[x_in];
-                        // for speed, short circuit when input is zero
-                        if (0 == in_val)
-                            continue;
-                        OutputValueType& out_val = row_out[x];
-                        static_cast<T*>(this)->sample(in_val, out_val, c2, 1 /* TODO */);
-                    }
-                }
-            }
-        }
-    }
-
-    std::vector<IndexType> dims_in; // number of voxels in each direction x,y,z,c
-    const InputValueType* data_in;
-
-    // For each dimension, precomputed mapping between coordinates
-    std::vector<std::vector<IndexType> > coords_in_from_out;
-    std::vector<std::vector<IndexType> > coords_out_from_in;
-
-    std::vector<IndexType> dims_out; // number of voxels in each direction x,y,z,c
-    OutputValueType* data_out;
-};
-
-
-template<class InputValueType, class OutputValueType>
-struct LabelSampler : public BaseSampler<LabelSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType>
-{
-private:
-    typedef BaseSampler<LabelSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType> super;
-
-public:
-    typedef uint16_t IndexType;
-
-    LabelSampler(const Image4DProxy<My4DImage>& input, Base3DTexture<OutputValueType>& output)
-        : super(input, output)
-    {
-        this->sample_over_input();
-    }
-
-    inline void sample(const InputValueType& in_val, OutputValueType& out_val, IndexType c)
-    {
-        // Take smallest non-zero value
-        if ( (0 == out_val) || (out_val > in_val) )
-            out_val = in_val;
-    }
-};
-
-template<class InputValueType, class OutputValueType>
-struct SignalSampler : public BaseSampler<SignalSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType>
-{
-private:
-    typedef BaseSampler<SignalSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType> super;
-
-public:
-    typedef uint16_t IndexType;
-
-    SignalSampler(const Image4DProxy<My4DImage>& input, Base3DTexture<OutputValueType>& output)
-        : super(input, output)
-        , truncate_bits(0)
-    {
-        if (sizeof(InputValueType) > 1)
-            truncate_bits = 4; // convert 12-bit to 8-bit
-        this->sample_over_input(); // combine multiple samples
-    }
-
-    inline void sample(const InputValueType& in_val, OutputValueType& out_val, IndexType c)
-    {
-        uint8_t& out_byte = ((uint8_t*)&out_val)[c];
-        uint8_t in_byte = in_val >> truncate_bits;
-        if (in_byte > out_byte)
-            out_byte = in_byte; // maximum
-    }
-
-    int truncate_bits;
-};
-
-
-template<class InputValueType, class OutputValueType>
-struct ReferenceSampler : public BaseSampler<ReferenceSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType>
-{
-private:
-    typedef BaseSampler<ReferenceSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType> super;
-
-public:
-    typedef uint16_t IndexType;
-
-    ReferenceSampler(const Image4DProxy<My4DImage>& input, Base3DTexture<OutputValueType>& output)
-        : super(input, output)
-        , truncate_bits(0)
-    {
-        if (sizeof(InputValueType) > 1)
-            truncate_bits = 4; // convert 12-bit to 8-bit
-        this->sample_over_input(); // combine multiple samples
-    }
-
-    inline void sample(const InputValueType& in_val, OutputValueType& out_val, IndexType c)
-    {
-        uint8_t& out_byte = ((uint8_t*)&out_val)[3];
-        uint8_t in_byte = in_val >> truncate_bits;
-        if (in_byte > out_byte)
-            out_byte = in_byte; // maximum
-    }
-
-    int truncate_bits;
-};
-
-
 ////////////////////////////////
 // NeuronLabelTexture methods //
 ////////////////////////////////
@@ -505,10 +270,16 @@ bool ColorMapTexture::update()
     const DataColorModel::Reader colorReader(*dataColorModel);
     if (dataColorModel->readerIsStale(colorReader))
         return false;
+    bool bChanged = false; // For efficiency, keep track of whether the colors actually change.
     for (int rgb = 0; rgb < 4; ++rgb) // loop red, then green, then blue, then reference
     {
         // qDebug() << "color" << rgb;
         QRgb channelColor = colorReader.getChannelColor(rgb);
+        uint32_t hue = 0;
+        hue |= (  qRed(channelColor) <<  0);
+        hue |= (qGreen(channelColor) <<  8);
+        hue |= ( qBlue(channelColor) << 16);
+        uint32_t* channelColors = &colors[rgb*256];
         for (int i_in = 0; i_in < 256; ++i_in)
         {
             // R/G/B color channel value is sum of data channel values
@@ -520,15 +291,14 @@ bool ColorMapTexture::update()
             uint32_t i_out = (uint32_t) (i_out_f + 0.49999);
             // Intensities are set in the alpha channel only
             // (i.e. not R, G, or B)
-            uint32_t color = 0;
-            color |= (  qRed(channelColor) <<  0);
-            color |= (qGreen(channelColor) <<  8);
-            color |= ( qBlue(channelColor) << 16);
-            color |= ( i_out << 24 ); // alpha
-            colors[rgb*256 + i_in] = color;
+            uint32_t color = hue | ( i_out << 24 ); // alpha
+            if (color != channelColors[i_in]) {
+                channelColors[i_in] = color;
+                bChanged = true;
+            }
         }
     }
-    return true;
+    return bChanged;
 }
 
 void ColorMapTexture::setDataColorModel(const DataColorModel& cm)
@@ -670,6 +440,89 @@ bool PrivateVolumeTexture::subsampleReferenceField(const NaVolumeData::Reader& v
     return true;
 }
 
+// Box filters a range of z slices for PrivateVolumeTexture::populateVolume(), for v3d_parallel_for()
+struct VolumePopulator
+{
+    typedef PrivateVolumeTexture::BGRA BGRA;
+
+    VolumePopulator(const NaVolumeData::Reader& volumeReader, NeuronSignalTexture& texture, const Dimension& usedSize)
+        : imageProxy(volumeReader.getOriginalImageProxy())
+        , referenceProxy(volumeReader.getReferenceImageProxy())
+        , labelProxy(volumeReader.getNeuronMaskProxy())
+        , hasReferenceImage(volumeReader.hasReferenceImage())
+        , hasNeuronMask(volumeReader.hasNeuronMask())
+        , neuronSignalTexture(texture)
+        , usedTextureSize(usedSize)
+        , zBegin(0)
+    {}
+
+    void operator()(V3DLONG begin, V3DLONG end)
+    {
+        size_t refIx = imageProxy.sc; // index of reference channel
+        std::vector<double> channelIntensities(imageProxy.sc + 1, 0.0); // For colorReader::blend() interface; +1 for reference channel
+        for(int z = zBegin + (int)begin; z < zBegin + (int)end; ++z)
+        {
+            // qDebug() << z << __FILE__ << __LINE__;
+            int z0 = (int)(z * zScale + 0.49);
+            int z1 = (int)((z + 1) * zScale + 0.49);
+            for(int y = 0; y < usedTextureSize.y(); ++y)
+            {
+                int y0 = (int)(y * yScale + 0.49);
+                int y1 = (int)((y + 1) * yScale + 0.49);
+                for(int x = 0; x < usedTextureSize.x(); ++x)
+                {
+                    int x0 = (int)(x * xScale + 0.49);
+                    int x1 = (int)((x + 1) * xScale + 0.49);
+                    float weight = 0.0;
+                    // Choose exactly one neuron index for this voxel.  Default to zero (background),
+                    // but accept any non-background value in its place.
+                    int neuronIndex = 0;
+                    // Average over multiple voxels in input image
+                    channelIntensities.assign(channelCount, 0.0);
+                    for(int sx = x0; sx < x1; ++sx)
+                        for(int sy = y0; sy < y1; ++sy)
+                            for(int sz = z0; sz < z1; ++sz)
+                            {
+                                for (int c = 0; c < imageProxy.sc; ++c)
+                                    channelIntensities[c] += imageProxy.value_at(sx, sy, sz, c);
+                                if (hasReferenceImage)
+                                    channelIntensities[refIx] += referenceProxy.value_at(sx, sy, sz, 0);
+                                if (hasNeuronMask) {
+                                    if (neuronIndex == 0) // take first non-zero value
+                                        neuronIndex = (int)labelProxy.value_at(sx, sy, sz, 0);
+                                }
+                                weight += 1.0;
+                            }
+                    for (int c = 0; c < channelCount; ++c) // Normalize
+                        if (weight > 0)
+                            channelIntensities[c]  = ((channelIntensities[c] / weight) - minData[c]) * rangeData[c];
+                    // Swap red and blue from RGBA to BGRA, for Windows texture efficiency
+                    // Create unsigned int with #AARRGGBB pattern
+                    BGRA color = 0;
+                    color |= (((int)channelIntensities[2]));       // #000000BB blue  : channel 3
+                    color |= (((int)channelIntensities[1]) << 8);  // #0000GGBB green : channel 2
+                    color |= (((int)channelIntensities[0]) << 16); // #00RRGGBB red   : channel 1
+                    color |= (((int)channelIntensities[3]) << 24); // #AARRGGBB white : reference
+                    neuronSignalTexture.setValueAt(x, y, z, color);
+                }
+            }
+        }
+    }
+
+    const Image4DProxy<My4DImage>& imageProxy;
+    const Image4DProxy<My4DImage>& referenceProxy;
+    const Image4DProxy<My4DImage>& labelProxy;
+    bool hasReferenceImage;
+    bool hasNeuronMask;
+    NeuronSignalTexture& neuronSignalTexture;
+    Dimension usedTextureSize;
+    int minData[4]; // minimum data value of channel
+    double rangeData[4]; // 255.0 divided by data range of channel
+    double xScale, yScale, zScale;
+    int channelCount;
+    int zBegin;
+};
+
 // Create host texture memory for data volume
 // TODO fill 3D texture
 bool PrivateVolumeTexture::populateVolume(const NaVolumeData::Reader& volumeReader, int zBegin, int zEnd)
@@ -679,89 +532,47 @@ bool PrivateVolumeTexture::populateVolume(const NaVolumeData::Reader& volumeRead
     stopwatch.start();
     const Image4DProxy<My4DImage>& imageProxy = volumeReader.getOriginalImageProxy();
     const Image4DProxy<My4DImage>& referenceProxy = volumeReader.getReferenceImageProxy();
-    const Image4DProxy<My4DImage>& labelProxy = volumeReader.getNeuronMaskProxy();
     initializeSizes(volumeReader);
+    VolumePopulator populator(volumeReader, neuronSignalTexture, getUsedTextureSize());
     // Scale RGBA channel colors to actual data range of input
     // (Final coloring will be handled in the shader, so don't use colorReader.blend())
     // Precompute coefficients for scaling.
-    int minData[4] = {0, 0, 0, 0}; // minimum data value of channel
-    double rangeData[4] = {1.0, 1.0, 1.0, 1.0}; // 255.0 divided by data range of channel
+    for (int c = 0; c < 4; ++c)
+    {
+        populator.minData[c] = 0;
+        populator.rangeData[c] = 1.0;
+    }
     size_t refIx = imageProxy.sc; // index of reference channel
     assert(imageProxy.sc <= 3); // that's what I'm assuming for now...
     for (int c = 0; c < imageProxy.sc; ++c)
     {
-        minData[c] = imageProxy.vmin[c];
-        rangeData[c] = 255.0 / (imageProxy.vmax[c] - imageProxy.vmin[c]);
+        populator.minData[c] = imageProxy.vmin[c];
+        populator.rangeData[c] = 255.0 / (imageProxy.vmax[c] - imageProxy.vmin[c]);
         // elide use of colorReader
         // minData[c] = colorReader.getChannelDataMin(c);
         // rangeData[c] = 255.0 / (colorReader.getChannelDataMax(c) - colorReader.getChannelDataMin(c));
     }
     if (volumeReader.hasReferenceImage()) {
-        minData[refIx] = referenceProxy.vmin[0];
-        rangeData[refIx] = 255.0 / (referenceProxy.vmax[0] - referenceProxy.vmin[0]);
+        populator.minData[refIx] = referenceProxy.vmin[0];
+        populator.rangeData[refIx] = 255.0 / (referenceProxy.vmax[0] - referenceProxy.vmin[0]);
     }
 
     // Use stupid box filter for now.  Once that's working, use Lanczos for better sampling.
     // TODO
-    double xScale = (double)getOriginalImageSize().x() / (double)getUsedTextureSize().x();
-    double yScale = (double)getOriginalImageSize().y() / (double)getUsedTextureSize().y();
-    double zScale = (double)getOriginalImageSize().z() / (double)getUsedTextureSize().z();
+    populator.xScale = (double)getOriginalImageSize().x() / (double)getUsedTextureSize().x();
+    populator.yScale = (double)getOriginalImageSize().y() / (double)getUsedTextureSize().y();
+    populator.zScale = (double)getOriginalImageSize().z() / (double)getUsedTextureSize().z();
     // qDebug() << "x, y, z Scale =" << xScale << yScale << zScale << __FILE__ << __LINE__;
-    std::vector<double> channelIntensities(imageProxy.sc + 1, 0.0); // For colorReader::blend() interface; +1 for reference channel
     if (zEnd < 0) // -1 means actual final z
         zEnd = (int)getUsedTextureSize().z();
     if (zEnd > getUsedTextureSize().z())
         zEnd = (int)getUsedTextureSize().z();
-    int channelCount = imageProxy.sc;
+    populator.channelCount = imageProxy.sc;
     if (volumeReader.hasReferenceImage())
-        channelCount += 1;
-    for(int z = zBegin; z < zEnd; ++z)
-    {
-        // qDebug() << z << __FILE__ << __LINE__;
-        int z0 = (int)(z * zScale + 0.49);
-        int z1 = (int)((z + 1) * zScale + 0.49);
-        for(int y = 0; y < getUsedTextureSize().y(); ++y)
-        {
-            int y0 = (int)(y * yScale + 0.49);
-            int y1 = (int)((y + 1) * yScale + 0.49);
-            for(int x = 0; x < getUsedTextureSize().x(); ++x)
-            {
-                int x0 = (int)(x * xScale + 0.49);
-                int x1 = (int)((x + 1) * xScale + 0.49);
-                float weight = 0.0;
-                // Choose exactly one neuron index for this voxel.  Default to zero (background),
-                // but accept any non-background value in its place.
-                int neuronIndex = 0;
-                // Average over multiple voxels in input image
-                channelIntensities.assign(channelCount, 0.0);
-                for(int sx = x0; sx < x1; ++sx)
-                    for(int sy = y0; sy < y1; ++sy)
-                        for(int sz = z0; sz < z1; ++sz)
-                        {
-                            for (int c = 0; c < imageProxy.sc; ++c)
-                                channelIntensities[c] += imageProxy.value_at(sx, sy, sz, c);
-                            if (volumeReader.hasReferenceImage())
-                                channelIntensities[refIx] += referenceProxy.value_at(sx, sy, sz, 0);
-                            if (volumeReader.hasNeuronMask()) {
-                                if (neuronIndex == 0) // take first non-zero value
-                                    neuronIndex = (int)labelProxy.value_at(sx, sy, sz, 0);
-                            }
-                            weight += 1.0;
-                        }
-                for (int c = 0; c < channelCount; ++c) // Normalize
-                    if (weight > 0)
-                        channelIntensities[c]  = ((channelIntensities[c] / weight) - minData[c]) * rangeData[c];
-                // Swap red and blue from RGBA to BGRA, for Windows texture efficiency
-                // Create unsigned int with #AARRGGBB pattern
-                BGRA color = 0;
-                color |= (((int)channelIntensities[2]));       // #000000BB blue  : channel 3
-                color |= (((int)channelIntensities[1]) << 8);  // #0000GGBB green : channel 2
-                color |= (((int)channelIntensities[0]) << 16); // #00RRGGBB red   : channel 1
-                color |= (((int)channelIntensities[3]) << 24); // #AARRGGBB white : reference
-                neuronSignalTexture.setValueAt(x, y, z, color);
-            }
-        }
-    }
+        populator.channelCount += 1;
+    populator.zBegin = zBegin;
+    // Output slices are independent, so fill them in parallel slabs
+    v3d_parallel_for(zEnd - zBegin, populator);
     // qDebug() << "Sampling 3D volume for 3D viewer took" << stopwatch.elapsed() / 1000.0 << "seconds";
     return true;
 }
@@ -0,0 +1,283 @@
+#ifndef VOLUMESAMPLER_H
+#define VOLUMESAMPLER_H
+
+#include "Dimension.h"
+#include "../../basic_c_fun/basic_parallel.h"
+#include <vector>
+#include <cassert>
+#include <stdint.h>
+
+namespace jfrc {
+
+// Samplers that reduce a full size volume to the 3D viewer textures of PrivateVolumeTexture.
+// The input is any image proxy with sx, sy, sz, sc and data_p (e.g. Image4DProxy<My4DImage>),
+// the output any texture with the accessors of Base3DTexture, so that the samplers need only
+// QtCore and can be checked in headless tests.
+//
+// Each input voxel is combined into the output voxel it falls in. The output z slices are
+// split among threads; input slices map to output slices in increasing order, so every thread
+// reads its own contiguous range of input slices and writes its own output slices.
+
+// Runs BaseSampler::sample_input_slab() for a range of output slices, for v3d_parallel_for()
+template<class S>
+struct SamplerSlabs
+{
+    explicit SamplerSlabs(S& samplerParam) : sampler(samplerParam) {}
+    void operator()(V3DLONG begin, V3DLONG end) {sampler.sample_input_slab(begin, end);}
+    S& sampler;
+};
+
+// LabelSampler class for efficiently sampling a label field.
+// This is meant to be fast, so all inline.
+// with precomputed data offsets
+template<typename T, class InputValueType, class OutputValueType>
+struct BaseSampler
+{
+    typedef size_t IndexType;
+    static const int nDims = 3;
+
+    template<class InputProxy, class OutputTexture>
+    BaseSampler(const InputProxy& input, OutputTexture& output)
+    {
+        // cache volume dimensions
+        dims_in.assign(4, 0);
+        dims_in[0] = input.sx;
+        dims_in[1] = input.sy;
+        dims_in[2] = input.sz;
+        dims_in[3] = input.sc;
+
+        dims_out.assign(nDims, 0);
+        dims_out[0] = output.getWidth();
+        dims_out[1] = output.getHeight();
+        dims_out[2] = output.getDepth();
+        Dimension used_size_out = output.getUsedSize();
+
+        // lesser offsets will be set during recursion
+        data_in = (const InputValueType*)input.data_p; // offset[2] = start of data block
+        data_out = (OutputValueType*)output.getData();
+
+        // precompute mapping between coordinates - nearest match
+        coords_in_from_out.assign(nDims, std::vector<IndexType>());
+        coords_out_from_in.assign(nDims, std::vector<IndexType>());
+        for (int d = 0; d < nDims; ++d) {
+            double ratio = 1.0;
+            if (dims_in[d] > 0) {
+                // Use "used" size for mapping, not padded size
+                ratio = double(used_size_out[d])/double(dims_in[d]);
+            }
+            if (dims_in[d] > 0) {
+                coords_out_from_in[d].assign(dims_in[d], 0);
+                for (IndexType x1 = 0; x1 < dims_in[d]; ++x1) {
+                    IndexType x2 = IndexType((x1 + 0.5) * ratio);
+                    assert(x2 < dims_out[d]);
+                    coords_out_from_in[d][x1] = x2;
+                }
+            }
+            if (dims_out[d] > 0) {
+                coords_in_from_out[d].assign(dims_out[d], 0);
+                for (IndexType x2 = 0; x2 < dims_out[d]; ++x2) {
+                    IndexType x1 = 0;
+                    if (ratio > 0)
+                        x1 = IndexType((x2 + 0.5) / ratio);
+                    if (x1 < dims_in[d])
+                        coords_in_from_out[d][x2] = x1;
+                    else
+                        coords_in_from_out[d][x2] = dims_in[d] - 1;
+                }
+            }
+        }
+
+        // first input slice of each output slice (coords_out_from_in[2] never decreases)
+        first_z_in.assign(dims_out[2] + 1, dims_in[2]);
+        for (IndexType z = dims_in[2]; z > 0; --z)
+            first_z_in[coords_out_from_in[2][z - 1]] = z - 1;
+        for (IndexType z_out = dims_out[2]; z_out > 0; --z_out)
+            if (first_z_in[z_out - 1] > first_z_in[z_out])
+                first_z_in[z_out - 1] = first_z_in[z_out];
+    }
+
+    inline void sample_over_input()
+    {
+        SamplerSlabs<BaseSampler> slabs(*this);
+        v3d_parallel_for((V3DLONG)dims_out[2], slabs);
+    }
+
+    // combines the input slices that fall in output slices [z_out_begin, z_out_end)
+    inline void sample_input_slab(IndexType z_out_begin, IndexType z_out_end)
+    {
+        const IndexType sx = dims_in[0];
+        const IndexType sy = dims_in[1];
+        const IndexType sc = dims_in[3];
+        const size_t vol_in_stride = sx * sy * dims_in[2];
+        const size_t slice_in_stride = sx * sy;
+        const size_t row_in_stride = sx;
+        const size_t slice_out_stride = dims_out[0] * dims_out[1];
+        const size_t row_out_stride = dims_out[0];
+        const IndexType z_begin = first_z_in[z_out_begin];
+        const IndexType z_end = first_z_in[z_out_end];
+
+        for (IndexType c = 0; c < sc; ++c) { // color channel
+            const InputValueType* color_in = data_in + c * vol_in_stride;
+            // precompute funny bgra mapping 0xAARRGGBB
+            IndexType c2 = 2 - c;
+            for (IndexType z = z_begin; z < z_end; ++z) { // input z depth dimension
+                const IndexType z_out = coords_out_from_in[2][z];
+                const InputValueType* slice_in = color_in + z * slice_in_stride;
+                OutputValueType* slice_out = data_out + z_out * slice_out_stride;
+                for (IndexType y = 0; y < sy; ++y) { // input y height dimension
+                    const IndexType y_out = coords_out_from_in[1][y];
+                    const InputValueType* row_in = slice_in + y * row_in_stride;
+                    OutputValueType* row_out = slice_out + y_out * row_out_stride;
+                    for (IndexType x = 0; x < sx; ++x) // input x width dimension
+                    {
+                        const InputValueType in_val = row_in[x];
+                        // for speed, short circuit when input is zero
+                        if (0 == in_val)
+                            continue;
+                        const IndexType x_out = coords_out_from_in[0][x];
+                        static_cast<T*>(this)->sample(in_val, row_out[x_out], c2);
+                    }
+                }
+            }
+        }
+    }
+
+    inline void sample_over_output()
+    {
+        const IndexType sx = dims_out[0];
+        const IndexType sy = dims_out[1];
+        const IndexType sz = dims_out[2];
+        const IndexType sc = dims_in[3];
+        const size_t slice_out_stride = sx * sy;
+        const size_t row_out_stride = sx;
+        const size_t vol_in_stride = dims_in[0] * dims_in[1] * dims_in[2];
+        const size_t slice_in_stride = dims_in[0] * dims_in[1];
+        const size_t row_in_stride = dims_in[0];
+        for (IndexType c = 0; c < sc; ++c) {
+            IndexType c2 = 2 - c;
+            // qDebug() << "Color channel" << c << c2;
+            const InputValueType* color_in = data_in + c * vol_in_stride;
+            for (IndexType z = 0; z < sz; ++z) {
+                const IndexType z_in = coords_in_from_out[2][z];
+                OutputValueType* slice_out = data_out + z * slice_out_stride;
+                const InputValueType* slice_in = color_in + z_in * slice_in_stride;
+                for (IndexType y = 0; y < sy; ++y) {
+                    const IndexType y_in = coords_in_from_out[1][y];
+                    OutputValueType* row_out = slice_out + y * row_out_stride;
+                    const InputValueType* row_in = slice_in + y_in * row_in_stride;
+                    for (IndexType x = 0; x < sx; ++x)
+                    {
+                        const IndexType x_in = coords_in_from_out[0][x];
+                        const InputValueType& in_val = row_in[x_in];
+                        // for speed, short circuit when input is zero
+                        if (0 == in_val)
+                            continue;
+                        OutputValueType& out_val = row_out[x];
+                        static_cast<T*>(this)->sample(in_val, out_val, c2, 1 /* TODO */);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<IndexType> dims_in; // number of voxels in each direction x,y,z,c
+    const InputValueType* data_in;
+
+    // For each dimension, precomputed mapping between coordinates
+    std::vector<std::vector<IndexType> > coords_in_from_out;
+    std::vector<std::vector<IndexType> > coords_out_from_in;
+    std::vector<IndexType> first_z_in; // dims_out[2]+1 entries
+
+    std::vector<IndexType> dims_out; // number of voxels in each direction x,y,z,c
+    OutputValueType* data_out;
+};
+
+
+template<class InputValueType, class OutputValueType>
+struct LabelSampler : public BaseSampler<LabelSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType>
+{
+private:
+    typedef BaseSampler<LabelSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType> super;
+
+public:
+    typedef uint16_t IndexType;
+
+    template<class InputProxy, class OutputTexture>
+    LabelSampler(const InputProxy& input, OutputTexture& output)
+        : super(input, output)
+    {
+        this->sample_over_input();
+    }
+
+    inline void sample(const InputValueType& in_val, OutputValueType& out_val, IndexType c)
+    {
+        // Take smallest non-zero value
+        if ( (0 == out_val) || (out_val > in_val) )
+            out_val = in_val;
+    }
+};
+
+template<class InputValueType, class OutputValueType>
+struct SignalSampler : public BaseSampler<SignalSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType>
+{
+private:
+    typedef BaseSampler<SignalSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType> super;
+
+public:
+    typedef uint16_t IndexType;
+
+    template<class InputProxy, class OutputTexture>
+    SignalSampler(const InputProxy& input, OutputTexture& output)
+        : super(input, output)
+        , truncate_bits(0)
+    {
+        if (sizeof(InputValueType) > 1)
+            truncate_bits = 4; // convert 12-bit to 8-bit
+        this->sample_over_input(); // combine multiple samples
+    }
+
+    inline void sample(const InputValueType& in_val, OutputValueType& out_val, IndexType c)
+    {
+        uint8_t& out_byte = ((uint8_t*)&out_val)[c];
+        uint8_t in_byte = in_val >> truncate_bits;
+        if (in_byte > out_byte)
+            out_byte = in_byte; // maximum
+    }
+
+    int truncate_bits;
+};
+
+
+template<class InputValueType, class OutputValueType>
+struct ReferenceSampler : public BaseSampler<ReferenceSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType>
+{
+private:
+    typedef BaseSampler<ReferenceSampler<InputValueType, OutputValueType>, InputValueType, OutputValueType> super;
+
+public:
+    typedef uint16_t IndexType;
+
+    template<class InputProxy, class OutputTexture>
+    ReferenceSampler(const InputProxy& input, OutputTexture& output)
+        : super(input, output)
+        , truncate_bits(0)
+    {
+        if (sizeof(InputValueType) > 1)
+            truncate_bits = 4; // convert 12-bit to 8-bit
+        this->sample_over_input(); // combine multiple samples
+    }
+
+    inline void sample(const InputValueType& in_val, OutputValueType& out_val, IndexType c)
+    {
+        uint8_t& out_byte = ((uint8_t*)&out_val)[3];
+        uint8_t in_byte = in_val >> truncate_bits;
+        if (in_byte > out_byte)
+            out_byte = in_byte; // maximum
+    }
+
+    int truncate_bits;
+};
+
+} // namespace jfrc
+
+#endif // VOLUMESAMPLER_H
@@ -0,0 +1,107 @@
+// test_dilation_erosion.cpp - Compare DilationErosion with the direct neighbor count
+// it replaced, on random masks for several element sizes and thresholds.
+
+#include "../analysis/DilationErosion.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+// the original per-voxel count over the (2*elementSize)^3 cube
+static void referenceDilateOrErode(int type, int xDim, int yDim, int zDim,
+        unsigned char*** s, unsigned char*** t, int elementSize, int neighborsForThreshold)
+{
+    for (int z=0;z<zDim;z++) {
+        for (int y=0;y<yDim;y++) {
+            for (int x=0;x<xDim;x++) {
+                int currentValue=s[z][y][x];
+                if (type==DilationErosion::TYPE_ERODE && currentValue==0) {
+                    t[z][y][x]=0;
+                    continue;
+                }
+                if (type==DilationErosion::TYPE_DILATE && currentValue>0) {
+                    t[z][y][x]=currentValue;
+                    continue;
+                }
+                int neighborCount=0;
+                for (int ez=z-elementSize;ez<z+elementSize;ez++) {
+                    int sz = ez<0 ? 0 : (ez>=zDim ? zDim-1 : ez);
+                    for (int ey=y-elementSize;ey<y+elementSize;ey++) {
+                        int sy = ey<0 ? 0 : (ey>=yDim ? yDim-1 : ey);
+                        for (int ex=x-elementSize;ex<x+elementSize;ex++) {
+                            int sx = ex<0 ? 0 : (ex>=xDim ? xDim-1 : ex);
+                            if (s[sz][sy][sx]>0) {
+                                neighborCount++;
+                            }
+                        }
+                    }
+                }
+                if (type==DilationErosion::TYPE_DILATE) {
+                    t[z][y][x] = (neighborCount>=neighborsForThreshold) ? 255 : 0;
+                } else {
+                    t[z][y][x] = (neighborCount<=neighborsForThreshold) ? 0 : s[z][y][x];
+                }
+            }
+        }
+    }
+}
+
+// a volume of xDim*yDim*zDim bytes with its [z][y] row pointers
+class Volume
+{
+public:
+    Volume(int xDim, int yDim, int zDim) : data((size_t)xDim*yDim*zDim), rows((size_t)yDim*zDim), planes(zDim) {
+        for (int z=0;z<zDim;z++) {
+            for (int y=0;y<yDim;y++) {
+                rows[(size_t)z*yDim+y]=&data[((size_t)z*yDim+y)*xDim];
+            }
+            planes[z]=&rows[(size_t)z*yDim];
+        }
+    }
+    unsigned char*** ptr() { return &planes[0]; }
+    vector<unsigned char> data;
+private:
+    vector<unsigned char*> rows;
+    vector<unsigned char**> planes;
+};
+
+int main(int argc, const char* argv[])
+{
+    srand(12345);
+    int failures=0;
+    int runs=0;
+    const int elementSizes[] = {0, 1, 2, 3, 5};
+    for (int ei=0;ei<5;ei++) {
+        int elementSize=elementSizes[ei];
+        for (int trial=0;trial<8;trial++) {
+            int xDim=1+rand()%60;
+            int yDim=1+rand()%50;
+            int zDim=1+rand()%45;
+            int density=rand()%100;
+
+            Volume source(xDim, yDim, zDim);
+            for (size_t i=0;i<source.data.size();i++) {
+                source.data[i] = (rand()%100<density) ? (unsigned char)(1+rand()%255) : 0;
+            }
+
+            int cube=8*elementSize*elementSize*elementSize;
+            int neighborsForThreshold = cube>0 ? rand()%(cube+1) : 0;
+            for (int type=DilationErosion::TYPE_DILATE;type<=DilationErosion::TYPE_ERODE;type++) {
+                Volume expected(xDim, yDim, zDim);
+                Volume result(xDim, yDim, zDim);
+                referenceDilateOrErode(type, xDim, yDim, zDim, source.ptr(), expected.ptr(), elementSize, neighborsForThreshold);
+                DilationErosion de;
+                de.dilateOrErode(type, xDim, yDim, zDim, source.ptr(), result.ptr(), elementSize, neighborsForThreshold);
+                runs++;
+                if (result.data!=expected.data) {
+                    failures++;
+                    printf("mismatch: type %d size %dx%dx%d element %d threshold %d\n",
+                           type, xDim, yDim, zDim, elementSize, neighborsForThreshold);
+                }
+            }
+        }
+    }
+    printf("%d of %d comparisons differ\n", failures, runs);
+    return failures==0 ? 0 : 1;
+}
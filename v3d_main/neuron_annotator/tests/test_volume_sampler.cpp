@@ -0,0 +1,198 @@
+#include "../data_model/VolumeSampler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/* Label, signal and reference samplers of the 3D viewer textures: a few textures worked out
+ * by hand, then random volumes where every output voxel is gathered from the input voxels
+ * that land in it, whichever thread wrote it. */
+
+using jfrc::Dimension;
+
+static int nFailed = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        nFailed++;
+    }
+}
+
+// what the samplers read of Image4DProxy
+struct Proxy
+{
+    V3DLONG sx, sy, sz, sc;
+    unsigned char* data_p;
+};
+
+// what the samplers read and write of Base3DTexture
+template<class VoxelType>
+struct Texture
+{
+    Texture(Dimension usedParam) : used(usedParam), padded(usedParam.padToMultipleOf(8)), data(padded.numberOfVoxels(), 0) {}
+    size_t getWidth() const {return padded.x();}
+    size_t getHeight() const {return padded.y();}
+    size_t getDepth() const {return padded.z();}
+    Dimension getUsedSize() const {return used;}
+    Dimension getPaddedSize() const {return padded;}
+    VoxelType* getData() {return &data[0];}
+    VoxelType& at(size_t x, size_t y, size_t z) {return data[(z*padded.y() + y)*padded.x() + x];}
+
+    Dimension used, padded;
+    std::vector<VoxelType> data;
+};
+
+static uint8_t byteOf(uint32_t voxel, int b) {return ((uint8_t*)&voxel)[b];}
+
+/* hand-worked textures */
+
+static void testLabel()
+{
+    // 4x2x1 labels into 2x1x1: each output voxel takes the smallest nonzero label of a 2x2 block
+    uint8_t labels[8] = {0, 5, 3, 0,
+                         7, 0, 0, 2};
+    Proxy input = {4, 2, 1, 1, labels};
+    Texture<uint16_t> texture(Dimension(2, 1, 1));
+    texture.at(1, 0, 0) = 1; // already there and smaller, so it stays
+    jfrc::LabelSampler<uint8_t, uint16_t> sampler(input, texture);
+    check(texture.at(0, 0, 0) == 5, "label: smallest nonzero label of the block");
+    check(texture.at(1, 0, 0) == 1, "label: a smaller label already in the texture is kept");
+    check(texture.at(2, 0, 0) == 0 && texture.at(0, 1, 0) == 0, "label: padding is not written");
+}
+
+static void testSignal()
+{
+    // three 12-bit channels of one voxel go to the red, green and blue bytes of 0xAARRGGBB
+    uint16_t channels[3] = {0x0ABC, 0x0010, 0};
+    Proxy input = {1, 1, 1, 3, (unsigned char*)channels};
+    Texture<uint32_t> texture(Dimension(1, 1, 1));
+    uint8_t* before = (uint8_t*)&texture.at(0, 0, 0);
+    before[0] = 5;
+    before[3] = 0xFF;
+    jfrc::SignalSampler<uint16_t, uint32_t> sampler(input, texture);
+    uint32_t v = texture.at(0, 0, 0);
+    check(byteOf(v, 2) == 0xAB && byteOf(v, 1) == 0x01, "signal: 12-bit channels truncated to their bytes");
+    check(byteOf(v, 0) == 5, "signal: a zero channel leaves its byte alone");
+    check(byteOf(v, 3) == 0xFF, "signal: the reference byte is not touched");
+}
+
+static void testReference()
+{
+    // 2x1x1 reference into 1x1x1: the alpha byte is the maximum, including what was there
+    uint8_t reference[2] = {40, 90};
+    Proxy input = {2, 1, 1, 1, reference};
+    Texture<uint32_t> texture(Dimension(1, 1, 1));
+    uint8_t* before = (uint8_t*)&texture.at(0, 0, 0);
+    before[3] = 60;
+    before[2] = 7;
+    jfrc::ReferenceSampler<uint8_t, uint32_t> sampler(input, texture);
+    uint32_t v = texture.at(0, 0, 0);
+    check(byteOf(v, 3) == 90, "reference: maximum in the alpha byte");
+    check(byteOf(v, 2) == 7, "reference: the signal bytes are not touched");
+}
+
+/* random volumes */
+
+enum Kind {LABEL, SIGNAL, REFERENCE};
+
+// input coordinates that land in each output coordinate along one axis, by nearest match on the used size
+static std::vector<std::vector<size_t> > inputsOf(size_t sizeIn, size_t used, size_t padded)
+{
+    std::vector<std::vector<size_t> > inputs(padded);
+    double ratio = double(used) / double(sizeIn);
+    for (size_t x = 0; x < sizeIn; x++)
+        inputs[size_t((x + 0.5) * ratio)].push_back(x);
+    return inputs;
+}
+
+template<class In, class Out>
+static bool gathered(Kind kind, const Proxy& input, const Texture<Out>& before, Texture<Out>& after)
+{
+    std::vector<std::vector<size_t> > xs = inputsOf(input.sx, after.used.x(), after.padded.x());
+    std::vector<std::vector<size_t> > ys = inputsOf(input.sy, after.used.y(), after.padded.y());
+    std::vector<std::vector<size_t> > zs = inputsOf(input.sz, after.used.z(), after.padded.z());
+    const In* in = (const In*)input.data_p;
+    int shift = sizeof(In) > 1 ? 4 : 0;
+
+    for (size_t z = 0; z < after.padded.z(); z++)
+        for (size_t y = 0; y < after.padded.y(); y++)
+            for (size_t x = 0; x < after.padded.x(); x++)
+            {
+                Out expect = before.data[(z*after.padded.y() + y)*after.padded.x() + x];
+                for (V3DLONG c = 0; c < input.sc; c++)
+                    for (size_t k = 0; k < zs[z].size(); k++)
+                        for (size_t j = 0; j < ys[y].size(); j++)
+                            for (size_t i = 0; i < xs[x].size(); i++)
+                            {
+                                In v = in[((c*input.sz + zs[z][k])*input.sy + ys[y][j])*input.sx + xs[x][i]];
+                                if (v == 0)
+                                    continue;
+                                if (kind == LABEL)
+                                {
+                                    if (expect == 0 || v < expect) expect = v;
+                                    continue;
+                                }
+                                uint8_t& b = ((uint8_t*)&expect)[kind == SIGNAL ? 2 - c : 3];
+                                if (uint8_t(v >> shift) > b) b = uint8_t(v >> shift);
+                            }
+                if (after.at(x, y, z) != expect)
+                    return false;
+            }
+    return true;
+}
+
+template<class In, class Out>
+static void testRandom(Kind kind, V3DLONG sx, V3DLONG sy, V3DLONG sz, V3DLONG sc, Dimension used, const char* what)
+{
+    std::vector<In> voxels(sx*sy*sz*sc);
+    int percentSet = rand() % 101;
+    for (size_t k = 0; k < voxels.size(); k++)
+        if (rand() % 100 < percentSet) voxels[k] = (In)rand();
+    Proxy input = {sx, sy, sz, sc, (unsigned char*)&voxels[0]};
+
+    // the samplers merge into whatever the texture holds
+    Texture<Out> before(used);
+    for (size_t k = 0; k < before.data.size(); k++)
+        if (rand() % 4 == 0) before.data[k] = (Out)(rand() * 65599u + rand());
+    Texture<Out> after = before;
+    if (kind == LABEL)
+        jfrc::LabelSampler<In, Out> sampler(input, after);
+    else if (kind == SIGNAL)
+        jfrc::SignalSampler<In, Out> sampler(input, after);
+    else
+        jfrc::ReferenceSampler<In, Out> sampler(input, after);
+
+    char message[160];
+    sprintf(message, "%s of %ldx%ldx%ldx%ld into %dx%dx%d", what, (long)sx, (long)sy, (long)sz, (long)sc,
+            (int)used.x(), (int)used.y(), (int)used.z());
+    check(gathered<In, Out>(kind, input, before, after), message);
+}
+
+int main()
+{
+    testLabel();
+    testSignal();
+    testReference();
+
+    srand(49);
+    for (int trial = 0; trial < 60; trial++)
+    {
+        V3DLONG sx = 1 + rand() % 70, sy = 1 + rand() % 60, sz = 1 + rand() % 50, sc = 1 + rand() % 3;
+        // the used texture size is never larger than the input; every fifth trial is not reduced at all
+        Dimension used(1 + rand() % sx, 1 + rand() % sy, 1 + rand() % sz);
+        if (trial % 5 == 0)
+            used = Dimension(sx, sy, sz);
+        testRandom<uint8_t, uint16_t>(LABEL, sx, sy, sz, 1, used, "8-bit labels");
+        testRandom<uint16_t, uint16_t>(LABEL, sx, sy, sz, 1, used, "16-bit labels");
+        testRandom<uint8_t, uint32_t>(SIGNAL, sx, sy, sz, sc, used, "8-bit signal");
+        testRandom<uint16_t, uint32_t>(SIGNAL, sx, sy, sz, sc, used, "16-bit signal");
+        testRandom<uint8_t, uint32_t>(REFERENCE, sx, sy, sz, 1, used, "8-bit reference");
+        testRandom<uint16_t, uint32_t>(REFERENCE, sx, sy, sz, 1, used, "16-bit reference");
+    }
+
+    printf("%s\n", nFailed ? "test_volume_sampler FAILED" : "test_volume_sampler passed");
+    return nFailed ? 1 : 0;
+}
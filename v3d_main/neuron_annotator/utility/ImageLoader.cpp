@@ -19,11 +19,17 @@
 #include "loadV3dFFMpeg.h"
 #endif
 #include "ImageLoader.h"
+#include "../../basic_c_fun/basic_parallel.h"
 
 using namespace std;
 
+// Compressed bytes per segment when decoding PBD data on several threads
+static const V3DLONG PBD_SEGMENT_BYTES = V3DLONG(1) << 18;
+
 ImageLoader::ImageLoader()
     : progressIndex(0)
+    , bDecodeInSegments(false)
+    , decodeReadBytes(0)
 {
     // qDebug() << "ImageLoader() constructor called";
     mode=MODE_UNDEFINED;
@@ -1130,6 +1136,7 @@ int ImageLoader::loadRaw2StackPBDFromStream(QIODevice& fileStream, V3DLONG fileS
 
     QThreadPool threadPool;
     setAutoDelete(false);
+    bDecodeInSegments = ( datatype == 1 || datatype == 2 );
 
     while (remainingBytes>0)
     {
@@ -1168,6 +1175,7 @@ int ImageLoader::loadRaw2StackPBDFromStream(QIODevice& fileStream, V3DLONG fileS
             {
                 // qDebug() << "Prior to start() image is non-zero";
             }
+            decodeReadBytes = totalReadBytes;
             threadPool.start(this);
         }
         else
@@ -1214,15 +1222,45 @@ int ImageLoader::loadRaw2StackPBDFromStream(QIODevice& fileStream, V3DLONG fileS
 }
 
 
+// Decodes a range of PBD segments, for v3d_parallel_for()
+class ImageLoader::PbdSegmentDecoder
+{
+public:
+    PbdSegmentDecoder(ImageLoader& loader, std::vector<PbdSegment>& segments)
+        : loader(loader), segments(segments)
+    {}
+
+    void operator()(V3DLONG begin, V3DLONG end)
+    {
+        for (V3DLONG s = begin; s < end; ++s)
+            loader.decompressPbdSegment(segments[s]);
+    }
+
+private:
+    ImageLoader& loader;
+    std::vector<PbdSegment>& segments;
+};
+
+
+// Decodes everything read so far, while loadRaw2StackPBDFromStream() reads the next block
 void ImageLoader::run()
 {
-    if ( loadDatatype == 1 )
+    unsigned char * readEnd = &compressionBuffer[0] + decodeReadBytes;
+    if ( bDecodeInSegments )
+    {
+        std::vector<PbdSegment> segments;
+        findPbdSegments(readEnd, PBD_SEGMENT_BYTES, segments);
+        PbdSegmentDecoder decoder(*this, segments);
+        v3d_parallel_for((V3DLONG)segments.size(), decoder);
+        finishPbdSegments(segments);
+    }
+    else if ( loadDatatype == 1 )
     {
-        updateCompressionBuffer8(&compressionBuffer[0]+totalReadBytes);
+        updateCompressionBuffer8(readEnd);
     }
     else
     {
-        updateCompressionBuffer16(&compressionBuffer[0]+totalReadBytes);
+        updateCompressionBuffer16(readEnd);
     }
 }
 
@@ -125,6 +125,9 @@ private:
     My4DImage * image;
     bool flipy;
     int progressIndex;
+    bool bDecodeInSegments; // PBD8/PBD16 data are decoded in parallel segments by run()
+    V3DLONG decodeReadBytes; // how much of compressionBuffer run() may decode
+    class PbdSegmentDecoder;
 
 };
 
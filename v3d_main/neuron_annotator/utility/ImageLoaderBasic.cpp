@@ -857,7 +857,7 @@ V3DLONG ImageLoaderBasic::compressPBD16(unsigned char * compressionBuffer, unsig
     return p;
 }
 
-V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength) {
+V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength, int& prior) {
 
     // Decompress data
     V3DLONG cp=0;
@@ -885,7 +885,7 @@ V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned ch
                 targetData[dp++]=sourceData[j];
             }
             cp+=(count+1);
-            decompressionPrior=targetData[dp-1];
+            prior=targetData[dp-1];
         } else if (value<128) {
             // Difference 33-127
             leftToFill=value-32;
@@ -900,7 +900,7 @@ V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned ch
                 p2=sourceChar & mask;
                 sourceChar >>= 2;
                 p3=sourceChar & mask;
-                pva=(p0==3?-1:p0)+decompressionPrior;
+                pva=(p0==3?-1:p0)+prior;
 
                 *toFill=pva;
                 if (fillNumber>1) {
@@ -918,7 +918,7 @@ V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned ch
                     }
                 }
 
-                decompressionPrior = *toFill;
+                prior = *toFill;
                 dp+=fillNumber;
                 leftToFill-=fillNumber;
             }
@@ -931,7 +931,7 @@ V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned ch
             for (int j=0;j<repeatCount;j++) {
                 targetData[dp++]=repeatValue;
             }
-            decompressionPrior=repeatValue;
+            prior=repeatValue;
             cp++;
         }
 
@@ -939,7 +939,7 @@ V3DLONG ImageLoaderBasic::decompressPBD8(unsigned char * sourceData, unsigned ch
     return dp;
 }
 
-V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength)
+V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength, int& prior)
 {
     // bool debug=false;
 
@@ -961,7 +961,7 @@ V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned c
 
         code=sourceData[cp];
 
-         //if (debug) qDebug() << "decompressPBD16  dPos=" << decompPos << " dBuf=" << decompBuf << " decompressionPrior=" << decompressionPrior << " debugThreshold=" << debugThreshold << " cp=" << cp << " code=" << code;
+         //if (debug) qDebug() << "decompressPBD16  dPos=" << decompPos << " dBuf=" << decompBuf << " prior=" << prior << " debugThreshold=" << debugThreshold << " cp=" << cp << " code=" << code;
 
         // Literal 0-31
         if (code<32) {
@@ -973,8 +973,8 @@ V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned c
                 //if (debug) qDebug() << "decompressPBD16 added literal value=" << target16Data[dp-1] << " at position=" << ((decompressionPosition-decompressionBuffer) + 2*(dp-1));
             }
             cp+=(count*2+1);
-            decompressionPrior=target16Data[dp-1];
-            //if (debug) qDebug() << "debug: literal set decompressionPrior=" << decompressionPrior;
+            prior=target16Data[dp-1];
+            //if (debug) qDebug() << "debug: literal set prior=" << prior;
         }
 
         // NOTE: For the difference sections, we will unroll conditional
@@ -983,7 +983,7 @@ V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned c
         // Difference 3-bit 32-79
         else if (code<80) {
             leftToFill=code-31;
-            //if (debug) qDebug() << "decompressPBD16 leftToFill start=" << leftToFill << " decompressionPrior=" << decompressionPrior;
+            //if (debug) qDebug() << "decompressPBD16 leftToFill start=" << leftToFill << " prior=" << prior;
             while(leftToFill>0) {
 
                 // 332
@@ -991,7 +991,7 @@ V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned c
                 sourceChar=sourceData[++cp];
                 d0=sourceChar;
                 d0 >>= 5;
-                target16Data[dp++]=decompressionPrior+(d0<5?d0:4-d0);
+                target16Data[dp++]=prior+(d0<5?d0:4-d0);
                 //if (debug) qDebug() << "debug: position " << (dp-1) << " diff value=" << target16Data[dp-1] << " d0=" << d0;
                 leftToFill--;
                 if (leftToFill==0) {
@@ -1082,13 +1082,13 @@ V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned c
                 if (leftToFill==0) {
                     break;
                 }
-                decompressionPrior=target16Data[dp-1];
+                prior=target16Data[dp-1];
             }
-            decompressionPrior=target16Data[dp-1];
-            //if (debug) qDebug() << "debug: diff set decompressionPrior=" << decompressionPrior;
+            prior=target16Data[dp-1];
+            //if (debug) qDebug() << "debug: diff set prior=" << prior;
             cp++;
         } else if (code<223) {
-            cerr << "DEBUG: Mistakenly received unimplemented code of " << code << " at dp=" << dp << " cp=" << cp << " decompressionPrior=" << decompressionPrior << endl;
+            cerr << "DEBUG: Mistakenly received unimplemented code of " << code << " at dp=" << dp << " cp=" << cp << " prior=" << prior << endl;
         }
         // Repeat 223-255
         else {
@@ -1099,8 +1099,8 @@ V3DLONG ImageLoaderBasic::decompressPBD16(unsigned char * sourceData, unsigned c
             for (int j=0;j<repeatCount;j++) {
                 target16Data[dp++]=repeatValue;
             }
-            decompressionPrior=repeatValue;
-            //if (debug) qDebug() << "debug: repeat set decompressionPrior=" << decompressionPrior;
+            prior=repeatValue;
+            //if (debug) qDebug() << "debug: repeat set prior=" << prior;
             cp+=2;
             //if (debug) qDebug() << "decompressPBD16  finished adding repeats at dp=" << dp << " cp=" << cp;
         }
@@ -1271,6 +1271,92 @@ void ImageLoaderBasic::updateCompressionBuffer16(unsigned char * updatedCompress
     //printf("d2\n");
 }
 
+// Splits the complete codes between compressionPosition and updatedCompressionBuffer into
+// segments of about segmentBytes compressed bytes, for PBD8 and PBD16 data. A new segment
+// only starts at a literal or repeat code, which does not depend on the previously decoded
+// value, so the segments can be decoded concurrently with decompressPbdSegment().
+void ImageLoaderBasic::findPbdSegments(unsigned char * updatedCompressionBuffer, V3DLONG segmentBytes, std::vector<PbdSegment>& segments) {
+    if (compressionPosition==0) {
+        compressionPosition=&compressionBuffer[0];
+    }
+    if (decompressionPosition==0) {
+        decompressionPosition=decompressionBuffer;
+    }
+    segments.clear();
+    PbdSegment segment;
+    segment.source=compressionPosition;
+    segment.sourceLength=0;
+    segment.target=decompressionPosition;
+    segment.targetLength=0;
+    segment.prior=decompressionPrior;
+    unsigned char * lookAhead=compressionPosition;
+    while(lookAhead<updatedCompressionBuffer) {
+        // Same code layout as in updateCompressionBuffer8() and updateCompressionBuffer16()
+        unsigned char lav=*lookAhead;
+        V3DLONG codeBytes, codeValues;
+        bool independent;
+        if (loadDatatype==2) {
+            if (lav<32) {
+                codeValues=lav+1; codeBytes=codeValues*2+1; independent=true;
+            } else if (lav<80) {
+                codeValues=lav-31; codeBytes=(codeValues*3+7)/8+1; independent=false;
+            } else if (lav<183) {
+                codeValues=lav-79; codeBytes=(codeValues*4+7)/8+1; independent=false;
+            } else if (lav<223) {
+                codeValues=lav-182; codeBytes=(codeValues*5+7)/8+1; independent=false;
+            } else {
+                codeValues=lav-222; codeBytes=3; independent=true;
+            }
+            codeValues*=2; // bytes
+        } else {
+            if (lav<33) {
+                codeValues=lav+1; codeBytes=lav+2; independent=true;
+            } else if (lav<128) {
+                codeValues=lav-32; codeBytes=(lav-33)/4+2; independent=false;
+            } else {
+                codeValues=lav-127; codeBytes=2; independent=true;
+            }
+        }
+        if (lookAhead+codeBytes > updatedCompressionBuffer) {
+            break; // wait for the rest of this code
+        }
+        if (independent && segment.sourceLength>=segmentBytes) {
+            segments.push_back(segment);
+            segment.source=lookAhead;
+            segment.sourceLength=0;
+            segment.target+=segment.targetLength;
+            segment.targetLength=0;
+            segment.prior=0; // overwritten by the first code
+        }
+        segment.sourceLength+=codeBytes;
+        segment.targetLength+=codeValues;
+        lookAhead+=codeBytes;
+    }
+    if (segment.sourceLength>0) {
+        segments.push_back(segment);
+    }
+}
+
+// Decodes one segment from findPbdSegments(); different segments may be decoded in parallel.
+void ImageLoaderBasic::decompressPbdSegment(PbdSegment& segment) {
+    if (loadDatatype==2) {
+        decompressPBD16(segment.source, segment.target, segment.sourceLength, segment.prior);
+    } else {
+        decompressPBD8(segment.source, segment.target, segment.sourceLength, segment.prior);
+    }
+}
+
+// Moves past the segments from findPbdSegments() once all of them are decoded.
+void ImageLoaderBasic::finishPbdSegments(const std::vector<PbdSegment>& segments) {
+    if (segments.empty()) {
+        return;
+    }
+    const PbdSegment& last=segments.back();
+    compressionPosition=last.source+last.sourceLength;
+    decompressionPosition=last.target+last.targetLength;
+    decompressionPrior=last.prior;
+}
+
 /* virtual */
 int ImageLoaderBasic::exitWithError(std::string errorMessage) {
   cerr << errorMessage << endl;
@@ -24,6 +24,17 @@ public:
 };
 
 
+// A run of whole PBD codes that can be decoded independently of its neighbors.
+struct PbdSegment
+{
+    unsigned char * source;
+    V3DLONG sourceLength;
+    unsigned char * target;
+    V3DLONG targetLength; // in bytes
+    int prior; // last decoded value, updated by decompressPbdSegment()
+};
+
+
 // Simple implementation of ImageLoader that uses no Qt.
 class ImageLoaderBasic
 {
@@ -60,8 +71,14 @@ public:
     int saveStack2RawPBD(const char * filename, ImagePixelType dataType, unsigned char* data, const V3DLONG * sz);
     virtual int loadRaw2StackPBD(DataStream& fileStream, V3DLONG fileSize, Image4DSimple * image, bool useThreading);
     virtual int loadRaw2StackPBD(const char * filename, Image4DSimple * image, bool useThreading);
-    V3DLONG decompressPBD8(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength);
-    V3DLONG decompressPBD16(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength);
+    V3DLONG decompressPBD8(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength) {
+        return decompressPBD8(sourceData, targetData, sourceLength, decompressionPrior);
+    }
+    V3DLONG decompressPBD16(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength) {
+        return decompressPBD16(sourceData, targetData, sourceLength, decompressionPrior);
+    }
+    V3DLONG decompressPBD8(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength, int& prior);
+    V3DLONG decompressPBD16(unsigned char * sourceData, unsigned char * targetData, V3DLONG sourceLength, int& prior);
     bool isCanceled() const {return bIsCanceled;}
 
 protected:
@@ -70,6 +87,9 @@ protected:
     V3DLONG compressPBD16(unsigned char * compressionBuffer, unsigned char * sourceBuffer, V3DLONG sourceBufferLength, V3DLONG spaceLeft);
     void updateCompressionBuffer8(unsigned char * updatedCompressionBuffer);
     void updateCompressionBuffer16(unsigned char * updatedCompressionBuffer);
+    void findPbdSegments(unsigned char * updatedCompressionBuffer, V3DLONG segmentBytes, std::vector<PbdSegment>& segments);
+    void decompressPbdSegment(PbdSegment& segment);
+    void finishPbdSegments(const std::vector<PbdSegment>& segments);
     virtual int exitWithError(std::string errorMessage);
     virtual int exitWithError(const char* errorMessage){
         // avoid stack overflow from infinite virtual recursion by specifying this class method
@@ -42,8 +42,11 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #include "../basic_c_fun/v3d_message.h"
 
 #include <QtDebug>
+#include <QHash>
+#include <QSet>
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <iostream>
@@ -113,6 +116,7 @@ bool V_NeuronSWC_list::reverse()
 		res = reverse_V_NeuronSWC_inplace(seg[i]);
 		if (!res)  break;
 	}
+	invalidateIndex();
 	// keep old segment number
 	if (oldnseg==1)
 	{
@@ -125,7 +129,7 @@ bool V_NeuronSWC_list::split(V3DLONG seg_id, V3DLONG nodeinseg_id)
 	bool res = false;
 	V_NeuronSWC_list new_slist = split_V_NeuronSWC_simplepath (seg.at(seg_id), nodeinseg_id);
 
-	if (!delete_seg_in_V_NeuronSWC_list(*this, seg_id))
+	if (!deleteSeg(seg_id))
 	{
 		printf("error in deleting seg (%d)", seg_id);
 		res = false;
@@ -139,6 +143,8 @@ bool V_NeuronSWC_list::split(V3DLONG seg_id, V3DLONG nodeinseg_id)
 }
 bool V_NeuronSWC_list::deleteSeg(V3DLONG seg_id)
 {
+	if (seg_id>=0 && seg_id<seg.size())
+		indexRemove(seg_id);
 	return delete_seg_in_V_NeuronSWC_list(*this, seg_id);
 }
 
@@ -157,7 +163,10 @@ void                                            // no value returned
     std::vector<V_NeuronSWC>::iterator iter = seg.begin();
     while (iter != seg.end())
         if (iter->to_be_deleted)
+        {
+            indexRemove(iter-seg.begin());
             iter = seg.erase(iter);
+        }
         else
            ++iter;
 
@@ -381,207 +390,167 @@ Link_Map get_link_map(const V_NeuronSWC & in_swc)
 			pnl.in_link.push_back(nid);
             pnl.nlink ++;
 			//cout << i << " " << nid << " " << parent << endl;
-        }else
-        {
-            bool single_node = true;
-            for (V3DLONG j=0; j<in_swc.row.size(); j++)
-            {
-                if(in_swc.row.at(j).parent == nid)
-                {
-                    single_node = false;
-                    break;
-                }
-            }
-            if(single_node)
-            {
-                Node_Link & nl = link_map[nid];
-                nl.out_link.push_back(nid);
-                nl.nlink ++;
-            }
         }
     }
+
+	// a root without child links to itself (single node); the in links of all nodes are known only now
+	for (V3DLONG i=0; i<in_swc.row.size(); i++)
+	{
+		if (in_swc.row.at(i).parent < 0)
+		{
+			Node_Link & nl = link_map[V3DLONG(in_swc.row.at(i).n)];
+			if (nl.in_link.empty())
+			{
+				nl.out_link.push_back(V3DLONG(in_swc.row.at(i).n));
+				nl.nlink ++;
+			}
+		}
+	}
 	
 	return link_map;
 }
 
-//091212 RZC
-vector <V_NeuronSWC> decompose_V_NeuronSWC(V_NeuronSWC & in_swc)
+// rows of an swc not yet put in a segment, in row order, and among them the possible start points of segments
+struct Remaining_Rows
 {
-	double duration;
-
-	vector<V3DLONG> indices;
-
-	// map swc's index --> vector's index & in/out link
-	Link_Map link_map = get_link_map(in_swc);
-	qDebug("link_map is created.");
+	vector<char> left;
+	vector<V3DLONG> next_start, prev_start;
+	V3DLONG n_left, first_left, first_start, last_start;
 
-	vector <V_NeuronSWC> out_swc_segs;
-	out_swc_segs.clear();
+	Remaining_Rows(V3DLONG n) : left(n, 1), next_start(n, -1), prev_start(n, -1), n_left(n), first_left(0), first_start(-1), last_start(-1) {}
 
-	// nchild as processed counter
-	//V_NeuronSWC inputSWC(in_swc);
-	for (V3DLONG i = 0; i < in_swc.row.size(); i++)
+	void add_start(V3DLONG i)
 	{
-		V_NeuronSWC_unit& cur_node = in_swc.row[i];
-		Node_Link & nodelink = link_map[V3DLONG(cur_node.n)];
-		cur_node.nchild = nodelink.nlink;
-		//qDebug("#%d nlink = %d, in %d, out %d", V3DLONG(cur_node.n), nodelink.nlink, nodelink.in_link.size(), nodelink.out_link.size());
-	
-		//if (cur_node.nchild >= 3) cout << cur_node.n << " " << i << endl;
-		indices.push_back(i);
+		prev_start[i] = last_start;
+		if (last_start >= 0) next_start[last_start] = i; else first_start = i;
+		last_start = i;
+	}
+	void remove(V3DLONG i)
+	{
+		if (!left[i]) return;
+		left[i] = 0;
+		n_left--;
+		if (first_start == i || prev_start[i] >= 0) // unlink a start point
+		{
+			if (prev_start[i] >= 0) next_start[prev_start[i]] = next_start[i]; else first_start = next_start[i];
+			if (next_start[i] >= 0) prev_start[next_start[i]] = prev_start[i];
+		}
+		while (first_left < V3DLONG(left.size()) && !left[first_left]) first_left++;
 	}
+};
 
-	clock_t timerStart = clock();
-	int rootCount = 0;
-	int branchCount = 0;
-	int branchID = 0;
-	size_t removedCount = 0;
-	bool halted = false;
-	for (;;)
+//091212 RZC
+//The links are counted as in get_link_map() (rows sharing a node id share them, a parent id not in the list makes
+//the node a root), but in arrays indexed by row, and the start points are taken from a list of the remaining
+//candidates in row order instead of rescanning all remaining rows for each segment: one sort, then linear.
+vector <V_NeuronSWC> decompose_V_NeuronSWC(V_NeuronSWC & in_swc)
+{
+	V3DLONG nrows = in_swc.row.size();
+
+	// node id --> last row with that id
+	vector< pair<V3DLONG,V3DLONG> > id_row(nrows);
+	for (V3DLONG i = 0; i < nrows; i++)
+		id_row[i] = make_pair(V3DLONG(in_swc.row[i].n), i);
+	sort(id_row.begin(), id_row.end());
+
+	vector<V3DLONG> link_row(nrows), parent_row(nrows, -1); // row holding the links of each row, row of its parent
+	for (V3DLONG k = nrows-1; k >= 0; k--)
+		link_row[id_row[k].second] = (k+1 < nrows && id_row[k+1].first == id_row[k].first) ? link_row[id_row[k+1].second] : id_row[k].second;
+	for (V3DLONG i = 0; i < nrows; i++)
 	{
-		if (indices.empty()) break;
+		double parent = in_swc.row[i].parent;
+		if (parent < 0) continue;
+		vector< pair<V3DLONG,V3DLONG> >::iterator it =
+			upper_bound(id_row.begin(), id_row.end(), make_pair(V3DLONG(parent), V3DLONG(nrows)));
+		if (it != id_row.begin() && (it-1)->first == V3DLONG(parent))
+			parent_row[i] = (it-1)->second;
+	}
 
-		// check is all nodes processed
-		/*V3DLONG n_removed = 0;
-		for (V3DLONG i = 0; i < in_swc.row.size(); ++i)
+	// in/out links
+	vector<V3DLONG> nlink(nrows, 0), n_in(nrows, 0), n_out(nrows, 0);
+	for (V3DLONG i = 0; i < nrows; i++)
+		if (parent_row[i] >= 0)
 		{
-			V_NeuronSWC_unit& cur_node = in_swc.row[i];
-			if (cur_node.nchild <=0) // is removed node ////// count down to 0   --> Use nchild to label whether or not the node has been processed.
-				n_removed ++;
-
-			//cout << "number of removed nodes: " << n_removed << endl;
+			nlink[link_row[i]]++;  n_out[link_row[i]]++;
+			nlink[parent_row[i]]++;  n_in[parent_row[i]]++;
 		}
-		if (n_removed >= in_swc.row.size())
+	for (V3DLONG i = 0; i < nrows; i++)
+		if (parent_row[i] < 0 && n_in[link_row[i]] == 0) // single node
 		{
-			//qDebug("split_V_NeuronSWC_segs is done.");
-			break; //over, all nodes have been labeled to remove
-		}*/
+			nlink[link_row[i]]++;  n_out[link_row[i]]++;
+		}
 
-		// find a tip/out-branch/pure-out point as start point
-		V3DLONG istart = -1;
-		V3DLONG n_left = 0;
-		V3DLONG i_left = -1;
-
-		clock_t searchStart = clock();
-		for (V3DLONG i = 0; i < indices.size(); i++)
-		{	
-			if (halted)
-			{
-				halted = false;
-				continue;
-			}
+	// nchild as processed counter
+	Remaining_Rows rows(nrows);
+	for (V3DLONG i = 0; i < nrows; i++)
+	{
+		in_swc.row[i].nchild = nlink[link_row[i]];
 
-			V_NeuronSWC_unit& cur_node = in_swc.row[indices[i]];
-			Node_Link& nodelink = link_map[V3DLONG(cur_node.n)];
+		V3DLONG nl = nlink[link_row[i]], nin = n_in[link_row[i]], nout = n_out[link_row[i]];
+		if ((nl ==1 && nin==0) // tip point (include single point)
+		 || (nl >2 && nout >0) // out-branch point
+		 || (nl ==2 && nin==0)) // pure-out point (root)
+			rows.add_start(i);
+	}
 
-			//if (cur_node.nchild <= 0)
-			//{	
-			//	cout << " -- processed node found, ID: " << cur_node.n << ", i = " << i << endl;
-			//	continue; //skip removed point
-			//}
+	vector <V_NeuronSWC> out_swc_segs;
+	out_swc_segs.clear();
 
-			n_left++; //left valid point
-			i_left = indices[i];
+	bool halted = false; // after stopping at a branch point left to finish, the first remaining row does not start the next segment
+	for (;;)
+	{
+		if (rows.n_left == 0) break;
 
-			if ((nodelink.nlink ==1 && nodelink.in_link.size()==0) // tip point (include single point)
-			 || (nodelink.nlink >2 && nodelink.out_link.size() >0) // out-branch point
-			 || (nodelink.nlink ==2 && nodelink.in_link.size()==0)) // pure-out point (root) <== MK: root or possible looping point??
-			{
-				istart = indices[i];
-				//cout << "starting index: " << istart << " nlink: " << nodelink.nlink << " in_link: " << nodelink.in_link.size() << " out_link: " << nodelink.out_link.size() << endl;
-				if (0)
-                    qDebug("start from #%d", V3DLONG(cur_node.n));
-				break; //find a start point
-			}
-		}
+		// find a tip/out-branch/pure-out point as start point
+		V3DLONG iskip = (halted) ? rows.first_left : -1;
+		halted = false;
+		V3DLONG istart = rows.first_start;
+		if (istart >= 0 && istart == iskip) istart = rows.next_start[istart];
 		if (istart < 0) //not find a start point
 		{
-			if (n_left)
-			{
-				qDebug("split_V_NeuronSWC_segs cann't find start point (left %d points)", n_left);
-				istart = i_left;
-				cout << " -- " << istart << endl;
-                continue;
-			}
-			else
-			{
-				qDebug("split_V_NeuronSWC_segs finished.");
-				break;
-			}
+			// only the skipped row is left (was dropped with its segment up to the parent before), or all left rows are on loops
+			if (rows.first_start < 0)
+				qDebug("split_V_NeuronSWC_segs cann't find start point (the SWC has loop link), start from #%d", V3DLONG(in_swc.row[rows.first_left].n));
+			istart = rows.first_left;
 		}
 
 		// extract a simple segment
 		V_NeuronSWC new_seg;
 		new_seg.clear();
-		//qDebug("decompose_V_NeuronSWC_segs: segment from node #%d", j);
 
-		duration = (clock() - searchStart) / double(CLOCKS_PER_SEC);
-		//cout << "Starting point search time: " << duration << endl;
-
-		clock_t segForm = clock();
-		V3DLONG inext = istart; // critical node -> inext starts from istart, which is the reason of node duplication.
+		V3DLONG inext = istart;
 		for (V3DLONG n = 1; inext >= 0; ++n)
 		{
 			V_NeuronSWC_unit& cur_node = in_swc.row[inext];
-			Node_Link& nodelink = link_map[V3DLONG(cur_node.n)];
-			//qDebug("	link #%d", V3DLONG(cur_node.n));
 
 			V_NeuronSWC_unit new_node = cur_node;
 			new_node.n = n;
-			new_node.parent = n + 1; // link order as original order ==> this is why in V_NeuronSWC the order is reversed
-			new_seg.row.push_back(new_node); // This is where all those critical nodes duplicate.
+			new_node.parent = n + 1; // link order as original order
+			new_seg.row.push_back(new_node);
 
-			if(cur_node.parent < 0)    // root point ////////////////////////////
+			if (parent_row[inext] < 0)    // root point ////////////////////////////
 			{
-				/*++rootCount;
-				++branchID;
-				new_seg.branchingProfile.isBranch = true;
-				new_seg.branchingProfile.paID = -1;
-				new_seg.branchingProfile.ID = branchID;
-				new_seg.branchingProfile.hierarchy = 1;
-				new_seg.branchingProfile.x = cur_node.x;
-				new_seg.branchingProfile.y = cur_node.y;
-				new_seg.branchingProfile.z = cur_node.z;
-				new_seg.branchingProfile.isBranch = true;*/
-				
-				//qDebug("decompose_V_NeuronSWC_segs: segment end at root #%d", V3DLONG(cur_node.n));
-				//cout << cur_node.n << " " << cur_node.nchild << " " << nodelink.in_link.size() << " " << nodelink.out_link.size() << endl;
 				--cur_node.nchild;
 				if (cur_node.nchild == 0)
 				{
-					//++removedCount;
-					indices.erase(find(indices.begin(), indices.end(), inext));
+					rows.remove(inext);
 					break; //over, a simple segment
 				}
 				else if (cur_node.nchild < 0)
 				{
-					//++removedCount;
 					break; //over, a simple segment
 				}
 			}
-			else if (n>1 && nodelink.nlink >2)  // branch point (in link_map) ///////////
+			else if (n>1 && nlink[link_row[inext]] >2)  // branch point ///////////
 			{
-				/*++branchCount;
-				++branchID;
-				new_seg.branchingProfile.isBranch = true;
-				new_seg.branchingProfile.x = cur_node.x;
-				new_seg.branchingProfile.y = cur_node.y;
-				new_seg.branchingProfile.z = cur_node.z;
-				new_seg.branchingProfile.ID = branchID;
-				new_seg.branchingProfile.isBranch = true;*/
-
-				//qDebug("decompose_V_NeuronSWC_segs: segment end at branch #%d", V3DLONG(cur_node.n));
-				//cout << cur_node.n << " " << cur_node.nchild << " " << nodelink.in_link.size() << " " << nodelink.out_link.size() << endl;
 				cur_node.nchild --;
 				if (cur_node.nchild == 0)
 				{
-					//++removedCount;
-					indices.erase(find(indices.begin(), indices.end(), inext));
+					rows.remove(inext);
 					break; //over, a simple segment
 				}
 				else if (cur_node.nchild < 0)
 				{
-					++removedCount;
 					break; //over, a simple segment
 				}
 				else if (cur_node.nchild > 0)
@@ -592,37 +561,25 @@ vector <V_NeuronSWC> decompose_V_NeuronSWC(V_NeuronSWC & in_swc)
 			}
 			else if (n>1 && inext==istart)  // i_left point (a loop) ///////////
 			{
-				//qDebug("decompose_V_NeuronSWC_segs: segment end at branch #%d", V3DLONG(cur_node.n));
-				//cout << inext << " " << cur_node.nchild << " " << nodelink.in_link.size() << " " << nodelink.out_link.size() << endl;
 				cur_node.nchild --;
 				if (cur_node.nchild == 0)
 				{
-					//++removedCount;
-					indices.erase(find(indices.begin(), indices.end(), inext));
+					rows.remove(inext);
 					break; //over, a simple segment
 				}
 				else if (cur_node.nchild < 0)
 				{
-					//++removedCount;
 					break; //over, a simple segment
 				}
 			}
 			else  //(nodelink.nlink==2)   // path node ///////////////////////////////////////////////
 			{
-				//qDebug("decompose_V_NeuronSWC_segs: node #%d", j);
-				//cout << inext << " " << cur_node.nchild << " " << nodelink.in_link.size() << " " << nodelink.out_link.size() << endl;		
-				cur_node.nchild = -1;  // label to remove	
-				//++removedCount;
-				//if (find(indices.begin(), indices.end(), inext) == indices.end()) cout << "missing inext: " << inext << endl;
-				//cout << "inext:" << inext << " ";
-				indices.erase(find(indices.begin(), indices.end(), inext));
-				V3DLONG parent = cur_node.parent;
-				//cout << "parent for inext:" << link_map[parent].i << endl;
-				inext = link_map[parent].i; //// next point in seg
+				if (n>1 && !rows.left[inext]) break; //already in a segment (only with duplicated node ids)
+				cur_node.nchild = -1;  // label to remove
+				rows.remove(inext);
+				inext = parent_row[inext]; //// next point in seg
 			}
 		}
-		duration = (clock() - segForm) / double(CLOCKS_PER_SEC);
-		//cout << "  -- segment forming time: " << duration << endl;
 
 		if (new_seg.row.size()>0)//>=2)//? single point
 		{
@@ -633,62 +590,6 @@ vector <V_NeuronSWC> decompose_V_NeuronSWC(V_NeuronSWC & in_swc)
 			out_swc_segs.push_back(new_seg);
 		}
 	}
-	cout << "	root point: " << rootCount << " || " << "branch point: " << branchCount << endl;
-	duration = (clock() - timerStart) / double(CLOCKS_PER_SEC);
-	cout << "Decompose time elapsed: " << duration << endl;
-
-	/*int curHi = 1;
-	bool allHiAssigned = false;
-	int hiCount = 0;
-	if (!out_swc_segs.empty())
-	{
-		while (!allHiAssigned)
-		{
-			for (vector<V_NeuronSWC>::iterator outSegIt = out_swc_segs.begin(); outSegIt != out_swc_segs.end(); ++outSegIt)
-			{
-				if (outSegIt->branchingProfile.hierarchy == curHi)
-				{
-					++hiCount;
-					int paHi = curHi;
-					int paID = outSegIt->branchingProfile.ID;
-					float chkX = outSegIt->row.begin()->x;
-					float chkY = outSegIt->row.begin()->y;
-					float chkZ = outSegIt->row.begin()->z;
-					for (vector<V_NeuronSWC>::iterator outSegIt2 = out_swc_segs.begin(); outSegIt2 != out_swc_segs.end(); ++outSegIt2)
-					{
-						if (outSegIt2->branchingProfile.x == chkX && outSegIt2->branchingProfile.y == chkY && outSegIt2->branchingProfile.z == chkZ)
-						{
-							outSegIt2->branchingProfile.paID = paID;
-							outSegIt2->branchingProfile.hierarchy = paHi + 1;
-
-							outSegIt->branchingProfile.childIDs.push_back(outSegIt2->branchingProfile.ID);
-						}
-					}
-				}
-			}
-			//cout << "hierarchy " << curHi << ": " << hiCount << endl;
-			++curHi;
-
-			for (vector<V_NeuronSWC>::iterator chkIt = out_swc_segs.begin(); chkIt != out_swc_segs.end(); ++chkIt)
-			{
-				if (chkIt->branchingProfile.hierarchy == 0)
-				{
-					allHiAssigned = false;
-					break;
-				}
-				else allHiAssigned = true;
-			}
-		}
-	}*/
-
-	/*size_t nodeCount = 0;
-	for (vector<V_NeuronSWC>::iterator it = out_swc_segs.begin(); it != out_swc_segs.end(); ++it)
-	{
-		nodeCount = nodeCount + it->row.size();
-		//cout << it->row.begin()->branchingProfile.ID << " " << it->row.begin()->branchingProfile.paID << " " << it->row.begin()->branchingProfile.hierarchy << " size: " << it->row.size() << endl;
-	}
-	cout << "Total node number after decompose: " << nodeCount << endl;*/
-
 	return out_swc_segs;
 }
 
@@ -852,22 +753,102 @@ V3DLONG find_node_in_V_NeuronSWC(V_NeuronSWC & in_swc, double x, double y, doubl
 
 V3DLONG find_seg_in_V_NeuronSWC_list(V_NeuronSWC_list & swc_list, double x, double y, double z, V3DLONG & nodeinseg_id) //find the id of a seg
 {
-	double eps = 1e-6;
-	bool b_found=false;
-	for (V3DLONG k=0;k<swc_list.seg.size();k++)
+	V3DLONG k = swc_list.findNode(x,y,z, nodeinseg_id);
+	if (k<0)
 	{
-		V3DLONG nodeinseg_id = find_node_in_V_NeuronSWC(swc_list.seg[k], x,y,z);
-		if (nodeinseg_id>=0)
-		{
-			b_found=true;
-			return k;
-		}
+		printf("can not find segment contained the coordinate");
 	}
-	if (!b_found)
+	return k;
+}
+
+//V_NeuronSWC_index:: ///////////////////////////////////////////
+
+V_NeuronSWC_index::Cell V_NeuronSWC_index::cell_of(double x, double y, double z)
+{
+	const double cell_size = 2e-6, max_cell = 1e18; //twice the default eps, find() looks into the 27 cells around
+	double c[3] = {floor(x/cell_size), floor(y/cell_size), floor(z/cell_size)};
+	for (int d=0; d<3; d++)
+		if (!(c[d] > -max_cell && c[d] < max_cell)) c[d] = (c[d]>0) ? max_cell : -max_cell; //far away or NaN
+	Cell cell;
+	cell.i = V3DLONG(c[0]);  cell.j = V3DLONG(c[1]);  cell.k = V3DLONG(c[2]);
+	return cell;
+}
+
+void V_NeuronSWC_index::clear()
+{
+	cells.clear();
+	handles.clear();
+	pos.clear();
+	row_cells.clear();
+	free_handles.clear();
+	built = false;
+}
+
+void V_NeuronSWC_index::build(const vector <V_NeuronSWC> & seg)
+{
+	clear();
+	built = true;
+	for (V3DLONG k=0; k<V3DLONG(seg.size()); k++)
+		add(seg[k]);
+}
+
+void V_NeuronSWC_index::add(const V_NeuronSWC & new_seg)
+{
+	V3DLONG h;
+	if (free_handles.empty()) {h = pos.size(); pos.push_back(-1); row_cells.push_back(vector <Cell>());}
+	else {h = free_handles.back(); free_handles.pop_back();}
+
+	pos[h] = handles.size();
+	handles.push_back(h);
+	vector <Cell> & rc = row_cells[h];
+	rc.resize(new_seg.row.size());
+	for (V3DLONG j=0; j<V3DLONG(rc.size()); j++)
 	{
-		printf("can not find segment contained the coordinate");
-		return -1;
+		rc[j] = cell_of(new_seg.row[j].x, new_seg.row[j].y, new_seg.row[j].z);
+		Node node = {h, j};
+		cells.insert(rc[j], node);
+	}
+}
+
+void V_NeuronSWC_index::remove(V3DLONG seg_id)
+{
+	V3DLONG h = handles[seg_id];
+	vector <Cell> & rc = row_cells[h];
+	for (V3DLONG j=0; j<V3DLONG(rc.size()); j++)
+	{
+		Node node = {h, j};
+		cells.remove(rc[j], node);
 	}
+	rc.clear();
+	pos[h] = -1;
+	free_handles.push_back(h);
+
+	handles.erase(handles.begin()+seg_id);
+	for (V3DLONG k=seg_id; k<V3DLONG(handles.size()); k++)
+		pos[handles[k]] = k;
+}
+
+V3DLONG V_NeuronSWC_index::find(const vector <V_NeuronSWC> & seg, double x, double y, double z, V3DLONG & nodeinseg_id, V3DLONG skip_seg, double eps) const
+{
+	V3DLONG best_k = -1, best_j = -1;
+	Cell c0 = cell_of(x,y,z);
+	for (int di=-1; di<=1; di++)
+		for (int dj=-1; dj<=1; dj++)
+			for (int dk=-1; dk<=1; dk++)
+			{
+				Cell c = {c0.i+di, c0.j+dj, c0.k+dk};
+				QMultiHash <Cell, Node>::const_iterator it = cells.find(c);
+				for (; it!=cells.end() && it.key()==c; ++it)
+				{
+					V3DLONG k = pos[it.value().handle], j = it.value().row;
+					if (k==skip_seg || k<0 || k>=V3DLONG(seg.size()) || j>=V3DLONG(seg[k].row.size())) continue;
+					const V_NeuronSWC_unit & node = seg[k].row[j]; //checked, in case a node was moved without invalidateIndex()
+					if (fabs(node.x-x)<eps && fabs(node.y-y)<eps && fabs(node.z-z)<eps)
+						if (best_k<0 || k<best_k || (k==best_k && j<best_j)) {best_k = k; best_j = j;} //the first one, as a scan
+				}
+			}
+	if (best_k>=0) nodeinseg_id = best_j;
+	return best_k;
 }
 
 //V3DLONG find_seg_num_in_V_NeuronSWC_list(V_NeuronSWC_list & swc_list, V3DLONG node_id) //find the id of a seg
@@ -957,7 +938,6 @@ double getLength_V_NeuronSWC(V_NeuronSWC & subject_swc) //compute the length of
 		if (subject_swc.row.at(i).data[6]>=0)
 		{
 			V3DLONG parent_row = sub_index_map[subject_swc.row.at(i).data[6]];
-			printf("now row = %d, parent row = %d ", i, parent_row);
 			double dx = subject_swc.row.at(i).data[2] - subject_swc.row.at(parent_row).data[2];
 			double dy = subject_swc.row.at(i).data[3] - subject_swc.row.at(parent_row).data[3];
 			double dz = subject_swc.row.at(i).data[4] - subject_swc.row.at(parent_row).data[4];
@@ -1214,6 +1194,47 @@ bool join_two_V_NeuronSWC_old(V_NeuronSWC & destination_swc, V_NeuronSWC & subje
 }
 
 
+static inline uint qHash(const V_NeuronSWC_coord & c)
+{
+	//equal coordinates must hash the same, so -0 is hashed as 0
+	uint h = 0;
+	for (int d=0; d<3; d++)
+	{
+		double v = c.data[d]+0.0;
+		quint64 bits;
+		memcpy(&bits, &v, sizeof(bits));
+		h = h*31 + qHash(bits);
+	}
+	return h;
+}
+
+//unique node coordinates of a swc in the order of appearance, and the index of each row's coordinate in them;
+//false if a coordinate is NaN (never equal to itself)
+static bool unique_V_NeuronSWC_ncoord(const V_NeuronSWC & in_swc, vector<V_NeuronSWC_coord> & unpos, vector<V3DLONG> & row_unid)
+{
+	QHash <V_NeuronSWC_coord, V3DLONG> unid_of_coord;
+	unid_of_coord.reserve(in_swc.row.size());
+	unpos.clear();
+	row_unid.resize(in_swc.row.size());
+	bool b_ok = true;
+	for (V3DLONG i=0; i<V3DLONG(in_swc.row.size()); i++)
+	{
+		V_NeuronSWC_coord c;
+		c.set(in_swc.row[i].x, in_swc.row[i].y, in_swc.row[i].z);
+		if (!(c==c)) b_ok = false;
+		QHash <V_NeuronSWC_coord, V3DLONG>::const_iterator it = unid_of_coord.constFind(c);
+		if (it!=unid_of_coord.constEnd())
+			row_unid[i] = it.value();
+		else
+		{
+			row_unid[i] = unpos.size();
+			unid_of_coord.insert(c, unpos.size());
+			unpos.push_back(c);
+		}
+	}
+	return b_ok;
+}
+
 bool join_two_V_NeuronSWC(V_NeuronSWC & destination_swc, V_NeuronSWC & subject_swc)
 {
 	if (subject_swc.nrows()<=0) {qDebug("subject_swc is empty in join_two_V_NeuronSWC()"); return false;}
@@ -1227,7 +1248,7 @@ bool join_two_V_NeuronSWC(V_NeuronSWC & destination_swc, V_NeuronSWC & subject_s
 	}
 
     //first just concatenate records
-	V_NeuronSWC_unit v, vp;
+	V_NeuronSWC_unit v;
 	V3DLONG i=0, j=0;
 
 	V3DLONG nr_des = destination_swc.nrows();
@@ -1240,97 +1261,76 @@ bool join_two_V_NeuronSWC(V_NeuronSWC & destination_swc, V_NeuronSWC & subject_s
 	}
     nr_des = destination_swc.nrows();
 
-	//then produce the adjacency matrix
-	vector<V_NeuronSWC_coord> unpos = destination_swc.unique_ncoord();
+	//then produce the adjacency lists, in flat arrays: the parents, radii and types of unique node i are
+	//pa[pa_start[i]..pa_start[i+1]) and r_t[rt_start[i]..rt_start[i+1]), in row order
+	vector<V_NeuronSWC_coord> unpos;
+	vector<V3DLONG> row_unid_lut;
+	if (!unique_V_NeuronSWC_ncoord(destination_swc, unpos, row_unid_lut))
+	{
+		v3d_msg("Indexing error! Check data in join_two_V_NeuronSWC.");
+		return false;
+	}
 	V3DLONG N = unpos.size();
 
-	map <V3DLONG, V3DLONG> nid_row_lut;
-	for (i=0; i<nr_des; i++) { nid_row_lut[destination_swc.row.at(i).n] = i; }
+	vector< pair<V3DLONG,V3DLONG> > nid_row(nr_des); //node id --> last row with that id, row 0 if not found
+	for (i=0; i<nr_des; i++) nid_row[i] = make_pair(V3DLONG(destination_swc.row.at(i).n), i);
+	sort(nid_row.begin(), nid_row.end());
 
-	map <V3DLONG, V3DLONG> row_unid_lut;
+	vector<V3DLONG> pa_start(N+1, 0), rt_start(N+1, 0);
 	for (i=0; i<nr_des; i++)
 	{
-		V_NeuronSWC_coord c = destination_swc.row.at(i).get_coord();
-		V3DLONG ic = value_in_vector(unpos, c);
-		if (ic<0)
-		{
-			v3d_msg("Indexing error! Check data in join_two_V_NeuronSWC.");
-			return false;
-		}
-		row_unid_lut[i] = ic;
+		if (destination_swc.row.at(i).parent>=0) pa_start[row_unid_lut[i]+1]++;
+		rt_start[row_unid_lut[i]+1]++;
 	}
+	for (i=0; i<N; i++) {pa_start[i+1] += pa_start[i]; rt_start[i+1] += rt_start[i];}
 
-	vector < vector <V3DLONG> > adjm;
-	vector <V3DLONG> plist;
-	for (i=0; i<N; i++) adjm.push_back(plist); //initialize as empty
-
-	vector < vector <float> > adjm_radius;
-	vector <float> tmpr;
-	for (i=0; i<N; i++) adjm_radius.push_back(tmpr); //initialize as empty
-
-    vector < vector <float> > adjm_type;
-    vector <float> tmpt;
-	for (i=0; i<N; i++) adjm_type.push_back(tmpt); //initialize as empty
-
+	vector<V3DLONG> pa(pa_start[N]), pa_end(pa_start.begin(), pa_start.end()-1);
+	vector< pair<float,float> > r_t(rt_start[N]); //radius, type
+	vector<V3DLONG> rt_end(rt_start.begin(), rt_start.end()-1);
 	for (i=0; i<nr_des; i++)
 	{
-        v = destination_swc.row.at(i);
-        V3DLONG iv = row_unid_lut[i];
+		const V_NeuronSWC_unit & v = destination_swc.row.at(i);
+		V3DLONG iv = row_unid_lut[i];
 
 		if (v.parent>=0)
 		{
-			vp = destination_swc.row.at(nid_row_lut[v.parent]);
-			V3DLONG ip =  row_unid_lut[nid_row_lut[v.parent]];
-			adjm.at(iv).push_back(ip); //add it anyway, will find unique one later. Indeed even unnecessary to find the unique ones, because the repeated record will merge automatically
-			adjm_radius.at(iv).push_back(float(v.r));
-            adjm_type.at(iv).push_back(float(v.type));
-			//need to record neuron edge type and radius as well later
+			vector< pair<V3DLONG,V3DLONG> >::iterator it =
+				upper_bound(nid_row.begin(), nid_row.end(), make_pair(V3DLONG(v.parent), V3DLONG(nr_des)));
+			V3DLONG prow = (it!=nid_row.begin() && (it-1)->first==V3DLONG(v.parent)) ? (it-1)->second : 0;
+			pa[pa_end[iv]++] = row_unid_lut[prow]; //add it anyway, the repeated record will merge automatically
 		}
-		else
-		{
-			//do nothing about the parent, i.e. this is a root for this record, and thus do not add to the parent list at all
-			//but still update type and radius
-			adjm_radius.at(iv).push_back(float(v.r));
-            adjm_type.at(iv).push_back(float(v.type));
-        }
+		//for a root, do not add to the parent list at all, but still update type and radius
+		r_t[rt_end[iv]++] = make_pair(float(v.r), float(v.type));
 	}
 
-	//no need to find unique ones
-
 	//then re-produce a new swc
 	V_NeuronSWC newswc = destination_swc; newswc.row.clear();
+	newswc.row.reserve(max(N, pa_start[N]));
 	for (i=0;i<N;i++)
 	{
-		vector <V3DLONG> & cur_pa = adjm.at(i);
-		vector <float> & cur_r = adjm_radius.at(i);
-        vector <float> & cur_t = adjm_type.at(i);
-		V_NeuronSWC_coord & cur_coord = unpos.at(i);
+		const V_NeuronSWC_coord & cur_coord = unpos.at(i);
+		v.x = cur_coord.x;
+		v.y = cur_coord.y;
+		v.z = cur_coord.z;
+		v.n = i;
 
-		if (cur_pa.size()<=0) //a root
+		if (pa_start[i]==pa_start[i+1]) //a root
 		{
-			v.n = i;
-            v.type = double(cur_t.back()); //direct use the last one, which means the later one overwrite the first one
-			v.x = cur_coord.x;
-			v.y = cur_coord.y;
-			v.z = cur_coord.z;
-			v.r = cur_r.back(); //direct use the last one, which means the later one overwrite the first one
+			v.type = double(r_t[rt_start[i+1]-1].second); //direct use the last one, which means the later one overwrite the first one
+			v.r = r_t[rt_start[i+1]-1].first;
 			v.parent = -1;
 			newswc.append(v);
 		}
 		else
 		{
-			for (j=0;j<cur_pa.size();j++)
+			for (j=0; j<pa_start[i+1]-pa_start[i]; j++)
 			{
-				v.n = i;
-                v.type = double(cur_t.at(j)); //allow he later one overwrite the earlier one(s) if there are redundant records
-				v.x = cur_coord.x;
-				v.y = cur_coord.y;
-				v.z = cur_coord.z;
-				v.r = cur_r.at(j); //so I allow the later one overwrite the earlier one(s) if there are redundant records
-				v.parent = cur_pa.at(j);
+				v.type = double(r_t.at(rt_start[i]+j).second); //allow he later one overwrite the earlier one(s) if there are redundant records
+				v.r = r_t.at(rt_start[i]+j).first;
+				v.parent = pa[pa_start[i]+j];
 				newswc.append(v);
 			}
-        }
+		}
 	}
 
 
@@ -1409,12 +1409,15 @@ V_SWCNodes V_NeuronSWC::unique_nodes_info()
 vector<V3DLONG> V_NeuronSWC::unique_nid()
 {
 	vector<V3DLONG> res;	if (row.size()<1) return res;
-	res.push_back(row.at(0).n);
-	for (V3DLONG i=1;i<row.size();i++)
+	QSet<V3DLONG> found;
+	for (V3DLONG i=0;i<row.size();i++)
 	{
 		V3DLONG cur_nid = V3DLONG(row.at(i).n);
-		if (value_in_vector(res, cur_nid)<0)
+		if (!found.contains(cur_nid))
+		{
+			found.insert(cur_nid);
 			res.push_back(cur_nid);
+		}
 	}
 	return res;
 }
@@ -1427,15 +1430,9 @@ V3DLONG V_NeuronSWC::n_unique_nid()
 
 vector<V_NeuronSWC_coord> V_NeuronSWC::unique_ncoord()
 {
-	vector<V_NeuronSWC_coord> res;	if (row.size()<1) return res;
-	V_NeuronSWC_coord cur_coord; cur_coord.set(row.at(0).x, row.at(0).y, row.at(0).z);
-	res.push_back(cur_coord);
-	for (V3DLONG i=1;i<row.size();i++)
-	{
-		cur_coord.set(row.at(i).x, row.at(i).y, row.at(i).z);
-		if (value_in_vector(res, cur_coord)<0)
-			res.push_back(cur_coord);
-	}
+	vector<V_NeuronSWC_coord> res;
+	vector<V3DLONG> row_unid;
+	unique_V_NeuronSWC_ncoord(*this, res, row_unid);
 	return res;
 }
 
@@ -1447,3 +1444,118 @@ V3DLONG V_NeuronSWC::n_unique_ncoord()
 
 
 
+//////////////////////////////////////////////////////
+// undo/redo history with shared segments
+
+static bool same_V_BranchUnit(const V_BranchUnit & a, const V_BranchUnit & b)
+{
+	return a.isBranch==b.isBranch && a.x==b.x && a.y==b.y && a.z==b.z && a.ID==b.ID && a.paID==b.paID &&
+		a.hierarchy==b.hierarchy && a.childIDs==b.childIDs && a.segLoc==b.segLoc && a.segPaLoc==b.segPaLoc &&
+		a.childSegLocs==b.childSegLocs;
+}
+
+static bool same_V_NeuronSWC(const V_NeuronSWC & a, const V_NeuronSWC & b)
+{
+	if (a.row.size()!=b.row.size()) return false;
+	if (!a.row.empty() && memcmp(&a.row[0], &b.row[0], a.row.size()*sizeof(V_NeuronSWC_unit))!=0) return false;
+	return a.b_linegraph==b.b_linegraph && a.b_jointed==b.b_jointed && a.to_be_deleted==b.to_be_deleted &&
+		a.to_be_broken==b.to_be_broken && a.on==b.on && memcmp(a.color_uc, b.color_uc, 4)==0 &&
+		a.name==b.name && a.comment==b.comment && a.file==b.file &&
+		same_V_BranchUnit(a.branchingProfile, b.branchingProfile);
+}
+
+// cheap key to find a moved segment in the previous snapshot: node count and the first/last node
+static quint64 key_V_NeuronSWC(const V_NeuronSWC & seg)
+{
+	quint64 h = 1469598103934665603ULL ^ quint64(seg.row.size());
+	if (!seg.row.empty())
+	{
+		const unsigned char * p[2] = {(const unsigned char *)&seg.row.front(), (const unsigned char *)&seg.row.back()};
+		for (int k=0; k<2; k++)
+			for (size_t i=0; i<sizeof(V_NeuronSWC_unit); i++)
+				h = (h ^ p[k][i]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+void V_NeuronSWC_history::append(const V_NeuronSWC_list & swc_list)
+{
+	Snapshot s;
+	s.last_seg_num = swc_list.last_seg_num;
+	s.name = swc_list.name;
+	s.comment = swc_list.comment;
+	s.file = swc_list.file;
+	memcpy(s.color_uc, swc_list.color_uc, 4);
+	s.b_traced = swc_list.b_traced;
+	s.seg.reserve(swc_list.seg.size());
+
+	const Snapshot * last = (snapshots.isEmpty())? 0 : &snapshots.last();
+	multimap <quint64, V3DLONG> moved; // built only when a segment is not found at its old position
+	bool b_moved = false;
+	for (V3DLONG i=0; i<(V3DLONG)swc_list.seg.size(); i++)
+	{
+		const V_NeuronSWC & cur = swc_list.seg[i];
+		SegPtr shared;
+		if (last && i<(V3DLONG)last->seg.size() && same_V_NeuronSWC(cur, *last->seg[i]))
+			shared = last->seg[i];
+		else if (last)
+		{
+			if (!b_moved)
+			{
+				for (V3DLONG j=0; j<(V3DLONG)last->seg.size(); j++)
+					moved.insert(make_pair(key_V_NeuronSWC(*last->seg[j]), j));
+				b_moved = true;
+			}
+			pair <multimap<quint64, V3DLONG>::iterator, multimap<quint64, V3DLONG>::iterator> r = moved.equal_range(key_V_NeuronSWC(cur));
+			for (multimap<quint64, V3DLONG>::iterator it=r.first; it!=r.second; ++it)
+				if (same_V_NeuronSWC(cur, *last->seg[it->second]))
+				{
+					shared = last->seg[it->second];
+					break;
+				}
+		}
+		if (shared.isNull())
+			shared = SegPtr(new V_NeuronSWC(cur));
+		s.seg.push_back(shared);
+	}
+	snapshots.append(s);
+}
+
+void V_NeuronSWC_history::restore(int i, V_NeuronSWC_list & swc_list, int current) const
+{
+	if (i<0 || i>=snapshots.size()) return;
+	const Snapshot & s = snapshots.at(i);
+
+	// a segment of swc_list can be reused only if it still equals its segment of snapshot current,
+	// swc_list may have been edited since then, so every segment is compared (cheaper than a copy)
+	map <const V_NeuronSWC *, V3DLONG> reusable;
+	if (current>=0 && current<snapshots.size())
+	{
+		const Snapshot & c = snapshots.at(current);
+		for (V3DLONG k=0; k<(V3DLONG)c.seg.size() && k<(V3DLONG)swc_list.seg.size(); k++)
+			if (same_V_NeuronSWC(*c.seg[k], swc_list.seg[k]))
+				reusable.insert(make_pair(c.seg[k].data(), k));
+	}
+
+	vector <V_NeuronSWC> seg(s.seg.size());
+	for (V3DLONG k=0; k<(V3DLONG)s.seg.size(); k++)
+	{
+		map <const V_NeuronSWC *, V3DLONG>::iterator it = reusable.find(s.seg[k].data());
+		if (it!=reusable.end())
+		{
+			std::swap(seg[k], swc_list.seg[it->second]); // unchanged segment, no copy
+			reusable.erase(it);
+		}
+		else
+			seg[k] = *s.seg[k];
+	}
+	swc_list.seg.swap(seg);
+	swc_list.invalidateIndex();
+	swc_list.last_seg_num = s.last_seg_num;
+	swc_list.name = s.name;
+	swc_list.comment = s.comment;
+	swc_list.file = s.file;
+	memcpy(swc_list.color_uc, s.color_uc, 4);
+	swc_list.b_traced = s.b_traced;
+}
+
@@ -42,6 +42,9 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #include <vector>
 #include <string>
 #include <map>
+#include <QList>
+#include <QSharedPointer>
+#include <QHash>
 using namespace std;
 
 struct V_NeuronSWC_coord    //for sort
@@ -147,6 +150,7 @@ struct V_NeuronSWC
     bool to_be_deleted;   // @ADDED by Alessandro on 2015-05-08. Needed to support late delete of multiple neuron segments.
     bool to_be_broken;
 	bool on; //Added by Y. Wang on 2016-05-25. For the segment-wise display of a SWC.
+	unsigned int collaboration_id; // the ID of the segment in the binary messages of a collaboration session (V3dR_Communicator), 0 until it is sent
 
 	bool check_data_consistency() {/* to verify if unique node id have unique coord, and if parent are in the nid, except -1*/ return true;}
 
@@ -156,6 +160,7 @@ struct V_NeuronSWC
         to_be_deleted = false;
         to_be_broken = false;
 		on = true;
+		collaboration_id = 0;
 	}
 
 	V_BranchUnit branchingProfile;
@@ -225,6 +230,53 @@ struct V_NeuronSWC
 	vector <V3DLONG> getAllIndexof3DPos(const V_NeuronSWC_unit * subject_node, V3DLONG noninclude_ind) {return getAllIndexof3DPos(subject_node->data[2], subject_node->data[3], subject_node->data[4], noninclude_ind);}
 };
 
+// Coordinate lookup of the nodes of the segments of a V_NeuronSWC_list, see V_NeuronSWC_list::findNode().
+// The list mutators (append, clear, deleteSeg, deleteMultiSeg, split, merge, decompose, reverse) keep it in sync
+// at the cost of the rows they add or remove, plus one position per segment after an erased one. Code changing
+// seg[] or moving nodes directly calls V_NeuronSWC_list::invalidateIndex(), and the index is built again at the
+// next lookup, as it is when the number of segments no longer matches. A copy starts empty.
+class V_NeuronSWC_index
+{
+public:
+	V_NeuronSWC_index() {built=false;}
+	V_NeuronSWC_index(const V_NeuronSWC_index &) {built=false;}
+	V_NeuronSWC_index & operator=(const V_NeuronSWC_index &) {clear(); return *this;}
+
+	bool isBuilt(V3DLONG nsegs) const {return built && V3DLONG(handles.size())==nsegs;}
+	void clear();
+	void build(const vector <V_NeuronSWC> & seg);
+	void add(const V_NeuronSWC & new_seg); //appended to the list
+	void remove(V3DLONG seg_id);           //about to be erased from the list
+	//first (seg, node) within eps of (x,y,z) in each coordinate, skipping segment skip_seg; -1 if none
+	V3DLONG find(const vector <V_NeuronSWC> & seg, double x, double y, double z, V3DLONG & nodeinseg_id, V3DLONG skip_seg=-1, double eps=1e-6) const;
+
+	struct Cell
+	{
+		V3DLONG i, j, k;
+		bool operator == (const Cell & c) const {return i==c.i && j==c.j && k==c.k;}
+	};
+	struct Node
+	{
+		V3DLONG handle, row; //the handle of a segment stays the same while it moves in the list
+		bool operator == (const Node & n) const {return handle==n.handle && row==n.row;}
+	};
+
+private:
+	QMultiHash <Cell, Node> cells;
+	vector <V3DLONG> handles;            //of seg[k]
+	vector <V3DLONG> pos;                //of a handle in the list, -1 when free
+	vector < vector <Cell> > row_cells;  //of the rows of a handle
+	vector <V3DLONG> free_handles;
+	bool built;
+
+	static Cell cell_of(double x, double y, double z);
+};
+
+inline uint qHash(const V_NeuronSWC_index::Cell & c)
+{
+	return uint(c.i*73856093 ^ c.j*19349663 ^ c.k*83492791);
+}
+
 struct V_NeuronSWC_list
 {
 	vector <V_NeuronSWC> seg; //since each seg could be a complete neuron or multiple paths, thus I call it "seg", but not "path"
@@ -245,9 +297,9 @@ struct V_NeuronSWC_list
 	}
 	bool isJointed() {return nsegs()==1 && seg.at(0).b_jointed;}
 
-	void append(V_NeuronSWC & new_seg) {seg.push_back(new_seg); last_seg_num=seg.size();}
-        void append(vector <V_NeuronSWC> & new_segs) {for (int k=0; k<(int)new_segs.size(); k++) seg.push_back(new_segs.at(k)); last_seg_num=seg.size();}
-	void clear() {last_seg_num=seg.size(); seg.clear();}
+	void append(V_NeuronSWC & new_seg) {indexAdd(new_seg); seg.push_back(new_seg); last_seg_num=seg.size();}
+        void append(vector <V_NeuronSWC> & new_segs) {for (int k=0; k<(int)new_segs.size(); k++) {indexAdd(new_segs.at(k)); seg.push_back(new_segs.at(k));} last_seg_num=seg.size();}
+	void clear() {last_seg_num=seg.size(); seg.clear(); nodeIndex.build(seg);}
 	void merge();
 	void decompose();
 	bool reverse();
@@ -258,6 +310,46 @@ struct V_NeuronSWC_list
     void                                            // no value returned
         deleteMultiSeg(                             // by default, deletes neuron segments having 'to_be_deleted' field set to 'true'
             std::vector <V3DLONG> *seg_ids = 0);    // if provided, deletes the corresponding neuron segments.
+
+	V3DLONG findNode(double x, double y, double z, V3DLONG & nodeinseg_id, V3DLONG skip_seg=-1) //the first seg with a node at (x,y,z), -1 if none
+	{
+		if (!nodeIndex.isBuilt(seg.size())) nodeIndex.build(seg);
+		return nodeIndex.find(seg, x, y, z, nodeinseg_id, skip_seg);
+	}
+	void invalidateIndex() {nodeIndex.clear();}
+
+private:
+	V_NeuronSWC_index nodeIndex;
+	void indexAdd(const V_NeuronSWC & new_seg) {if (nodeIndex.isBuilt(seg.size())) nodeIndex.add(new_seg); else nodeIndex.clear();}
+	void indexRemove(V3DLONG seg_id) {if (nodeIndex.isBuilt(seg.size())) nodeIndex.remove(seg_id); else nodeIndex.clear();}
+};
+
+// Undo/redo history of a V_NeuronSWC_list. Snapshots share the segments that did not change between them,
+// so appending or restoring a snapshot copies only the changed segments.
+class V_NeuronSWC_history
+{
+public:
+	int size() const {return snapshots.size();}
+	bool isEmpty() const {return snapshots.isEmpty();}
+	void clear() {snapshots.clear();}
+	void removeFirst() {if (!snapshots.isEmpty()) snapshots.removeFirst();}
+	void removeFrom(int i) {while (snapshots.size()>i && snapshots.size()>0) snapshots.removeLast();} //drop snapshots i, i+1, ...
+
+	void append(const V_NeuronSWC_list & swc_list); //unchanged segments are shared with the last snapshot
+	void restore(int i, V_NeuronSWC_list & swc_list, int current=-1) const; //segments of swc_list still equal to their snapshot current segment are moved, not copied
+	V_NeuronSWC_list at(int i) const {V_NeuronSWC_list swc_list; restore(i, swc_list); return swc_list;}
+
+private:
+	typedef QSharedPointer<const V_NeuronSWC> SegPtr;
+	struct Snapshot
+	{
+		vector <SegPtr> seg;
+		V3DLONG last_seg_num;
+		string name, comment, file;
+		unsigned char color_uc[4];
+		bool b_traced;
+	};
+	QList <Snapshot> snapshots;
 };
 
 bool verifyIsLineGraph(const V_NeuronSWC & in_swc); //this will use graph algorithm to verify if really a line graph as claimed
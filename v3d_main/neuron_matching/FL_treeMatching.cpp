@@ -42,7 +42,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 
 #include "FL_treeMatching.h"
 #include "mymatrix.cpp"
-#include "munkres.cpp"
+#include "lap.cpp"
 #include "./combination/combination.h" 
 using namespace std;
 using namespace stdcomb;
@@ -2290,7 +2290,7 @@ bool treeMatching_leafNodes(swcTree *Tree1, swcTree *Tree2, float *parentVector1
 		}
 		
 		
-		Munkres branchMatch;
+		LinearAssignment branchMatch;
 		branchMatch.solve(bpMatrixOut); 
 		
 //		printf("print bpMatrixOut\n");
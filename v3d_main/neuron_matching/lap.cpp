@@ -0,0 +1,266 @@
+/*
+ * Copyright (c)2006-2010  Hanchuan Peng (Janelia Farm, Howard Hughes Medical Institute).  
+ * All rights reserved.
+ */
+
+
+/************
+                                            ********* LICENSE NOTICE ************
+
+This folder contains all source codes for the V3D project, which is subject to the following conditions if you want to use it. 
+
+You will ***have to agree*** the following terms, *before* downloading/using/running/editing/changing any portion of codes in this package.
+
+1. This package is free for non-profit research, but needs a special license for any commercial purpose. Please contact Hanchuan Peng for details.
+
+2. You agree to appropriately cite this work in your related studies and publications.
+
+Peng, H., Ruan, Z., Long, F., Simpson, J.H., and Myers, E.W. (2010) “V3D enables real-time 3D visualization and quantitative analysis of large-scale biological image data sets,” Nature Biotechnology, Vol. 28, No. 4, pp. 348-353, DOI: 10.1038/nbt.1612. ( http://penglab.janelia.org/papersall/docpdf/2010_NBT_V3D.pdf )
+
+Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstruction of 3D neuron structures using a graph-augmented deformable model,” Bioinformatics, Vol. 26, pp. i38-i46, 2010. ( http://penglab.janelia.org/papersall/docpdf/2010_Bioinfo_GD_ISMB2010.pdf )
+
+3. This software is provided by the copyright holders (Hanchuan Peng), Howard Hughes Medical Institute, Janelia Farm Research Campus, and contributors "as is" and any express or implied warranties, including, but not limited to, any implied warranties of merchantability, non-infringement, or fitness for a particular purpose are disclaimed. In no event shall the copyright owner, Howard Hughes Medical Institute, Janelia Farm Research Campus, or contributors be liable for any direct, indirect, incidental, special, exemplary, or consequential damages (including, but not limited to, procurement of substitute goods or services; loss of use, data, or profits; reasonable royalties; or business interruption) however caused and on any theory of liability, whether in contract, strict liability, or tort (including negligence or otherwise) arising in any way out of the use of this software, even if advised of the possibility of such damage.
+
+4. Neither the name of the Howard Hughes Medical Institute, Janelia Farm Research Campus, nor Hanchuan Peng, may be used to endorse or promote products derived from this software without specific prior written permission.
+
+*************/
+
+
+
+// lap.cpp - linear assignment by shortest augmenting paths
+//
+// Each free row is added in turn by a Dijkstra-like search over reduced costs
+// c(i,j) - u(i) - v(j), keeping the row/column potentials dual feasible, so every
+// augmentation costs O(rows*cols) and the whole problem O(n^3) on contiguous storage.
+
+#include "lap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const double LAP_INF = std::numeric_limits<double>::max();
+
+void
+LinearAssignment::reset(int rows, int cols) {
+	u.assign(rows, 0);
+	v.assign(cols+1, 0);          // last column is the virtual start of each search
+	colOwner.assign(cols+1, -1);
+	way.assign(cols+1, -1);
+	minv.resize(cols+1);
+	used.resize(cols+1);
+	usedList.reserve(cols+1);
+}
+
+bool
+LinearAssignment::augmentDense(const double *costs, int cols, int row) {
+	int j0 = cols;
+	colOwner[j0] = row;
+	minv.assign(cols+1, LAP_INF);
+	used.assign(cols+1, 0);
+	usedList.clear();
+
+	do {
+		used[j0] = 1;
+		usedList.push_back(j0);
+		int i0 = colOwner[j0];
+		const double *crow = costs + (size_t)i0 * cols;
+		double ui0 = u[i0];
+		double delta = LAP_INF;
+		int j1 = -1;
+		for ( int j = 0 ; j < cols ; j++ ) {
+			if ( used[j] )
+				continue;
+			double cur = crow[j] - ui0 - v[j];
+			if ( cur < minv[j] ) {
+				minv[j] = cur;
+				way[j] = j0;
+			}
+			if ( minv[j] < delta ) {
+				delta = minv[j];
+				j1 = j;
+			}
+		}
+		if ( j1 < 0 ) {
+			colOwner[cols] = -1;
+			return false;
+		}
+		for ( size_t k = 0 ; k < usedList.size() ; k++ ) {
+			int j = usedList[k];
+			u[colOwner[j]] += delta;
+			v[j] -= delta;
+		}
+		for ( int j = 0 ; j < cols ; j++ )
+			if ( !used[j] )
+				minv[j] -= delta;
+		j0 = j1;
+	} while ( colOwner[j0] != -1 );
+
+	// flip the alternating path back to the virtual column
+	do {
+		int j1 = way[j0];
+		colOwner[j0] = colOwner[j1];
+		j0 = j1;
+	} while ( j0 != cols );
+	colOwner[cols] = -1;
+	return true;
+}
+
+bool
+LinearAssignment::augmentSparse(const std::vector<int> &rowStart, const std::vector<int> &colIndex,
+                                const std::vector<double> &cost, int row) {
+	int cols = (int)v.size() - 1;
+	int j0 = cols;
+	colOwner[j0] = row;
+	minv.assign(cols+1, LAP_INF);
+	used.assign(cols+1, 0);
+	usedList.clear();
+
+	do {
+		used[j0] = 1;
+		usedList.push_back(j0);
+		int i0 = colOwner[j0];
+		double ui0 = u[i0];
+		for ( int k = rowStart[i0] ; k < rowStart[i0+1] ; k++ ) {
+			int j = colIndex[k];
+			if ( used[j] )
+				continue;
+			double cur = cost[k] - ui0 - v[j];
+			if ( cur < minv[j] ) {
+				minv[j] = cur;
+				way[j] = j0;
+			}
+		}
+		double delta = LAP_INF;
+		int j1 = -1;
+		for ( int j = 0 ; j < cols ; j++ )
+			if ( !used[j] && minv[j] < delta ) {
+				delta = minv[j];
+				j1 = j;
+			}
+		if ( j1 < 0 ) {
+			colOwner[cols] = -1; // no augmenting path: leave this row unassigned
+			return false;
+		}
+		for ( size_t k = 0 ; k < usedList.size() ; k++ ) {
+			int j = usedList[k];
+			u[colOwner[j]] += delta;
+			v[j] -= delta;
+		}
+		for ( int j = 0 ; j < cols ; j++ )
+			if ( !used[j] && minv[j] != LAP_INF )
+				minv[j] -= delta;
+		j0 = j1;
+	} while ( colOwner[j0] != -1 );
+
+	do {
+		int j1 = way[j0];
+		colOwner[j0] = colOwner[j1];
+		j0 = j1;
+	} while ( j0 != cols );
+	colOwner[cols] = -1;
+	return true;
+}
+
+double
+LinearAssignment::solve(const double *costs, int rows, int cols, std::vector<int> &rowAssignment) {
+	rowAssignment.assign(rows, -1);
+	if ( rows <= 0 || cols <= 0 )
+		return 0;
+
+	if ( rows > cols ) {
+		// the search needs at least as many columns as rows: solve the transpose
+		std::vector<double> transposed((size_t)rows * cols);
+		for ( int r = 0 ; r < rows ; r++ )
+			for ( int c = 0 ; c < cols ; c++ )
+				transposed[(size_t)c * rows + r] = costs[(size_t)r * cols + c];
+		std::vector<int> colAssignment;
+		solve(&transposed[0], cols, rows, colAssignment);
+		double total = 0;
+		for ( int c = 0 ; c < cols ; c++ )
+			if ( colAssignment[c] >= 0 ) {
+				rowAssignment[colAssignment[c]] = c;
+				total += costs[(size_t)colAssignment[c] * cols + c];
+			}
+		return total;
+	}
+
+	reset(rows, cols);
+	for ( int r = 0 ; r < rows ; r++ )
+		augmentDense(costs, cols, r);
+
+	double total = 0;
+	for ( int c = 0 ; c < cols ; c++ )
+		if ( colOwner[c] >= 0 ) {
+			rowAssignment[colOwner[c]] = c;
+			total += costs[(size_t)colOwner[c] * cols + c];
+		}
+	return total;
+}
+
+double
+LinearAssignment::solveSparse(int rows, int cols,
+                              const std::vector<int> &rowStart,
+                              const std::vector<int> &colIndex,
+                              const std::vector<double> &cost,
+                              std::vector<int> &rowAssignment) {
+	rowAssignment.assign(rows, -1);
+	if ( rows <= 0 || cols <= 0 )
+		return 0;
+
+	// Give every row a private fallback column priced above any complete real assignment,
+	// so the search always succeeds and prefers maximum cardinality, then minimum cost.
+	double maxAbs = 0;
+	for ( size_t k = 0 ; k < cost.size() ; k++ )
+		maxAbs = std::max(maxAbs, std::fabs(cost[k]));
+	double fallbackCost = (2*maxAbs + 1) * (std::min(rows, cols) + 1);
+
+	std::vector<int> augStart(rows+1, 0);
+	std::vector<int> augIndex;
+	std::vector<double> augCost;
+	augIndex.reserve(colIndex.size() + rows);
+	augCost.reserve(cost.size() + rows);
+	for ( int r = 0 ; r < rows ; r++ ) {
+		for ( int k = rowStart[r] ; k < rowStart[r+1] ; k++ ) {
+			augIndex.push_back(colIndex[k]);
+			augCost.push_back(cost[k]);
+		}
+		augIndex.push_back(cols + r);
+		augCost.push_back(fallbackCost);
+		augStart[r+1] = (int)augIndex.size();
+	}
+
+	reset(rows, cols + rows);
+	for ( int r = 0 ; r < rows ; r++ )
+		augmentSparse(augStart, augIndex, augCost, r);
+
+	for ( int c = 0 ; c < cols ; c++ ) // fallback columns leave their rows unassigned
+		if ( colOwner[c] >= 0 )
+			rowAssignment[colOwner[c]] = c;
+
+	double total = 0;
+	for ( int r = 0 ; r < rows ; r++ )
+		if ( rowAssignment[r] >= 0 )
+			for ( int k = rowStart[r] ; k < rowStart[r+1] ; k++ )
+				if ( colIndex[k] == rowAssignment[r] ) {
+					total += cost[k];
+					break;
+				}
+	return total;
+}
+
+void
+LinearAssignment::solve(Matrix<double> &m) {
+	int rows = m.rows(), cols = m.columns();
+	std::vector<double> costs((size_t)rows * cols);
+	for ( int row = 0 ; row < rows ; row++ )
+		for ( int col = 0 ; col < cols ; col++ )
+			costs[(size_t)row * cols + col] = m(row,col);
+
+	std::vector<int> rowAssignment;
+	solve(rows ? &costs[0] : 0, rows, cols, rowAssignment);
+
+	for ( int row = 0 ; row < rows ; row++ )
+		for ( int col = 0 ; col < cols ; col++ )
+			m(row,col) = (rowAssignment[row] == col) ? 0 : -1;
+}
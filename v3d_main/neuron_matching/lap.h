@@ -0,0 +1,75 @@
+/*
+ * Copyright (c)2006-2010  Hanchuan Peng (Janelia Farm, Howard Hughes Medical Institute).  
+ * All rights reserved.
+ */
+
+
+/************
+                                            ********* LICENSE NOTICE ************
+
+This folder contains all source codes for the V3D project, which is subject to the following conditions if you want to use it. 
+
+You will ***have to agree*** the following terms, *before* downloading/using/running/editing/changing any portion of codes in this package.
+
+1. This package is free for non-profit research, but needs a special license for any commercial purpose. Please contact Hanchuan Peng for details.
+
+2. You agree to appropriately cite this work in your related studies and publications.
+
+Peng, H., Ruan, Z., Long, F., Simpson, J.H., and Myers, E.W. (2010) “V3D enables real-time 3D visualization and quantitative analysis of large-scale biological image data sets,” Nature Biotechnology, Vol. 28, No. 4, pp. 348-353, DOI: 10.1038/nbt.1612. ( http://penglab.janelia.org/papersall/docpdf/2010_NBT_V3D.pdf )
+
+Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstruction of 3D neuron structures using a graph-augmented deformable model,” Bioinformatics, Vol. 26, pp. i38-i46, 2010. ( http://penglab.janelia.org/papersall/docpdf/2010_Bioinfo_GD_ISMB2010.pdf )
+
+3. This software is provided by the copyright holders (Hanchuan Peng), Howard Hughes Medical Institute, Janelia Farm Research Campus, and contributors "as is" and any express or implied warranties, including, but not limited to, any implied warranties of merchantability, non-infringement, or fitness for a particular purpose are disclaimed. In no event shall the copyright owner, Howard Hughes Medical Institute, Janelia Farm Research Campus, or contributors be liable for any direct, indirect, incidental, special, exemplary, or consequential damages (including, but not limited to, procurement of substitute goods or services; loss of use, data, or profits; reasonable royalties; or business interruption) however caused and on any theory of liability, whether in contract, strict liability, or tort (including negligence or otherwise) arising in any way out of the use of this software, even if advised of the possibility of such damage.
+
+4. Neither the name of the Howard Hughes Medical Institute, Janelia Farm Research Campus, nor Hanchuan Peng, may be used to endorse or promote products derived from this software without specific prior written permission.
+
+*************/
+
+
+
+// lap.h - linear assignment by shortest augmenting paths (Jonker-Volgenant style)
+// O(n^3) for dense n x n costs; handles rectangular and sparse cost matrices.
+// Drop-in replacement of Munkres::solve() for the tree matching code.
+
+#if !defined(_LAP_H_)
+#define _LAP_H_
+
+#include "mymatrix.h"
+
+#include <vector>
+
+class LinearAssignment {
+public:
+	// Munkres-compatible interface: on return m(row,col) is 0 for assigned pairs and -1 elsewhere.
+	void solve(Matrix<double> &m);
+
+	// Dense row-major costs (rows x cols). On return rowAssignment[row] is the assigned
+	// column, or -1 if the row is left unassigned (only when rows > cols). Returns the total cost.
+	double solve(const double *costs, int rows, int cols, std::vector<int> &rowAssignment);
+
+	// Sparse costs in compressed row format: the entries of row r are
+	// colIndex[rowStart[r] .. rowStart[r+1]-1] with costs cost[...]. Missing entries are
+	// forbidden pairs. The result has maximum cardinality and, among those, minimum cost;
+	// rows that cannot be matched are left at -1. Returns the total cost.
+	double solveSparse(int rows, int cols,
+	                   const std::vector<int> &rowStart,
+	                   const std::vector<int> &colIndex,
+	                   const std::vector<double> &cost,
+	                   std::vector<int> &rowAssignment);
+
+private:
+	// one shortest augmenting path from free row 'row'; returns false if no free column is reachable
+	bool augmentDense(const double *costs, int cols, int row);
+	bool augmentSparse(const std::vector<int> &rowStart, const std::vector<int> &colIndex,
+	                   const std::vector<double> &cost, int row);
+	void reset(int rows, int cols);
+
+	std::vector<double> u, v;      // row and column potentials
+	std::vector<int> colOwner;     // row assigned to each column, -1 if free
+	std::vector<int> way;          // predecessor column on the augmenting path
+	std::vector<double> minv;      // tentative reduced distances to each column
+	std::vector<char> used;        // columns already in the shortest path tree
+	std::vector<int> usedList;     // columns in the tree, in visiting order
+};
+
+#endif /* !defined(_LAP_H_) */
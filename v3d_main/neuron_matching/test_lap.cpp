@@ -0,0 +1,113 @@
+// test_lap.cpp - LinearAssignment on small problems with a known optimal cost,
+// and against exhaustive search on random ones.
+// build and run: make test_lap && ./test_lap
+
+#include "mymatrix.cpp"
+#include "lap.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static int nFailed = 0;
+
+static void check(bool ok, const char *what) {
+	if ( !ok ) {
+		printf("FAILED: %s\n", what);
+		nFailed++;
+	}
+}
+
+// lowest cost of assigning min(rows,cols) pairs, by trying every assignment of the rows
+static double bruteForce(const std::vector<double> &costs, int rows, int cols, int row, std::vector<char> &usedCols) {
+	if ( row == rows )
+		return 0;
+	double best = 1e300;
+	int freeCols = 0;
+	for ( int c = 0 ; c < cols ; c++ )
+		if ( !usedCols[c] ) {
+			freeCols++;
+			usedCols[c] = 1;
+			best = std::min(best, costs[row*cols + c] + bruteForce(costs, rows, cols, row+1, usedCols));
+			usedCols[c] = 0;
+		}
+	if ( rows - row > freeCols ) // this row may stay unassigned
+		best = std::min(best, bruteForce(costs, rows, cols, row+1, usedCols));
+	return best;
+}
+
+static bool isAssignment(const std::vector<int> &rowAssignment, int cols, int expectedPairs) {
+	std::vector<char> taken(cols, 0);
+	int pairs = 0;
+	for ( size_t r = 0 ; r < rowAssignment.size() ; r++ ) {
+		int c = rowAssignment[r];
+		if ( c < 0 )
+			continue;
+		if ( c >= cols || taken[c] )
+			return false;
+		taken[c] = 1;
+		pairs++;
+	}
+	return pairs == expectedPairs;
+}
+
+int main() {
+	LinearAssignment lap;
+	std::vector<int> assignment;
+
+	// 3 x 3 with optimum 1 + 2 + 2 (row 0 -> 1, row 1 -> 0, row 2 -> 2)
+	double square[9] = { 4, 1, 3,
+	                     2, 0, 5,
+	                     3, 2, 2 };
+	check(lap.solve(square, 3, 3, assignment) == 5, "3x3 optimal cost");
+	check(assignment[0] == 1 && assignment[1] == 0 && assignment[2] == 2, "3x3 assignment");
+
+	// 2 x 3 and its transpose: the cheapest two columns are 0 and 2, cost 1 + 2
+	double wide[6] = { 1, 5, 9,
+	                   4, 6, 2 };
+	check(lap.solve(wide, 2, 3, assignment) == 3, "2x3 optimal cost");
+	double tall[6] = { 1, 4,
+	                   5, 6,
+	                   9, 2 };
+	check(lap.solve(tall, 3, 2, assignment) == 3, "3x2 optimal cost");
+	check(assignment[0] == 0 && assignment[1] == -1 && assignment[2] == 1, "3x2 leaves the middle row free");
+
+	// sparse: row 1 can only take column 0, so row 0 must give it up; cost 3 + 1
+	std::vector<int> rowStart, colIndex;
+	std::vector<double> cost;
+	rowStart.push_back(0);
+	colIndex.push_back(0); cost.push_back(1);
+	colIndex.push_back(1); cost.push_back(3);
+	rowStart.push_back(2);
+	colIndex.push_back(0); cost.push_back(1);
+	rowStart.push_back(3);
+	rowStart.push_back(3); // row 2 has no allowed pair
+	check(lap.solveSparse(3, 2, rowStart, colIndex, cost, assignment) == 4, "sparse maximum cardinality, then minimum cost");
+	check(assignment[0] == 1 && assignment[1] == 0 && assignment[2] == -1, "sparse assignment");
+
+	// Munkres-compatible interface
+	Matrix<double> m(3, 3);
+	for ( int r = 0 ; r < 3 ; r++ )
+		for ( int c = 0 ; c < 3 ; c++ )
+			m(r,c) = square[r*3 + c];
+	lap.solve(m);
+	check(m(0,1) == 0 && m(1,0) == 0 && m(2,2) == 0 && m(0,0) == -1 && m(2,1) == -1, "Matrix interface marks assigned pairs with 0");
+
+	// random dense problems against exhaustive search
+	srand(27);
+	for ( int trial = 0 ; trial < 300 ; trial++ ) {
+		int rows = 1 + rand() % 6, cols = 1 + rand() % 6;
+		std::vector<double> costs(rows*cols);
+		for ( size_t k = 0 ; k < costs.size() ; k++ )
+			costs[k] = (rand() % 2000 - 500) / 8.0; // exact in binary, some negative
+		double total = lap.solve(&costs[0], rows, cols, assignment);
+		std::vector<char> usedCols(cols, 0);
+		double best = bruteForce(costs, rows, cols, 0, usedCols);
+		char what[64];
+		sprintf(what, "random %dx%d problem %d", rows, cols, trial);
+		check(fabs(total - best) < 1e-9 && isAssignment(assignment, cols, std::min(rows, cols)), what);
+	}
+
+	printf("%s\n", nFailed ? "test_lap FAILED" : "test_lap passed");
+	return nFailed ? 1 : 0;
+}
@@ -55,6 +55,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 using namespace boost;
 
 #include "../graph/dijk.h"
+#include "heap.h"
 
 #include "../v3d/compute_win_pca.h"
 
@@ -284,6 +285,188 @@ double edge_weight_func(int it, double va, double vb, double max_v=255)
 	//(dist + exp(tmpv*tmpv*10)-1);  // try plus scheme, 090713
 //########################################################
 
+//######################################################
+// implicit graph of find_shortest_path_graphimg(): the nodes are the grid points of the bounding box, the edges
+// link each node to its 6 (or 26 with diagonal edges) neighbours and their weights are computed from the image
+// only when the search reaches them. Node states are kept in 8x8x8 pages allocated on first touch, so a search
+// costs time and memory for the nodes it visits, not for the whole box.
+// With end nodes this is A* (the straight line to the nearest end node, as every edge weighs at least its length
+// times min_weight_step) and it stops once all end nodes are settled; without end nodes it is Dijkstra over the box.
+
+struct GridNode : public HeapElem
+{
+	double g;           // distance from the start node
+	double va;          // block average at the node, <0 until computed
+	signed char from;   // index of the neighbour offset leading from the parent, -1 for none
+	char   state;       // 0 unreached, 1 in heap, 2 settled
+	GridNode() : HeapElem(-1, 0), g(0), va(-1), from(-1), state(0) {}
+};
+
+class GridShortestPath
+{
+public:
+	GridShortestPath(unsigned char ***img3d_, V3DLONG dim0_, V3DLONG dim1_, V3DLONG dim2_,
+					 V3DLONG xmin_, V3DLONG ymin_, V3DLONG zmin_, V3DLONG nx_, V3DLONG ny_, V3DLONG nz_,
+					 int step_, float zthickness_, double imgTH_, bool diagonal)
+	: img3d(img3d_), dim0(dim0_), dim1(dim1_), dim2(dim2_), xmin(xmin_), ymin(ymin_), zmin(zmin_),
+	  nx(nx_), ny(ny_), nz(nz_), step(step_), zthickness(zthickness_), imgTH(imgTH_), n_pages_used(0)
+	{
+		npx = (nx+7)/8;  npy = (ny+7)/8;  npz = (nz+7)/8;
+		pages.assign(npx*npy*npz, (GridNode*)0);
+
+		// z-thickness weighted edge, as edge_table
+		for (int dk=-1; dk<=1; dk++)
+			for (int dj=-1; dj<=1; dj++)
+				for (int di=-1; di<=1; di++)
+				{
+					int n = abs(di)+abs(dj)+abs(dk);
+					if (n==0 || (!diagonal && n>1)) continue;
+					Offset o;
+					o.di = di;  o.dj = dj;  o.dk = dk;
+					o.dist = sqrt(double(di*di) + double(dj*dj) + double(dk*zthickness)*double(dk*zthickness));
+					offsets.push_back(o);
+				}
+	}
+	~GridShortestPath()
+	{
+		for (V3DLONG p=0; p<V3DLONG(pages.size()); p++)
+			if (pages[p]) delete []pages[p];
+	}
+
+	// returns the number of settled nodes; end nodes <0 (out of the box) are ignored
+	V3DLONG search(V3DLONG start, const V3DLONG *end_nodes, int n_end_nodes)
+	{
+		const double min_weight_step = 1e-5; // as edge_weight_func()
+		targets.clear();
+		for (int t=0; t<n_end_nodes; t++)
+			if (end_nodes[t]>=0 && std::find(targets.begin(), targets.end(), end_nodes[t])==targets.end())
+				targets.push_back(end_nodes[t]);
+		// the heuristic costs one distance per end node and evaluation, many end nodes are left to Dijkstra
+		h_scale = (targets.size()<=32) ? min_weight_step*(1-1e-9) : 0;
+		V3DLONG remaining = targets.size();
+
+		BasicHeap<GridNode> heap;
+		GridNode *s = at(start, true);
+		s->g = 0;
+		s->value = h(start);
+		s->state = 1;
+		heap.insert(s);
+
+		V3DLONG n_settled = 0;
+		while (!heap.empty())
+		{
+			GridNode *u = heap.delete_min();
+			u->state = 2;
+			n_settled++;
+			V3DLONG ind = u->img_ind;
+
+			if (remaining>0 && std::find(targets.begin(), targets.end(), ind)!=targets.end() && --remaining==0)
+				break; //all end nodes reached
+
+			double va = value(u);
+			if (va<imgTH) continue; //background node: no link
+
+			V3DLONG i = ind%nx, j = (ind/nx)%ny, k = ind/(nx*ny);
+			for (int o=0; o<int(offsets.size()); o++)
+			{
+				V3DLONG ii = i+offsets[o].di, jj = j+offsets[o].dj, kk = k+offsets[o].dk;
+				if (ii<0 || ii>=nx || jj<0 || jj>=ny || kk<0 || kk>=nz) continue; //for boundary condition
+
+				V3DLONG vind = (kk*ny + jj)*nx + ii;
+				GridNode *v = at(vind, true);
+				if (v->state==2) continue;
+				double vb = value(v);
+				if (vb<imgTH) continue; //skip background node link
+
+				double g = u->g + edge_weight_func(offsets[o].dist, va, vb, 255);
+				if (v->state==0)
+				{
+					v->g = g;
+					v->from = o;
+					v->value = g + h(vind);
+					v->state = 1;
+					heap.insert(v);
+				}
+				else if (g < v->g)
+				{
+					v->g = g;
+					v->from = o;
+					heap.adjust(v->heap_id, g + h(vind));
+				}
+			}
+		}
+		return n_settled;
+	}
+
+	// parent of a node in the shortest path tree, the node itself if it has none (start node, or not reached)
+	V3DLONG parent(V3DLONG ind)
+	{
+		GridNode *n = at(ind, false);
+		if (!n || n->from<0) return ind;
+		const Offset & o = offsets[n->from];
+		return ind - (V3DLONG(o.dk)*ny + o.dj)*nx - o.di;
+	}
+
+	V3DLONG pagesUsed() const {return n_pages_used;}
+
+private:
+	struct Offset {int di, dj, dk; double dist;};
+
+	unsigned char ***img3d;
+	V3DLONG dim0, dim1, dim2, xmin, ymin, zmin, nx, ny, nz, npx, npy, npz;
+	int step;
+	float zthickness;
+	double imgTH, h_scale;
+	std::vector<Offset> offsets;
+	std::vector<GridNode*> pages;
+	V3DLONG n_pages_used;
+	std::vector<V3DLONG> targets;
+
+	GridNode * at(V3DLONG ind, bool create)
+	{
+		V3DLONG i = ind%nx, j = (ind/nx)%ny, k = ind/(nx*ny);
+		GridNode *& page = pages[((k>>3)*npy + (j>>3))*npx + (i>>3)];
+		if (!page)
+		{
+			if (!create) return 0;
+			page = new GridNode [512];
+			n_pages_used++;
+		}
+		GridNode *n = page + (((k&7)<<6) | ((j&7)<<3) | (i&7));
+		n->img_ind = ind;
+		return n;
+	}
+
+	// block average at the node, as the edges of the explicit graph
+	double value(GridNode *n)
+	{
+		if (n->va<0)
+		{
+			V3DLONG ind = n->img_ind;
+			V3DLONG i = ind%nx, j = (ind/nx)%ny, k = ind/(nx*ny);
+			n->va = getBlockAveValue(img3d, dim0, dim1, dim2, xmin+i*step, ymin+j*step, zmin+k*step,
+									 step, step, (step/zthickness)); //zthickness
+		}
+		return n->va;
+	}
+
+	// lower bound of the distance to the nearest end node
+	double h(V3DLONG ind)
+	{
+		if (h_scale==0) return 0;
+		V3DLONG i = ind%nx, j = (ind/nx)%ny, k = ind/(nx*ny);
+		double best = -1;
+		for (V3DLONG t=0; t<V3DLONG(targets.size()); t++)
+		{
+			V3DLONG ti = targets[t]%nx, tj = (targets[t]/nx)%ny, tk = targets[t]/(nx*ny);
+			double di = double(i-ti), dj = double(j-tj), dk = double(k-tk)*zthickness;
+			double d = di*di + dj*dj + dk*dk;
+			if (best<0 || d<best) best = d;
+		}
+		return sqrt(best)*h_scale;
+	}
+};
+
 // return error message, 0 is no error
 //
 const char* find_shortest_path_graphimg(unsigned char ***img3d, V3DLONG dim0, V3DLONG dim1, V3DLONG dim2, //image
@@ -340,7 +523,7 @@ const char* find_shortest_path_graphimg(unsigned char ***img3d, V3DLONG dim0, V3
         printf("%ld x %ld x %ld nodes, step = %d, connect = %ld \n", nx, ny, nz, min_step, num_edge_table*2);
 
 	V3DLONG num_nodes = nx*ny*nz;
-	V3DLONG i,j,k,n,m;
+	V3DLONG i,j,k;
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	#define NODE_FROM_XYZ(x,y,z) 	(V3DLONG((z+.5)-zmin)/zstep*ny*nx + V3DLONG((y+.5)-ymin)/ystep*nx + V3DLONG((x+.5)-xmin)/xstep)
@@ -409,94 +592,14 @@ const char* find_shortest_path_graphimg(unsigned char ***img3d, V3DLONG dim0, V3
 
 
 #define _setting_thresholds_
-	//find # of edges
 	double imgMax = getImageMaxValue(img3d, dim0, dim1, dim2);
 	double imgAve = getImageAveValue(img3d, dim0, dim1, dim2);
 	double imgStd = getImageStdValue(img3d, dim0, dim1, dim2);
 	double imgTH = 0;
 	if (background_select) imgTH = (imgAve < imgStd)? imgAve : (imgAve+imgStd)*.5;
 
-	///////////////////////////////////////////////////////////////////////////////////////////////////////
-	//switch back to new[] from std::vector for *** glibc detected *** ??? on Linux
-	std::vector<Node> 	plist(num_nodes);		for (i=0;i<num_nodes;i++) plist[i]=i;
-	std::vector<Edge> 	edge_array;				edge_array.clear();
-	std::vector<Weight>	weights;				weights.clear();
-	///////////////////////////////////////////////////////////////////////////////////////////////////////
-
-#define _setting_weight_of_edges_
-	printf("setting weight of edges ......  ");
-
-	// z-thickness weighted edge
-	for (V3DLONG it=0; it<num_edge_table; it++)
-	{
-		double di = (edge_table[it].i0 - edge_table[it].i1);
-		double dj = (edge_table[it].j0 - edge_table[it].j1);
-		double dk = (edge_table[it].k0 - edge_table[it].k1) * zthickness;
-		edge_table[it].dist = sqrt(di*di + dj*dj + dk*dk);
-	}
-
-	double va, vb;
-	double maxw=0, minw=1e+6; //for debug info
-	n=0; m=0;
-	for (k=0;k<nz;k++)
-	{
-		for (j=0;j<ny;j++)
-		{
-			for (i=0;i<nx;i++)
-			{
-				for (int it=0; it<num_edge_table; it++)
-				{
-					// take an edge
-					V3DLONG ii = i+ edge_table[it].i0;
-					V3DLONG jj = j+ edge_table[it].j0;
-					V3DLONG kk = k+ edge_table[it].k0;
-					V3DLONG ii1 = i+ edge_table[it].i1;
-					V3DLONG jj1 = j+ edge_table[it].j1;
-					V3DLONG kk1 = k+ edge_table[it].k1;
-
-					if (ii>=nx || jj>=ny || kk>=nz || ii1>=nx || jj1>=ny || kk1>=nz) continue;//for boundary condition
-
-					V3DLONG node_a = NODE_FROM_IJK(ii,jj,kk);
-					V3DLONG node_b = NODE_FROM_IJK(ii1,jj1,kk1);
-
-					m++;
-
-					//=========================================================================================
-					// edge link
-					va = getBlockAveValue(img3d, dim0, dim1, dim2, X_I(ii),Y_I(jj),Z_I(kk),
-							xstep, ystep, (zstep/zthickness)); //zthickness
-					vb = getBlockAveValue(img3d, dim0, dim1, dim2, X_I(ii1),Y_I(jj1),Z_I(kk1),
-							xstep, ystep, (zstep/zthickness)); //zthickness
-					if (va<imgTH || vb<imgTH)
-						continue; //skip background node link
-
-					Edge e = Edge(node_a, node_b);
-					edge_array.push_back( e );
-
-					Weight w =	edge_weight_func(it, va,vb, 255);
-					weights.push_back( w );
-					//=========================================================================================
-
-					n++; // that is the correct position of n++
-
-					if (w>maxw) maxw=w;	if (w<minw) minw=w;
-				}
-			}
-		}
-	}
-	printf(" minw=%g maxw=%g ", minw,maxw);
-	printf(" graph defined! \n");
-
-	if (n != edge_array.size())
-	{
-                printf("%s", s_error="The number of edges is not consistent \n");
-		if (end_nodeind) {delete []end_nodeind; end_nodeind=0;} //100520, by PHC
-		return s_error;
-	}
-	V3DLONG num_edges = n; // back to undirectEdge for less memory consumption
-
-	printf("image average =%g, std =%g, max =%g.  select %ld out of %ld links \n", imgAve, imgStd, imgMax, n, m);
-	printf("total %ld nodes, total %ld edges \n", num_nodes, num_edges);
+	printf("image average =%g, std =%g, max =%g \n", imgAve, imgStd, imgMax);
+	printf("total %ld nodes \n", num_nodes);
 	printf("start from #%ld to ", start_nodeind);
 	for(V3DLONG i=0; i<n_end_nodes; i++) printf("#%ld ", end_nodeind[i]); printf("\n");
 	printf("---------------------------------------------------------------\n");
@@ -505,32 +608,10 @@ const char* find_shortest_path_graphimg(unsigned char ***img3d, V3DLONG dim0, V3
 
 #define _do_shortest_path_algorithm_
 	//========================================================================================================
-	// extract key code to function ???_shortest_path()
-     // add const for solving error LNK2019 in MSVC. ZJL 110921
-	const char* bgl_shortest_path(Edge *edge_array, V3DLONG nedges, Weight *weights, V3DLONG num_nodes, //input graph
-					Node start_nodeind,
-					Node *plist); //output path
-	const char* phc_shortest_path(Edge *edge_array, V3DLONG nedges, Weight *weights, V3DLONG num_nodes, //input graph
-					Node start_nodeind,
-					Node *plist); //output path
-
-	int code_select = 0; // BGL has the best speed and correctness
-	switch(code_select)
-	{
-	case 0:
-		printf("bgl_shortest_path() \n");
-		s_error = bgl_shortest_path(&edge_array[0], num_edges, &weights[0], num_nodes, start_nodeind, &plist[0]);
-		break;
-	case 1:
-		printf("phc_shortest_path() \n");
-		s_error = phc_shortest_path(&edge_array[0], num_edges, &weights[0], num_nodes,	start_nodeind, &plist[0]);
-		break;
-	}
-	if (s_error)
-	{
-		if (end_nodeind) {delete []end_nodeind; end_nodeind=0;} //100520, by PHC
-		return s_error;
-	}
+	// search the implicit graph of the box: only the nodes reached get their edges weighted
+	GridShortestPath search(img3d, dim0, dim1, dim2, xmin, ymin, zmin, nx, ny, nz, min_step, zthickness, imgTH, num_edge_table>3);
+	V3DLONG n_settled = search.search(start_nodeind, end_nodeind, n_end_nodes);
+	printf("%ld nodes settled, %ld nodes allocated \n", n_settled, search.pagesUsed()*512);
 	//=========================================================================================================
 
 	// output node coordinates of the shortest path
@@ -562,7 +643,7 @@ const char* find_shortest_path_graphimg(unsigned char ***img3d, V3DLONG dim0, V3
 				index_map[cc.n] = mUnit.size()-1; //fix this bug so that the nchild file of the root will be correct, PHC, 20101231
 				printf("[start: x y z] %ld: %g %g %g \n", j, cc.x, cc.y, cc.z);
 			}
-			else if ( (k=plist[j]) != j ) // has parent
+			else if ( (k=search.parent(j)) != j ) // has parent
 				if (k>=0 && k<num_nodes)  // is valid
 			{
 				NODE_TO_XYZ(j, cc.x, cc.y, cc.z);
@@ -685,9 +766,9 @@ const char* find_shortest_path_graphimg(unsigned char ***img3d, V3DLONG dim0, V3
 
 		mUnit.push_back(cc);
 
-		for (k=0;k<n;k++) //at most n edge links
+		for (k=0;k<num_nodes;k++) //at most num_nodes links
 		{
-			V3DLONG jj = j;	j = plist[j];
+			V3DLONG jj = j;	j = search.parent(j);
 
 			if (j==jj)
 			{
@@ -5,6 +5,7 @@ int terafly::NewViewerOperation::gid = 0;
 int terafly::RestoreViewerOperation::gid = 0;
 int terafly::AnnotationOperation::gid = 0;
 int terafly::ZoominRoiOperation::gid = 0;
+int terafly::CacheOperation::gid = 0;
 int terafly::ConverterLoadBlockOperation::gid = 0;
 int terafly::ConverterWriteBlockOperation::gid = 0;
 int terafly::TiffLoadMetadata::gid = 0;
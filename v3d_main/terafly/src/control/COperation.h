@@ -2,6 +2,7 @@
 #define COPERATION_H
 
 #include "CPlugin.h"
+#include "CTrace.h"
 
 namespace terafly
 {
@@ -32,10 +33,13 @@ namespace terafly
             COMPONENT comp;
             std::string message;
             int groupID;
+            long long endTime;              // microseconds, see CTrace::now()
+            unsigned long long threadID;    // thread that measured the operation
 
             virtual std::string name() = 0;
 
-            Operation(std::string m, COMPONENT c, int ms, int gid) : message(m), comp(c), milliseconds(ms), groupID(gid){}
+            Operation(std::string m, COMPONENT c, int ms, int gid) : message(m), comp(c), milliseconds(ms), groupID(gid),
+                endTime(CTrace::now()), threadID(CTrace::currentThread()){}
             Operation(){}
             std::string compName()
             {
@@ -124,6 +128,20 @@ namespace terafly
 
 
 
+    class CacheOperation : public Operation
+    {
+        private:
+            CacheOperation(){}
+
+        public:
+
+            static int gid;
+            virtual std::string name(){return "OP_CACHE";}
+            static int newGroup(){return gid++;}
+            CacheOperation(std::string m, COMPONENT c, int ms) : Operation(m, c, ms, gid){}
+            friend class PLog;
+    };
+
     class ConverterLoadBlockOperation : public Operation
     {
         private:
@@ -218,7 +236,7 @@ terafly::classname::newGroup();
 timer##classname.restart();
 
 #define TERAFLY_TIME_STOP(classname, component, message)    \
-if(terafly::PLog::instance()->isIoCoreOperationsEnabled()) \
+if(terafly::PLog::instance()->isIoCoreOperationsEnabled() || terafly::CTrace::instance()->isEnabled()) \
     terafly::PLog::instance()->emitSendAppend(new terafly::classname(message, component, timer##classname.elapsed()));
 
 //#define TERAFLY_TIME_START(classname)
@@ -81,6 +81,7 @@ namespace terafly
     class CAnnotations;         //control class used to manage annotations (markers, curves, etc.) among all the resolutions
     class CImageUtils;          //control class containing image processing functions
     class COperation;           //control class to keep track of performed operations
+    class CTrace;               //control class to export the performed operations as traces
     class QArrowButton;         //Qt-customized class to model arrow buttons
     class QHelpBox;             //Qt-customized class to model help box
     class QGradientBar;         //Qt-customized class to model a gradient-colored bar
@@ -0,0 +1,171 @@
+#include "CTrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QThread>
+
+using namespace terafly;
+
+CTrace* CTrace::uniqueInstance = 0;
+
+CTrace* CTrace::instance()
+{
+    if (uniqueInstance == 0)
+    {
+        uniqueInstance = new CTrace();
+
+        const char* env_path = getenv("TERAFLY_TRACE");
+        if(env_path && *env_path)
+        {
+            const char* env_run = getenv("TERAFLY_TRACE_RUN");
+            if(!uniqueInstance->start(env_path, env_run ? env_run : ""))
+                fprintf(stderr, "TeraFly: cannot write trace file \"%s\"\n", env_path);
+        }
+    }
+    return uniqueInstance;
+}
+
+void CTrace::uninstance()
+{
+    if(uniqueInstance)
+    {
+        delete uniqueInstance;
+        uniqueInstance = 0;
+    }
+}
+
+CTrace::CTrace() : enabled(false), chrome(false), firstEvent(true)
+{
+    now();  // start the clock
+}
+
+CTrace::~CTrace()
+{
+    stop();
+}
+
+long long CTrace::now()
+{
+    static QElapsedTimer clock;
+    if(!clock.isValid())
+        clock.start();
+    return clock.nsecsElapsed() / 1000;
+}
+
+unsigned long long CTrace::currentThread()
+{
+    return (unsigned long long)(size_t)(QThread::currentThreadId());
+}
+
+bool CTrace::start(const std::string & path, const std::string & run_label)
+{
+    stop();
+
+    QMutexLocker locker(&mutex);
+    file.open(path.c_str(), std::ios::out | std::ios::trunc);
+    if(!file.is_open())
+        return false;
+
+    filePath = path;
+    run = run_label;
+    chrome = path.size() >= 5 && path.compare(path.size()-5, 5, ".json") == 0;
+    firstEvent = true;
+    threads.clear();
+    if(chrome)
+    {
+        file << "[\n";
+        file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\""
+             << escape(run.empty() ? std::string("TeraFly") : "TeraFly " + run) << "\"}}";
+        firstEvent = false;
+    }
+    file.flush();
+    enabled = true;
+    return true;
+}
+
+void CTrace::stop()
+{
+    QMutexLocker locker(&mutex);
+    if(!enabled)
+        return;
+    enabled = false;
+    if(chrome)
+        file << "\n]\n";
+    file.close();
+    filePath.clear();
+}
+
+void CTrace::record(const std::string & name, const std::string & component, const std::string & message,
+                    int group, long long duration_us, long long end_us, unsigned long long thread)
+{
+    if(!enabled)
+        return;
+
+    QMutexLocker locker(&mutex);
+    if(!enabled)
+        return;
+
+    std::map<unsigned long long, int>::iterator it = threads.find(thread);
+    int tid = it == threads.end() ? 0 : it->second;
+    bool new_thread = it == threads.end();
+    if(new_thread)
+    {
+        tid = (int)threads.size() + 1;
+        threads[thread] = tid;
+    }
+
+    char times[128];
+    if(chrome)
+    {
+        if(new_thread)
+            file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                 << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+        sprintf(times, "\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d", end_us - duration_us, duration_us, tid);
+        file << (firstEvent ? "" : ",") << "\n{\"name\":\"" << escape(name) << "\",\"cat\":\"" << escape(component)
+             << "\",\"ph\":\"X\"," << times << ",\"args\":{\"group\":" << group << ",\"message\":\"" << escape(message) << "\"";
+        if(!run.empty())
+            file << ",\"run\":\"" << escape(run) << "\"";
+        file << "}}";
+    }
+    else
+    {
+        sprintf(times, "\"start_us\":%lld,\"dur_us\":%lld,\"thread\":%d", end_us - duration_us, duration_us, tid);
+        file << "{";
+        if(!run.empty())
+            file << "\"run\":\"" << escape(run) << "\",";
+        file << "\"name\":\"" << escape(name) << "\",\"comp\":\"" << escape(component) << "\",\"group\":" << group
+             << "," << times << ",\"message\":\"" << escape(message) << "\"}\n";
+    }
+    firstEvent = false;
+    file.flush();
+}
+
+std::string CTrace::escape(const std::string & s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for(size_t i=0; i<s.size(); i++)
+    {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if(c == '\n')
+            out += "\\n";
+        else if(c == '\t')
+            out += "\\t";
+        else if(c < 0x20)
+        {
+            char u[8];
+            sprintf(u, "\\u%04x", c);
+            out += u;
+        }
+        else
+            out += c;
+    }
+    return out;
+}
@@ -0,0 +1,64 @@
+#ifndef CTRACE_H
+#define CTRACE_H
+
+#include <string>
+#include <fstream>
+#include <map>
+#include <QMutex>
+
+namespace terafly
+{
+    class CTrace;
+}
+
+/*********************************************************************************
+* Structured export of the timed operations (see COperation.h): while a trace is
+* open, every logged operation is written to the trace file with its name,
+* component, group, message, duration, end time and thread.
+* - "*.json" files follow the Chrome trace event format (chrome://tracing or
+*   https://ui.perfetto.dev), one complete ("X") event per operation;
+* - any other file gets one JSON object per line (easy to diff and script).
+* Only QtCore is needed, so that headless tools can write the same traces.
+* Setting TERAFLY_TRACE=<file> opens a trace when TeraFly starts, and
+* TERAFLY_TRACE_RUN=<label> tags its events (e.g. with the build under test).
+**********************************************************************************/
+class terafly::CTrace
+{
+    private:
+
+        static CTrace* uniqueInstance;
+        CTrace();
+        ~CTrace();
+
+        QMutex mutex;
+        std::ofstream file;
+        std::string filePath;
+        std::string run;                    // label of the run, added to every event
+        volatile bool enabled;
+        bool chrome;                        // Chrome trace (JSON array) instead of JSON lines
+        bool firstEvent;
+        std::map<unsigned long long, int> threads;  // thread handle -> small id, in order of appearance
+
+        static std::string escape(const std::string & s);
+
+    public:
+
+        static CTrace* instance();
+        static void uninstance();
+
+        // opens <path> (see above), closing the current trace first; returns false if the file cannot be written
+        bool start(const std::string & path, const std::string & run_label = "");
+        void stop();
+        bool isEnabled(){return enabled;}
+        std::string path(){return filePath;}
+
+        // writes one operation of <duration_us> microseconds, ended at <end_us> (see now()) on <thread> (see currentThread())
+        void record(const std::string & name, const std::string & component, const std::string & message,
+                    int group, long long duration_us, long long end_us, unsigned long long thread);
+
+        // microseconds elapsed on a process-wide monotonic clock, the time base of all traces
+        static long long now();
+        static unsigned long long currentThread();
+};
+
+#endif // CTRACE_H
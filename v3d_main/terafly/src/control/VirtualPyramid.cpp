@@ -3,7 +3,12 @@
 #include <fstream>
 #include "IOPluginAPI.h"
 #include "CImageUtils.h"
+#include "../presentation/PLog.h"
+#include "CSettings.h"
 #include "basic_4dimage.h"
+#include <QRunnable>
+#include <QThreadPool>
+#include <cstring>
 
 
 /********************************
@@ -516,6 +521,10 @@ void tf::VirtualPyramid::initPyramid(
                                                  _virtualPyramid[k]->getDIM_C(),
                                                  _virtualPyramid[k]->getDIM_T()), block5Ddim, block_format));
     }
+
+    // the layers share the RAM limit in the settings equally
+    for(size_t k=0; k<_cachePyramid.size(); k++)
+        _cachePyramid[k]->setRamShare(1.0f / _cachePyramid.size());
 }
 
 // load volume of interest from the given resolution layer
@@ -877,11 +886,19 @@ throw (iim::IOException, iom::exception, tf::RuntimeException)
                 progress.setValue(i);
                 progress.setLabelText(iim::strprintf("Save virtual pyramid files %d of %d...", i+1, blocks_modified.size()).c_str());
 
-                blocks_modified[i]->save();
+                // blocks are encoded and written in background: wait for them every few blocks to keep progress and RAM in check
+                blocks_modified[i]->save(true);
+                if(i % 8 == 7)
+                    for(int j=0; j<cachePyramid().size(); j++)
+                        if(layer == -1 || layer == j)
+                            _cachePyramid[j]->flush();
 
                 if (progress.wasCanceled())
                     break;
             }
+            for(int j=0; j<cachePyramid().size(); j++)
+                if(layer == -1 || layer == j)
+                    _cachePyramid[j]->flush();
             progress.setValue(blocks_modified.size());
         }
     }
@@ -1042,6 +1059,308 @@ throw (iim::IOException)
 *   HYPER GRID  CACHE definitions     *
 ***************************************
 ---------------------------------------------------------------------------------------------------------------------------*/
+// compressed block format: 4-byte magic, 1-byte codec, 3 reserved bytes, 5 x 4-byte dims (little endian), payload
+static const std::string packedBlockFormat = ".v3dblk";
+static const char packedBlockMagic[4] = {'V', 'P', 'B', '1'};
+enum {CODEC_RAW = 0, CODEC_ZERORUN = 1, CODEC_ZERORUN_DEFLATE = 2, PACKED_HEADER_SIZE = 28};
+
+static void putVarint(QByteArray & out, size_t v)
+{
+    while(v >= 0x80)
+    {
+        out.append(char((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.append(char(v));
+}
+
+static bool getVarint(const unsigned char* & p, const unsigned char* end, size_t & v)
+{
+    v = 0;
+    for(int shift=0; shift<64 && p<end; shift+=7)
+    {
+        unsigned char b = *p++;
+        v |= size_t(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// zero-run coding: (# of empty voxels, # of literal voxels, literal voxels)*
+// a literal run only ends at 4 or more consecutive empty voxels, so that isolated zeros do not split it
+static QByteArray zeroRunEncode(const tf::uint8* data, size_t n)
+{
+    QByteArray out;
+    out.reserve(int(n/8 + 64));
+    size_t i = 0;
+    while(i < n)
+    {
+        size_t z = i;
+        while(z < n && !data[z])
+            z++;
+        size_t l = z;
+        while(l < n)
+        {
+            if(data[l])
+            {
+                l++;
+                continue;
+            }
+            size_t e = l;
+            while(e < n && e-l < 4 && !data[e])
+                e++;
+            if(e-l >= 4 || e == n)
+                break;
+            l = e;
+        }
+        putVarint(out, z-i);
+        putVarint(out, l-z);
+        out.append((const char*)(data+z), int(l-z));
+        i = l;
+    }
+    return out;
+}
+
+static bool zeroRunDecode(const unsigned char* p, const unsigned char* end, tf::uint8* data, size_t n)
+{
+    size_t i = 0;
+    while(p < end)
+    {
+        size_t z, l;
+        if(!getVarint(p, end, z) || !getVarint(p, end, l) || z > n-i || l > n-i-z || l > size_t(end-p))
+            return false;
+        memset(data+i, 0, z);
+        i += z;
+        memcpy(data+i, p, l);
+        i += l;
+        p += l;
+    }
+    return i == n;
+}
+
+// thread pool shared by the background block I/O of all caches
+static QThreadPool* blockIOPool()
+{
+    static QThreadPool* pool = 0;
+    if(!pool)
+    {
+        pool = new QThreadPool();
+        pool->setMaxThreadCount(std::max(1, std::min(4, QThread::idealThreadCount())));
+    }
+    return pool;
+}
+
+// background task working on one block: compress evicted data into the block's _packed data, or write the block file
+class terafly::HyperGridCache::BlockTask : public QRunnable
+{
+    public:
+
+        enum kind_t {PACK, WRITE};
+
+        CacheBlock* _block;                 // block this task works on
+        kind_t      _kind;                  // task kind
+        uint8*      _data;                  // uncompressed block data (owned by this task), 0 if only _packed is given
+        QByteArray  _packed;                // compressed block data (WRITE only)
+
+        BlockTask(CacheBlock* block, kind_t kind, uint8* data, const QByteArray & packed = QByteArray())
+            : _block(block), _kind(kind), _data(data), _packed(packed){}
+        ~BlockTask(){delete[] _data;}
+
+        void run()
+        {
+            TERAFLY_TIME_START(CacheOperation)
+            HyperGridCache* cache = _block->_parent;
+            QByteArray packed;
+            std::string error;
+            try
+            {
+                if(_kind == PACK)
+                    packed = HyperGridCache::encodeBlock(_data, _block->_dims);
+                else
+                    _block->write(_data, _packed);
+            }
+            catch(iim::IOException & e) {error = e.what();}
+            catch(iom::exception & e)   {error = e.what();}
+            catch(std::exception & e)   {error = e.what();}
+            if(error.empty())
+            {
+                TERAFLY_TIME_STOP(CacheOperation, _kind == PACK ? tf::CPU : tf::IO,
+                                  tf::strprintf("Block \"%s\" %s in background", _block->_path.c_str(), _kind == PACK ? "compressed" : "written"))
+            }
+
+            // results are dropped if the block took its data back in the meanwhile (see CacheBlock::load)
+            QMutexLocker lock(&cache->_ioMutex);
+            if(_block->_task == this)
+            {
+                _block->_task = 0;
+                if(_kind == PACK)
+                {
+                    _block->_packed = packed;
+                    cache->_ramUsed += packed.size();
+                }
+                else if(error.empty())
+                {
+                    cache->_ramUsed -= _block->_packed.size();
+                    _block->_packed.clear();
+                }
+            }
+            if(!error.empty() && cache->_ioError.empty())
+                cache->_ioError = error;
+            cache->_ioPending--;
+            cache->_ioDone.wakeAll();
+        }
+};
+
+// compress block data
+QByteArray tf::HyperGridCache::encodeBlock(const uint8* data, xyzct<size_t> dims)
+{
+    size_t n = dims.size();
+    QByteArray payload = zeroRunEncode(data, n);
+    char codec = CODEC_ZERORUN;
+
+    // dense blocks: deflate (fast level), or keep them raw if nothing helps
+    if(size_t(payload.size()) > n/8)
+    {
+        QByteArray deflated = qCompress(payload, 1);
+        if(deflated.size() < payload.size() - payload.size()/8)
+        {
+            payload = deflated;
+            codec = CODEC_ZERORUN_DEFLATE;
+        }
+        else if(size_t(payload.size()) >= n)
+        {
+            payload = QByteArray((const char*)data, int(n));
+            codec = CODEC_RAW;
+        }
+    }
+
+    QByteArray out(PACKED_HEADER_SIZE, 0);
+    memcpy(out.data(), packedBlockMagic, 4);
+    out[4] = codec;
+    size_t d[5] = {dims.x, dims.y, dims.z, dims.c, dims.t};
+    for(int i=0; i<5; i++)
+        for(int b=0; b<4; b++)
+            out[8 + 4*i + b] = char((d[i] >> (8*b)) & 0xff);
+    out.append(payload);
+    return out;
+}
+
+// decompress block data, false if packed is not a valid block of the given dimensions
+bool tf::HyperGridCache::decodeBlock(const QByteArray & packed, uint8* data, xyzct<size_t> dims)
+{
+    if(packed.size() < PACKED_HEADER_SIZE || memcmp(packed.constData(), packedBlockMagic, 4) != 0)
+        return false;
+    const unsigned char* h = (const unsigned char*)packed.constData();
+    size_t d[5] = {dims.x, dims.y, dims.z, dims.c, dims.t};
+    for(int i=0; i<5; i++)
+        if((size_t(h[8+4*i]) | size_t(h[9+4*i]) << 8 | size_t(h[10+4*i]) << 16 | size_t(h[11+4*i]) << 24) != d[i])
+            return false;
+
+    size_t n = dims.size();
+    const unsigned char* payload = h + PACKED_HEADER_SIZE;
+    size_t payload_size = packed.size() - PACKED_HEADER_SIZE;
+    switch(h[4])
+    {
+        case CODEC_RAW:
+            if(payload_size != n)
+                return false;
+            memcpy(data, payload, n);
+            return true;
+        case CODEC_ZERORUN:
+            return zeroRunDecode(payload, payload + payload_size, data, n);
+        case CODEC_ZERORUN_DEFLATE:
+        {
+            QByteArray inflated = qUncompress(payload, int(payload_size));
+            const unsigned char* p = (const unsigned char*)inflated.constData();
+            return !inflated.isEmpty() && zeroRunDecode(p, p + inflated.size(), data, n);
+        }
+        default:
+            return false;
+    }
+}
+
+// eviction order of (value, block) pairs
+static bool lessValuable(const std::pair<double, tf::HyperGridCache::CacheBlock*> & a, const std::pair<double, tf::HyperGridCache::CacheBlock*> & b)
+{
+    return a.first < b.first;
+}
+
+// run a block task on the I/O thread pool
+void tf::HyperGridCache::startTask(BlockTask* task)
+{
+    {
+        QMutexLocker lock(&_ioMutex);
+        task->_block->_task = task;
+        _ioPending++;
+    }
+    blockIOPool()->start(task);
+}
+
+// wait until all background block tasks are done, throw if any write failed
+void tf::HyperGridCache::flush() throw (iim::IOException)
+{
+    /**/tf::debug(tf::LEV2, 0, __itm__current__function__);
+
+    QMutexLocker lock(&_ioMutex);
+    while(_ioPending)
+        _ioDone.wait(&_ioMutex);
+    if(!_ioError.empty())
+    {
+        std::string error = _ioError;
+        _ioError.clear();
+        throw iim::IOException(tf::strprintf("Cannot save cache blocks: %s", error.c_str()), __itm__current__function__);
+    }
+}
+
+// # of background block tasks not yet finished
+int tf::HyperGridCache::pendingIO()
+{
+    QMutexLocker lock(&_ioMutex);
+    return _ioPending;
+}
+
+// _ramUsed, read under the I/O mutex (background compressions add to it)
+size_t tf::HyperGridCache::ramUsed()
+{
+    QMutexLocker lock(&_ioMutex);
+    return _ramUsed;
+}
+
+// evict blocks until RAM usage is within the share of the RAM limit in the settings
+// - the blocks just read or put are kept
+// - the others are ranked by visit count, times the non-empty fraction (empty voxels cost nothing to reload), over the time since last use
+// - compressed blocks with unsaved changes count, but are never evicted
+void tf::HyperGridCache::evict() throw (iim::IOException, tf::RuntimeException, iom::exception)
+{
+    double limit = tf::CSettings::instance()->getRamLimitGB() * _ramShare * 1.0e9;
+    if(limit <= 0 || ramUsed() <= limit)
+        return;
+
+    std::vector< std::pair<double, CacheBlock*> > candidates;
+    for(size_t t=0; t<_nBlocks.t; t++)
+        for(size_t c=0; c<_nBlocks.c; c++)
+            for(size_t z=0; z<_nBlocks.z; z++)
+                for(size_t y=0; y<_nBlocks.y; y++)
+                    for(size_t x=0; x<_nBlocks.x; x++)
+                    {
+                        CacheBlock* block = _hypergrid[t][c][z][y][x];
+                        if(block->_imdata && block->_lastUse != _tick)
+                        {
+                            double filled = 1.0 - double(block->_emptycount) / block->_dims.size();
+                            candidates.push_back(std::make_pair((block->_visits + 1) * filled / (_tick - block->_lastUse), block));
+                        }
+                    }
+    std::stable_sort(candidates.begin(), candidates.end(), lessValuable);
+
+    // evict down to 80% of the limit, so that eviction does not run again at the next read / put
+    size_t evicted = 0;
+    for(; evicted < candidates.size() && ramUsed() > limit * 0.8; evicted++)
+        candidates[evicted].second->evict();
+
+    /**/tf::debug(tf::LEV2, strprintf("path = \"%s\", evicted %d blocks, %.3f GB of block data in RAM",
+                                    _path.c_str(), evicted, ramUsed() * 1.0e-9).c_str(), __itm__current__function__);
+}
 
 // constructor 1
 tf::HyperGridCache::HyperGridCache(
@@ -1060,6 +1379,10 @@ throw (iim::IOException, tf::RuntimeException, iom::exception)
     _block_dim = block_dim;
     _hypergrid = 0;
     _block_fmt = block_fmt;
+    _ramUsed = 0;
+    _ramShare = 1.0f;
+    _tick = 0;
+    _ioPending = 0;
 
     // adjust block dim if needed
     if(_block_dim.x == std::numeric_limits<size_t>::max())
@@ -1090,6 +1413,13 @@ tf::HyperGridCache::~HyperGridCache() throw (iim::IOException)
     // save metadata
     save();
 
+    // wait for background block tasks
+    {
+        QMutexLocker lock(&_ioMutex);
+        while(_ioPending)
+            _ioDone.wait(&_ioMutex);
+    }
+
     for(size_t t=0; t<_nBlocks.t; t++)
     {
         for(size_t c=0; c<_nBlocks.c; c++)
@@ -1345,6 +1675,9 @@ throw (iim::IOException, iom::exception, tf::RuntimeException)
                                               scaling.x, scaling.y, scaling.z), __itm__current__function__);
 
 
+    // blocks used from now on are protected from eviction
+    _tick++;
+
     // allocate and initialize data
     tf::image5D<tf::uint8> img;
     img.chans = channels;
@@ -1392,6 +1725,8 @@ throw (iim::IOException, iom::exception, tf::RuntimeException)
                         }
     //printf("\n");
 
+    evict();
+
     return img;
 }
 
@@ -1423,6 +1758,9 @@ void tf::HyperGridCache::putData(
 
 //    printf("before scaling, VOI(t,z,t,x) is [%.1f,%.1f),[%.1f,%.1f),[%.1f,%.1f),[%.1f,%.1f)\n", voi.start.t, voi.end.t, voi.start.z, voi.end.z, voi.start.y, voi.end.y, voi.start.x, voi.end.x);
 
+	// blocks used from now on are protected from eviction
+	_tick++;
+
 	// scale voi
 	if(upscaling)
         voi *= tf::xyz<float>(scaling);
@@ -1483,6 +1821,8 @@ void tf::HyperGridCache::putData(
 						}
 					}
     //printf("\n");
+
+    evict();
 }
 
 
@@ -1512,14 +1852,7 @@ void tf::HyperGridCache::clear()
 
 float tf::HyperGridCache::memoryUsed()
 {
-    float sum = 0;
-    for(size_t t=0; t<_nBlocks.t; t++)
-        for(size_t c=0; c<_nBlocks.c; c++)
-            for(size_t z=0; z<_nBlocks.z; z++)
-                for(size_t y=0; y<_nBlocks.y; y++)
-                    for(size_t x=0; x<_nBlocks.x; x++)
-                        sum += _hypergrid[t][c][z][y][x]->memoryUsed();
-    return sum;
+    return ramUsed() * 1.0e-9;
 }
 
 float tf::HyperGridCache::memoryMax()
@@ -1596,6 +1929,8 @@ throw (iim::IOException, iom::exception)
     _visits = 0;
     _emptycount = _dims.size();
     _hasChanged = false;
+    _lastUse = 0;
+    _task = 0;
 
     _path = _parent->_path + "/" + tf::strprintf("t%s_c%s_z%s_y%s_x%s%s",
                                                              tf::num2str(_index.t).c_str(),
@@ -1613,7 +1948,7 @@ tf::HyperGridCache::CacheBlock::~CacheBlock() throw (iim::IOException, iom::exce
     /**/tf::debug(tf::LEV_MAX, 0, __itm__current__function__);
 
     if(_imdata)
-        delete _imdata;
+        delete[] _imdata;
 }
 
 // calculate channel intersection with current block
@@ -1708,15 +2043,22 @@ size_t tf::HyperGridCache::CacheBlock::emptyCountInVOI(iim::voi3D<> voi , bool f
             return empty;
         }
 
-        // intersection is a VOI of this block, we don't have neither image or the block file
-        //  --> just return intersection size
-        else if(!iim::isFile(_path))
-            return ivoi.size() * _dims.c * _dims.t;
-
-        // all other cases
-        //  --> we make an estimate using the current _emptyCount and the ratio between the block size and the intersection VOI size
         else
         {
+            // compressed in RAM or being written in background
+            bool packed = false;
+            {
+                QMutexLocker lock(&_parent->_ioMutex);
+                packed = _task || !_packed.isEmpty();
+            }
+
+            // intersection is a VOI of this block, we don't have neither image or the block file
+            //  --> just return intersection size
+            if(!packed && !iim::isFile(_path))
+                return ivoi.size() * _dims.c * _dims.t;
+
+            // all other cases
+            //  --> we make an estimate using the current _emptyCount and the ratio between the block size and the intersection VOI size
             //QMessageBox::information(0, "title", "you should never see this");
             return tf::round(_emptycount * ivoi.size() / double(_dims.x*_dims.y*_dims.z));
         }
@@ -1729,6 +2071,8 @@ void tf::HyperGridCache::CacheBlock::load() throw (iim::IOException, iom::except
 {
     /**/tf::debug(tf::LEV2, 0, __itm__current__function__);
 
+    TERAFLY_TIME_START(CacheOperation)
+
     // precondition checks
     if(_dims.c > 3)
         throw iim::IOException("I/O functions with c (channels) > 3 not yet implemented", __itm__current__function__);
@@ -1738,33 +2082,80 @@ void tf::HyperGridCache::CacheBlock::load() throw (iim::IOException, iom::except
         throw iim::IOException("dims <= 0", __itm__current__function__);
 
     // allocate memory for data if needed
+    size_t imdata_size = _dims.size();
     if(!_imdata)
-        _imdata = new uint8[_dims.x * _dims.y * _dims.z * _dims.c * _dims.t];
+    {
+        _imdata = new uint8[imdata_size];
+        QMutexLocker lock(&_parent->_ioMutex);
+        _parent->_ramUsed += imdata_size * bytesPerPixel();
+    }
+
+    // take the data back from a background task, or decompress the data kept in RAM since eviction
+    bool restored = false;
+    {
+        QMutexLocker lock(&_parent->_ioMutex);
+        if(_task)
+        {
+            if(_task->_data)
+                memcpy(_imdata, _task->_data, imdata_size);
+            else if(!decodeBlock(_task->_packed, _imdata, _dims))
+                throw iim::IOException(tf::strprintf("Cannot decompress image block \"%s\"", _path.c_str()), __itm__current__function__);
+
+            // a compression is no longer needed, a write completes anyway
+            if(_task->_kind == BlockTask::PACK)
+                _task = 0;
+            restored = true;
+        }
+        else if(!_packed.isEmpty())
+        {
+            if(!decodeBlock(_packed, _imdata, _dims))
+                throw iim::IOException(tf::strprintf("Cannot decompress image block \"%s\"", _path.c_str()), __itm__current__function__);
+            _parent->_ramUsed -= _packed.size();
+            _packed.clear();
+            restored = true;
+        }
+    }
 
     // try to load data from disk
-    if(iim::isFile(_path))
+    if(!restored && iim::isFile(_path))
     {
-        Image4DSimple img;
-        img.loadImage(_path.c_str());
-        if(!img.valid())
-            throw iim::IOException(tf::strprintf("Cannot read image block at \"%s\"", _path.c_str()));
-        delete _imdata;
-        _imdata = img.getRawData();
-        img.setRawDataPointerToNull();
+        if(_parent->_block_fmt == packedBlockFormat)
+        {
+            std::ifstream f(_path.c_str(), std::ios::in | std::ios::binary);
+            f.seekg(0, std::ios::end);
+            std::streamoff file_size = f.tellg();
+            f.seekg(0, std::ios::beg);
+            QByteArray packed(int(file_size > 0 ? file_size : 0), 0);
+            if(!f.is_open() || file_size <= 0 || !f.read(packed.data(), file_size) || !decodeBlock(packed, _imdata, _dims))
+                throw iim::IOException(tf::strprintf("Cannot read image block at \"%s\"", _path.c_str()));
+        }
+        else
+        {
+            Image4DSimple img;
+            img.loadImage(_path.c_str());
+            if(!img.valid())
+                throw iim::IOException(tf::strprintf("Cannot read image block at \"%s\"", _path.c_str()));
+            delete[] _imdata;
+            _imdata = img.getRawData();
+            img.setRawDataPointerToNull();
+        }
     }
-    else // otherwise initialize to perfect black (0: value reserved for empty voxels)
+    else if(!restored) // otherwise initialize to perfect black (0: value reserved for empty voxels)
     {
-        size_t imdata_size = _dims.size();
         for(size_t i = 0; i<imdata_size; i++)
             _imdata[i] = 0;
     }
 
     // update empty voxel count
     updateEmptyCount();
+
+    TERAFLY_TIME_STOP(CacheOperation, restored ? tf::CPU : tf::IO,
+                      tf::strprintf("Block \"%s\" %s", _path.c_str(), restored ? "restored from RAM" : "loaded from disk"))
 }
 
 // save to disk
-void tf::HyperGridCache::CacheBlock::save() throw (iim::IOException, iom::exception, tf::RuntimeException)
+// - async: the data is handed over to a background task and released from RAM, see HyperGridCache::flush
+void tf::HyperGridCache::CacheBlock::save(bool async) throw (iim::IOException, iom::exception, tf::RuntimeException)
 {
     /**/tf::debug(tf::LEV2, 0, __itm__current__function__);
 
@@ -1777,23 +2168,116 @@ void tf::HyperGridCache::CacheBlock::save() throw (iim::IOException, iom::except
         throw iim::IOException("dims <= 0", __itm__current__function__);
 
     // only save when data has been modified
-    if(_imdata && _hasChanged)
+    if(!_hasChanged)
+        return;
+
+    // one background task at a time per block (block data is in RAM, uncompressed or compressed, once it is done)
+    waitTask();
+    if(!_imdata && _packed.isEmpty())
+        return;
+
+    TERAFLY_TIME_START(CacheOperation)
+    if(async)
+    {
+        _parent->startTask(new BlockTask(this, BlockTask::WRITE, _imdata, _packed));
+        QMutexLocker lock(&_parent->_ioMutex);
+        _parent->_ramUsed -= (_imdata ? _dims.size() * bytesPerPixel() : 0) + _packed.size();
+        _imdata = 0;
+        _packed.clear();
+    }
+    else
     {
-        Image4DSimple img;
-        img.setDatatype(V3D_UINT8);
-        img.setXDim(_dims.x);
-        img.setYDim(_dims.y);
-        img.setZDim(_dims.z);
-        img.setCDim(_dims.c);
-        img.setTDim(_dims.y);
-        img.setRawDataPointer(_imdata);
-        bool saved = img.saveImage(_path.c_str());
-        img.setRawDataPointerToNull();
-        if(!saved)
+        write(_imdata, _packed);
+        QMutexLocker lock(&_parent->_ioMutex);
+        _parent->_ramUsed -= _packed.size();
+        _packed.clear();
+    }
+    _hasChanged = false;
+    TERAFLY_TIME_STOP(CacheOperation, tf::IO, tf::strprintf("Block \"%s\" %s", _path.c_str(), async ? "queued for writing" : "written"))
+}
+
+// write block file from uncompressed data, or from compressed data if data is 0 (also called by background tasks)
+void tf::HyperGridCache::CacheBlock::write(const uint8* data, const QByteArray & packed) throw (iim::IOException, iom::exception, tf::RuntimeException)
+{
+    if(_parent->_block_fmt == packedBlockFormat)
+    {
+        QByteArray bytes = data ? encodeBlock(data, _dims) : packed;
+        std::ofstream f(_path.c_str(), std::ios::out | std::ios::binary);
+        if(!f.is_open() || !f.write(bytes.constData(), bytes.size()))
             throw iim::IOException(tf::strprintf("Cannot save image block at \"%s\"", _path.c_str()));
+        return;
+    }
 
-        _hasChanged = false;
+    std::vector<uint8> unpacked;
+    if(!data)
+    {
+        unpacked.resize(_dims.size());
+        if(!decodeBlock(packed, &unpacked[0], _dims))
+            throw iim::IOException(tf::strprintf("Cannot decompress image block \"%s\"", _path.c_str()));
+        data = &unpacked[0];
     }
+
+    Image4DSimple img;
+    img.setDatatype(V3D_UINT8);
+    img.setXDim(_dims.x);
+    img.setYDim(_dims.y);
+    img.setZDim(_dims.z);
+    img.setCDim(_dims.c);
+    img.setTDim(_dims.t);
+    img.setRawDataPointer(const_cast<uint8*>(data));
+    bool saved = img.saveImage(_path.c_str());
+    img.setRawDataPointerToNull();
+    if(!saved)
+        throw iim::IOException(tf::strprintf("Cannot save image block at \"%s\"", _path.c_str()));
+}
+
+// wait until no background task works on this block
+void tf::HyperGridCache::CacheBlock::waitTask()
+{
+    QMutexLocker lock(&_parent->_ioMutex);
+    while(_task)
+        _parent->_ioDone.wait(&_parent->_ioMutex);
+}
+
+// release the uncompressed data: blocks with unsaved changes are compressed in background and kept in RAM
+void tf::HyperGridCache::CacheBlock::evict()
+{
+    /**/tf::debug(tf::LEV3, strprintf("path = \"%s\", changed = %d, visits = %d", _path.c_str(), _hasChanged, _visits).c_str(), __itm__current__function__);
+
+    if(!_imdata)
+        return;
+
+    TERAFLY_TIME_START(CacheOperation)
+    if(_hasChanged)
+    {
+        waitTask();
+        _parent->startTask(new BlockTask(this, BlockTask::PACK, _imdata));
+    }
+    else
+        delete[] _imdata;
+    _imdata = 0;
+    QMutexLocker lock(&_parent->_ioMutex);
+    _parent->_ramUsed -= _dims.size() * bytesPerPixel();
+    TERAFLY_TIME_STOP(CacheOperation, tf::CPU, tf::strprintf("Block \"%s\" evicted", _path.c_str()))
+}
+
+// clear data
+void tf::HyperGridCache::CacheBlock::clear()
+{
+    QMutexLocker lock(&_parent->_ioMutex);
+    if(_imdata)
+    {
+        delete[] _imdata;
+        _parent->_ramUsed -= _dims.size() * bytesPerPixel();
+    }
+    _imdata = 0;
+    _hasChanged = 0;
+
+    // drop compressed data and pending compressions (pending writes complete anyway)
+    _parent->_ramUsed -= _packed.size();
+    _packed.clear();
+    if(_task && _task->_kind == BlockTask::PACK)
+        _task = 0;
 }
 
 // put data into current block (rescaling on-the-fly supported)
@@ -1873,6 +2357,7 @@ void tf::HyperGridCache::CacheBlock::putData(
 
     // increment visit counter
     _visits++;
+    _lastUse = _parent->_tick;
 }
 
 // read data from block and put into image buffer (rescaling on-the-fly supported)
@@ -1946,6 +2431,7 @@ void tf::HyperGridCache::CacheBlock::readData(
 
     // increment visit counter
     _visits++;
+    _lastUse = _parent->_tick;
 }
 
 /*---- END HYPER GRID CACHE BLOCK section --------------------------------------------------------------------------------*/
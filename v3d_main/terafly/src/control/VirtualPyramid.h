@@ -7,6 +7,8 @@
 #if defined(USE_Qt5)
 #include <QtWidgets>
 #endif
+#include <QMutex>
+#include <QWaitCondition>
 
 // Virtual Pyramid class: builds a virtual image pyramid on top of real (unconverted) image data
 class terafly::VirtualPyramid
@@ -233,12 +235,15 @@ class terafly::VirtualPyramidLayer : public iim::VirtualVolume
 // - designed to cache image data during visualization
 // - send/receive image data to/from client
 // - store cached data permanently on the disk
+// - keep RAM within its share of the RAM limit in the settings by evicting the least valuable blocks (by visit and empty counts)
+// - compress evicted blocks and write blocks to disk in background threads (blocks are still loaded synchronously by readData / putData)
 // - supports up to 5D images
 class terafly::HyperGridCache
 {
     public:
 
         class CacheBlock;                           // forward-declaration
+        class BlockTask;                            // forward-declaration
 
     private:
 
@@ -249,6 +254,15 @@ class terafly::HyperGridCache
         std::string _block_fmt;                     // block file format (e.g. ".tif", ".v3draw", ...)
         tf::xyzct<size_t> _nBlocks;                 // hypergrid dimension along X, Y, Z, C (channel), and T (time)
         tf::xyzct<size_t> _dims;                    // image space dimensions along X, Y, Z, C (channel), and T (time)
+        size_t _ramUsed;                            // bytes of block data currently in RAM, uncompressed and compressed (guarded by _ioMutex)
+        float _ramShare;                            // fraction of CSettings::getRamLimitGB() this cache may use (0 = no limit)
+        size_t _tick;                               // incremented at every readData / putData, to protect the blocks just used from eviction
+
+        // background block I/O
+        QMutex _ioMutex;                            // guards block tasks, compressed block data and the members below
+        QWaitCondition _ioDone;                     // signaled whenever a block task finishes
+        int _ioPending;                             // # of block tasks not yet finished
+        std::string _ioError;                       // first error of a background write (thrown by flush)
 
         // object methods
         HyperGridCache(){}                          // disable default constructor
@@ -256,6 +270,9 @@ class terafly::HyperGridCache
         void save() throw (iim::IOException, tf::RuntimeException, iom::exception);		// save to disk
         void init() throw (iim::IOException, tf::RuntimeException, iom::exception);		// init object
         void initHyperGrid() throw (iim::IOException, tf::RuntimeException);            // init 'hypergrid' 5D matrix
+        void evict() throw (iim::IOException, tf::RuntimeException, iom::exception);	// evict blocks until RAM usage is within the share of the RAM limit
+        size_t ramUsed();                                                                // _ramUsed, read under the I/O mutex
+        void startTask(BlockTask* task);                                                 // run a block task on the I/O thread pool
 
     public:
 
@@ -319,6 +336,20 @@ class terafly::HyperGridCache
         // clear all data
         void clear();
 
+        // wait until all background block tasks are done, throw if any write failed
+        void flush() throw (iim::IOException);
+
+        // # of background block tasks (compressions and writes) not yet finished
+        int pendingIO();
+
+        // set the fraction of the RAM limit in the settings this cache may use (VirtualPyramid splits it across its layers)
+        void setRamShare(float share){_ramShare = share;}
+
+        // compressed block codec, used for ".v3dblk" block files and for evicted blocks with unsaved data:
+        // runs of empty (0) voxels are stored as counts, dense blocks are further deflated
+        static QByteArray encodeBlock(const uint8* data, tf::xyzct<size_t> dims);
+        static bool decodeBlock(const QByteArray & packed, uint8* data, tf::xyzct<size_t> dims);
+
 
     public:
 
@@ -338,11 +369,16 @@ class terafly::HyperGridCache
                 bool              _hasChanged;                // whether the data of this block has been modified w.r.t. its original version stored on the disk
                 int               _visits;                  // # of times this block has been visited (load and/or store)
                 size_t            _emptycount;              // # of empty voxels (= 0 with '0' reserved for empty voxels only / values start from 1)
+                size_t            _lastUse;                 // parent tick of the last read / put
+                QByteArray        _packed;                  // compressed data of a block evicted with unsaved changes (guarded by parent I/O mutex)
+                BlockTask*        _task;                    // background task working on this block, if any (guarded by parent I/O mutex)
 
                 // object utility methods
                 CacheBlock(){}                              // disable default constructor
                 void load() throw (iim::IOException, iom::exception, tf::RuntimeException);   // load from disk
                 void updateEmptyCount();                    // update empty voxel count
+                void waitTask();                            // wait until no background task works on this block
+                void write(const uint8* data, const QByteArray & packed) throw (iim::IOException, iom::exception, tf::RuntimeException); // write block file
 
 
             public:
@@ -381,7 +417,11 @@ class terafly::HyperGridCache
                 size_t bytesPerPixel(){return sizeof(unsigned char);}
 
                 // get current RAM usage in Gigabytes
-                float memoryUsed(){return _imdata ? _dims.size() * bytesPerPixel() * 1.0e-9 : 0.0f;}
+                float memoryUsed()
+                {
+                    QMutexLocker lock(&_parent->_ioMutex);
+                    return _imdata ? _dims.size() * bytesPerPixel() * 1.0e-9 : _packed.size() * 1.0e-9;
+                }
 
                 // get maximum RAM usage in Gigabytes
                 float memoryMax(){return _dims.size() * bytesPerPixel() * 1.0e-9;}
@@ -436,17 +476,20 @@ class terafly::HyperGridCache
                     tf::xyz<int> scaling					// scaling along X,Y and Z (> 0 upscaling, < 0 downscaling)
                 ) throw (iim::IOException, iom::exception, tf::RuntimeException);
 
-                // save to disk
-                void save() throw (iim::IOException, iom::exception, tf::RuntimeException);
+                // save to disk (in background if async, see HyperGridCache::flush)
+                void save(bool async = false) throw (iim::IOException, iom::exception, tf::RuntimeException);
+
+                // release the uncompressed data: blocks with unsaved changes are kept compressed in RAM
+                void evict();
+
+                // whether the uncompressed data is in RAM
+                bool isLoaded(){return _imdata != 0;}
 
                 // clear data
-                void clear()
-                {
-                    if(_imdata)
-                        delete[] _imdata;
-                    _imdata = 0;
-                    _hasChanged = 0;
-                }
+                void clear();
+
+                friend class HyperGridCache;
+                friend class BlockTask;
         };
 };
 
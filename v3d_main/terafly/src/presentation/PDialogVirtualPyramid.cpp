@@ -86,6 +86,8 @@ PDialogVirtualPyramid::PDialogVirtualPyramid(const std::string & _volumepath, ii
     block_format_combobox = new QComboBox(this);
     block_format_combobox->addItem(".tif");
     block_format_combobox->addItem(".v3draw");
+    block_format_combobox->addItem(".v3dblk");
+    block_format_combobox->setItemData(2, "compressed blocks (empty space takes almost no disk space)", Qt::ToolTipRole);
 
     lowres_panel = new QGroupBox("Preconversion", this);
 #ifdef Q_OS_LINUX
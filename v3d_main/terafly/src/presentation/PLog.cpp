@@ -45,6 +45,7 @@ PLog::PLog(QWidget *parent) : QDialog(parent)
     appendOpComboBox->addItem(tf::RestoreViewerOperation().name().c_str());
     appendOpComboBox->addItem(tf::AnnotationOperation().name().c_str());
     appendOpComboBox->addItem(tf::ZoominRoiOperation().name().c_str());
+    appendOpComboBox->addItem(tf::CacheOperation().name().c_str());
     appendOpComboBox->addItem(tf::ConverterLoadBlockOperation().name().c_str());
     appendOpComboBox->addItem(tf::ConverterWriteBlockOperation().name().c_str());
     appendOpComboBox->addItem(tf::TiffLoadMetadata().name().c_str());
@@ -68,7 +69,9 @@ PLog::PLog(QWidget *parent) : QDialog(parent)
     appendEverySecondsSpinBox->setMinimum(1);
     appendEverySecondsSpinBox->setMaximum(100);
     appendEverySecondsSpinBox->setValue(1);
-
+    traceButton = new QPushButton();
+    traceButton->setToolTip("Write every operation (with its start time, duration and thread) to a trace file:\n"
+                            "*.json files can be opened with chrome://tracing or ui.perfetto.dev, other files get one JSON object per line.");
 
     autoUpdateCheckBox = new QCheckBox("Auto update");
     autoUpdateCheckBox->setChecked(false);
@@ -109,6 +112,7 @@ PLog::PLog(QWidget *parent) : QDialog(parent)
     appendOpLayout2->addWidget(appendEverySecondsSpinBox, 1);
     logPanelLayout->addLayout(appendOpLayout);
     logPanelLayout->addLayout(appendOpLayout2);
+    logPanelLayout->addWidget(traceButton);
     logPanel->setLayout(logPanelLayout);
     #ifdef Q_OS_LINUX
     logPanel->setStyle(new QWindowsStyle());
@@ -136,7 +140,10 @@ PLog::PLog(QWidget *parent) : QDialog(parent)
     connect(autoUpdateCheckBox, SIGNAL(stateChanged(int)), this, SLOT(autoUpdateCheckBoxChanged(int)));
     connect(updatePushButton, SIGNAL(clicked()), this, SLOT(updatePushButtonClicked()));
     connect(appendCheckBox, SIGNAL(stateChanged(int)), this, SLOT(appendCheckBoxChanged(int)));
+    connect(traceButton, SIGNAL(clicked()), this, SLOT(traceButtonClicked()));
 
+    // a trace may have been requested with the TERAFLY_TRACE environment variable
+    traceButton->setText(tf::CTrace::instance()->isEnabled() ? "Stop trace" : "Trace to file...");
 
     reset();
 }
@@ -230,6 +237,11 @@ void PLog::appendOperation(tf::Operation *op, bool update_time_comps /* = true *
     // add operation to its group vector
     loggedOperations[op->name()].push_back(op);
 
+    // export operation to the trace file, if any
+    if(tf::CTrace::instance()->isEnabled())
+        tf::CTrace::instance()->record(op->name(), tf::comp2str(op->comp), op->message, op->groupID,
+                                       op->milliseconds*1000LL, op->endTime, op->threadID);
+
 //    if( op->name().compare(appendOpComboBox->currentText().toStdString()) == 0 &&
 //        op->comp == tf::str2comp(appendCompComboBox->currentText().toStdString()))
 //        printf("[%05d] %s\n", op->milliseconds, op->message.c_str());
@@ -394,3 +406,33 @@ void PLog::updatePushButtonClicked()
 {
     update();
 }
+
+/**********************************************************************************
+* <traceButton> event handler: starts/stops the export of operations to a trace file
+***********************************************************************************/
+void PLog::traceButtonClicked()
+{
+    if(tf::CTrace::instance()->isEnabled())
+    {
+        QMessageBox::information(this, "Trace", QString("Trace saved to \"") + tf::CTrace::instance()->path().c_str() + "\"");
+        tf::CTrace::instance()->stop();
+    }
+    else
+    {
+        QString path = QFileDialog::getSaveFileName(this, "Save trace", "terafly_trace.json", "Chrome trace (*.json);;JSON lines (*.jsonl)");
+        if(path.isEmpty())
+            return;
+        if(!tf::CTrace::instance()->start(path.toStdString()))
+        {
+            QMessageBox::critical(this, "Error", "Cannot write trace file \"" + path + "\"");
+            return;
+        }
+
+        // operations logged so far come first
+        for(std::map< std::string, std::vector<tf::Operation*> >::iterator it = loggedOperations.begin(); it != loggedOperations.end(); it++)
+            for(int k=0; k< it->second.size(); k++)
+                tf::CTrace::instance()->record(it->first, tf::comp2str(it->second[k]->comp), it->second[k]->message, it->second[k]->groupID,
+                                               it->second[k]->milliseconds*1000LL, it->second[k]->endTime, it->second[k]->threadID);
+    }
+    traceButton->setText(tf::CTrace::instance()->isEnabled() ? "Stop trace" : "Trace to file...");
+}
@@ -31,6 +31,7 @@ class terafly::PLog : public QDialog
         QComboBox *appendCompComboBox;
         QLineEdit *appendToFileLineEdit;
         QSpinBox  *appendEverySecondsSpinBox;
+        QPushButton* traceButton;
         /* ----------- */
         QCheckBox *autoUpdateCheckBox;
         QPushButton* updatePushButton;
@@ -73,6 +74,7 @@ class terafly::PLog : public QDialog
                 delete uniqueInstance;
                 uniqueInstance = 0;
             }
+            tf::CTrace::uninstance();
         }
         PLog(QWidget *parent);
         bool isIoCoreOperationsEnabled(){return enableIoCoreOperations;}
@@ -124,6 +126,11 @@ class terafly::PLog : public QDialog
         ***********************************************************************************/
         void updatePushButtonClicked();
 
+        /**********************************************************************************
+        * <traceButton> event handler: starts/stops the export of operations to a trace file
+        ***********************************************************************************/
+        void traceButtonClicked();
+
         void reset();
 
 };
@@ -246,6 +246,7 @@ HEADERS += ../terafly/src/control/CImageUtils.h
 HEADERS += ../terafly/src/control/V3Dsubclasses.h
 HEADERS += ../terafly/src/control/VirtualPyramid.h
 HEADERS += ../terafly/src/control/COperation.h
+HEADERS += ../terafly/src/control/CTrace.h
 INCLUDEPATH += ../terafly/src/presentation
 HEADERS += ../terafly/src/presentation/PConverter.h
 HEADERS += ../terafly/src/presentation/PDialogImport.h
@@ -280,6 +281,7 @@ SOURCES += ../terafly/src/control/CSettings.cpp
 SOURCES += ../terafly/src/control/CVolume.cpp
 SOURCES += ../terafly/src/control/CImageUtils.cpp
 SOURCES += ../terafly/src/control/COperation.cpp
+SOURCES += ../terafly/src/control/CTrace.cpp
 SOURCES += ../terafly/src/control/V3Dsubclasses.cpp
 SOURCES += ../terafly/src/control/VirtualPyramid.cpp
 SOURCES += ../terafly/src/presentation/PConverter.cpp
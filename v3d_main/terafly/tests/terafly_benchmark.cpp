@@ -0,0 +1,367 @@
+// terafly_benchmark.cpp - headless replay of a TeraFly navigation session on a synthetic tiled volume.
+//
+// Generates (once, in the work directory) a deterministic 8-bit volume, converts it with VolumeConverter to
+// the "Vaa3D raw (tiled, 3D)" multiresolution format TeraFly reads, then replays a navigation script: every
+// step loads the subvolume a viewer would load with VirtualVolume::loadSubvolume_to_UINT8(). Each load is
+// timed, written to a trace (see src/control/CTrace.h) and summed into a checksum of the data read, so that
+// two builds can be compared on the same machine, with the same data and the same requests.
+//
+// The navigation script is either
+//  - a trace recorded by TeraFly (TERAFLY_TRACE=session.jsonl, or the "Trace to file..." button of the log
+//    window): every "Block X=[..) Y=[..) Z=[..), T=[..] loaded from res r" operation is replayed, or
+//  - a text file with one "res V0 V1 H0 H1 D0 D1" line per load, '#' starting a comment (see navigation.txt).
+// Resolution indices are TeraFly's: 0 is the lowest resolution. Requests are clipped to the synthetic volume.
+// Without a script, the replay zooms from the lowest to the highest resolution and then pans.
+//
+// Only the loading and decoding of data is measured here; cache and rendering times come from TeraFly traces.
+//
+// build: against the TeraStitcher core (src/terarepo, or v3d_main/mozak/terafly/src/core) compiled WITHOUT
+// _VAA3D_TERAFLY_PLUGIN_MODE, e.g. from this directory with the core libraries built in <core build dir>:
+//     g++ -O2 -I../src/control -I<core>/imagemanager -I<core>/iomanager -I<core>/volumeconverter
+//         terafly_benchmark.cpp ../src/control/CTrace.cpp -L<core build dir> -lvolumeconverter -limagemanager
+//         -liomanager -ltinyxml -ltiff -lhdf5 -lz $(pkg-config --cflags --libs QtCore)
+//
+// usage: terafly_benchmark <work dir> [-script <file>] [-trace <file>] [-run <label>] [-repeat <n>]
+//                          [-size <V>x<H>x<D>] [-block <n>] [-res <n>] [-baseline <trace.jsonl>] [-tolerance <%>]
+//  -trace     writes every load to a trace (".json": Chrome trace, otherwise JSON lines)
+//  -baseline  JSON lines trace of a previous run: compares the median load time of every resolution with it
+//             and exits with 2 if one is more than -tolerance percent (default: 20) slower
+
+#include "CTrace.h"
+#include "VirtualVolume.h"
+#include "VolumeConverter.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Step
+{
+    int res, V0, V1, H0, H1, D0, D1;
+};
+
+static const char* OPERATION = "OP_REPLAY_LOAD";
+
+// smooth structures plus noise, never 0 (the value TeraFly reserves for missing data)
+static unsigned char voxel(int d, int v, int h)
+{
+    unsigned int x = (unsigned int)(d*73856093 ^ v*19349663 ^ h*83492791);
+    return (unsigned char)(1 + ((v/7 + h/5 + d/3) % 128) + (x % 64));
+}
+
+static string resDir(const string & dir, int V, int H, int D, int r)
+{
+    char name[128];
+    sprintf(name, "/RES(%dx%dx%d)", V >> r, H >> r, D >> r);
+    return dir + name;
+}
+
+// writes the synthetic volume as a single .v3draw file (header, then x fastest, 1 channel)
+static bool writeRaw(const string & path, int V, int H, int D)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f)
+        return false;
+    const char* key = "raw_image_stack_by_hpeng";
+    char endian = 'L';
+    short datatype = 1;
+    int sz[4] = {H, V, D, 1};
+    bool ok = fwrite(key, 1, strlen(key), f) == strlen(key) && fwrite(&endian, 1, 1, f) == 1 &&
+              fwrite(&datatype, 2, 1, f) == 1 && fwrite(sz, 4, 4, f) == 4;
+    vector<unsigned char> slice((size_t)V*H);
+    for(int d=0; d<D && ok; d++)
+    {
+        for(int v=0; v<V; v++)
+            for(int h=0; h<H; h++)
+                slice[(size_t)v*H + h] = voxel(d, v, h);
+        ok = fwrite(&slice[0], 1, slice.size(), f) == slice.size();
+    }
+    return fclose(f) == 0 && ok;
+}
+
+// (re)generates the tiled volume unless the work directory already holds one with the same parameters
+static void prepareVolume(const string & work, int V, int H, int D, int block, int nres)
+{
+    char stamp[256];
+    sprintf(stamp, "%dx%dx%d block %d resolutions %d", V, H, D, block, nres);
+    string stamp_path = work + "/synthetic.txt";
+    ifstream in(stamp_path.c_str());
+    string line;
+    if(in && getline(in, line) && line == stamp)
+        return;
+    in.close();
+
+    printf("generating %s in \"%s\"...\n", stamp, work.c_str());
+    mkdir(work.c_str(), 0755);
+    string raw = work + "/synthetic.v3draw";
+    if(!writeRaw(raw, V, H, D))
+        throw iim::IOException("cannot write \"" + raw + "\"");
+
+    bool resolutions[S_MAX_MULTIRES] = {false};
+    for(int r=0; r<nres; r++)
+        resolutions[r] = true;
+    mkdir((work + "/volume").c_str(), 0755);
+    VolumeConverter vc;
+    vc.setSrcVolume(raw.c_str(), iim::RAW_FORMAT.c_str(), UINT8_REPRESENTATION);
+    vc.convertTo(work + "/volume", iim::TILED_FORMAT, 8, false, resolutions, block, block, block);
+    remove(raw.c_str());
+
+    ofstream out(stamp_path.c_str());
+    out << stamp << "\n";
+}
+
+// a "Block X=[H0, H1) Y=[V0, V1) Z=[D0, D1), T=[t0, t1] loaded from res r" message anywhere in the line
+static bool parseLoad(const string & line, Step & s)
+{
+    size_t pos = line.find("Block X=[");
+    int t0, t1;
+    return pos != string::npos && line.find("loaded from res", pos) != string::npos &&
+           sscanf(line.c_str() + pos, "Block X=[%d, %d) Y=[%d, %d) Z=[%d, %d), T=[%d, %d] loaded from res %d",
+                  &s.H0, &s.H1, &s.V0, &s.V1, &s.D0, &s.D1, &t0, &t1, &s.res) == 9;
+}
+
+static vector<Step> readScript(const string & path)
+{
+    ifstream f(path.c_str());
+    if(!f)
+        throw iim::IOException("cannot read navigation script \"" + path + "\"");
+    vector<Step> steps;
+    string line;
+    while(getline(f, line))
+    {
+        Step s;
+        if(parseLoad(line, s))
+        {
+            steps.push_back(s);
+            continue;
+        }
+        size_t hash = line.find('#');
+        if(hash != string::npos)
+            line.erase(hash);
+        if(sscanf(line.c_str(), "%d %d %d %d %d %d %d", &s.res, &s.V0, &s.V1, &s.H0, &s.H1, &s.D0, &s.D1) == 7)
+            steps.push_back(s);
+    }
+    return steps;
+}
+
+// zoom in from the lowest resolution to the highest, centered, then pan the highest one by half views along X and Y
+static vector<Step> defaultScript(const vector<iim::VirtualVolume*> & vols, int view)
+{
+    vector<Step> steps;
+    for(int r=0; r<(int)vols.size(); r++)
+    {
+        Step s = {r, 0, 0, 0, 0, 0, 0};
+        s.V0 = max(0, vols[r]->getDIM_V()/2 - view/2);  s.V1 = s.V0 + view;
+        s.H0 = max(0, vols[r]->getDIM_H()/2 - view/2);  s.H1 = s.H0 + view;
+        s.D0 = max(0, vols[r]->getDIM_D()/2 - view/2);  s.D1 = s.D0 + view;
+        steps.push_back(s);
+    }
+    iim::VirtualVolume* vol = vols.back();
+    for(int axis=0; axis<2; axis++)
+    {
+        Step s = steps.back();
+        int dim = axis == 0 ? vol->getDIM_H() : vol->getDIM_V();
+        int & start = axis == 0 ? s.H0 : s.V0;
+        int & end   = axis == 0 ? s.H1 : s.V1;
+        for(int pos = 0; pos + view <= dim || pos == 0; pos += view/2)
+        {
+            start = pos;
+            end = pos + view;
+            steps.push_back(s);
+        }
+    }
+    return steps;
+}
+
+static double percentile(vector<double> v, double p)
+{
+    if(v.empty())
+        return 0;
+    sort(v.begin(), v.end());
+    return v[min(v.size()-1, (size_t)(p*(v.size()-1) + 0.5))];
+}
+
+// median load time (ms) of every resolution in a JSON lines (or Chrome) trace of this benchmark
+static map<int, double> baselineMedians(const string & path)
+{
+    ifstream f(path.c_str());
+    if(!f)
+        throw iim::IOException("cannot read baseline \"" + path + "\"");
+    map<int, vector<double> > times;
+    string line;
+    while(getline(f, line))
+    {
+        Step s;
+        if(line.find(OPERATION) == string::npos || !parseLoad(line, s))
+            continue;
+        size_t pos = line.find("\"dur_us\":");                        // JSON lines
+        if(pos != string::npos)
+            pos += strlen("\"dur_us\":");
+        else if((pos = line.find("\"dur\":")) != string::npos)     // Chrome trace
+            pos += strlen("\"dur\":");
+        if(pos == string::npos || !isdigit(line[pos]))
+            continue;
+        times[s.res].push_back(atof(line.c_str() + pos) / 1000.0);
+    }
+    map<int, double> medians;
+    for(map<int, vector<double> >::iterator it = times.begin(); it != times.end(); it++)
+        medians[it->first] = percentile(it->second, 0.5);
+    return medians;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s <work dir> [-script <file>] [-trace <file>] [-run <label>] [-repeat <n>]\n"
+                    "       [-size <V>x<H>x<D>] [-block <n>] [-res <n>] [-baseline <trace.jsonl>] [-tolerance <%%>]\n", argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || argv[1][0] == '-')
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    string work = argv[1], script, trace, run, baseline;
+    int V = 1024, H = 1024, D = 256, block = 256, nres = 4, repeat = 3, view = 256;
+    double tolerance = 20;
+    for(int i=2; i<argc; i++)
+    {
+        string opt = argv[i];
+        if(i+1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* val = argv[++i];
+        if(opt == "-script")            script = val;
+        else if(opt == "-trace")        trace = val;
+        else if(opt == "-run")          run = val;
+        else if(opt == "-baseline")     baseline = val;
+        else if(opt == "-repeat")       repeat = atoi(val);
+        else if(opt == "-block")        block = atoi(val);
+        else if(opt == "-res")          nres = atoi(val);
+        else if(opt == "-tolerance")    tolerance = atof(val);
+        else if(opt != "-size" || sscanf(val, "%dx%dx%d", &V, &H, &D) != 3)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(V < 1 || H < 1 || D < 1 || block < 1 || nres < 1 || nres > S_MAX_MULTIRES || repeat < 1 || (D >> (nres-1)) < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        prepareVolume(work, V, H, D, block, nres);
+
+        // lowest resolution first, as TeraFly (CImport) sorts them
+        vector<iim::VirtualVolume*> vols;
+        for(int r=nres-1; r>=0; r--)
+            vols.push_back(iim::VirtualVolume::instance_format(resDir(work + "/volume", V, H, D, r).c_str(), iim::TILED_FORMAT));
+
+        vector<Step> steps = script.empty() ? defaultScript(vols, view) : readScript(script);
+        if(steps.empty())
+            throw iim::IOException("no load found in \"" + script + "\"");
+
+        if(!trace.empty() && !terafly::CTrace::instance()->start(trace, run))
+            throw iim::IOException("cannot write trace \"" + trace + "\"");
+
+        map<int, vector<double> > times;  // ms per load, by resolution
+        map<int, double> bytes;
+        unsigned long long checksum = 0;
+        int skipped = 0;
+        for(int pass=0; pass<repeat; pass++)
+        {
+            long long pass_start = terafly::CTrace::now();
+            for(size_t i=0; i<steps.size(); i++)
+            {
+                Step s = steps[i];
+                if(s.res < 0 || s.res >= (int)vols.size())
+                {
+                    skipped += pass == 0;
+                    continue;
+                }
+                iim::VirtualVolume* vol = vols[s.res];
+                s.V0 = max(0, s.V0);  s.V1 = min((int)vol->getDIM_V(), s.V1);
+                s.H0 = max(0, s.H0);  s.H1 = min((int)vol->getDIM_H(), s.H1);
+                s.D0 = max(0, s.D0);  s.D1 = min((int)vol->getDIM_D(), s.D1);
+                if(s.V0 >= s.V1 || s.H0 >= s.H1 || s.D0 >= s.D1)
+                {
+                    skipped += pass == 0;
+                    continue;
+                }
+
+                long long t0 = terafly::CTrace::now();
+                iim::uint8* data = vol->loadSubvolume_to_UINT8(s.V0, s.V1, s.H0, s.H1, s.D0, s.D1);
+                long long t1 = terafly::CTrace::now();
+
+                size_t n = (size_t)(s.V1-s.V0) * (s.H1-s.H0) * (s.D1-s.D0);
+                for(size_t k=0; k<n; k++)
+                    checksum += data[k];
+                delete[] data;
+
+                char msg[256];
+                sprintf(msg, "Block X=[%d, %d) Y=[%d, %d) Z=[%d, %d), T=[0, 0] loaded from res %d",
+                        s.H0, s.H1, s.V0, s.V1, s.D0, s.D1, s.res);
+                terafly::CTrace::instance()->record(OPERATION, "IO", msg, pass, t1-t0, t1, terafly::CTrace::currentThread());
+                times[s.res].push_back((t1-t0) / 1000.0);
+                bytes[s.res] += n;
+            }
+            printf("pass %d: %.3f s\n", pass+1, (terafly::CTrace::now() - pass_start) / 1e6);
+        }
+        terafly::CTrace::instance()->stop();
+        if(skipped)
+            printf("%d of %d loads skipped: resolution not available or outside the volume\n", skipped, (int)steps.size());
+
+        map<int, double> base;
+        if(!baseline.empty())
+            base = baselineMedians(baseline);
+
+        bool regression = false;
+        printf("%4s %18s %6s %10s %10s %10s %10s%s\n", "res", "dims (VxHxD)", "loads", "mean ms", "p50 ms", "p95 ms", "MB/s",
+               base.empty() ? "" : "   p50 vs baseline");
+        for(map<int, vector<double> >::iterator it = times.begin(); it != times.end(); it++)
+        {
+            double sum = 0;
+            for(size_t k=0; k<it->second.size(); k++)
+                sum += it->second[k];
+            double p50 = percentile(it->second, 0.5);
+            char dims[64];
+            sprintf(dims, "%dx%dx%d", vols[it->first]->getDIM_V(), vols[it->first]->getDIM_H(), vols[it->first]->getDIM_D());
+            printf("%4d %18s %6d %10.3f %10.3f %10.3f %10.1f", it->first, dims, (int)it->second.size(), sum/it->second.size(),
+                   p50, percentile(it->second, 0.95), sum > 0 ? bytes[it->first] / (sum/1000) / 1e6 : 0.0);
+            if(base.count(it->first) && base[it->first] > 0)
+            {
+                double change = (p50 / base[it->first] - 1) * 100;
+                bool slower = change > tolerance;
+                regression = regression || slower;
+                printf("   %+7.1f%%%s", change, slower ? "  REGRESSION" : "");
+            }
+            printf("\n");
+        }
+        printf("checksum %llu\n", checksum);
+
+        for(size_t r=0; r<vols.size(); r++)
+            delete vols[r];
+        terafly::CTrace::uninstance();
+        return regression ? 2 : 0;
+    }
+    catch(iim::IOException & e)
+    {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+}
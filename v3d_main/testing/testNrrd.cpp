@@ -0,0 +1,287 @@
+#include "../basic_c_fun/v3d_basicdatatype.h"
+#include "../io/v3d_nrrd.h"
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <zlib.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/* v3d_nrrd: write/read round trips, hand-written raw and gzip headers (attached and detached,
+ * foreign endian, line and byte skips), and sub-regions with their origin, natively and via teem */
+
+static int nFailed = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        nFailed++;
+    }
+}
+
+static std::vector<std::string> tempFiles;
+
+static std::string tempFile(const char * name)
+{
+    std::string path = QDir::temp().filePath(QString("testNrrd_") + name).toLocal8Bit().constData();
+    tempFiles.push_back(path);
+    return path;
+}
+
+static void writeFile(const std::string & path, const std::string & header, const std::vector<unsigned char> & body)
+{
+    FILE * f = fopen(path.c_str(), "wb");
+    fwrite(header.data(), 1, header.size(), f);
+    if (!body.empty())
+        fwrite(&body[0], 1, body.size(), f);
+    fclose(f);
+}
+
+static std::vector<unsigned char> gzipped(const std::vector<unsigned char> & data)
+{
+    std::vector<unsigned char> out(compressBound(data.size()) + 64);
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    deflateInit2(&strm, 6, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY);
+    strm.next_in = (Bytef *)&data[0];
+    strm.avail_in = data.size();
+    strm.next_out = &out[0];
+    strm.avail_out = out.size();
+    deflate(&strm, Z_FINISH);
+    out.resize(out.size() - strm.avail_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+static bool hostIsLittleEndian()
+{
+    unsigned short v = 1;
+    return *((unsigned char *)&v) == 1;
+}
+
+// random voxels laid out x, y, z, c
+struct Volume
+{
+    V3DLONG sz[4];
+    int unitSize;
+    std::vector<unsigned char> data;
+
+    Volume(V3DLONG sx, V3DLONG sy, V3DLONG sz_, V3DLONG sc, int unitSizeParam) : unitSize(unitSizeParam)
+    {
+        sz[0] = sx;  sz[1] = sy;  sz[2] = sz_;  sz[3] = sc;
+        data.resize(sx*sy*sz_*sc*unitSize);
+        for (size_t i=0; i<data.size(); i++)
+            data[i] = (unsigned char) rand();
+        if (unitSize==4) // keep the floats finite
+            for (size_t i=3; i<data.size(); i+=4)
+                data[hostIsLittleEndian() ? i : i-3] &= 0x3f;
+    }
+    const unsigned char * at(V3DLONG x, V3DLONG y, V3DLONG z, V3DLONG c) const
+    {
+        return &data[(((c*sz[2] + z)*sz[1] + y)*sz[0] + x)*unitSize];
+    }
+    std::vector<unsigned char> byteSwapped() const
+    {
+        std::vector<unsigned char> out(data);
+        for (size_t i=0; i<out.size(); i+=unitSize)
+            for (int k=0; k<unitSize/2; k++)
+                std::swap(out[i+k], out[i+unitSize-1-k]);
+        return out;
+    }
+};
+
+// where voxel 0 is and the space direction of the x, y and z axes, as the reader should report them
+struct Geometry
+{
+    double origin[3];
+    double direction[3][3];
+};
+
+static Geometry diagonal(const float pixelsz[3], const float origin[3])
+{
+    Geometry g;
+    for (int i=0; i<3; i++)
+    {
+        g.origin[i] = origin[i];
+        for (int j=0; j<3; j++)
+            g.direction[i][j] = (i==j) ? pixelsz[i] : 0;
+    }
+    return g;
+}
+
+static bool regionMatches(const Volume & v, const V3DLONG start[4], const V3DLONG size[4], const unsigned char * got)
+{
+    for (V3DLONG c=0; c<size[3]; c++)
+        for (V3DLONG z=0; z<size[2]; z++)
+            for (V3DLONG y=0; y<size[1]; y++)
+                for (V3DLONG x=0; x<size[0]; x++, got+=v.unitSize)
+                    if (memcmp(v.at(start[0]+x, start[1]+y, start[2]+z, start[3]+c), got, v.unitSize))
+                        return false;
+    return true;
+}
+
+// reads the whole file and random regions of it and compares them with v and g
+static void checkFile(const char * what, const std::string & path, const Volume & v, const Geometry & g, int nRegions)
+{
+    char msg[256];
+    for (int k=-1; k<nRegions; k++)
+    {
+        V3DLONG start[4] = {0, 0, 0, 0}, size[4];
+        for (int i=0; i<4; i++)
+            size[i] = v.sz[i];
+        if (k>=0)
+            for (int i=0; i<4; i++)
+            {
+                start[i] = rand() % v.sz[i];
+                size[i] = 1 + rand() % (v.sz[i] - start[i]);
+            }
+        bool bToEnd = (k==0); // no region size: up to the end of each axis
+        if (bToEnd)
+            for (int i=0; i<4; i++)
+                size[i] = v.sz[i] - start[i];
+
+        unsigned char * data1d = 0;
+        V3DLONG * sz = 0;
+        int datatype = 0;
+        float pixelsz[4], origin[3];
+        bool bOk = (k<0) ? read_nrrd_with_pxinfo(path.c_str(), data1d, sz, datatype, pixelsz, origin)
+                         : read_nrrd_region(path.c_str(), start, bToEnd ? 0 : size, data1d, sz, datatype, pixelsz, origin);
+        sprintf(msg, "%s: region %ld,%ld,%ld,%ld of %ldx%ldx%ldx%ld", what, (long)start[0], (long)start[1], (long)start[2], (long)start[3],
+                (long)size[0], (long)size[1], (long)size[2], (long)size[3]);
+        check(bOk, msg);
+        if (!bOk)
+            continue;
+        check(datatype==v.unitSize && sz[0]==size[0] && sz[1]==size[1] && sz[2]==size[2] && sz[3]==size[3], msg);
+        check(regionMatches(v, start, size, data1d), msg);
+        for (int i=0; i<3; i++)
+        {
+            double len = sqrt(g.direction[i][0]*g.direction[i][0] + g.direction[i][1]*g.direction[i][1] + g.direction[i][2]*g.direction[i][2]);
+            double o = g.origin[i] + start[0]*g.direction[0][i] + start[1]*g.direction[1][i] + start[2]*g.direction[2][i];
+            check(fabs(pixelsz[i] - len) < 1e-5, msg);
+            check(fabs(origin[i] - o) < 1e-3, msg);
+        }
+        delete []data1d;
+        delete []sz;
+    }
+}
+
+static std::string sizesLine(const Volume & v)
+{
+    char line[128];
+    if (v.sz[3]>1)
+        sprintf(line, "sizes: %ld %ld %ld %ld\n", (long)v.sz[0], (long)v.sz[1], (long)v.sz[2], (long)v.sz[3]);
+    else
+        sprintf(line, "sizes: %ld %ld %ld\n", (long)v.sz[0], (long)v.sz[1], (long)v.sz[2]);
+    return line;
+}
+
+int main()
+{
+    srand(50);
+    const std::string foreignEndian = hostIsLittleEndian() ? "endian: big\n" : "endian: little\n";
+
+    // round trips through write_nrrd_with_pxinfo(), attached and detached, over several deflate blocks
+    {
+        float pixelsz[4] = {0.5f, 0.25f, 2.0f, 1.0f}, origin[3] = {10.0f, -20.5f, 3.25f};
+        Volume bytes(61, 47, 23, 1, 1), shorts(256, 160, 9, 2, 2), floats(33, 20, 17, 3, 4);
+        int datatypes[3] = {V3D_UINT8, V3D_UINT16, V3D_FLOAT32};
+        Volume * volumes[3] = {&bytes, &shorts, &floats};
+        const char * names[3][2] = {{"u8.nrrd", "u8.nhdr"}, {"u16.nrrd", "u16.nhdr"}, {"f32.nrrd", "f32.nhdr"}};
+        const char * dataFiles[3] = {"u8.raw.gz", "u16.raw.gz", "f32.raw.gz"};
+        for (int t=0; t<3; t++)
+            for (int detached=0; detached<2; detached++)
+            {
+                std::string path = tempFile(names[t][detached]);
+                if (detached)
+                    tempFile(dataFiles[t]); // written next to the .nhdr
+                check(write_nrrd_with_pxinfo(path.c_str(), &volumes[t]->data[0], volumes[t]->sz, datatypes[t], pixelsz, origin), names[t][detached]);
+                checkFile(names[t][detached], path, *volumes[t], diagonal(pixelsz, origin), 12);
+            }
+    }
+
+    // raw data after the header, in the other byte order, with oblique space directions
+    Volume v(40, 30, 12, 2, 2);
+    Geometry oblique = {{1, 2, 3}, {{0, 2, 0}, {1.5, 0, 0}, {0, 0.5, 3}}};
+    const std::string spaceHeader = "space: right-anterior-superior\n"
+                                    "space directions: (0,2,0) (1.5,0,0) (0,0.5,3) none\n"
+                                    "kinds: space space space list\n"
+                                    "space origin: (1,2,3)\n";
+    std::string header = "NRRD0004\n# comment\ntype: unsigned short\ndimension: 4\n" + sizesLine(v) + spaceHeader
+                         + foreignEndian + "encoding: raw\n\n";
+    std::string path = tempFile("raw_swapped.nrrd");
+    writeFile(path, header, v.byteSwapped());
+    checkFile("attached raw, foreign endian", path, v, oblique, 20);
+
+    // the same data gzipped after the header
+    header = "NRRD0004\ntype: unsigned short\ndimension: 4\n" + sizesLine(v) + spaceHeader + foreignEndian + "encoding: gzip\n\n";
+    path = tempFile("gzip_swapped.nrrd");
+    writeFile(path, header, gzipped(v.byteSwapped()));
+    checkFile("attached gzip, foreign endian", path, v, oblique, 20);
+
+    // detached raw data behind two text lines and 17 bytes, spacings instead of space directions
+    Volume b(50, 9, 31, 1, 1);
+    float spacings[3] = {0.75f, 1.0f, 4.0f}, noOrigin[3] = {0, 0, 0};
+    std::vector<unsigned char> body(17, 0xee);
+    body.insert(body.begin(), (const unsigned char *)"first line\nsecond\n", (const unsigned char *)"first line\nsecond\n" + 18);
+    body.insert(body.end(), b.data.begin(), b.data.end());
+    writeFile(tempFile("skips.raw"), "", body);
+    header = "NRRD0004\ntype: uchar\ndimension: 3\n" + sizesLine(b) + "spacings: 0.75 1 4\nencoding: raw\n"
+             "line skip: 2\nbyte skip: 17\ndata file: testNrrd_skips.raw\n";
+    path = tempFile("skips.nhdr");
+    writeFile(path, header, std::vector<unsigned char>());
+    checkFile("detached raw, line and byte skip", path, b, diagonal(spacings, noOrigin), 20);
+
+    // "byte skip: -1": the data is the end of the file, whatever comes before it
+    body.assign(1234, 0x55);
+    body.insert(body.end(), b.data.begin(), b.data.end());
+    writeFile(tempFile("tail.raw"), "", body);
+    header = "NRRD0004\ntype: uchar\ndimension: 3\n" + sizesLine(b) + "spacings: 0.75 1 4\nencoding: raw\n"
+             "byte skip: -1\ndata file: testNrrd_tail.raw\n";
+    path = tempFile("tail.nhdr");
+    writeFile(path, header, std::vector<unsigned char>());
+    checkFile("detached raw, data at the end of the file", path, b, diagonal(spacings, noOrigin), 10);
+
+    // detached gzip whose decompressed data starts with 33 bytes to skip
+    body.assign(33, 0x77);
+    std::vector<unsigned char> swapped = v.byteSwapped();
+    body.insert(body.end(), swapped.begin(), swapped.end());
+    writeFile(tempFile("skip.raw.gz"), "", gzipped(body));
+    header = "NRRD0004\ntype: ushort\ndimension: 4\n" + sizesLine(v) + spaceHeader + foreignEndian + "encoding: gzip\n"
+             "byte skip: 33\ndata file: testNrrd_skip.raw.gz\n";
+    path = tempFile("gzip_skip.nhdr");
+    writeFile(path, header, std::vector<unsigned char>());
+    checkFile("detached gzip, byte skip", path, v, oblique, 20);
+
+    // colour first is left to teem, which moves it last; its regions start where the native ones would
+    Volume rgb(19, 14, 6, 3, 1);
+    std::vector<unsigned char> interleaved(rgb.data.size());
+    for (V3DLONG z=0, k=0; z<rgb.sz[2]; z++)
+        for (V3DLONG y=0; y<rgb.sz[1]; y++)
+            for (V3DLONG x=0; x<rgb.sz[0]; x++)
+                for (V3DLONG c=0; c<3; c++)
+                    interleaved[k++] = *rgb.at(x, y, z, c);
+    header = "NRRD0004\ntype: uchar\ndimension: 4\nsizes: 3 19 14 6\n"
+             "space: right-anterior-superior\n"
+             "space directions: none (0,2,0) (1.5,0,0) (0,0.5,3)\n"
+             "kinds: RGB-color space space space\n"
+             "space origin: (1,2,3)\n"
+             "encoding: raw\n\n";
+    path = tempFile("rgb_first.nrrd");
+    writeFile(path, header, interleaved);
+    checkFile("colour first, through teem", path, rgb, oblique, 20);
+
+    for (size_t i=0; i<tempFiles.size(); i++)
+        QFile::remove(QString::fromLocal8Bit(tempFiles[i].c_str()));
+
+    printf("%s\n", nFailed ? "testNrrd FAILED" : "testNrrd passed");
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#include "../3drenderer/screen_pick_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* ScreenPickCache: picks against the brute-force projection loop, and reuse until invalidate() */
+
+static int nFailed = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        nFailed++;
+    }
+}
+
+static V3DLONG bruteNearest(const NeuronTree & tree, double cx, double cy,
+                            const double mv[16], const double proj[16], const int vp[4], double & best_dist)
+{
+    V3DLONG best_ind = -1;
+    best_dist = -1;
+    for (int i=0; i<tree.listNeuron.size(); i++)
+    {
+        const NeuronSWC & p = tree.listNeuron.at(i);
+        double px, py, pz;
+        ScreenPickCache::projectPoint(p.x, p.y, p.z, mv, proj, vp, px, py, pz);
+        double d = (px-cx)*(px-cx)+(py-cy)*(py-cy);
+        if (best_ind<0 || d<best_dist) {best_dist = d; best_ind = i;}
+    }
+    return best_ind;
+}
+
+int main()
+{
+    // a camera looking down -z at a 512^3 volume: column-major modelview and perspective, 800x600 viewport
+    double mv[16] = {0.002,0,0,0,  0,0.002,0,0,  0,0,0.002,0,  -0.5,-0.5,-3,1};
+    double n = 1, f = 10;
+    double proj[16] = {1.5,0,0,0,  0,2,0,0,  0,0,-(f+n)/(f-n),-1,  0,0,-2*f*n/(f-n),0};
+    int vp[4] = {0, 0, 800, 600};
+
+    srand(33);
+    NeuronTree tree;
+    for (int i=0; i<3000; i++)
+    {
+        NeuronSWC s;
+        s.n = i+1;  s.pn = i;
+        s.x = rand()%512;  s.y = rand()%512;  s.z = rand()%512;
+        tree.listNeuron.append(s);
+    }
+
+    ScreenPickCache pick;
+    check(pick.update(tree, mv, proj, vp), "projects every node");
+    check(pick.size()==tree.listNeuron.size(), "cache size");
+
+    for (int k=0; k<300; k++)
+    {
+        double cx = rand()%900 - 50, cy = rand()%700 - 50, d0, d1;
+        V3DLONG i0 = pick.nearest(cx, cy, d0), i1 = bruteNearest(tree, cx, cy, mv, proj, vp, d1);
+        check(i0==i1 && d0==d1, "nearest node matches the brute-force loop");
+
+        std::set<int> got, expect;
+        pick.within(cx, cy, 40, got);
+        for (int i=0; i<tree.listNeuron.size(); i++)
+        {
+            const NeuronSWC & p = tree.listNeuron.at(i);
+            double px, py, pz;
+            ScreenPickCache::projectPoint(p.x, p.y, p.z, mv, proj, vp, px, py, pz);
+            if ((px-cx)*(px-cx)+(py-cy)*(py-cy) < 40*40) expect.insert(i);
+        }
+        check(got==expect, "nodes within a radius match the brute-force loop");
+    }
+
+    // hit: until invalidate() the projection is reused, so a node moved in place is still found where it was
+    const int moved = 1234;
+    double ox, oy, oz, d;
+    ScreenPickCache::projectPoint(tree.listNeuron[moved].x, tree.listNeuron[moved].y, tree.listNeuron[moved].z, mv, proj, vp, ox, oy, oz);
+    tree.listNeuron[moved].x = tree.listNeuron[moved].y = tree.listNeuron[moved].z = 600; // off the volume
+    pick.update(tree, mv, proj, vp);
+    check(pick.nearest(ox, oy, d)==moved && d<1e-12, "no re-projection without invalidate()");
+
+    // miss: after invalidate() the edit is seen
+    pick.invalidate();
+    pick.update(tree, mv, proj, vp);
+    check(pick.nearest(ox, oy, d)!=moved, "moved node is gone from its old place after invalidate()");
+    double nx, ny, nz, d1;
+    ScreenPickCache::projectPoint(600, 600, 600, mv, proj, vp, nx, ny, nz);
+    check(pick.nearest(nx, ny, d)==moved && d<1e-12, "moved node is found at its new place after invalidate()");
+
+    // a camera change is also an invalidate() of the owner
+    mv[12] = -0.4;
+    pick.invalidate();
+    pick.update(tree, mv, proj, vp);
+    check(pick.nearest(200, 300, d)==bruteNearest(tree, 200, 300, mv, proj, vp, d1) && d==d1, "new camera after invalidate()");
+
+    // a node appended without invalidate() changes the count, which re-projects
+    NeuronSWC s;
+    s.x = s.y = s.z = -300;
+    tree.listNeuron.append(s);
+    pick.update(tree, mv, proj, vp);
+    ScreenPickCache::projectPoint(-300, -300, -300, mv, proj, vp, nx, ny, nz);
+    check(pick.nearest(nx, ny, d)==tree.listNeuron.size()-1, "appended node is projected");
+
+    // a node behind the camera plane cannot be projected, like gluProject()
+    NeuronTree bad;
+    s.x = s.y = 0;  s.z = 1500; // w = 0
+    bad.listNeuron.append(s);
+    ScreenPickCache badPick;
+    check(!badPick.update(bad, mv, proj, vp) && badPick.nearest(0, 0, d)<0, "unprojectable node fails the update");
+
+    printf("%s\n", nFailed ? "testScreenPickCache FAILED" : "testScreenPickCache passed");
+    return nFailed ? 1 : 0;
+}
@@ -39,6 +39,7 @@ Peng, H, Ruan, Z., Atasoy, D., and Sternson, S. (2010) “Automatic reconstructi
 #include "import_images_tool_dialog.h"
 
 #include "../io/io_bioformats.h"
+#include "../multithreadimageIO/v3d_multithreadimageIO.h"
 
 bool XFormWidget::importGeneralImageFile(QString filename)
 {
@@ -70,116 +71,18 @@ bool XFormWidget::importGeneralImgSeries(const QStringList & mylist, TimePackTyp
   	imgData = new My4DImage;
 	if (!imgData)  return false;
 
-	//now we can simply read files one by one, and arrange them in term of (1) the color channel and (2) z-planes. At this stage we need to verify each plane has the same size, and NOT colored image!!
-
-    V3DLONG nsz0=0, nsz1=0;
-    ImagePixelType cur_datatype=V3D_UNKNOWN, ndatatype=V3D_UNKNOWN;
-    V3DLONG ncolors=0, nthick=0;
-    V3DLONG pack_color=0, pack_z=0;
-
-    for (V3DLONG i = 0; i < ntime; ++i)
+	//now read the files in parallel, and arrange them in term of (1) the color channel and (2) z-planes. Each plane is verified to have the same size and type as the first file.
+	QString errmsg;
+	v3d_imageseries_import_stats stats;
+	if (!v3d_importImageSeries_multithreaded(mylist, timepacktype, imgData, errmsg, &stats))
 	{
-        QString tmpfileInfo = mylist.at(i);
-        printf("importing %i file: {%s}\n", i, qPrintable(tmpfileInfo));
-
-		unsigned char * cur_data1d=0;
-		V3DLONG * cur_sz=0;
-		if (!readSingleImageFile(tmpfileInfo.toUtf8().data(), cur_data1d, cur_sz, cur_datatype))
-		{
-			v3d_msg("Error occurs in reading the file. Exit importing.\n");
-			return false;
-		}
-		if (!cur_data1d || !cur_sz)
-		{
-			v3d_msg("Error occurs in reading the file. Exit importing.\n");
-			return false;
-		}
-
-		//-----------------------------------------------------------------------
-		// 090731 RZC: (3D time series --> 4D color image) packed time in Z dim.
-		//-----------------------------------------------------------------------
-
-		if (i==0) ncolors = cur_sz[3];
-		if (cur_sz[3]<=0 || cur_sz[3]!=ncolors)
-		{
-			printf("The current file has invalid or different colors [=%ld] from first section [=%ld]. Exit importing.\n", cur_sz[3], ncolors);
-			v3d_msg("The current file has invalid or different colors\n");
-			if (cur_data1d) {delete []cur_data1d; cur_data1d=0;}
-			if (cur_sz) {delete []cur_sz; cur_sz=0;}
-			return false;
-		}
-		if (i==0) ndatatype = cur_datatype;
-		if (cur_datatype != ndatatype)
-		{
-			printf("The current file has different data type [=%ld] from first section [=%ld]. Exit importing.\n", cur_datatype, ndatatype);
-			v3d_msg("The current file has different data type\n");
-			if (cur_data1d) {delete []cur_data1d; cur_data1d=0;}
-			if (cur_sz) {delete []cur_sz; cur_sz=0;}
-			return false;
-		}
-
-
-		if (i==0)
-		{
-			nsz0 = cur_sz[0]; nsz1 = cur_sz[1]; nthick = cur_sz[2];
-			if (timepacktype==TIME_PACK_Z)
-			{
-				pack_z     = nthick*ntime;
-				pack_color = ncolors;
-			}
-			else // TIME_PACK_C
-			{
-				pack_z     = nthick;
-				pack_color = ncolors*ntime;
-			}
-
-			if (imgData->createImage(nsz0, nsz1, pack_z, pack_color, cur_datatype)==false)
-			{
-				v3d_msg("Fail to allocate memory for the image stack. Exit importing.\n");
-				return false;
-			}
-			imgData->setTDim( ntime );
-			imgData->setTimePackType( timepacktype );
-		}
-		else
-		{
-			if (cur_sz[0]!=nsz0 || cur_sz[1]!=nsz1 || cur_sz[2]!=nthick)
-			{
-				printf("The current image has a different [width, height, thick]=[%ld, %ld, %ld] from the first section [%ld, %ld, %ld]. Exit importing.\n",
-					   cur_sz[0], cur_sz[1], cur_sz[2], nsz0, nsz1, nthick);
-				v3d_msg("The current image has a different [width, height, thick]\n");
-				if (cur_data1d) {delete []cur_data1d; cur_data1d=0;}
-				if (cur_sz) {delete []cur_sz; cur_sz=0;}
-				return false;
-			}
-		}
-
-		//now copy data of different planes into the 5D stack
-		V3DLONG element_bytes = imgData->getUnitBytes();
-		V3DLONG cur_time = i;
-		V3DLONG block_size = (nthick*nsz0*nsz1)*(element_bytes);
-		for (V3DLONG cur_ch=0; cur_ch<ncolors; cur_ch++)
-		{
-			unsigned char * cur_data1d_block = cur_data1d + (cur_ch)*block_size;
-			unsigned char * cur_target1d_block;
-			if (timepacktype==TIME_PACK_Z)
-			{
-				cur_target1d_block = imgData->getRawData() + (cur_ch*ntime + cur_time)*block_size;
-			}
-			else
-			{
-				cur_target1d_block = imgData->getRawData() + (cur_ch + cur_time*ncolors)*block_size;
-			}
-
-			//for (V3DLONG j=0; j<(block_size); j++)   cur_target1d_block[j] = cur_data1d_block[j];
-			memcpy(cur_target1d_block, cur_data1d_block, block_size);
-		}
-
-		//now delete the temporary image data
-		if (cur_data1d) {delete []cur_data1d; cur_data1d=0;}
-		if (cur_sz) {delete []cur_sz; cur_sz=0;}
+		printf("%s\n", qPrintable(errmsg));
+		v3d_msg(errmsg + "\n");
+		return false;
+	}
+	printf("Imported %ld files (%.1f MB) in %.2f seconds, %.1f MB/s\n",
+		   stats.nfiles, stats.nbytes/(1024.0*1024.0), stats.seconds, stats.mbPerSecond());
 
-    }
     printf("Finished importing data. Now img data size = [%ld, %ld, %ld, %ld]\n", imgData->getXDim(), imgData->getYDim(), imgData->getZDim(), imgData->getCDim());
 	if (imgData->getTDim()>1 && imgData->getTimePackType()==TIME_PACK_Z)
 	{
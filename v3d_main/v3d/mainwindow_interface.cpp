@@ -114,6 +114,8 @@ XFormWidget* MainWindow::updateImageWindow(void* window)
 	XFormWidget* w = validateImageWindow(window);
 	if (w)
 	{
+		if (w->getImageData())
+			w->getImageData()->invalidateIntensityStats(); //the caller may have changed the voxel values in place
 		w->show();
 		w->updateViews();
 		//updateWorkspace(); //seems no need
@@ -131,6 +133,8 @@ XFormWidget* MainWindow::updateImageWindow(void* window, bool b_forceUpdateChann
             if (w->getImageData())
                 w->getImageData()->updateminmaxvalues();
         }
+		else if (w->getImageData())
+			w->getImageData()->invalidateIntensityStats(); //the caller may have changed the voxel values in place
 		w->show();
 		w->updateViews();
 		//updateWorkspace(); //seems no need
@@ -387,6 +387,7 @@ My4DImage::My4DImage()
 
 	p_vmax = NULL;
 	p_vmin = NULL;
+	intensityStatsData = 0;
 
 	colorMap = new ColorMap(colorPseudoMaskColor, 256);
 
@@ -872,6 +873,8 @@ void My4DImage::setupDefaultColorChannelMapping() //20100824, PHC
 
 bool My4DImage::updateminmaxvalues()
 {
+	invalidateIntensityStats(); //the voxel values have changed
+
 	if (this->getError() == 1 || !this->getRawData()  || this->getCDim()<=0 || this->getXDim()<=0 || this->getYDim()<=0 || this->getZDim()<=0)
 	{
 		v3d_msg("The image data is invalid.\n", false);
@@ -896,78 +899,113 @@ bool My4DImage::updateminmaxvalues()
 		return false;
 	}
 
-	V3DLONG i, tmppos;
+	V3DLONG i;
 	V3DLONG channelPageSize = this->getTotalUnitNumberPerChannel();
 
-	switch (this->getDatatype())
+	for(i=0;i<this->getCDim();i++)
 	{
-		case V3D_UINT8:
-			for(i=0;i<this->getCDim();i++)
-			{
-				unsigned char minvv,maxvv;
-				V3DLONG tmppos_min, tmppos_max;
-				unsigned char *datahead = (unsigned char *)getRawDataAtChannel(i);
-				minMaxInVector(datahead, channelPageSize, tmppos_min, minvv, tmppos_max, maxvv);
-				p_vmax[i] = maxvv; p_vmin[i] = minvv;
-				v3d_msg(QString("channel %1 min=[%2] max=[%3]").arg(i).arg(p_vmin[i]).arg(p_vmax[i]),0);
-			}
-			break;
+		V3dIntensityStats st;
+		bool b_ok;
+		switch (this->getDatatype())
+		{
+			case V3D_UINT8:
+				b_ok = v3d_intensity_stats((unsigned char *)getRawDataAtChannel(i), channelPageSize, st);
+				break;
 
-		case V3D_UINT16:
-			for(i=0;i<this->getCDim();i++)
-			{
-				USHORTINT16 minvv,maxvv;
-				V3DLONG tmppos_min, tmppos_max;
-				USHORTINT16 *datahead = (USHORTINT16 *)getRawDataAtChannel(i);
-				minMaxInVector(datahead, channelPageSize, tmppos_min, minvv, tmppos_max, maxvv);
-				p_vmax[i] = maxvv; p_vmin[i] = minvv;
-				v3d_msg(QString("channel %1 min=[%2] max=[%3]").arg(i).arg(p_vmin[i]).arg(p_vmax[i]),0);
-			}
-			break;
+			case V3D_UINT16:
+				b_ok = v3d_intensity_stats((USHORTINT16 *)getRawDataAtChannel(i), channelPageSize, st);
+				break;
 
-		case V3D_FLOAT32:
-			for(i=0;i<this->getCDim();i++)
-			{
-                float minvv,maxvv;
+			case V3D_FLOAT32:
+				b_ok = v3d_intensity_stats((float *)getRawDataAtChannel(i), channelPageSize, st);
+				break;
+
+			default:
+				this->setError(1);
+				v3d_msg("Invalid data type found in updateminmaxvalues(). Should never happen, - check with V3D developers.");
+				return false;
+		}
 
-				V3DLONG tmppos_min, tmppos_max;
-				float *datahead = (float *)getRawDataAtChannel(i);
+		if (b_ok)
+		{
+			p_vmax[i] = st.vmax; p_vmin[i] = st.vmin;
+			v3d_msg(QString("channel %1 min=[%2] max=[%3]").arg(i).arg(p_vmin[i]).arg(p_vmax[i]),0);
+		}
+		else
+		{
+			p_vmax[i] = p_vmin[i] = 0;
+			v3d_msg("fail");
+		}
+	}
 
-                if (0) //for debugging purpose. 2014-08-22
-                {
-                    minvv=datahead[0], maxvv=datahead[0];
-                    for (V3DLONG myii=1; myii<channelPageSize;myii++)
-                    {
-                        if (minvv>datahead[myii]) minvv=datahead[myii];
-                        else if (maxvv<datahead[myii]) maxvv=datahead[myii];
-                    }
-
-                    p_vmax[i] = maxvv; p_vmin[i] = minvv;
-                    v3d_msg(QString("channel %1 min=[%2] max=[%3]").arg(i).arg(p_vmin[i]).arg(p_vmax[i]));
-                }
-                else
-                {
-                    if (minMaxInVector(datahead, channelPageSize, tmppos_min, minvv, tmppos_max, maxvv))
-                    {
-                        p_vmax[i] = maxvv; p_vmin[i] = minvv;
-                        v3d_msg(QString("channel %1 min=[%2] max=[%3]").arg(i).arg(p_vmin[i]).arg(p_vmax[i]), 0);
-                    }
-                    else
-                    {
-                        v3d_msg("fail");
-                    }
-                }
+	return true;
+}
+
+//number of bins of the float histograms, as the float data used to be rescaled to [0, 4095] to get one
+static const V3DLONG FLOAT_HIST_BINS = 4096;
+
+const V3dIntensityStats * My4DImage::getIntensityStats(V3DLONG channo)
+{
+	if (!valid() || channo<0 || channo>=getCDim())
+		return 0;
+
+	if (intensityStatsData != getRawData() || V3DLONG(intensityStats.size()) != getCDim())
+	{
+		intensityStats.assign(getCDim(), V3dIntensityStats());
+		intensityStatsData = getRawData();
+	}
+
+	V3dIntensityStats & st = intensityStats[channo];
+	if (st.hist.empty())
+	{
+		V3DLONG channelPageSize = getTotalUnitNumberPerChannel();
+		bool b_ok = false;
+		switch (this->getDatatype())
+		{
+			case V3D_UINT8:
+				b_ok = v3d_intensity_stats((unsigned char *)getRawDataAtChannel(channo), channelPageSize, st, 256);
+				break;
 
+			case V3D_UINT16:
+				b_ok = v3d_intensity_stats((USHORTINT16 *)getRawDataAtChannel(channo), channelPageSize, st, 65536);
+				break;
+
+			case V3D_FLOAT32:
+			{
+				//the bins cover [min, max] of the channel, so the range is needed first
+				float *p = (float *)getRawDataAtChannel(channo);
+				double lower, upper;
+				if (p_vmin && p_vmax)
+				{
+					lower = p_vmin[channo]; upper = p_vmax[channo];
+				}
+				else
+				{
+					if (!v3d_intensity_stats(p, channelPageSize, st)) break;
+					lower = st.vmin; upper = st.vmax;
+				}
+				b_ok = v3d_intensity_stats(p, channelPageSize, st, FLOAT_HIST_BINS, lower, upper);
+				break;
 			}
-			break;
 
-		default:
-			this->setError(1);
-			v3d_msg("Invalid data type found in updateminmaxvalues(). Should never happen, - check with V3D developers.");
-			return false;
+			default:
+				break;
+		}
+
+		if (!b_ok)
+		{
+			st.hist.clear();
+			return 0;
+		}
 	}
 
-	return true;
+	return &st;
+}
+
+void My4DImage::invalidateIntensityStats()
+{
+	intensityStats.clear();
+	intensityStatsData = 0;
 }
 
 void My4DImage::loadImage(V3DLONG imgsz0, V3DLONG imgsz1, V3DLONG imgsz2, V3DLONG imgsz3, int imgdatatype) //an overloaded function to create a blank image
@@ -1661,6 +1699,8 @@ bool My4DImage::maskBW_roi_bbox(unsigned char tval, V3DLONG c_min, V3DLONG c_max
 		}
 	}
 
+	invalidateIntensityStats(); //the voxel values have changed
+
 	updateViews();
 	return true;
 }
@@ -1852,6 +1892,7 @@ bool My4DImage::maskBW_roi(unsigned char tval, V3DLONG c_min, V3DLONG c_max, Ima
 		return false;
 	}
 
+	invalidateIntensityStats(); //the voxel values have changed
 	return true;
 }
 
@@ -1901,6 +1942,8 @@ bool My4DImage::maskBW_channel(V3DLONG mask_channel_no)
 		}
 	}
 
+	invalidateIntensityStats(); //the voxel values have changed
+
 	updateViews();
 	return true;
 }
@@ -2342,6 +2385,8 @@ bool My4DImage::flip(AxisCode my_axiscode)
 			//break;
 	}
 
+	invalidateIntensityStats(); //the channels may have been swapped
+
 	//update view
 	updateViews();
 	return true;
@@ -2373,6 +2418,8 @@ bool My4DImage::invertcolor(int channo) //channo < 0 will invert all channels. O
 		for (p=getRawData();p<p_end; p++) {*p = 255- *p; }
 	}
 
+	invalidateIntensityStats(); //the voxel values have changed
+
 	updateViews();
 	return true;
 }
@@ -2805,6 +2852,7 @@ void My4DImage::cleanExistData_only4Dpointers()
 
 	if (p_vmax) {delete []p_vmax; p_vmax = NULL;}
 	if (p_vmin) {delete []p_vmin; p_vmin = NULL;}
+	invalidateIntensityStats();
 }
 
 
@@ -5094,15 +5142,53 @@ bool My4DImage::proj_general_linear_adjustment()
 
 bool My4DImage::proj_general_hist_equalization(unsigned char lowerbound, unsigned char higherbound)
 {
+	if (!valid() || this->getDatatype()!=V3D_UINT8)
+	{
+		v3d_msg("Histogram equalization only works for 8-bit images. Convert the image to 8 bit first.\n");
+		return false;
+	}
+
+	if (lowerbound>higherbound)
+	{
+		unsigned char tmp=lowerbound; lowerbound=higherbound; higherbound=tmp;
+	}
+
 	V3DLONG pagesz = getTotalUnitNumberPerChannel();
 	for (int c=0;c<getCDim(); c++)
 	{
-		//if (!hist_eq_uint8(data1d+c*pagesz, pagesz))
-		if (!hist_eq_range_uint8(this->getRawData()+c*pagesz, pagesz, lowerbound, higherbound))
+		const V3dIntensityStats * st = getIntensityStats(c);
+		if (!st)
 		{
 			v3d_msg("Error happens in proj_general_hist_equalization();\n");
 			return false;
 		}
+
+		//same mapping as hist_eq_range_uint8(): the cumulative histogram of [lowerbound, higherbound] stretched over that range
+		const std::vector<V3DLONG> & h = st->hist;
+		unsigned char lut[256];
+		V3DLONG i;
+		for (i=0;i<256;i++) lut[i] = (unsigned char)i;
+
+		double cdf[256];
+		cdf[lowerbound] = h[lowerbound];
+		for (i=lowerbound+1;i<=higherbound;i++) cdf[i] = cdf[i-1]+h[i];
+		double total = cdf[higherbound], range = higherbound-lowerbound;
+		if (total>0) //otherwise no voxel is in the range
+			for (i=lowerbound;i<=higherbound;i++) lut[i] = (unsigned char)(cdf[i]/total*range + lowerbound);
+
+		unsigned char *p = (unsigned char *)getRawDataAtChannel(c);
+		v3d_apply_lookup(p, p, pagesz, lut);
+
+		//the new histogram and range follow from the old one, no need to read the voxels again
+		std::vector<V3DLONG> nh(256, 0);
+		for (i=0;i<256;i++) nh[lut[i]] += h[i];
+		V3dIntensityStats & nst = intensityStats[c];
+		nst.hist.swap(nh);
+		for (i=0;i<256 && nst.hist[i]==0;i++);
+		nst.vmin = (i<256) ? i : 0;
+		for (i=255;i>=0 && nst.hist[i]==0;i--);
+		nst.vmax = (i>=0) ? i : 0;
+		if (p_vmin && p_vmax) {p_vmin[c] = nst.vmin; p_vmax[c] = nst.vmax;}
 	}
 	return true;
 }
@@ -5188,6 +5274,63 @@ bool My4DImage::proj_general_convertIndexedImg2RGB()
 	return true;
 }
 
+//the rescaling and conversion to 8 bit of one channel in a single pass: the values go through the same
+//scaleintensity() mappings and casts as when the channel was rescaled in place and then copied
+
+template <class T> static void scaleandconvert28bit_lookup(const T *src, V3DLONG n, V3DLONG nvalues, const V3dLinearScale & scale, unsigned char *dst)
+{
+	std::vector<unsigned char> lut(nvalues);
+	for (V3DLONG v=0;v<nvalues;v++)
+		lut[v] = (unsigned char)(T)(scale(double(v)));
+	v3d_apply_lookup(src, dst, n, &lut[0]);
+}
+
+class ScaleAndConvertFloatBody
+{
+public:
+	ScaleAndConvertFloatBody(const float *s, unsigned char *d, const V3dLinearScale *pre, const V3dLinearScale & post)
+	: src(s), dst(d), prescale(pre), scale(post) {}
+
+	void operator()(V3DLONG begin, V3DLONG end)
+	{
+		for (V3DLONG i=begin;i<end;i++)
+		{
+			float t = src[i];
+			if (prescale) t = (float)(*prescale)(t);
+			dst[i] = (unsigned char)(float)scale(t);
+		}
+	}
+
+private:
+	const float *src;
+	unsigned char *dst;
+	const V3dLinearScale *prescale;
+	V3dLinearScale scale;
+};
+
+//prescale (if not 0) is a first rescaling of the float values, applied before scale
+static bool scaleandconvert28bit_channel(My4DImage *img, V3DLONG c, const V3dLinearScale *prescale, const V3dLinearScale & scale, unsigned char *dst)
+{
+	V3DLONG n = img->getTotalUnitNumberPerChannel();
+	switch (img->getDatatype())
+	{
+		case V3D_UINT8:
+			scaleandconvert28bit_lookup((const unsigned char *)img->getRawDataAtChannel(c), n, 256, scale, dst);
+			return true;
+		case V3D_UINT16:
+			scaleandconvert28bit_lookup((const USHORTINT16 *)img->getRawDataAtChannel(c), n, 65536, scale, dst);
+			return true;
+		case V3D_FLOAT32:
+		{
+			ScaleAndConvertFloatBody body((const float *)img->getRawDataAtChannel(c), dst, prescale, scale);
+			v3d_parallel_for(n, body, 0, 1<<20);
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
 bool My4DImage::proj_general_scaleandconvert28bit(int lb, int ub) //lb, ub: lower bound, upper bound
 {
 	if (!valid())
@@ -5196,13 +5339,10 @@ bool My4DImage::proj_general_scaleandconvert28bit(int lb, int ub) //lb, ub: lowe
 		return false;
 	}
 
-	V3DLONG k;
-	for (k=0;k<getCDim();k++)
-		scaleintensity(k, p_vmin[k], p_vmax[k], double(lb), double(ub));
-
 	V3DLONG tsz0 = getXDim(), tsz1 = getYDim(), tsz2 = getZDim(), tsz3 = getCDim();
 	V3DLONG tunits =tsz0*tsz1*tsz2*tsz3;
 	V3DLONG tbytes = tunits;
+	V3DLONG channelsz = getTotalUnitNumberPerChannel();
 
 	unsigned char * outvol1d = 0;
 	try
@@ -5215,31 +5355,16 @@ bool My4DImage::proj_general_scaleandconvert28bit(int lb, int ub) //lb, ub: lowe
 		return false;
 	}
 
-	//now cpy data
-	V3DLONG i;
-	if ( this->getDatatype() ==V3D_UINT8)
-	{
-		unsigned char * cur_data1d = (unsigned char *)this->getRawData();
-		for (i=0;i<tunits;i++)
-			outvol1d[i] = cur_data1d[i];
-	}
-	else if ( this->getDatatype() ==V3D_UINT16)
-	{
-		unsigned short int * cur_data1d = (unsigned short int *)this->getRawData();
-		for (i=0;i<tunits;i++)
-			outvol1d[i] = (unsigned char)(cur_data1d[i]);
-	}
-	else if ( this->getDatatype() ==V3D_FLOAT32)
-	{
-		float * cur_data1d = (float *)this->getRawData();
-		for (i=0;i<tunits;i++)
-			outvol1d[i] = (unsigned char)(cur_data1d[i]);
-	}
-	else
+	V3DLONG k;
+	for (k=0;k<tsz3;k++)
 	{
-		v3d_msg("should not get here in proj_general_scaleandconvert28bit(). Check your code/data.");
-		if (outvol1d) {delete []outvol1d;outvol1d=0;}
-		return false;
+		V3dLinearScale scale(p_vmin[k], p_vmax[k], double(lb), double(ub));
+		if (!scaleandconvert28bit_channel(this, k, 0, scale, outvol1d + k*channelsz))
+		{
+			v3d_msg("should not get here in proj_general_scaleandconvert28bit(). Check your code/data.");
+			if (outvol1d) {delete []outvol1d;outvol1d=0;}
+			return false;
+		}
 	}
 
 	setNewImageData(outvol1d, tsz0, tsz1, tsz2, tsz3, V3D_UINT8);
@@ -5262,98 +5387,11 @@ bool My4DImage::proj_general_scaleandconvert28bit_1percentage(double apercent) /
 		return false;
 	}
 
-	if ( this->getDatatype() ==V3D_FLOAT32) //for float data , first rescale it to [0, 4095]
-	{
-		for (V3DLONG k=0;k<getCDim();k++)
-		{
-			scaleintensity(k, p_vmin[k], p_vmax[k], double(0), double(4095));
-		}
-	}
-
-	qDebug()<< "enter 1...";
-
-	V3DLONG k;
-	for (k=0;k<getCDim();k++)
-	{
-		V3DLONG maxvv = ceil(p_vmax[k]+1); //this should be safe now as the potential FLOAT32 data has been rescaled
-		V3DLONG i;
-
-		qDebug() << "ch k=" << k << " maxvv=" << maxvv;
-
-		double *hist = 0;
-		try
-		{
-			hist = new double [maxvv];
-		}
-		catch (...)
-		{
-			qDebug() << "fail to allocate"; return false;
-			v3d_msg("Fail to allocate memory in proj_general_scaleandconvert28bit_1percentage().\n");
-			return false;
-		}
-
-		for (i=0;i<maxvv;i++)
-		{
-			hist[i] = 0;
-		}
-
-		V3DLONG channelsz = getXDim()*getYDim()*getZDim();
-
-		//find the histogram
-		if ( this->getDatatype() ==V3D_UINT8)
-		{
-			unsigned char * cur_data1d = (unsigned char *)this->getRawData() + k*channelsz;
-			for (i=0;i<channelsz;i++)
-				hist[V3DLONG(cur_data1d[i])] += 1;
-		}
-		else if ( this->getDatatype() ==V3D_UINT16)
-		{
-			unsigned short int * cur_data1d = (unsigned short int *)this->getRawData() + k*channelsz;
-			for (i=0;i<channelsz;i++)
-				hist[cur_data1d[i]] += 1;
-		}
-		else if ( this->getDatatype() ==V3D_FLOAT32)
-		{
-			float * cur_data1d = (float *)this->getRawData() + k*channelsz;
-			for (i=0;i<channelsz;i++)
-				hist[V3DLONG(cur_data1d[i])] += 1;
-		}
-
-		qDebug() << "Histogram computed.";
-
-		//compute the CDF
-		for (i=1;i<maxvv;i++)
-		{
-			hist[i] += hist[i-1];
-		}
-
-		for (i=0;i<maxvv;i++)
-		{
-			hist[i] /= hist[maxvv-1];
-		}
-
-		//now search for the intensity thresholds
-		double lowerth, upperth; lowerth = upperth = 0;
-		for (i=0;i<maxvv-1;i++) //not the most efficient method, but the code should be readable
-		{
-			if (hist[i]<apercent && hist[i+1]>apercent)
-				lowerth = i;
-			if (hist[i]<1-apercent && hist[i+1]>1-apercent)
-				upperth = i;
-		}
-
-		v3d_msg(QString("channel=%1 lower th=%2 upper th=%3").arg(k).arg(lowerth).arg(upperth), 0);
-
-		//real rescale of intensity
-		scaleintensity(k, lowerth, upperth, double(0), double(255));
-
-		//free space
-		if (hist) {delete []hist; hist=0;}
-	}
-
 	V3DLONG tsz0 = getXDim(), tsz1 = getYDim(), tsz2 = getZDim(), tsz3 = getCDim();
 	V3DLONG tunits =tsz0*tsz1*tsz2*tsz3;
 	V3DLONG tbytes = tunits;
+	V3DLONG channelsz = getTotalUnitNumberPerChannel();
+
 	unsigned char * outvol1d = 0;
 	try
 	{
@@ -5361,35 +5399,35 @@ bool My4DImage::proj_general_scaleandconvert28bit_1percentage(double apercent) /
 	}
 	catch (...)
 	{
-		v3d_msg("Fail to allocate memory in proj_general_scaleandconvert28bit().\n");
+		v3d_msg("Fail to allocate memory in proj_general_scaleandconvert28bit_1percentage().\n");
 		return false;
 	}
 
-	//now cpy data
-	V3DLONG i;
-	if ( this->getDatatype() ==V3D_UINT8)
-	{
-		unsigned char * cur_data1d = (unsigned char *)this->getRawData();
-		for (i=0;i<tunits;i++)
-			outvol1d[i] = cur_data1d[i];
-	}
-	else if ( this->getDatatype() ==V3D_UINT16)
-	{
-		unsigned short int * cur_data1d = (unsigned short int *)this->getRawData();
-		for (i=0;i<tunits;i++)
-			outvol1d[i] = (unsigned char)(cur_data1d[i]);
-	}
-	else if ( this->getDatatype() ==V3D_FLOAT32)
-	{
-		float * cur_data1d = (float *)this->getRawData();
-		for (i=0;i<tunits;i++)
-			outvol1d[i] = (unsigned char)(cur_data1d[i]);
-	}
-	else
+	V3DLONG k;
+	for (k=0;k<tsz3;k++)
 	{
-		v3d_msg("should not get here in proj_general_scaleandconvert28bit(). Check your code/data.");
-		if (outvol1d) {delete []outvol1d;outvol1d=0;}
-		return false;
+		//the histogram of float data is the one of the data rescaled to [0, FLOAT_HIST_BINS-1], and so are the thresholds
+		const V3dIntensityStats * st = getIntensityStats(k);
+		if (!st)
+		{
+			v3d_msg("Fail to compute the histogram in proj_general_scaleandconvert28bit_1percentage().\n");
+			if (outvol1d) {delete []outvol1d;outvol1d=0;}
+			return false;
+		}
+
+		double lowerth, upperth;
+		v3d_intensity_saturation_bounds(st->hist, apercent, lowerth, upperth);
+
+		v3d_msg(QString("channel=%1 lower th=%2 upper th=%3").arg(k).arg(lowerth).arg(upperth), 0);
+
+		V3dLinearScale prescale(st->histLower, st->histUpper, 0, double(FLOAT_HIST_BINS-1));
+		V3dLinearScale scale(lowerth, upperth, double(0), double(255));
+		if (!scaleandconvert28bit_channel(this, k, (this->getDatatype()==V3D_FLOAT32) ? &prescale : 0, scale, outvol1d + k*channelsz))
+		{
+			v3d_msg("should not get here in proj_general_scaleandconvert28bit_1percentage(). Check your code/data.");
+			if (outvol1d) {delete []outvol1d;outvol1d=0;}
+			return false;
+		}
 	}
 
 	setNewImageData(outvol1d, tsz0, tsz1, tsz2, tsz3, V3D_UINT8);
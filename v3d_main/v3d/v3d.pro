@@ -143,6 +143,7 @@ HEADERS += \
     ../neuron_annotator/data_model/SampledVolumeMetadata.h \
     ../neuron_annotator/data_model/StagedFileLoader.h \
     ../neuron_annotator/data_model/PrivateVolumeTexture.h \
+    ../neuron_annotator/data_model/VolumeSampler.h \
     ../neuron_annotator/data_model/VolumeTexture.h \
     ../neuron_annotator/entity_model/EntityData.h \
     ../neuron_annotator/entity_model/Entity.h \
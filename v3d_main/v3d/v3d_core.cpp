@@ -6575,6 +6575,7 @@ void load_merged_neuron(My4DImage* curImg, Renderer_gl1* curRen)
 	merged_neuron.name = curImg->tracedNeuron.name;
 	merged_neuron.file = curImg->tracedNeuron.file;
     curRen->updateNeuronTree(merged_neuron);
+	curRen->tracedNeuronReloaded();
 
 	for (size_t i = 0; i < curImg->tracedNeuron.seg.size(); ++i) // Generate a branchID -> segID map, MK, May, 2018
 	{
@@ -78,6 +78,7 @@ Jan 28-30, 2010: PHC. further adjusting codes for v2.440 and above
 #include "../basic_c_fun/basic_surf_objs.h"
 
 #include "../basic_c_fun/img_definition.h"
+#include "../basic_c_fun/basic_intensity_stats.h"
 
 #include "../neuron_editing/v_neuronswc.h"
 
@@ -261,6 +262,8 @@ public:
 	void setupData4D();
 	void setupDefaultColorChannelMapping();
 	bool updateminmaxvalues();
+	const V3dIntensityStats * getIntensityStats(V3DLONG channo); //min/max/histogram of a channel, cached until invalidateIntensityStats()
+	void invalidateIntensityStats(); //called whenever the voxel values change: updateminmaxvalues(), the in-place editors (invertcolor(), maskBW_*()...) and MainWindow::updateImageWindow() do it
 	void loadImage(V3DLONG imgsz0, V3DLONG imgsz1, V3DLONG imgsz2, V3DLONG imgsz3, int imgdatatype); //an overloaded function to create a blank image
 
 	void setFocusX(V3DLONG x) {curFocusX = (x>=1 && x <= this->getXDim()) ? x-1 : -1;}
@@ -284,6 +287,8 @@ public:
 	bool permute(V3DLONG dimorder[4]);
 
 	double * p_vmax, * p_vmin; //whole volume max/min values. Use pointer to handle multiple channels separately
+	std::vector<V3dIntensityStats> intensityStats; //per channel, computed on demand by getIntensityStats()
+	const void * intensityStatsData; //the data buffer intensityStats were computed on
 	double getChannalMinIntensity(V3DLONG channo);
 	double getChannalMaxIntensity(V3DLONG channo);
 
@@ -409,8 +414,8 @@ public:
 	bool proj_trace_mergeAllClosebyNeuronNodes(NeuronTree *p_tree);
 	bool proj_trace_mergeAllClosebyNeuronNodes();
 
-	QList <V_NeuronSWC_list> tracedNeuron_historylist;
-	static const int MAX_history = 30;
+	V_NeuronSWC_history tracedNeuron_historylist; //snapshots share unchanged segments
+	static const int MAX_history = 300;
 	int cur_history;
 	void proj_trace_history_append(V_NeuronSWC_list & tNeuron);
 	void proj_trace_history_append();
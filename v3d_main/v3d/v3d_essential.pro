@@ -228,6 +228,8 @@ HEADERS += ../basic_c_fun/mg_utilities.h \
     ../3drenderer/v3d_hoverpoints.h \
     ../3drenderer/barFigureDialog.h \
     ../3drenderer/line_box_intersection_check.h \
+    ../3drenderer/segment_grid_index.h \
+    ../3drenderer/screen_pick_cache.h \
     ../neuron_tracing/heap.h \
     ../neuron_tracing/fastmarching_linker.h \
 	../imaging/v3d_imaging.h \
@@ -393,6 +395,7 @@ HEADERS += \
     ../vrrenderer/RenderableObject.h \
     ../vrrenderer/VRFinger.h \
     ../vrrenderer/V3dR_Communicator.h \
+    ../vrrenderer/V3dR_MessageCodec.h \
     ../vrrenderer/VR_MainWindow.h
 
 SOURCES += \
@@ -404,6 +407,7 @@ SOURCES += \
     ../vrrenderer/RenderableObject.cpp \
     ../vrrenderer/VRFinger.cpp \
     ../vrrenderer/V3dR_Communicator.cpp \
+    ../vrrenderer/V3dR_MessageCodec.cpp \
     ../vrrenderer/VR_MainWindow.cpp
 }
 
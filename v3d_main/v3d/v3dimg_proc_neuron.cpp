@@ -1021,12 +1021,12 @@ void My4DImage::proj_trace_history_append(V_NeuronSWC_list & tNeuron)
 	//null seg is also a undo/redo status
 
 	// remove from cur_history+1
-	for (int i=cur_history+1; i>=0 && i<tracedNeuron_historylist.size();i++) tracedNeuron_historylist.removeAt(i);
+	if (cur_history+1>=0) tracedNeuron_historylist.removeFrom(cur_history+1);
 
 	// make size <= MAX_history
-	while (tracedNeuron_historylist.size()>=MAX_history) tracedNeuron_historylist.pop_front();
+	while (tracedNeuron_historylist.size()>=MAX_history) tracedNeuron_historylist.removeFirst();
 
-	tracedNeuron_historylist.push_back(tNeuron);
+	tracedNeuron_historylist.append(tNeuron); // only the segments changed since the last snapshot are copied
 	cur_history = tracedNeuron_historylist.size()-1;
 
 	//	qDebug()<<"***************************************************************";
@@ -1057,7 +1057,7 @@ void My4DImage::proj_trace_history_undo(V_NeuronSWC_list & tNeuron)
 	}
 	else if (cur_history>=0 && cur_history<tracedNeuron_historylist.size())
 	{
-		tNeuron = tracedNeuron_historylist.at(cur_history);
+		tracedNeuron_historylist.restore(cur_history, tNeuron, cur_history+1);
     }
 
 //	qDebug()<<"      historylist last ="<<tracedNeuron_historylist.size()-1<<"  cur_history ="<<cur_history;
@@ -1083,7 +1083,7 @@ void My4DImage::proj_trace_history_redo(V_NeuronSWC_list & tNeuron)
 	}
 	else if (cur_history>=0 && cur_history<=tracedNeuron_historylist.size()-1)
 	{
-		tNeuron = tracedNeuron_historylist.at(cur_history);
+		tracedNeuron_historylist.restore(cur_history, tNeuron, cur_history-1);
 	}
 
 //	qDebug()<<"      historylist last ="<<tracedNeuron_historylist.size()-1<<"  cur_history ="<<cur_history;
@@ -1337,7 +1337,7 @@ bool My4DImage::proj_trace_joinAllNeuronSegs(V3DLONG node_id, NeuronTree *p_tree
 	for (V3DLONG i=0;i<n_segs;i++) seg_id_array[i]=i;
 
 	V_NeuronSWC m_neuron = join_segs_in_V_NeuronSWC_list(tracedNeuron, seg_id_array, n_segs);
-	tracedNeuron.seg.clear();
+	tracedNeuron.clear();
 	tracedNeuron.append(m_neuron);
 
 	if (seg_id_array) {delete []seg_id_array; seg_id_array=0;}
@@ -1595,39 +1595,17 @@ bool My4DImage::proj_trace_mergeOneClosebyNeuronSeg(V3DLONG node_id, NeuronTree
 	int cur_sid;
 
 	//first check if both ends are overlapping with other segments' tips, if so, then skip this "continuous seg" and quit w/o doing anything
+	//(looked up in the node index of tracedNeuron, which its mutators keep in sync)
 	bool b_headoverlap=false, b_tailoverlap=false;
+	V3DLONG overlap_node;
 	double scx = subject_swc.row.at(0).data[2];
 	double scy = subject_swc.row.at(0).data[3];
 	double scz = subject_swc.row.at(0).data[4];
-	for (cur_sid=0;cur_sid<NSegs;cur_sid++)
-	{
-		if (cur_sid==seg_id)
-			continue;
-
-		V_NeuronSWC & target_swc = tracedNeuron.seg.at(cur_sid);
-		if (find_node_in_V_NeuronSWC(target_swc, scx, scy, scz) >= 0)
-		{
-			b_headoverlap = true;
-			break;
-		}
-	}
+	b_headoverlap = (tracedNeuron.findNode(scx, scy, scz, overlap_node, seg_id) >= 0);
 	scx = subject_swc.row.at(slength-1).data[2];
 	scy = subject_swc.row.at(slength-1).data[3];
 	scz = subject_swc.row.at(slength-1).data[4];
-	for (cur_sid=0;cur_sid<NSegs;cur_sid++)
-	{
-		if (cur_sid==seg_id)
-			continue;
-
-		V_NeuronSWC & target_swc = tracedNeuron.seg.at(cur_sid);
-		int tlength = target_swc.nrows();
-
-		if (find_node_in_V_NeuronSWC(target_swc, scx, scy, scz) >= 0)
-		{
-			b_tailoverlap = true;
-			break;
-		}
-	}
+	b_tailoverlap = (tracedNeuron.findNode(scx, scy, scz, overlap_node, seg_id) >= 0);
 	if (b_tailoverlap && b_headoverlap) //skip the continuous segments
 	{
 		v3d_msg("Both the head and tail tips of this segment overlap with other segments. You should choose a different segment to merge.");
@@ -242,6 +242,8 @@ V3dR_Communicator::V3dR_Communicator(bool *client_flag /*= 0*/, V_NeuronSWC_list
 //	connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
 	CURRENT_DATA_IS_SENT=false;
 //    nextblocksize=0;
+	useBinaryProtocol=false;
+	nextSegID=1; // 0: not sent
 }
 
 	V3dR_Communicator::~V3dR_Communicator() {
@@ -252,12 +254,13 @@ bool V3dR_Communicator::SendLoginRequest(QString ip,QString port,QString user) {
     socket=new QTcpSocket;
 //    connect(this->managesocket,SIGNAL(disconnected()),socket,SLOT(disconnectFromHost()));
     connect(socket,SIGNAL(connected()),this,SLOT(onConnected()));
- //   connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
     connect(socket,SIGNAL(disconnected()),socket,SLOT(deleteLater()));
 
     connect(socket, SIGNAL(disconnected()), this, SLOT(onDisconnected()));
     qDebug()<<"start login messageserver";
     QSettings settings("HHMI", "Vaa3D");
+    setBinaryProtocol(settings.value("collaboration_binary_protocol", false).toBool()); // before the login message
 
     userName=user;
 //    vr_Port=port;
@@ -285,15 +288,89 @@ bool V3dR_Communicator::SendLoginRequest(QString ip,QString port,QString user) {
 	return 1;
 }
 
-void V3dR_Communicator::UpdateSendPoolNTList(V_NeuronSWC seg)
+void V3dR_Communicator::UpdateSendPoolNTList(V_NeuronSWC & seg)
 {
+	if (useBinaryProtocol)
+	{
+		// an ID that is no longer sent was copied from a deleted segment, e.g. into the halves of a split one
+		if (seg.collaboration_id==0 || !binaryOut.hasSegment(seg.collaboration_id))
+			seg.collaboration_id = nextSegID++;
+		vector<XYZ> nodes(seg.row.size());
+		for (int i=0; i<seg.row.size(); i++)
+			nodes[i] = XYZ(seg.row[i].x, seg.row[i].y, seg.row[i].z);
+		binaryOut.addSegment(seg.collaboration_id, nodes); // sent with the next batch, as an edit if it was sent before
+	}
+	else
+		onReadySend(QString("/seg: "+V_NeuronSWCToSendMSG(seg)));
+
+	if (!NTList_SendPool) return;
+	if (seg.collaboration_id)
+		for (V3DLONG i=0; i<NTList_SendPool->seg.size(); i++)
+			if (NTList_SendPool->seg[i].collaboration_id==seg.collaboration_id)
+			{
+				NTList_SendPool->seg[i] = seg;
+				return;
+			}
 	NTList_SendPool->append(seg);
-    onReadySend(QString("/seg: "+V_NeuronSWCToSendMSG(seg)));
+}
+
+void V3dR_Communicator::RemoveSendPoolNTList(const V_NeuronSWC & seg)
+{
+	if (seg.collaboration_id==0) return; // never sent, or only as text, which has no delete
+	if (NTList_SendPool)
+		for (V3DLONG i=NTList_SendPool->seg.size()-1; i>=0; i--)
+			if (NTList_SendPool->seg[i].collaboration_id==seg.collaboration_id)
+				NTList_SendPool->seg.erase(NTList_SendPool->seg.begin()+i);
+	if (useBinaryProtocol && binaryOut.hasSegment(seg.collaboration_id))
+		binaryOut.removeSegment(seg.collaboration_id);
+}
+
+void V3dR_Communicator::setBinaryProtocol(bool on)
+{
+	useBinaryProtocol = on;
+	binaryOut.reset();
+	binaryIn.reset();
+	// a new session: the other clients tell its segments from those of this client's earlier sessions
+	quint32 session = qHash(QString::number(QDateTime::currentMSecsSinceEpoch())) ^ quint32(QCoreApplication::applicationPid());
+	binaryOut.setSender(session ? session : 1);
+}
+
+void V3dR_Communicator::flushBinaryMessages()
+{
+	if (!socket || binaryOut.pendingMessages()==0) return;
+	socket->write(binaryOut.takeFrame());
+}
+
+void V3dR_Communicator::receiveBinaryMessages(const QByteArray & bytes)
+{
+	binaryIn.feed(bytes);
+	V3dR_Message msg;
+	while (binaryIn.next(msg))
+	{
+		if (msg.type!=V3dR_Message::Text && msg.sender==binaryOut.sender())
+			continue; // this client's segments relayed back
+		if (msg.type==V3dR_Message::SegmentAdd || msg.type==V3dR_Message::SegmentEdit)
+			loc_ReceivePool[ReceivedSegKey(msg.sender, msg.segID)].swap(msg.nodes); // an edit replaces the copy received before
+		else if (msg.type==V3dR_Message::SegmentDelete)
+			loc_ReceivePool.erase(ReceivedSegKey(msg.sender, msg.segID));
+		else if (msg.type==V3dR_Message::Text)
+			qDebug()<<"receive:"<<msg.text;
+	}
+	if (binaryIn.failed())
+	{
+		qDebug()<<"binary message error:"<<binaryIn.errorString();
+		binaryIn.reset();
+	}
 }
 
 void V3dR_Communicator::onReadySend(QString send_MSG) {
 
-    if (!send_MSG.isEmpty()) {
+    if (!send_MSG.isEmpty() && useBinaryProtocol) {
+        // in the frames, after the segments added before it
+        binaryOut.addText((send_MSG!="exit")&&(send_MSG!="quit") ? send_MSG : QString("/say: GoodBye~"));
+        flushBinaryMessages();
+    }
+    else if (!send_MSG.isEmpty()) {
         if((send_MSG!="exit")&&(send_MSG!="quit"))
         {
 
@@ -314,10 +391,12 @@ void V3dR_Communicator::onReadySend(QString send_MSG) {
 
 void V3dR_Communicator::onReadyRead() {
 
-	       
+	if (useBinaryProtocol)
+		receiveBinaryMessages(socket->readAll());
 }
 
 void V3dR_Communicator::CollaborationMainloop(){
+	flushBinaryMessages();
 	Collaborationsendmessage();
 	Collaborationaskmessage();
 	QTimer::singleShot(200, this, SLOT(CollaborationMainloop()));
@@ -385,7 +464,7 @@ void V3dR_Communicator::MsgToV_NeuronSWC(QString msg)
 		}
 
 	}
-	loc_ReceivePool.push_back(loclist_temp);
+	loc_ReceivePool[ReceivedSegKey(0, quint32(NTNumReceieved++))] = loclist_temp;
 	//update AddCurveSWC
 }
 
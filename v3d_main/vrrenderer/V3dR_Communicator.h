@@ -12,6 +12,7 @@
 //#endif
 #include "../neuron_editing/v_neuronswc.h"
 #include "../basic_c_fun/v3d_interface.h"
+#include "V3dR_MessageCodec.h"
 
 
 struct Agent {
@@ -82,12 +83,20 @@ public:
 //	bool SendLoginRequest();
 	//void StartVRScene(QList<NeuronTree>* ntlist, My4DImage *i4d, MainWindow *pmain,bool isLinkSuccess);
 	//void Update3DViewNTList(QString &msg, int type);
-	void UpdateSendPoolNTList(V_NeuronSWC seg);
+	// a new segment, or a new version of one sent before: seg keeps its collaboration_id, assigned when it is first sent
+	void UpdateSendPoolNTList(V_NeuronSWC & seg);
+	void RemoveSendPoolNTList(const V_NeuronSWC & seg);
 	void Collaborationsendmessage();
 	void Collaborationaskmessage();
 	//trans func
 	QString V_NeuronSWCToSendMSG(V_NeuronSWC seg);
 	void MsgToV_NeuronSWC(QString msg);
+	// binary frames (V3dR_MessageCodec.h) instead of text lines; only for servers that relay them,
+	// set from "collaboration_binary_protocol" in the settings at login
+	void setBinaryProtocol(bool on);
+	bool binaryProtocol() const {return useBinaryProtocol;}
+	void flushBinaryMessages();
+	void receiveBinaryMessages(const QByteArray & bytes);
     QString userName;
 	std::vector<Agent> Agents;
 //	ManageSocket * managesocket;
@@ -113,10 +122,15 @@ private:
 	bool CURRENT_DATA_IS_SENT;
 	bool * clienton;
 	V_NeuronSWC_list * NTList_SendPool;	
-	vector<vector<XYZ>> loc_ReceivePool;
+	typedef std::pair<quint32, quint32> ReceivedSegKey; // (sender session, segment ID); sender 0 for the text messages
+	std::map<ReceivedSegKey, vector<XYZ> > loc_ReceivePool;
 	int NTNumReceieved;
 	int NTNumcurrentUser;
     quint64 nextblocksize;
+	bool useBinaryProtocol;
+	quint32 nextSegID;
+	V3dR_MessageEncoder binaryOut; // batched until the next CollaborationMainloop(); its sender is this session
+	V3dR_MessageDecoder binaryIn;
 };
 
 
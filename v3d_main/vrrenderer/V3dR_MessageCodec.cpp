@@ -0,0 +1,317 @@
+#include "V3dR_MessageCodec.h"
+
+#include <math.h>
+
+static const qint64 MaxFramePayload = 256*1024*1024;
+
+static void putVarint(QByteArray & out, quint64 v)
+{
+	while (v >= 0x80)
+	{
+		out.append(char((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	out.append(char(v));
+}
+
+static void putSigned(QByteArray & out, qint64 v)
+{
+	putVarint(out, (quint64(v) << 1) ^ quint64(v >> 63));
+}
+
+static bool getVarint(const QByteArray & in, int & pos, quint64 & v)
+{
+	v = 0;
+	for (int shift=0; shift<64 && pos<in.size(); shift+=7)
+	{
+		unsigned char b = (unsigned char)in.at(pos++);
+		v |= quint64(b & 0x7f) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+static bool getSigned(const QByteArray & in, int & pos, qint64 & v)
+{
+	quint64 u;
+	if (!getVarint(in, pos, u)) return false;
+	v = qint64(u >> 1) ^ -qint64(u & 1);
+	return true;
+}
+
+static void putUInt32(char * p, quint32 v)
+{
+	p[0] = char(v >> 24);  p[1] = char(v >> 16);  p[2] = char(v >> 8);  p[3] = char(v);
+}
+
+static quint32 getUInt32(const char * p)
+{
+	const unsigned char * u = (const unsigned char *)p;
+	return (quint32(u[0]) << 24) | (quint32(u[1]) << 16) | (quint32(u[2]) << 8) | quint32(u[3]);
+}
+
+static qint64 quantize(float v)
+{
+	return qint64(floor(double(v)*1000 + 0.5));
+}
+
+static float dequantize(qint64 q)
+{
+	return float(q/1000.0);
+}
+
+// n nodes as differences, the first one to (px,py,pz)
+static void putNodes(QByteArray & out, const qint64 * q, size_t n, qint64 px, qint64 py, qint64 pz)
+{
+	for (size_t i=0; i<n; i++, q+=3)
+	{
+		putSigned(out, q[0]-px);  putSigned(out, q[1]-py);  putSigned(out, q[2]-pz);
+		px = q[0];  py = q[1];  pz = q[2];
+	}
+}
+
+static bool getNodes(const QByteArray & in, int & pos, quint64 n, std::vector<qint64> & q, qint64 px, qint64 py, qint64 pz)
+{
+	if (n > quint64(in.size()-pos)) return false; // every node takes at least 3 bytes
+	for (quint64 i=0; i<n; i++)
+	{
+		qint64 dx, dy, dz;
+		if (!getSigned(in, pos, dx) || !getSigned(in, pos, dy) || !getSigned(in, pos, dz)) return false;
+		px += dx;  py += dy;  pz += dz;
+		q.push_back(px);  q.push_back(py);  q.push_back(pz);
+	}
+	return true;
+}
+
+
+V3dR_MessageEncoder::V3dR_MessageEncoder(quint32 sender)
+{
+	nPending = 0;
+	senderID = sender;
+}
+
+void V3dR_MessageEncoder::addText(const QString & text)
+{
+	QByteArray utf8 = text.toUtf8();
+	payload.append(char(V3dR_Message::Text));
+	putVarint(payload, quint64(utf8.size()));
+	payload.append(utf8);
+	nPending++;
+}
+
+void V3dR_MessageEncoder::addSegment(quint32 segID, const std::vector<XYZ> & nodes)
+{
+	QuantizedNodes q(nodes.size()*3);
+	for (size_t i=0; i<nodes.size(); i++)
+	{
+		q[3*i] = quantize(nodes[i].x);  q[3*i+1] = quantize(nodes[i].y);  q[3*i+2] = quantize(nodes[i].z);
+	}
+	size_t n = nodes.size();
+
+	QByteArray whole;
+	whole.append(char(V3dR_Message::SegmentAdd));
+	putVarint(whole, segID);
+	putVarint(whole, n);
+	putNodes(whole, n ? &q[0] : 0, n, 0, 0, 0);
+
+	std::map<quint32, QuantizedNodes>::iterator it = sent.find(segID);
+	if (it != sent.end())
+	{
+		// an edit keeps the nodes the two versions start and end with
+		const QuantizedNodes & old = it->second;
+		size_t nOld = old.size()/3, head = 0, tail = 0;
+		while (head<n && head<nOld && q[3*head]==old[3*head] && q[3*head+1]==old[3*head+1] && q[3*head+2]==old[3*head+2])
+			head++;
+		while (tail<n-head && tail<nOld-head && q[3*(n-1-tail)]==old[3*(nOld-1-tail)] && q[3*(n-1-tail)+1]==old[3*(nOld-1-tail)+1]
+		       && q[3*(n-1-tail)+2]==old[3*(nOld-1-tail)+2])
+			tail++;
+
+		QByteArray edit;
+		edit.append(char(V3dR_Message::SegmentEdit));
+		putVarint(edit, segID);
+		putVarint(edit, head);
+		putVarint(edit, tail);
+		putVarint(edit, n-head-tail);
+		if (head) putNodes(edit, &q[3*head], n-head-tail, q[3*head-3], q[3*head-2], q[3*head-1]);
+		else      putNodes(edit, n ? &q[0] : 0, n-tail, 0, 0, 0);
+		if (edit.size() < whole.size()) whole = edit;
+	}
+
+	payload.append(whole);
+	nPending++;
+	sent[segID].swap(q);
+}
+
+void V3dR_MessageEncoder::removeSegment(quint32 segID)
+{
+	payload.append(char(V3dR_Message::SegmentDelete));
+	putVarint(payload, segID);
+	nPending++;
+	sent.erase(segID);
+}
+
+void V3dR_MessageEncoder::reset()
+{
+	sent.clear();
+}
+
+QByteArray V3dR_MessageEncoder::takeFrame(int compressAbove)
+{
+	if (nPending==0) return QByteArray();
+
+	char flags = 0;
+	if (compressAbove>=0 && payload.size()>=compressAbove)
+	{
+		QByteArray packed = qCompress(payload);
+		if (packed.size() < payload.size())
+		{
+			payload = packed;
+			flags |= FrameCompressed;
+		}
+	}
+
+	QByteArray frame(HeaderSize, 0);
+	putUInt32(frame.data(), quint32(payload.size()));
+	frame[4] = char(Version);
+	frame[5] = flags;
+	putUInt32(frame.data()+6, quint32(nPending));
+	putUInt32(frame.data()+10, senderID);
+	frame.append(payload);
+
+	payload.clear();
+	nPending = 0;
+	return frame;
+}
+
+
+V3dR_MessageDecoder::V3dR_MessageDecoder()
+{
+	payloadPos = 0;
+	nLeft = 0;
+	frameSender = 0;
+}
+
+void V3dR_MessageDecoder::reset()
+{
+	segments.clear();
+	buffer.clear();
+	payload.clear();
+	payloadPos = 0;
+	nLeft = 0;
+	frameSender = 0;
+	errorMsg.clear();
+}
+
+void V3dR_MessageDecoder::feed(const QByteArray & bytes)
+{
+	buffer.append(bytes);
+}
+
+qint64 V3dR_MessageDecoder::frameSize(const char * bytes, qint64 n)
+{
+	if (n < V3dR_MessageEncoder::HeaderSize) return 0;
+	qint64 len = getUInt32(bytes);
+	if (bytes[4] != char(V3dR_MessageEncoder::Version) || len > MaxFramePayload) return -1;
+	return (n < V3dR_MessageEncoder::HeaderSize+len) ? 0 : V3dR_MessageEncoder::HeaderSize+len;
+}
+
+void V3dR_MessageDecoder::fail(const QString & why)
+{
+	errorMsg = why;
+	nLeft = 0;
+}
+
+bool V3dR_MessageDecoder::nextFrame()
+{
+	qint64 size = frameSize(buffer.constData(), buffer.size());
+	if (size < 0) {fail(QString("not a version %1 message frame").arg(int(V3dR_MessageEncoder::Version))); return false;}
+	if (size == 0) return false;
+
+	char flags = buffer.at(5);
+	quint32 count = getUInt32(buffer.constData()+6);
+	frameSender = getUInt32(buffer.constData()+10);
+	payload = buffer.mid(V3dR_MessageEncoder::HeaderSize, int(size-V3dR_MessageEncoder::HeaderSize));
+	buffer.remove(0, int(size));
+	if (flags & V3dR_MessageEncoder::FrameCompressed)
+	{
+		payload = qUncompress(payload);
+		if (payload.isEmpty()) {fail("corrupted compressed frame"); return false;}
+	}
+	payloadPos = 0;
+	nLeft = int(count);
+	return true;
+}
+
+bool V3dR_MessageDecoder::next(V3dR_Message & msg)
+{
+	while (!failed() && nLeft==0)
+		if (!nextFrame()) return false;
+	if (failed()) return false;
+
+	if (!readMessage(msg))
+	{
+		if (!failed()) fail("malformed message");
+		return false;
+	}
+	nLeft--;
+	return true;
+}
+
+bool V3dR_MessageDecoder::readMessage(V3dR_Message & msg)
+{
+	if (payloadPos >= payload.size()) return false;
+	msg.type = V3dR_Message::Type((unsigned char)payload.at(payloadPos++));
+	msg.text.clear();
+	msg.sender = frameSender;
+	msg.segID = 0;
+	msg.nodes.clear();
+
+	quint64 id, n, head, tail;
+	QuantizedNodes q;
+	switch (msg.type)
+	{
+	case V3dR_Message::Text:
+		if (!getVarint(payload, payloadPos, n) || n > quint64(payload.size()-payloadPos)) return false;
+		msg.text = QString::fromUtf8(payload.constData()+payloadPos, int(n));
+		payloadPos += int(n);
+		return true;
+
+	case V3dR_Message::SegmentAdd:
+		if (!getVarint(payload, payloadPos, id) || !getVarint(payload, payloadPos, n)) return false;
+		if (!getNodes(payload, payloadPos, n, q, 0, 0, 0)) return false;
+		break;
+
+	case V3dR_Message::SegmentEdit:
+	{
+		if (!getVarint(payload, payloadPos, id) || !getVarint(payload, payloadPos, head)
+		    || !getVarint(payload, payloadPos, tail) || !getVarint(payload, payloadPos, n)) return false;
+		std::map<SegmentKey, QuantizedNodes>::const_iterator it = segments.find(SegmentKey(frameSender, quint32(id)));
+		if (it == segments.end()) {fail(QString("edit of unknown segment %1 of sender %2").arg(quint32(id)).arg(frameSender)); return false;}
+		const QuantizedNodes & old = it->second;
+		quint64 nOld = old.size()/3;
+		if (head > nOld || tail > nOld-head) return false;
+		q.assign(old.begin(), old.begin()+3*head);
+		if (head) {if (!getNodes(payload, payloadPos, n, q, old[3*head-3], old[3*head-2], old[3*head-1])) return false;}
+		else      {if (!getNodes(payload, payloadPos, n, q, 0, 0, 0)) return false;}
+		q.insert(q.end(), old.end()-3*tail, old.end());
+		break;
+	}
+
+	case V3dR_Message::SegmentDelete:
+		if (!getVarint(payload, payloadPos, id)) return false;
+		msg.segID = quint32(id);
+		segments.erase(SegmentKey(frameSender, msg.segID));
+		return true;
+
+	default:
+		fail(QString("unknown message type %1").arg(int(msg.type)));
+		return false;
+	}
+
+	msg.segID = quint32(id);
+	msg.nodes.resize(q.size()/3);
+	for (size_t i=0; i<msg.nodes.size(); i++)
+		msg.nodes[i] = XYZ(dequantize(q[3*i]), dequantize(q[3*i+1]), dequantize(q[3*i+2]));
+	segments[SegmentKey(frameSender, msg.segID)].swap(q);
+	return true;
+}
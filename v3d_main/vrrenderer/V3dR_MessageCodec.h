@@ -0,0 +1,95 @@
+/*
+ * V3dR_MessageCodec.h
+ *
+ * Binary message frames for the collaborative annotation sessions, an alternative to the
+ * newline-terminated text messages ("/seg: x y z x y z ...") of V3dR_Communicator.
+ *
+ * A frame is a 14-byte header followed by a batch of messages:
+ *     quint32 payload length, quint8 version, quint8 flags, quint32 message count,
+ *     quint32 sender (big endian), payload (qCompress()ed when flags has FrameCompressed).
+ * The sender is the session ID of the client that encoded the frame: the server relays the frames
+ * of every client on one connection, and segment IDs are only unique within a session.
+ * Each message starts with its type byte. Integers are LEB128 varints, signed ones zigzag coded.
+ * Node coordinates are quantized to 1/1000 voxel, the precision of the "%5.3f" text messages,
+ * and sent as differences to the previous node. A segment sent again under the same ID is sent
+ * as an edit: the numbers of unchanged leading and trailing nodes, and the nodes in between.
+ */
+
+#ifndef V3DR_MESSAGECODEC_H
+#define V3DR_MESSAGECODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <map>
+#include <vector>
+#include "../basic_c_fun/color_xyz.h"
+
+struct V3dR_Message
+{
+	enum Type {Text=1, SegmentAdd=2, SegmentEdit=3, SegmentDelete=4};
+	Type type;
+	QString text;              // Text
+	quint32 sender;            // the session of the frame the message came in
+	quint32 segID;             // SegmentAdd, SegmentEdit, SegmentDelete: unique for the sender
+	std::vector<XYZ> nodes;    // SegmentAdd, SegmentEdit: the nodes of the segment after the message
+};
+
+class V3dR_MessageEncoder
+{
+public:
+	enum {Version = 2, FrameCompressed = 1, HeaderSize = 14};
+
+	V3dR_MessageEncoder(quint32 sender=0);
+
+	void setSender(quint32 sender) {senderID = sender;}
+	quint32 sender() const {return senderID;}
+
+	void addText(const QString & text);
+	void addSegment(quint32 segID, const std::vector<XYZ> & nodes); // a new segment, or a new version of one sent before
+	void removeSegment(quint32 segID);
+	bool hasSegment(quint32 segID) const {return sent.count(segID)>0;} // sent and not removed since
+	void reset(); // forget the segments sent so far, e.g. for a new connection: they will be sent whole again
+
+	int pendingMessages() const {return nPending;}
+	// the frame of the messages added since the last call, empty if there are none;
+	// the payload is compressed if it is at least compressAbove bytes (<0: never) and compression pays off
+	QByteArray takeFrame(int compressAbove=1024);
+
+private:
+	typedef std::vector<qint64> QuantizedNodes; // x,y,z,x,y,z... in 1/1000 voxel
+	std::map<quint32, QuantizedNodes> sent;
+	QByteArray payload;
+	int nPending;
+	quint32 senderID;
+};
+
+class V3dR_MessageDecoder
+{
+public:
+	V3dR_MessageDecoder();
+
+	void feed(const QByteArray & bytes);
+	bool next(V3dR_Message & msg); // false when no complete message is buffered, or after an error
+	bool failed() const {return !errorMsg.isEmpty();}
+	QString errorString() const {return errorMsg;}
+	void reset();
+
+	// the number of bytes of a complete frame at the start of bytes, 0 if more are needed, <0 if it is not a valid frame
+	static qint64 frameSize(const char * bytes, qint64 n);
+
+private:
+	typedef std::vector<qint64> QuantizedNodes;
+	typedef std::pair<quint32, quint32> SegmentKey; // (sender, segID)
+	std::map<SegmentKey, QuantizedNodes> segments;
+	QByteArray buffer;     // bytes received and not yet split into frames
+	QByteArray payload;    // the frame being read
+	quint32 frameSender;
+	int payloadPos, nLeft; // read position and messages left in payload
+	QString errorMsg;
+
+	bool nextFrame();
+	bool readMessage(V3dR_Message & msg);
+	void fail(const QString & why);
+};
+
+#endif // V3DR_MESSAGECODEC_H
@@ -0,0 +1,196 @@
+// collab_protocol_benchmark.cpp - Loopback comparison of the text segment messages of
+// V3dR_Communicator with the binary frames of V3dR_MessageCodec.
+//
+// A thread on 127.0.0.1 echoes everything it receives. The client sends the same annotation
+// session both ways - new segments, then edits that extend existing segments - and parses the
+// echo as a receiving annotator would. It reports the bytes on the wire, the throughput and
+// the round-trip time of each batch.
+//
+// usage: collab_protocol_benchmark [segments=2000] [nodes per segment=200] [segments per batch=20]
+
+#include "../V3dR_MessageCodec.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+class EchoThread : public QThread
+{
+public:
+	quint16 port;
+	QSemaphore listening;
+	EchoThread() : port(0) {}
+protected:
+	void run()
+	{
+		QTcpServer server;
+		if (server.listen(QHostAddress::LocalHost, 0)) port = server.serverPort();
+		listening.release();
+		if (!port || !server.waitForNewConnection(30000)) return;
+		QTcpSocket * s = server.nextPendingConnection();
+		while (s->state()==QAbstractSocket::ConnectedState)
+		{
+			if (!s->waitForReadyRead(1000)) continue;
+			s->write(s->readAll());
+			s->waitForBytesWritten(-1);
+		}
+		delete s;
+	}
+};
+
+struct Result
+{
+	qint64 bytes;
+	double seconds;
+	vector<double> latency; // ms per batch
+};
+
+static vector< vector<XYZ> > makeSession(int nseg, int nnodes)
+{
+	vector< vector<XYZ> > segs(nseg);
+	for (int i=0; i<nseg; i++)
+	{
+		float x = rand()%20000, y = rand()%20000, z = rand()%2000;
+		for (int j=0; j<nnodes; j++)
+		{
+			x += (rand()%2001-1000)/1000.f;  y += (rand()%2001-1000)/1000.f;  z += (rand()%1001-500)/1000.f;
+			segs[i].push_back(XYZ(x, y, z));
+		}
+	}
+	return segs;
+}
+
+// the segment after the n-th edit: a few nodes appended, as when a tracing is continued
+static void extend(vector<XYZ> & seg, int n)
+{
+	XYZ p = seg.back();
+	for (int k=0; k<5; k++)
+	{
+		p.x += 0.5f + 0.01f*n;  p.y -= 0.25f;  p.z += 0.125f;
+		seg.push_back(p);
+	}
+}
+
+static QByteArray textMessage(const vector<XYZ> & seg) // as V3dR_Communicator::V_NeuronSWCToSendMSG(), with a separator between nodes
+{
+	string buf = "/seg: ";
+	char node[300];
+	for (size_t i=0; i<seg.size(); i++)
+	{
+		sprintf(node, "%5.3f %5.3f %5.3f ", seg[i].x, seg[i].y, seg[i].z);
+		buf += node;
+	}
+	buf += "\n";
+	return QByteArray(buf.c_str());
+}
+
+static int parseText(const QString & line, vector<XYZ> & nodes) // as V3dR_Communicator::MsgToV_NeuronSWC()
+{
+	QStringList qsl = line.mid(6).trimmed().split(" ", QString::SkipEmptyParts);
+	nodes.clear();
+	for (int i=0; i+2<qsl.size(); i+=3)
+		nodes.push_back(XYZ(qsl[i].toFloat(), qsl[i+1].toFloat(), qsl[i+2].toFloat()));
+	return nodes.size();
+}
+
+static Result run(QTcpSocket & socket, vector< vector<XYZ> > segs, int batch, int edits, bool binary, int compressAbove)
+{
+	Result r;  r.bytes = 0;
+	V3dR_MessageEncoder enc;
+	V3dR_MessageDecoder dec;
+	QByteArray pending;
+	vector<XYZ> nodes;
+	QElapsedTimer total;  total.start();
+
+	int nseg = int(segs.size());
+	for (int round=0; round<=edits; round++)
+		for (int first=0; first<nseg; first+=batch)
+		{
+			int last = min(nseg, first+batch);
+			QElapsedTimer t;  t.start();
+			QByteArray out;
+			for (int i=first; i<last; i++)
+			{
+				if (round>0) extend(segs[i], round);
+				if (binary) enc.addSegment(i, segs[i]);
+				else out.append(textMessage(segs[i]));
+			}
+			if (binary) out = enc.takeFrame(compressAbove);
+			socket.write(out);
+			r.bytes += out.size();
+
+			int received = 0;
+			while (received < last-first)
+			{
+				if (!socket.bytesAvailable() && !socket.waitForReadyRead(10000)) {cerr<<"echo timed out"<<endl; exit(1);}
+				if (binary)
+				{
+					dec.feed(socket.readAll());
+					V3dR_Message msg;
+					while (dec.next(msg)) if (msg.nodes.size()==segs[first+received].size()) received++;
+					if (dec.failed()) {cerr<<qPrintable(dec.errorString())<<endl; exit(1);}
+				}
+				else
+				{
+					pending.append(socket.readAll());
+					int eol;
+					while ((eol = pending.indexOf('\n')) >= 0)
+					{
+						if (parseText(QString::fromUtf8(pending.constData(), eol), nodes)==int(segs[first+received].size())) received++;
+						pending.remove(0, eol+1);
+					}
+				}
+			}
+			r.latency.push_back(t.nsecsElapsed()/1e6);
+		}
+	r.seconds = total.nsecsElapsed()/1e9;
+	return r;
+}
+
+static void report(const char * name, Result r, int nmsg)
+{
+	sort(r.latency.begin(), r.latency.end());
+	printf("%-22s %12lld %10.1f %12.0f %10.3f %10.3f\n", name, r.bytes, r.bytes/r.seconds/1e6, nmsg/r.seconds,
+	       r.latency[r.latency.size()/2], r.latency[r.latency.size()*95/100]);
+}
+
+int main(int argc, char * argv[])
+{
+	QCoreApplication app(argc, argv);
+	int nseg = (argc>1) ? atoi(argv[1]) : 2000;
+	int nnodes = (argc>2) ? atoi(argv[2]) : 200;
+	int batch = (argc>3) ? atoi(argv[3]) : 20;
+	int edits = 5;
+	if (nseg<1 || nnodes<1 || batch<1) {cerr<<"usage: "<<argv[0]<<" [segments] [nodes per segment] [segments per batch]"<<endl; return 1;}
+
+	EchoThread echo;
+	echo.start();
+	echo.listening.acquire();
+	QTcpSocket socket;
+	socket.connectToHost(QHostAddress::LocalHost, echo.port);
+	if (!echo.port || !socket.waitForConnected(10000)) {cerr<<"cannot connect to the loopback echo server"<<endl; return 1;}
+	socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+	srand(1);
+	vector< vector<XYZ> > segs = makeSession(nseg, nnodes);
+	int nmsg = nseg*(edits+1);
+	printf("%d segments of %d nodes, %d edits each, %d segments per batch\n", nseg, nnodes, edits, batch);
+	printf("%-22s %12s %10s %12s %10s %10s\n", "protocol", "bytes", "MB/s", "segments/s", "p50 ms", "p95 ms");
+	report("text lines", run(socket, segs, batch, edits, false, -1), nmsg);
+	report("binary", run(socket, segs, batch, edits, true, -1), nmsg);
+	report("binary, compressed", run(socket, segs, batch, edits, true, 1024), nmsg);
+
+	socket.disconnectFromHost();
+	echo.wait();
+	return 0;
+}